@@ -26,6 +26,17 @@ loginProtocolPort = 7171
 gameProtocolPort = 7172
 adminProtocolPort = 7171
 statusProtocolPort = 7171
+-- NOTE: networkThreads is the number of threads running the connections,
+-- set it to 0 to use one per CPU core.
+networkThreads = 1
+-- NOTE: all messages queued for a connection are sent with a single write,
+-- tcpCork (Linux only) additionally holds partial segments until it finished.
+tcpNoDelay = "yes"
+tcpCork = "no"
+-- NOTE: packetCaptureFile records the packets received from players into
+-- the given file, it can be replayed with the tfs-replay target. Leave it
+-- empty to disable the capture.
+packetCaptureFile = ""
 maxPlayers = "1000"
 motd = "Welcome to The Forgotten Server!"
 onePlayerOnlinePerAccount = "yes"
@@ -36,6 +47,19 @@ adminLogsEnabled = "no"
 statusTimeout = 60000
 replaceKickOnLogin = "yes"
 maxPacketsPerSecond = 25
+-- NOTE: a warning is logged when a single dispatcher task runs longer than
+-- dispatcherStallThreshold milliseconds, set it to 0 to disable the watchdog.
+dispatcherStallThreshold = 100
+-- NOTE: connectionSendBudget is the number of bytes that may wait to be sent
+-- to a client, visual effects are dropped well before that. A client that
+-- falls further behind is disconnected, set it to 0 to disable the limit.
+connectionSendBudget = 1048576
+-- NOTE: logins are decrypted on cryptoThreads threads and loaded from the
+-- database on databaseThreads threads. At most maxPendingLogins logins wait
+-- for each of them, clients beyond that are put on the waiting list.
+cryptoThreads = 1
+databaseThreads = 1
+maxPendingLogins = 100
 
 -- Deaths
 -- NOTE: Leave deathLosePercent as -1 if you want to use Tibia's
@@ -54,8 +78,11 @@ timeBetweenActions = 200
 timeBetweenExActions = 1000
 
 -- Map
+-- NOTE: mapStorageType can be "quadtree" or "grid". The grid keeps the tiles in
+-- flat 32x32 chunks for faster lookups at the cost of some extra memory.
 mapName = "forgotten"
 mapAuthor = "Komic"
+mapStorageType = "quadtree"
 
 -- Market
 marketEnabled = "yes"
@@ -65,11 +92,18 @@ checkExpiredMarketOffersEachMinutes = 60
 maxMarketOffersAtATimePerPlayer = 100
 
 -- MySQL
+-- NOTE: asyncQueryConnections extra connections run the queries scripts send
+-- with db.asyncQuery and db.asyncStoreQuery, 0 runs them on the main one.
+-- NOTE: playerItemBlobs stores the inventory, depot and inbox of a player as
+-- one binary blob each instead of one row per item. The items are converted
+-- at the next startup after changing it.
 mysqlHost = "127.0.0.1"
 mysqlUser = "root"
 mysqlPass = ""
 mysqlDatabase = "theforgottenserver"
 mysqlPort = 3306
+asyncQueryConnections = 1
+playerItemBlobs = "no"
 
 -- Misc.
 allowChangeOutfit = "yes"
@@ -99,12 +133,19 @@ offlineRateMagic = 2
 -- NOTE: serverSaveHour is the hour of the day when the server save will occur,
 -- if you would rather save the server with intervals, disable server save and
 -- use autoSaveEachMinutes.
+-- NOTE: a save takes saveSnapshotsPerStep players or houses per dispatcher
+-- task, the game keeps running in between; more per task means a shorter
+-- save but longer stalls. The save thread writes up to saveBatchSize of them
+-- per database transaction; more per transaction means fewer round-trips but
+-- more to retry one by one when a transaction fails.
 serverSaveEnabled = "no"
 serverSaveHour = 10
 shutdownAtServerSave = "yes"
 cleanMapAtServerSave = "yes"
 autoSaveEachMinutes = 0
 saveGlobalStorage = "no"
+saveSnapshotsPerStep = 10
+saveBatchSize = 10
 
 -- Monsters
 deSpawnRange = 2
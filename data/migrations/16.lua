@@ -1,3 +1,5 @@
 function onUpdateDatabase()
-	return false
+	print("> Updating database to version 17 (player item blobs)")
+	db.query("CREATE TABLE IF NOT EXISTS `player_itemblobs` (`player_id` int(11) NOT NULL, `section` tinyint(3) unsigned NOT NULL COMMENT '0 = inventory, 1 = depot chests, 2 = inbox', `data` longblob NOT NULL, PRIMARY KEY (`player_id`, `section`), FOREIGN KEY (`player_id`) REFERENCES `players`(`id`) ON DELETE CASCADE) ENGINE=InnoDB")
+	return true
 end
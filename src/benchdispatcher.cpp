@@ -0,0 +1,213 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "otpch.h"
+
+#include "benchmark.h"
+#include "tasks.h"
+#include "outputmessage.h"
+#include "stats.h"
+
+// Network threads hand one task per parsed packet to the dispatcher. A few
+// producer threads add small tasks as fast as they can, and the time is taken
+// until the game thread has run all of them, for the lock-free dispatcher
+// and for a copy of the former mutex-guarded list. The bursts either stay
+// within DISPATCHER_QUEUE_SIZE or go well beyond it, where the lanes spill
+// into their overflow lists.
+
+#define DISPATCHER_BENCH_PRODUCERS 4
+#define DISPATCHER_BENCH_SMALL_BURST 8192
+#define DISPATCHER_BENCH_SMALL_BURSTS 32
+#define DISPATCHER_BENCH_LARGE_BURST 250000
+
+namespace {
+
+// The dispatcher as it was before the task lanes: every addTask and every
+// task taken off the list goes through the same mutex.
+class ListDispatcher
+{
+	public:
+		ListDispatcher() : m_running(false) {}
+
+		void start() {
+			m_running = true;
+			m_thread = boost::thread(boost::bind(&ListDispatcher::dispatcherThread, this));
+		}
+
+		void shutdown() {
+			m_taskLock.lock();
+			m_running = false;
+			m_taskLock.unlock();
+			m_taskSignal.notify_one();
+			m_thread.join();
+		}
+
+		void addTask(Task* task, bool push_front = false) {
+			m_taskLock.lock();
+			bool do_signal = m_taskList.empty();
+			if (push_front) {
+				m_taskList.push_front(task);
+			} else {
+				m_taskList.push_back(task);
+			}
+			m_taskLock.unlock();
+
+			if (do_signal) {
+				m_taskSignal.notify_one();
+			}
+		}
+
+	private:
+		void dispatcherThread() {
+			OutputMessagePool* outputPool = OutputMessagePool::getInstance();
+			Stats* stats = Stats::getInstance();
+
+			boost::unique_lock<boost::mutex> taskLockUnique(m_taskLock, boost::defer_lock);
+			while (true) {
+				Task* task = nullptr;
+
+				taskLockUnique.lock();
+				if (m_taskList.empty() && m_running) {
+					m_taskSignal.wait(taskLockUnique);
+				}
+
+				if (!m_running) {
+					taskLockUnique.unlock();
+					break;
+				}
+
+				if (!m_taskList.empty()) {
+					task = m_taskList.front();
+					m_taskList.pop_front();
+				}
+				taskLockUnique.unlock();
+
+				if (task) {
+					// timed like Dispatcher::runTask does, so only the queues differ
+					if (!task->hasExpired()) {
+						TaskStats* taskStats = stats->getOriginStats(TASK_ORIGIN_OTHER);
+						int64_t startTime = stats->enter(taskStats);
+
+						outputPool->startExecutionFrame();
+						(*task)();
+						outputPool->sendAll();
+
+						stats->leave(taskStats, startTime);
+					}
+					delete task;
+				}
+			}
+
+			for (Task* task : m_taskList) {
+				delete task;
+			}
+			m_taskList.clear();
+		}
+
+		boost::thread m_thread;
+		boost::mutex m_taskLock;
+		boost::condition_variable m_taskSignal;
+		std::list<Task*> m_taskList;
+		bool m_running;
+};
+
+std::atomic<uint64_t> executedTasks;
+
+void executeTask()
+{
+	//dispatcher thread
+	executedTasks.store(executedTasks.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+template<typename DispatcherType>
+void produceTasks(DispatcherType* dispatcher, uint32_t tasks)
+{
+	for (uint32_t i = 0; i < tasks; ++i) {
+		// every 64th packet is a login or logout, those go to the front
+		dispatcher->addTask(createTask(&executeTask), (i & 63) == 0);
+	}
+}
+
+template<typename DispatcherType>
+int64_t runBursts(DispatcherType& dispatcher, uint32_t burstSize, uint32_t bursts)
+{
+	executedTasks = 0;
+
+	int64_t startTime = OTSYS_STEADY_TIME_US();
+	for (uint32_t burst = 1; burst <= bursts; ++burst) {
+		boost::thread_group producers;
+		for (uint32_t i = 0; i < DISPATCHER_BENCH_PRODUCERS; ++i) {
+			producers.create_thread(boost::bind(&produceTasks<DispatcherType>, &dispatcher, burstSize));
+		}
+		producers.join_all();
+
+		const uint64_t executed = static_cast<uint64_t>(burst) * DISPATCHER_BENCH_PRODUCERS * burstSize;
+		while (executedTasks.load(std::memory_order_acquire) < executed) {
+			boost::this_thread::yield();
+		}
+	}
+	return OTSYS_STEADY_TIME_US() - startTime;
+}
+
+void printBursts(const char* name, uint32_t burstSize, uint32_t bursts, int64_t listTime, int64_t laneTime)
+{
+	const uint64_t total = static_cast<uint64_t>(DISPATCHER_BENCH_PRODUCERS) * burstSize * bursts;
+
+	std::ostringstream ss;
+	ss << name << ", mutex and list";
+	printBenchmarkResult(ss.str(), total, listTime);
+
+	ss.str("");
+	ss << name << ", lock-free lanes";
+	printBenchmarkResult(ss.str(), total, laneTime);
+
+	std::cout << "   tasks per second: " << (total * 1000000 / std::max<int64_t>(1, listTime)) << " before, "
+	          << (total * 1000000 / std::max<int64_t>(1, laneTime)) << " after" << std::endl;
+}
+
+bool benchmarkDispatcher()
+{
+	int64_t listTimes[2];
+	{
+		ListDispatcher dispatcher;
+		dispatcher.start();
+		listTimes[0] = runBursts(dispatcher, DISPATCHER_BENCH_SMALL_BURST, DISPATCHER_BENCH_SMALL_BURSTS);
+		listTimes[1] = runBursts(dispatcher, DISPATCHER_BENCH_LARGE_BURST, 1);
+		dispatcher.shutdown();
+	}
+
+	int64_t laneTimes[2];
+	{
+		Dispatcher dispatcher;
+		dispatcher.start();
+		laneTimes[0] = runBursts(dispatcher, DISPATCHER_BENCH_SMALL_BURST, DISPATCHER_BENCH_SMALL_BURSTS);
+		laneTimes[1] = runBursts(dispatcher, DISPATCHER_BENCH_LARGE_BURST, 1);
+		dispatcher.addTask(createTask(boost::bind(&Dispatcher::shutdown, &dispatcher)));
+		dispatcher.join();
+	}
+
+	printBursts("bursts within the lanes", DISPATCHER_BENCH_SMALL_BURST, DISPATCHER_BENCH_SMALL_BURSTS, listTimes[0], laneTimes[0]);
+	printBursts("one burst beyond the lanes", DISPATCHER_BENCH_LARGE_BURST, 1, listTimes[1], laneTimes[1]);
+	return true;
+}
+
+BenchmarkRegistration registration("dispatcher", "tasks per second into the game thread, lock-free lanes against the former list", &benchmarkDispatcher);
+
+}
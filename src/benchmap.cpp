@@ -0,0 +1,193 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "otpch.h"
+
+#include "benchmark.h"
+#include "map.h"
+#include "tile.h"
+#include "tools.h"
+
+// Map::getTile is looked up from canWalkTo, the path finder and spectator
+// scans. The same lookups run against a map stored in the quadtree and one
+// stored in the tile grid, both filled with the same tiles:
+// - random positions all over the filled area,
+// - viewport scans around random centers, as the spectator and map
+//   description code does,
+// - path steps, which check all neighbours of a position and then move to
+//   one of them, as the path finder does.
+// Both maps have to return the same tiles.
+
+#define MAP_BENCH_BASE_X 32000
+#define MAP_BENCH_BASE_Y 32000
+#define MAP_BENCH_BASE_Z 6
+#define MAP_BENCH_WIDTH 512
+#define MAP_BENCH_HEIGHT 512
+#define MAP_BENCH_FLOORS 2
+
+#define MAP_BENCH_LOOKUPS 4000000
+#define MAP_BENCH_SCANS 20000
+#define MAP_BENCH_STEPS 500000
+
+namespace {
+
+class BenchmarkMap : public Map
+{
+	public:
+		explicit BenchmarkMap(bool tileGrid) {
+			useTileGrid = tileGrid;
+
+			for (int32_t z = MAP_BENCH_BASE_Z; z < MAP_BENCH_BASE_Z + MAP_BENCH_FLOORS; ++z) {
+				for (int32_t y = MAP_BENCH_BASE_Y; y < MAP_BENCH_BASE_Y + MAP_BENCH_HEIGHT; ++y) {
+					for (int32_t x = MAP_BENCH_BASE_X; x < MAP_BENCH_BASE_X + MAP_BENCH_WIDTH; ++x) {
+						// leave some holes, as there are on real maps
+						if (((x * 7) ^ (y * 13)) % 11 != 0) {
+							setTile(x, y, z, new StaticTile(x, y, z));
+						}
+					}
+				}
+			}
+		}
+};
+
+struct MapWorkload {
+	MapWorkload() {
+		lookups.reserve(MAP_BENCH_LOOKUPS);
+		for (uint32_t i = 0; i < MAP_BENCH_LOOKUPS; ++i) {
+			lookups.push_back(randomPosition());
+		}
+
+		scans.reserve(MAP_BENCH_SCANS);
+		for (uint32_t i = 0; i < MAP_BENCH_SCANS; ++i) {
+			scans.push_back(randomPosition());
+		}
+
+		directions.reserve(MAP_BENCH_STEPS);
+		for (uint32_t i = 0; i < MAP_BENCH_STEPS; ++i) {
+			directions.push_back(uniform_random(0, 7));
+		}
+	}
+
+	static Position randomPosition() {
+		return Position(uniform_random(MAP_BENCH_BASE_X, MAP_BENCH_BASE_X + MAP_BENCH_WIDTH - 1),
+		                uniform_random(MAP_BENCH_BASE_Y, MAP_BENCH_BASE_Y + MAP_BENCH_HEIGHT - 1),
+		                uniform_random(MAP_BENCH_BASE_Z, MAP_BENCH_BASE_Z + MAP_BENCH_FLOORS - 1));
+	}
+
+	std::vector<Position> lookups;
+	std::vector<Position> scans;
+	std::vector<uint8_t> directions;
+};
+
+struct MapResult {
+	int64_t lookupTime;
+	int64_t scanTime;
+	int64_t stepTime;
+	uint64_t scanLookups;
+	uint64_t stepLookups;
+
+	// sum over the positions of the tiles found, to compare the two maps
+	uint64_t checksum;
+};
+
+uint64_t getChecksum(const Tile* tile)
+{
+	if (!tile) {
+		return 1;
+	}
+
+	const Position& pos = tile->getPosition();
+	return (static_cast<uint64_t>(pos.x) << 24) ^ (static_cast<uint64_t>(pos.y) << 8) ^ pos.z;
+}
+
+MapResult runWorkload(Map& map, const MapWorkload& workload)
+{
+	MapResult result;
+	result.checksum = 0;
+
+	int64_t startTime = OTSYS_STEADY_TIME_US();
+	for (const Position& pos : workload.lookups) {
+		result.checksum += getChecksum(map.getTile(pos.x, pos.y, pos.z));
+	}
+	result.lookupTime = OTSYS_STEADY_TIME_US() - startTime;
+
+	result.scanLookups = 0;
+	startTime = OTSYS_STEADY_TIME_US();
+	for (const Position& center : workload.scans) {
+		// the viewport on the floor of the center and the one above
+		for (int32_t z = center.z - 1; z <= center.z; ++z) {
+			for (int32_t y = center.y - Map::maxViewportY; y <= center.y + Map::maxViewportY; ++y) {
+				for (int32_t x = center.x - Map::maxViewportX; x <= center.x + Map::maxViewportX; ++x) {
+					result.checksum += getChecksum(map.getTile(x, y, z));
+					++result.scanLookups;
+				}
+			}
+		}
+	}
+	result.scanTime = OTSYS_STEADY_TIME_US() - startTime;
+
+	static const int32_t offsets[8][2] = {{-1, -1}, {0, -1}, {1, -1}, {-1, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+	result.stepLookups = 0;
+	Position pos(MAP_BENCH_BASE_X + MAP_BENCH_WIDTH / 2, MAP_BENCH_BASE_Y + MAP_BENCH_HEIGHT / 2, MAP_BENCH_BASE_Z);
+	startTime = OTSYS_STEADY_TIME_US();
+	for (uint8_t direction : workload.directions) {
+		for (uint32_t i = 0; i < 8; ++i) {
+			result.checksum += getChecksum(map.getTile(pos.x + offsets[i][0], pos.y + offsets[i][1], pos.z));
+		}
+		result.stepLookups += 8;
+
+		// stay within the filled area, walking off it only finds empty space
+		int32_t x = pos.x + offsets[direction][0];
+		int32_t y = pos.y + offsets[direction][1];
+		if (x > MAP_BENCH_BASE_X && x < MAP_BENCH_BASE_X + MAP_BENCH_WIDTH - 1) {
+			pos.x = x;
+		}
+		if (y > MAP_BENCH_BASE_Y && y < MAP_BENCH_BASE_Y + MAP_BENCH_HEIGHT - 1) {
+			pos.y = y;
+		}
+	}
+	result.stepTime = OTSYS_STEADY_TIME_US() - startTime;
+	return result;
+}
+
+bool benchmarkMap()
+{
+	MapWorkload workload;
+
+	MapResult results[2];
+	for (uint32_t i = 0; i < 2; ++i) {
+		// one map at a time, both of them together take a lot of memory
+		BenchmarkMap map(i == 1);
+		results[i] = runWorkload(map, workload);
+	}
+
+	static const char* names[2] = {"quadtree", "tile grid"};
+	for (uint32_t i = 0; i < 2; ++i) {
+		printBenchmarkResult(std::string(names[i]) + ", random lookups", MAP_BENCH_LOOKUPS, results[i].lookupTime);
+		printBenchmarkResult(std::string(names[i]) + ", viewport scans", results[i].scanLookups, results[i].scanTime);
+		printBenchmarkResult(std::string(names[i]) + ", path steps", results[i].stepLookups, results[i].stepTime);
+	}
+	return results[0].checksum == results[1].checksum;
+}
+
+BenchmarkRegistration registration("map", "getTile on the quadtree against the tile grid", &benchmarkMap);
+
+}
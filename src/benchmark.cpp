@@ -0,0 +1,129 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "otpch.h"
+
+#include "definitions.h"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "benchmark.h"
+#include "tasks.h"
+#include "scheduler.h"
+
+// Runs the benchmarks named on the command line, or all of them. The
+// dispatcher and the scheduler are started, nothing else is.
+
+extern Dispatcher g_dispatcher;
+extern Scheduler g_scheduler;
+
+void shutdown();
+
+volatile uint64_t benchmarkSink = 0;
+
+namespace {
+
+struct Benchmark {
+	const char* name;
+	const char* description;
+	BenchmarkFunction function;
+};
+
+std::vector<Benchmark>& getBenchmarks()
+{
+	// registrations run during static initialization, in no particular order
+	static std::vector<Benchmark> benchmarks;
+	return benchmarks;
+}
+
+}
+
+BenchmarkRegistration::BenchmarkRegistration(const char* name, const char* description, BenchmarkFunction function)
+{
+	Benchmark benchmark;
+	benchmark.name = name;
+	benchmark.description = description;
+	benchmark.function = function;
+	getBenchmarks().push_back(benchmark);
+}
+
+void printBenchmarkResult(const std::string& label, uint64_t operations, int64_t elapsedUs)
+{
+	double nsPerOperation = operations != 0 ? (elapsedUs * 1000.0) / operations : 0.0;
+	std::cout << "   " << std::left << std::setw(44) << label << std::right
+	          << std::setw(12) << operations << " ops"
+	          << std::setw(10) << (elapsedUs / 1000) << " ms"
+	          << std::setw(12) << std::fixed << std::setprecision(1) << nsPerOperation << " ns/op" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<Benchmark>& benchmarks = getBenchmarks();
+	std::sort(benchmarks.begin(), benchmarks.end(), [](const Benchmark& lhs, const Benchmark& rhs) {
+		return strcmp(lhs.name, rhs.name) < 0;
+	});
+
+	if (argc >= 2 && strcmp(argv[1], "--list") == 0) {
+		for (const Benchmark& benchmark : benchmarks) {
+			std::cout << std::left << std::setw(16) << benchmark.name << benchmark.description << std::endl;
+		}
+		return 0;
+	}
+
+	std::vector<const Benchmark*> selected;
+	if (argc < 2) {
+		for (const Benchmark& benchmark : benchmarks) {
+			selected.push_back(&benchmark);
+		}
+	} else {
+		for (int i = 1; i < argc; ++i) {
+			auto it = std::find_if(benchmarks.begin(), benchmarks.end(), [argv, i](const Benchmark& benchmark) {
+				return strcmp(benchmark.name, argv[i]) == 0;
+			});
+
+			if (it == benchmarks.end()) {
+				std::cout << "Unknown benchmark " << argv[i] << ", see " << argv[0] << " --list" << std::endl;
+				return 1;
+			}
+			selected.push_back(&*it);
+		}
+	}
+
+	g_dispatcher.start();
+	g_scheduler.start();
+
+	int exitCode = 0;
+	for (const Benchmark* benchmark : selected) {
+		std::cout << ">> " << benchmark->name << ": " << benchmark->description << std::endl;
+		if (!benchmark->function()) {
+			std::cout << ">> " << benchmark->name << " FAILED" << std::endl;
+			exitCode = 1;
+		}
+		std::cout << std::endl;
+	}
+
+	// shutdown() terminates both threads, stopping them first would refuse the task
+	g_dispatcher.addTask(createTask(boost::bind(shutdown)));
+	g_scheduler.join();
+	g_dispatcher.join();
+	return exitCode;
+}
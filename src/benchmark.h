@@ -0,0 +1,44 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef __OTSERV_BENCHMARK_H__
+#define __OTSERV_BENCHMARK_H__
+
+#include <string>
+
+// Microbenchmarks of the server internals, built by the tfs-bench target
+// ("make tfs-bench"). They run without a world or a database; every one of
+// them registers itself under a name through a static BenchmarkRegistration
+// and returns false when the code under test gave a wrong result.
+typedef bool (*BenchmarkFunction)();
+
+class BenchmarkRegistration
+{
+	public:
+		BenchmarkRegistration(const char* name, const char* description, BenchmarkFunction function);
+};
+
+// prints the number of operations, the total time and the time per operation
+void printBenchmarkResult(const std::string& label, uint64_t operations, int64_t elapsedUs);
+
+// results are folded into this so the compiler cannot drop the measured work
+extern volatile uint64_t benchmarkSink;
+
+#endif
@@ -0,0 +1,152 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "otpch.h"
+
+#include <queue>
+#include <unordered_set>
+
+#include "benchmark.h"
+#include "scheduler.h"
+#include "tools.h"
+
+// Walk and attack events are stopped and added again all the time. Both
+// schedulers get the same churn: a fixed number of live events, of which a
+// random one is stopped and replaced by a new event per operation.
+
+#define SCHEDULER_BENCH_LIVE_EVENTS 20000
+#define SCHEDULER_BENCH_OPERATIONS 1000000
+
+namespace {
+
+// The scheduler as it was before the timing wheel: a binary heap of tasks and
+// the set of live ids, a stopped task stays in the heap until it is due.
+class HeapScheduler
+{
+	public:
+		HeapScheduler() : m_lastEventId(0) {}
+		~HeapScheduler() {
+			while (!m_eventList.empty()) {
+				delete m_eventList.top();
+				m_eventList.pop();
+			}
+		}
+
+		uint32_t addEvent(SchedulerTask* task) {
+			boost::lock_guard<boost::mutex> lockClass(m_eventLock);
+			task->setEventId(++m_lastEventId);
+			m_eventIds.insert(task->getEventId());
+			m_eventList.push(task);
+			return task->getEventId();
+		}
+
+		bool stopEvent(uint32_t eventId) {
+			boost::lock_guard<boost::mutex> lockClass(m_eventLock);
+			return m_eventIds.erase(eventId) != 0;
+		}
+
+		size_t getQueuedCount() const {
+			return m_eventList.size();
+		}
+
+	private:
+		struct CompareCycle {
+			bool operator()(const SchedulerTask* lhs, const SchedulerTask* rhs) const {
+				return lhs->getCycle() > rhs->getCycle();
+			}
+		};
+
+		boost::mutex m_eventLock;
+		uint32_t m_lastEventId;
+		std::priority_queue<SchedulerTask*, std::vector<SchedulerTask*>, CompareCycle> m_eventList;
+		std::unordered_set<uint32_t> m_eventIds;
+};
+
+struct SchedulerChurn {
+	SchedulerChurn() {
+		slots.reserve(SCHEDULER_BENCH_OPERATIONS);
+		delays.reserve(SCHEDULER_BENCH_OPERATIONS);
+		for (uint32_t i = 0; i < SCHEDULER_BENCH_OPERATIONS; ++i) {
+			slots.push_back(uniform_random(0, SCHEDULER_BENCH_LIVE_EVENTS - 1));
+			// far enough out that nothing expires while measuring
+			delays.push_back(uniform_random(60000, 600000));
+		}
+	}
+
+	std::vector<uint32_t> slots;
+	std::vector<uint32_t> delays;
+};
+
+void noop() {}
+
+template<typename SchedulerType>
+int64_t runChurn(SchedulerType& scheduler, const SchedulerChurn& churn, bool& stoppedAll)
+{
+	std::vector<uint32_t> eventIds;
+	eventIds.reserve(SCHEDULER_BENCH_LIVE_EVENTS);
+	for (uint32_t i = 0; i < SCHEDULER_BENCH_LIVE_EVENTS; ++i) {
+		eventIds.push_back(scheduler.addEvent(createSchedulerTask(churn.delays[i], &noop)));
+	}
+
+	stoppedAll = true;
+
+	int64_t startTime = OTSYS_STEADY_TIME_US();
+	for (uint32_t i = 0; i < SCHEDULER_BENCH_OPERATIONS; ++i) {
+		uint32_t& eventId = eventIds[churn.slots[i]];
+		if (!scheduler.stopEvent(eventId)) {
+			stoppedAll = false;
+		}
+		eventId = scheduler.addEvent(createSchedulerTask(churn.delays[i], &noop));
+	}
+	return OTSYS_STEADY_TIME_US() - startTime;
+}
+
+bool benchmarkScheduler()
+{
+	SchedulerChurn churn;
+
+	bool heapStoppedAll;
+	size_t heapQueued;
+	int64_t heapTime;
+	{
+		HeapScheduler scheduler;
+		heapTime = runChurn(scheduler, churn, heapStoppedAll);
+		heapQueued = scheduler.getQueuedCount();
+	}
+
+	bool wheelStoppedAll;
+	int64_t wheelTime;
+	{
+		Scheduler scheduler;
+		scheduler.start();
+		wheelTime = runChurn(scheduler, churn, wheelStoppedAll);
+		scheduler.shutdown();
+		scheduler.join();
+	}
+
+	printBenchmarkResult("binary heap, stop + add", SCHEDULER_BENCH_OPERATIONS, heapTime);
+	printBenchmarkResult("timing wheel, stop + add", SCHEDULER_BENCH_OPERATIONS, wheelTime);
+	std::cout << "   tasks held by the heap afterwards: " << heapQueued << " for " << SCHEDULER_BENCH_LIVE_EVENTS << " live events" << std::endl;
+	return heapStoppedAll && wheelStoppedAll;
+}
+
+BenchmarkRegistration registration("scheduler", "timing wheel against the former binary heap under event churn", &benchmarkScheduler);
+
+}
@@ -0,0 +1,157 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "otpch.h"
+
+#include "benchmark.h"
+#include "connection.h"
+#include "outputmessage.h"
+#include "protocol.h"
+#include "xtea.h"
+
+// Outgoing messages used to get their length header, XTEA encryption and
+// crypto header on the dispatcher thread when they were handed to the
+// connection. Protocol::finalizeMessage now does that on the network thread,
+// so the time it takes is what the dispatcher saves. It is measured for a
+// movement update, a screen full of creatures and a map description, with
+// and without encryption; the ns per message equal the microseconds saved
+// per 1000 messages. The messages belong to a connection without a socket,
+// nothing is written.
+
+#define SEND_BENCH_ROUNDS 200
+#define SEND_BENCH_MESSAGES 1000
+
+namespace {
+
+struct SendScenario {
+	const char* name;
+	int32_t bodySize;
+};
+
+const SendScenario scenarios[] = {
+	{"movement update", 32},
+	{"creature screen", 400},
+	{"map description", 6000},
+};
+
+const uint32_t benchmarkKey[4] = {0x12345678, 0x9ABCDEF0, 0x0FEDCBA9, 0x87654321};
+
+class BenchmarkProtocol : public Protocol
+{
+	public:
+		BenchmarkProtocol(Connection_ptr connection, bool encrypt) : Protocol(connection), m_encrypt(encrypt) {
+			setXTEAKey(benchmarkKey);
+		}
+
+		virtual void onRecvFirstMessage(InputMessage& msg) {}
+
+		void finalize(OutputMessage& msg) {
+			if (!m_encrypt) {
+				finalizeMessage(msg);
+				return;
+			}
+
+			// what finalizeMessage does for the 7.7 protocol, whatever protocol this is built for
+			msg.writeMessageLength();
+			XTEA_encrypt(msg);
+			msg.addCryptoHeader();
+		}
+
+	private:
+		bool m_encrypt;
+};
+
+// checks the headers and that the body decrypts back to what was written
+bool checkMessage(OutputMessage& msg, const std::vector<char>& body, bool encrypt)
+{
+	const uint8_t* buffer = reinterpret_cast<const uint8_t*>(msg.getOutputBuffer());
+	int32_t length = msg.getMessageLength();
+	if (length < 2 || *reinterpret_cast<const uint16_t*>(buffer) != length - 2) {
+		return false;
+	}
+
+	if (!encrypt) {
+		return length - 2 == static_cast<int32_t>(body.size()) && std::equal(body.begin(), body.end(), buffer + 2);
+	}
+
+	// whole blocks are encrypted, as Protocol::XTEA_encrypt counts them
+	size_t blockCount = ((length - 2) / 4 + 1) / 2;
+	std::vector<uint8_t> packet(buffer + 2, buffer + 2 + blockCount * 8);
+	xteaDecrypt(&packet[0], blockCount, benchmarkKey);
+	if (*reinterpret_cast<const uint16_t*>(&packet[0]) != body.size()) {
+		return false;
+	}
+
+	return packet.size() >= body.size() + 2 && std::equal(body.begin(), body.end(), packet.begin() + 2);
+}
+
+bool benchmarkSend()
+{
+	boost::asio::io_service ioService;
+	Connection_ptr connection = ConnectionManager::getInstance()->createConnection(nullptr, ioService, ServicePort_ptr());
+
+	OutputMessagePool* outputPool = OutputMessagePool::getInstance();
+	outputPool->startExecutionFrame();
+
+	bool correct = true;
+	for (const SendScenario& scenario : scenarios) {
+		std::vector<char> body(scenario.bodySize);
+		for (int32_t i = 0; i < scenario.bodySize; ++i) {
+			body[i] = static_cast<char>(i * 31 + 7);
+		}
+
+		for (uint32_t encrypt = 0; encrypt < 2; ++encrypt) {
+			BenchmarkProtocol* protocol = new BenchmarkProtocol(connection, encrypt != 0);
+
+			std::vector<OutputMessage_ptr> messages;
+			messages.reserve(SEND_BENCH_MESSAGES);
+
+			int64_t elapsed = 0;
+			for (uint32_t round = 0; round < SEND_BENCH_ROUNDS; ++round) {
+				for (uint32_t i = 0; i < SEND_BENCH_MESSAGES; ++i) {
+					OutputMessage_ptr msg = outputPool->getOutputMessage(protocol, false);
+					msg->AddBytes(&body[0], body.size());
+					messages.push_back(msg);
+				}
+
+				int64_t startTime = OTSYS_STEADY_TIME_US();
+				for (const OutputMessage_ptr& msg : messages) {
+					protocol->finalize(*msg);
+				}
+				elapsed += OTSYS_STEADY_TIME_US() - startTime;
+
+				correct = correct && checkMessage(*messages.front(), body, encrypt != 0) && checkMessage(*messages.back(), body, encrypt != 0);
+				benchmarkSink += messages.back()->getMessageLength();
+				messages.clear();
+			}
+
+			delete protocol;
+
+			std::string label = std::string(scenario.name) + (encrypt != 0 ? ", XTEA" : ", length header");
+			printBenchmarkResult(label, SEND_BENCH_ROUNDS * SEND_BENCH_MESSAGES, elapsed);
+		}
+	}
+
+	ConnectionManager::getInstance()->releaseConnection(connection);
+	return correct;
+}
+
+BenchmarkRegistration registration("send", "dispatcher time saved by finalizing messages on the network thread", &benchmarkSend);
+
+}
@@ -0,0 +1,137 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "otpch.h"
+
+#include <unordered_set>
+
+#include "benchmark.h"
+#include "spectators.h"
+
+// Every move, say, effect and health change builds a spectator list and
+// walks it once. The same lists are built into SpectatorVec and into the
+// std::unordered_set it replaced, for a quiet street, a crowded depot and a
+// boss room, and then merged with a second overlapping list as multifloor
+// and two-position broadcasts do. Only the pointers are used, so the
+// creatures are addresses in an array that is never read.
+
+#define SPECTATOR_BENCH_QUERIES 100000
+
+namespace {
+
+struct SpectatorScenario {
+	const char* name;
+	uint32_t creatures;
+	// creatures of the second list that are not in the first one
+	uint32_t mergedCreatures;
+};
+
+const SpectatorScenario scenarios[] = {
+	{"street", 6, 2},
+	{"crowded depot", 80, 20},
+	{"boss room", 250, 50},
+};
+
+char creatureStorage[512];
+
+Creature* getCreature(uint32_t index)
+{
+	return reinterpret_cast<Creature*>(&creatureStorage[index]);
+}
+
+uint64_t visit(Creature* creature)
+{
+	return reinterpret_cast<uintptr_t>(creature);
+}
+
+int64_t runSpectatorVec(const SpectatorScenario& scenario, bool merge, uint64_t& checksum)
+{
+	int64_t startTime = OTSYS_STEADY_TIME_US();
+	for (uint32_t query = 0; query < SPECTATOR_BENCH_QUERIES; ++query) {
+		SpectatorVec list;
+		for (uint32_t i = 0; i < scenario.creatures; ++i) {
+			list.push_back(getCreature(i));
+		}
+
+		if (merge) {
+			SpectatorVec other;
+			for (uint32_t i = scenario.creatures / 2; i < scenario.creatures + scenario.mergedCreatures; ++i) {
+				other.push_back(getCreature(i));
+			}
+			list.insert(other.begin(), other.end());
+		}
+
+		for (Creature* creature : list) {
+			checksum += visit(creature);
+		}
+	}
+	return OTSYS_STEADY_TIME_US() - startTime;
+}
+
+int64_t runHashSet(const SpectatorScenario& scenario, bool merge, uint64_t& checksum)
+{
+	int64_t startTime = OTSYS_STEADY_TIME_US();
+	for (uint32_t query = 0; query < SPECTATOR_BENCH_QUERIES; ++query) {
+		std::unordered_set<Creature*> list;
+		for (uint32_t i = 0; i < scenario.creatures; ++i) {
+			list.insert(getCreature(i));
+		}
+
+		if (merge) {
+			std::unordered_set<Creature*> other;
+			for (uint32_t i = scenario.creatures / 2; i < scenario.creatures + scenario.mergedCreatures; ++i) {
+				other.insert(getCreature(i));
+			}
+			list.insert(other.begin(), other.end());
+		}
+
+		for (Creature* creature : list) {
+			checksum += visit(creature);
+		}
+	}
+	return OTSYS_STEADY_TIME_US() - startTime;
+}
+
+bool benchmarkSpectators()
+{
+	bool equal = true;
+	for (const SpectatorScenario& scenario : scenarios) {
+		for (uint32_t merge = 0; merge < 2; ++merge) {
+			uint64_t setChecksum = 0;
+			int64_t setTime = runHashSet(scenario, merge != 0, setChecksum);
+
+			uint64_t vecChecksum = 0;
+			int64_t vecTime = runSpectatorVec(scenario, merge != 0, vecChecksum);
+
+			// both have to see every creature exactly once
+			equal = equal && (setChecksum == vecChecksum);
+			benchmarkSink += vecChecksum;
+
+			std::string label = std::string(scenario.name) + (merge != 0 ? ", merged" : "");
+			printBenchmarkResult(label + ", unordered_set", SPECTATOR_BENCH_QUERIES, setTime);
+			printBenchmarkResult(label + ", SpectatorVec", SPECTATOR_BENCH_QUERIES, vecTime);
+		}
+	}
+	return equal;
+}
+
+BenchmarkRegistration registration("spectators", "spectator lists in SpectatorVec against std::unordered_set", &benchmarkSpectators);
+
+}
@@ -0,0 +1,109 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "otpch.h"
+
+#include <iostream>
+
+#include "benchmark.h"
+#include "networkmessage.h"
+#include "stats.h"
+#include "status.h"
+
+// The "stat" status reply is one raw message, written with AddBytes, which
+// drops anything over 8192 bytes. A server with every opcode in use and a
+// full table of scripts named by long paths has to get a trimmed report,
+// not an empty one. The report is then built repeatedly, as status queries
+// do on the dispatcher thread.
+
+#define STATUS_BENCH_SCRIPTS 400
+#define STATUS_BENCH_REPORTS 1000
+
+namespace {
+
+void fillStats()
+{
+	Stats* stats = Stats::getInstance();
+
+	for (int32_t opcode = 0; opcode < 256; ++opcode) {
+		LatencyHistogram& histogram = stats->getOpcodeStats(opcode)->getHistogram();
+		for (int32_t i = 0; i < 16; ++i) {
+			histogram.record(opcode * 7 + i * 131);
+		}
+	}
+
+	for (int32_t i = 0; i < STATUS_BENCH_SCRIPTS; ++i) {
+		std::ostringstream ss;
+		ss << "data/creaturescripts/scripts/quests/the_long_quest_name_" << i << "/on_kill_reward_handler.lua";
+
+		LatencyHistogram& histogram = stats->getScriptStats(ss.str())->getHistogram();
+		for (int32_t j = 0; j < 16; ++j) {
+			histogram.record(100000 + i * 977 + j * 3571);
+		}
+	}
+}
+
+bool checkReport(const std::string& report)
+{
+	if (report.size() > STATUS_MAX_STATS_SIZE) {
+		std::cout << "   the report takes " << report.size() << " bytes" << std::endl;
+		return false;
+	}
+
+	const std::string end = "</tsqp>";
+	if (report.size() < end.size() || report.compare(report.size() - end.size(), end.size(), end) != 0) {
+		std::cout << "   the report is not a complete document" << std::endl;
+		return false;
+	}
+
+	if (report.find("<task ") == std::string::npos) {
+		std::cout << "   the report has no entries" << std::endl;
+		return false;
+	}
+
+	// what ProtocolStatus does with it
+	NetworkMessage msg;
+	msg.AddBytes(report.c_str(), report.size());
+	if (msg.getMessageLength() != static_cast<int32_t>(report.size())) {
+		std::cout << "   the report does not fit into a message" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool benchmarkStatus()
+{
+	fillStats();
+
+	Status* status = Status::getInstance();
+	if (!checkReport(status->getStatsString())) {
+		return false;
+	}
+
+	int64_t startTime = OTSYS_STEADY_TIME_US();
+	for (uint32_t i = 0; i < STATUS_BENCH_REPORTS; ++i) {
+		benchmarkSink += status->getStatsString().size();
+	}
+	printBenchmarkResult("full stats report", STATUS_BENCH_REPORTS, OTSYS_STEADY_TIME_US() - startTime);
+	return true;
+}
+
+BenchmarkRegistration registration("status", "stats report of a full table fits into one status message", &benchmarkStatus);
+
+}
@@ -0,0 +1,171 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "otpch.h"
+
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include "benchmark.h"
+#include "xtea.h"
+
+// xteaEncrypt and xteaDecrypt run several blocks at a time with SSE2/AVX2
+// and the rest one by one. They have to give the same bytes as the plain
+// XTEA loop the protocol used before, for every block count that splits
+// differently between the kernels and at unaligned addresses. Then both
+// are timed on a movement update, a screen full of creatures and a map
+// description sized buffer.
+
+#define XTEA_BENCH_MAX_BLOCKS 67
+#define XTEA_BENCH_BYTES (64 * 1024 * 1024)
+
+namespace {
+
+const uint32_t XTEA_DELTA = 0x61C88647;
+
+const uint32_t xteaBenchSizes[] = {40, 400, 6000};
+
+// the loops of Protocol::XTEA_encrypt and XTEA_decrypt before they were vectorized
+void referenceEncrypt(uint8_t* buffer, size_t blockCount, const uint32_t* k)
+{
+	for (size_t n = 0; n < blockCount; ++n, buffer += 8) {
+		uint32_t v0, v1;
+		memcpy(&v0, buffer, 4);
+		memcpy(&v1, buffer + 4, 4);
+
+		uint32_t sum = 0;
+		for (int32_t i = 0; i < 32; ++i) {
+			v0 += ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
+			sum -= XTEA_DELTA;
+			v1 += ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum >> 11 & 3]);
+		}
+
+		memcpy(buffer, &v0, 4);
+		memcpy(buffer + 4, &v1, 4);
+	}
+}
+
+void referenceDecrypt(uint8_t* buffer, size_t blockCount, const uint32_t* k)
+{
+	for (size_t n = 0; n < blockCount; ++n, buffer += 8) {
+		uint32_t v0, v1;
+		memcpy(&v0, buffer, 4);
+		memcpy(&v1, buffer + 4, 4);
+
+		uint32_t sum = 0xC6EF3720;
+		for (int32_t i = 0; i < 32; ++i) {
+			v1 -= ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum >> 11 & 3]);
+			sum += XTEA_DELTA;
+			v0 -= ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
+		}
+
+		memcpy(buffer, &v0, 4);
+		memcpy(buffer + 4, &v1, 4);
+	}
+}
+
+bool checkXTEA()
+{
+	std::mt19937 generator(42);
+
+	std::vector<uint8_t> plain(XTEA_BENCH_MAX_BLOCKS * 8);
+	std::vector<uint8_t> expected(plain.size());
+	std::vector<uint8_t> buffer(plain.size() + 8);
+
+	for (int32_t keyIndex = 0; keyIndex < 16; ++keyIndex) {
+		uint32_t key[4];
+		for (uint32_t& word : key) {
+			word = generator();
+		}
+
+		for (size_t blockCount = 0; blockCount <= XTEA_BENCH_MAX_BLOCKS; ++blockCount) {
+			for (uint8_t& byte : plain) {
+				byte = static_cast<uint8_t>(generator());
+			}
+
+			expected = plain;
+			referenceEncrypt(&expected[0], blockCount, key);
+
+			for (size_t offset = 0; offset < 8; offset += 3) {
+				uint8_t* data = &buffer[offset];
+				memcpy(data, &plain[0], plain.size());
+
+				xteaEncrypt(data, blockCount, key);
+				if (memcmp(data, &expected[0], plain.size()) != 0) {
+					std::cout << "   xteaEncrypt differs for " << blockCount << " blocks at offset " << offset << std::endl;
+					return false;
+				}
+
+				xteaDecrypt(data, blockCount, key);
+				if (memcmp(data, &plain[0], plain.size()) != 0) {
+					std::cout << "   xteaDecrypt differs for " << blockCount << " blocks at offset " << offset << std::endl;
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+typedef void (*XTEAFunction)(uint8_t* buffer, size_t blockCount, const uint32_t* key);
+
+void runXTEA(const std::string& label, XTEAFunction function, uint32_t size)
+{
+	const uint32_t key[4] = {0x12345678, 0x9ABCDEF0, 0x0FEDCBA9, 0x87654321};
+
+	std::vector<uint8_t> buffer(size);
+	for (uint32_t i = 0; i < size; ++i) {
+		buffer[i] = static_cast<uint8_t>(i * 31 + 7);
+	}
+
+	const uint64_t messages = XTEA_BENCH_BYTES / size;
+
+	int64_t startTime = OTSYS_STEADY_TIME_US();
+	for (uint64_t i = 0; i < messages; ++i) {
+		function(&buffer[0], size / 8, key);
+	}
+	int64_t elapsed = std::max<int64_t>(1, OTSYS_STEADY_TIME_US() - startTime);
+	benchmarkSink += buffer[0];
+
+	printBenchmarkResult(label, messages, elapsed);
+	std::cout << "   " << std::left << std::setw(44) << "" << std::right << std::setw(16) << std::fixed << std::setprecision(1)
+	          << (messages * size / (elapsed / 1000000.0) / (1024 * 1024)) << " MB/s" << std::endl;
+}
+
+bool benchmarkXTEA()
+{
+	if (!checkXTEA()) {
+		return false;
+	}
+
+	for (uint32_t size : xteaBenchSizes) {
+		std::ostringstream ss;
+		ss << size << " bytes, ";
+		runXTEA(ss.str() + "reference encrypt", &referenceEncrypt, size);
+		runXTEA(ss.str() + "xteaEncrypt", &xteaEncrypt, size);
+		runXTEA(ss.str() + "reference decrypt", &referenceDecrypt, size);
+		runXTEA(ss.str() + "xteaDecrypt", &xteaDecrypt, size);
+	}
+	return true;
+}
+
+BenchmarkRegistration registration("xtea", "vectorized XTEA against the plain loop, bit-exact check and MB/s", &benchmarkXTEA);
+
+}
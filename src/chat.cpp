@@ -25,6 +25,7 @@
 #include "chat.h"
 #include "configmanager.h"
 #include "player.h"
+#include "networkmessage.h"
 #include "game.h"
 #include "iologindata.h"
 
@@ -168,8 +169,11 @@ bool ChatChannel::talk(const Player& fromPlayer, SpeakClasses type, const std::s
 		return false;
 	}
 
+	NetworkMessage msg;
+	ProtocolGame::AddCreatureSpeak(msg, &fromPlayer, type, text, getId());
+
 	for (const auto& it : users) {
-		it.second->sendToChannel(&fromPlayer, type, text, getId());
+		it.second->sendSharedMessage(msg, OUTPUT_PRIORITY_CHAT);
 	}
 	return true;
 }
@@ -1043,7 +1043,10 @@ void Commands::serverDiag(Player* player, const std::string& cmd, const std::str
 	text << "Active connections: " << Connection::connectionCount << "\n";
 	text << "Total message pool: " << OutputMessagePool::getInstance()->getTotalMessageCount() << "\n";
 	text << "Auto message pool: " << OutputMessagePool::getInstance()->getAutoMessageCount() << "\n";
-	text << "Free message pool: " << OutputMessagePool::getInstance()->getAvailableMessageCount() << "\n";
+	for (uint32_t i = 0; i < OUTPUT_POOL_SIZE_CLASSES; ++i) {
+		text << "Message buffers (" << OutputMessagePool::getBufferSize(i) << " bytes): " << OutputMessagePool::getBufferCount(i)
+		     << ", hits: " << OutputMessagePool::getPoolHits(i) << ", misses: " << OutputMessagePool::getPoolMisses(i) << "\n";
+	}
 
 	text << "\nLibraries:\n";
 	text << "--------------------\n";
@@ -62,10 +62,14 @@ bool ConfigManager::load()
 		m_confBoolean[SAVE_GLOBAL_STORAGE] = booleanString(getGlobalString(L, "saveGlobalStorage", "no"));
 		m_confBoolean[BIND_ONLY_GLOBAL_ADDRESS] = booleanString(getGlobalString(L, "bindOnlyGlobalAddress", "no"));
 		m_confBoolean[OPTIMIZE_DATABASE] = booleanString(getGlobalString(L, "startupDatabaseOptimization", "yes"));
+		m_confBoolean[SOCKET_NO_DELAY] = booleanString(getGlobalString(L, "tcpNoDelay", "yes"));
+		m_confBoolean[SOCKET_CORK] = booleanString(getGlobalString(L, "tcpCork", "no"));
+		m_confBoolean[PLAYER_ITEM_BLOBS] = booleanString(getGlobalString(L, "playerItemBlobs", "no"));
 
 		m_confString[IP] = getGlobalString(L, "ip", "127.0.0.1");
 		m_confString[MAP_NAME] = getGlobalString(L, "mapName", "forgotten");
 		m_confString[MAP_AUTHOR] = getGlobalString(L, "mapAuthor", "Unknown");
+		m_confString[MAP_STORAGE_TYPE] = getGlobalString(L, "mapStorageType", "quadtree");
 		m_confString[HOUSE_RENT_PERIOD] = getGlobalString(L, "houseRentPeriod", "monthly");
 		m_confString[MYSQL_HOST] = getGlobalString(L, "mysqlHost", "localhost");
 		m_confString[MYSQL_USER] = getGlobalString(L, "mysqlUser", "root");
@@ -79,6 +83,7 @@ bool ConfigManager::load()
 		m_confInteger[GAME_PORT] = getGlobalNumber(L, "gameProtocolPort", 7172);
 		m_confInteger[LOGIN_PORT] = getGlobalNumber(L, "loginProtocolPort", 7171);
 		m_confInteger[STATUS_PORT] = getGlobalNumber(L, "statusProtocolPort", 7171);
+		m_confInteger[NETWORK_THREADS] = getGlobalNumber(L, "networkThreads", 1);
 	}
 
 	m_confBoolean[ON_OR_OFF_CHARLIST] = booleanString(getGlobalString(L, "displayOnOrOffAtCharlist", "no"));
@@ -116,6 +121,7 @@ bool ConfigManager::load()
 	m_confString[LOCATION] = getGlobalString(L, "location");
 	m_confString[MOTD] = getGlobalString(L, "motd");
 	m_confString[WORLD_TYPE] = getGlobalString(L, "worldType", "pvp");
+	m_confString[PACKET_CAPTURE_FILE] = getGlobalString(L, "packetCaptureFile", "");
 
 	m_confInteger[MAX_PLAYERS] = getGlobalNumber(L, "maxPlayers");
 	m_confInteger[PZ_LOCKED] = getGlobalNumber(L, "pzLocked", 0);
@@ -143,6 +149,14 @@ bool ConfigManager::load()
 	m_confInteger[STAIRHOP_DELAY] = getGlobalNumber(L, "stairJumpExhaustion", 2000);
 	m_confInteger[EXP_FROM_PLAYERS_LEVEL_RANGE] = getGlobalNumber(L, "expFromPlayersLevelRange", 75);
 	m_confInteger[MAX_PACKETS_PER_SECOND] = getGlobalNumber(L, "maxPacketsPerSecond", 40);
+	m_confInteger[DISPATCHER_STALL_THRESHOLD] = getGlobalNumber(L, "dispatcherStallThreshold", 100);
+	m_confInteger[CONNECTION_SEND_BUDGET] = getGlobalNumber(L, "connectionSendBudget", 1048576);
+	m_confInteger[CRYPTO_THREADS] = getGlobalNumber(L, "cryptoThreads", 1);
+	m_confInteger[DATABASE_THREADS] = getGlobalNumber(L, "databaseThreads", 1);
+	m_confInteger[MAX_PENDING_LOGINS] = getGlobalNumber(L, "maxPendingLogins", 100);
+	m_confInteger[SAVE_BATCH_SIZE] = getGlobalNumber(L, "saveBatchSize", 10);
+	m_confInteger[SAVE_SNAPSHOTS_PER_STEP] = getGlobalNumber(L, "saveSnapshotsPerStep", 10);
+	m_confInteger[ASYNC_QUERY_CONNECTIONS] = getGlobalNumber(L, "asyncQueryConnections", 1);
 	m_confInteger[OFFLINE_RATE_SKILL] = getGlobalNumber(L, "offlineRateSkill", 1);
 	m_confInteger[OFFLINE_RATE_MAGIC] = getGlobalNumber(L, "offlineRateMagic", 1);
 
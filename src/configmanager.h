@@ -66,6 +66,9 @@ class ConfigManager
 			SUMMONS_DROP_CORPSE = 27,
 			BLESS_REDUCE_ITEM_DROP = 28,
 			LOOT_MESSAGE = 29,
+			SOCKET_NO_DELAY = 30,
+			SOCKET_CORK = 31,
+			PLAYER_ITEM_BLOBS = 32,
 			LAST_BOOLEAN_CONFIG /* this must be the last one */
 		};
 
@@ -90,6 +93,8 @@ class ConfigManager
 			DEFAULT_PRIORITY = 17,
 			PASSWORDTYPE = 18,
 			MAP_AUTHOR = 19,
+			MAP_STORAGE_TYPE = 20,
+			PACKET_CAPTURE_FILE = 21,
 			LAST_STRING_CONFIG /* this must be the last one */
 		};
 
@@ -130,6 +135,15 @@ class ConfigManager
 			MAX_PACKETS_PER_SECOND = 33,
 			OFFLINE_RATE_SKILL = 34,
 			OFFLINE_RATE_MAGIC = 35,
+			NETWORK_THREADS = 36,
+			DISPATCHER_STALL_THRESHOLD = 37,
+			CONNECTION_SEND_BUDGET = 38,
+			CRYPTO_THREADS = 39,
+			DATABASE_THREADS = 40,
+			MAX_PENDING_LOGINS = 41,
+			SAVE_BATCH_SIZE = 42,
+			ASYNC_QUERY_CONNECTIONS = 43,
+			SAVE_SNAPSHOTS_PER_STEP = 44,
 			LAST_INTEGER_CONFIG /* this must be the last one */
 		};
 
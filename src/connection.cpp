@@ -33,6 +33,11 @@
 
 #include <boost/bind.hpp>
 
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#endif
+
 bool Connection::m_logError = true;
 
 extern ConfigManager g_config;
@@ -126,6 +131,10 @@ void Connection::closeSocket()
 	if (m_socket->is_open()) {
 		m_pendingRead = 0;
 		m_pendingWrite = 0;
+		for (std::vector<OutputMessage_ptr>& queue : m_messageQueue) {
+			queue.clear();
+		}
+		m_queuedBytes = 0;
 
 		try {
 			boost::system::error_code error;
@@ -210,7 +219,7 @@ void Connection::acceptConnection()
 
 		// Read size of the first packet
 		boost::asio::async_read(getHandle(),
-		                        boost::asio::buffer(m_msg.getBuffer(), NetworkMessage::header_length),
+		                        boost::asio::buffer(m_msgHeader, NetworkMessage::header_length),
 		                        boost::bind(&Connection::parseHeader, shared_from_this(), boost::asio::placeholders::error));
 	} catch (boost::system::system_error& e) {
 		if (m_logError) {
@@ -227,7 +236,7 @@ void Connection::parseHeader(const boost::system::error_code& error)
 	m_connectionLock.lock();
 	m_readTimer.cancel();
 
-	int32_t size = m_msg.decodeHeader();
+	int32_t size = (int32_t)(m_msgHeader[0] | m_msgHeader[1] << 8);
 
 	if (error || size <= 0 || size >= NETWORKMESSAGE_MAXSIZE - 16) {
 		handleReadError(error);
@@ -248,8 +257,10 @@ void Connection::parseHeader(const boost::system::error_code& error)
 		                                    boost::asio::placeholders::error));
 
 		// Read packet content
-		m_msg.setMessageLength(size + NetworkMessage::header_length);
-		boost::asio::async_read(getHandle(), boost::asio::buffer(m_msg.getBodyBuffer(), size),
+		m_msg = InputMessage::create(size);
+		memcpy(m_msg->getBuffer(), m_msgHeader, NetworkMessage::header_length);
+		m_msg->setMessageLength(size + NetworkMessage::header_length);
+		boost::asio::async_read(getHandle(), boost::asio::buffer(m_msg->getBodyBuffer(), size),
 		                        boost::bind(&Connection::parsePacket, shared_from_this(), boost::asio::placeholders::error));
 	} catch (boost::system::system_error& e) {
 		if (m_logError) {
@@ -299,7 +310,7 @@ void Connection::parsePacket(const boost::system::error_code& error)
 
 		if (!m_protocol) {
 			// Game protocol has already been created at this point
-			m_protocol = m_service_port->make_protocol(m_msg);
+			m_protocol = m_service_port->make_protocol(*m_msg);
 
 			if (!m_protocol) {
 				closeConnection();
@@ -309,21 +320,24 @@ void Connection::parsePacket(const boost::system::error_code& error)
 
 			m_protocol->setConnection(shared_from_this());
 		} else {
-			m_msg.GetByte();    // Skip protocol ID
+			m_msg->GetByte();    // Skip protocol ID
 		}
 
-		m_protocol->onRecvFirstMessage(m_msg);
+		m_protocol->onRecvFirstMessage(*m_msg);
 	} else {
-		m_protocol->onRecvMessage(m_msg);    // Send the packet to the current protocol
+		m_protocol->onRecvMessage(*m_msg);    // Send the packet to the current protocol
 	}
 
+	// the game tasks created from the packet hold their own reference
+	m_msg.reset();
+
 	try {
 		++m_pendingRead;
 		m_readTimer.expires_from_now(boost::posix_time::seconds(Connection::read_timeout));
 		m_readTimer.async_wait( boost::bind(&Connection::handleReadTimeout, boost::weak_ptr<Connection>(shared_from_this()), boost::asio::placeholders::error));
 
 		// Wait to the next packet
-		boost::asio::async_read(getHandle(), boost::asio::buffer(m_msg.getBuffer(), NetworkMessage::header_length), boost::bind(&Connection::parseHeader, shared_from_this(), boost::asio::placeholders::error));
+		boost::asio::async_read(getHandle(), boost::asio::buffer(m_msgHeader, NetworkMessage::header_length), boost::bind(&Connection::parseHeader, shared_from_this(), boost::asio::placeholders::error));
 	} catch (boost::system::system_error& e) {
 		if (m_logError) {
 			LOG_MESSAGE("NETWORK", LOGTYPE_ERROR, 1, e.what());
@@ -345,29 +359,134 @@ bool Connection::send(OutputMessage_ptr msg)
 		return false;
 	}
 
+	msg->getProtocol()->onSendMessage(msg);
+
+	const OutputPriority_t priority = msg->getPriority();
+	const int32_t msgLength = msg->getMessageLength();
+	const int32_t sendBudget = g_config.getNumber(ConfigManager::CONNECTION_SEND_BUDGET);
+
+	if (priority == OUTPUT_PRIORITY_LOW) {
+		// a write completes once the kernel took the bytes, so what the client
+		// still has to receive is read from the socket when it was behind
+		int32_t unsentBytes = (m_unsentBytes > 0 ? std::max<int32_t>(0, getUnsentBytes()) : 0);
+		if (m_queuedBytes + m_writeBytes + unsentBytes + msgLength > getLowPriorityBacklog(sendBudget)) {
+			// the client is behind, effects are not worth waiting for
+			m_connectionLock.unlock();
+			return true;
+		}
+	}
+
+	if (sendBudget > 0 && m_queuedBytes + m_writeBytes + msgLength > sendBudget) {
+		dropLowPriorityMessages();
+
+		if (m_queuedBytes + m_writeBytes + msgLength > sendBudget) {
+			// to the log file, under load this happens to many slow clients at once
+			LOG_MESSAGE("NETWORK", LOGTYPE_WARNING, 1, convertIPToString(getIP()) + " disconnected for exceeding the send budget");
+			closeConnection();
+			m_connectionLock.unlock();
+			return false;
+		}
+	}
+
+	m_messageQueue[priority].push_back(msg);
+	m_queuedBytes += msgLength;
+
 	if (m_pendingWrite == 0) {
-		msg->getProtocol()->onSendMessage(msg);
-		internalSend(msg);
-	} else {
-		OutputMessagePool* outputPool = OutputMessagePool::getInstance();
-		outputPool->addToAutoSend(msg);
+		internalSend();
 	}
 
 	m_connectionLock.unlock();
 	return true;
 }
 
-void Connection::internalSend(OutputMessage_ptr msg)
+void Connection::internalSend()
 {
+	//the queued messages are encrypted and written on the network thread of this connection
+	++m_pendingWrite;
+
+	try {
+		m_io_service.post(boost::bind(&Connection::onSendOperation, shared_from_this()));
+	} catch (boost::system::system_error& e) {
+		if (m_logError) {
+			LOG_MESSAGE("NETWORK", LOGTYPE_ERROR, 1, e.what());
+			m_logError = false;
+		}
+	}
+}
+
+void Connection::onSendOperation()
+{
+	//io_service thread
+	m_connectionLock.lock();
+
+	//the queue is dropped when the socket was closed in the meantime, or
+	//emptied when the send budget closed the connection
+	if (hasQueuedMessages()) {
+		writeQueuedMessages();
+	} else {
+		--m_pendingWrite;
+
+		//closeConnectionTask leaves the socket to the write that was pending
+		if (m_connectionState != CONNECTION_STATE_OPEN || m_writeError) {
+			closeSocket();
+			closeConnection();
+		}
+	}
+
+	m_connectionLock.unlock();
+}
+
+void Connection::writeQueuedMessages()
+{
+	//io_service thread, m_connectionLock is held
+	//the lanes are merged by frame and only the messages of one frame go out
+	//in order of priority, nothing overtakes what an earlier frame queued
+	size_t positions[OUTPUT_PRIORITY_LAST] = {};
+	while (true) {
+		int32_t next = -1;
+		for (int32_t priority = 0; priority < OUTPUT_PRIORITY_LAST; ++priority) {
+			const std::vector<OutputMessage_ptr>& queue = m_messageQueue[priority];
+			if (positions[priority] < queue.size() && (next == -1 ||
+			        queue[positions[priority]]->getFrame() < m_messageQueue[next][positions[next]]->getFrame())) {
+				next = priority;
+			}
+		}
+
+		if (next == -1) {
+			break;
+		}
+
+		m_writeBatch.push_back(m_messageQueue[next][positions[next]++]);
+	}
+
+	for (std::vector<OutputMessage_ptr>& queue : m_messageQueue) {
+		queue.clear();
+	}
+	m_writeBuffers.clear();
+
+	m_writeBytes = m_queuedBytes;
+	m_writeStart = OTSYS_STEADY_TIME();
+	m_queuedBytes = 0;
+
+	if (m_unsentBytes > 0 && getUnsentBytes() <= 0) {
+		// the socket buffer ran empty since the last sample, the client was idle for a while
+		m_unsentBytes = 0;
+	}
+
+	for (const OutputMessage_ptr& msg : m_writeBatch) {
+		msg->getProtocol()->finalizeMessage(*msg);
+		m_writeBuffers.push_back(boost::asio::buffer(msg->getOutputBuffer(), msg->getMessageLength()));
+	}
+
 	try {
-		++m_pendingWrite;
 		m_writeTimer.expires_from_now(boost::posix_time::seconds(Connection::write_timeout));
 		m_writeTimer.async_wait( boost::bind(&Connection::handleWriteTimeout, boost::weak_ptr<Connection>(shared_from_this()),
 		                                     boost::asio::placeholders::error));
 
-		boost::asio::async_write(getHandle(),
-		                         boost::asio::buffer(msg->getOutputBuffer(), msg->getMessageLength()),
-		                         boost::bind(&Connection::onWriteOperation, shared_from_this(), msg, boost::asio::placeholders::error));
+		// everything queued since the last write goes out in a single gather write
+		setCork(true);
+		boost::asio::async_write(getHandle(), m_writeBuffers,
+		                         boost::bind(&Connection::onWriteOperation, shared_from_this(), boost::asio::placeholders::error));
 	} catch (boost::system::system_error& e) {
 		if (m_logError) {
 			LOG_MESSAGE("NETWORK", LOGTYPE_ERROR, 1, e.what());
@@ -376,6 +495,87 @@ void Connection::internalSend(OutputMessage_ptr msg)
 	}
 }
 
+bool Connection::hasQueuedMessages() const
+{
+	for (const std::vector<OutputMessage_ptr>& queue : m_messageQueue) {
+		if (!queue.empty()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void Connection::dropLowPriorityMessages()
+{
+	std::vector<OutputMessage_ptr>& queue = m_messageQueue[OUTPUT_PRIORITY_LOW];
+	for (const OutputMessage_ptr& msg : queue) {
+		m_queuedBytes -= msg->getMessageLength();
+	}
+	queue.clear();
+}
+
+int32_t Connection::getLowPriorityBacklog(int32_t sendBudget) const
+{
+	// at least one full message, so a burst on a fast link is not cut
+	int64_t backlog = std::max<int64_t>(NETWORKMESSAGE_MAXSIZE, m_sendRate * CONNECTION_LOW_PRIORITY_BACKLOG_TIME / 1000);
+	if (sendBudget > 0) {
+		backlog = std::min<int64_t>(backlog, sendBudget / 2);
+	}
+	return (int32_t)backlog;
+}
+
+void Connection::setCork(bool cork)
+{
+#ifdef TCP_CORK
+	if (g_config.getBoolean(ConfigManager::SOCKET_CORK)) {
+		boost::system::error_code error;
+		getHandle().set_option(boost::asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_CORK>(cork), error);
+	}
+#endif
+}
+
+int32_t Connection::getUnsentBytes()
+{
+#ifdef SIOCOUTQ
+	int value;
+	if (ioctl(getHandle().native_handle(), SIOCOUTQ, &value) == 0) {
+		return value;
+	}
+#endif
+	return -1;
+}
+
+void Connection::updateSendRate()
+{
+	//a write completes as soon as the kernel took the bytes, so the rate is
+	//taken from how fast the socket buffer drains to the client
+	const int64_t now = OTSYS_STEADY_TIME();
+	const int32_t unsentBytes = getUnsentBytes();
+
+	if (unsentBytes < 0) {
+		//only a write that had to wait for the client tells its speed
+		int64_t elapsed = now - m_writeStart;
+		if (elapsed >= CONNECTION_BLOCKED_WRITE_TIME) {
+			m_sendRate = (m_sendRate * 3 + (int64_t)m_writeBytes * 1000 / elapsed) / 4;
+		}
+		return;
+	}
+
+	//the drain is measured from the last sample when the buffer stayed
+	//filled since then, otherwise from the start of this write
+	int64_t sampleStart = (m_unsentBytes > 0 ? m_sampleTime : m_writeStart);
+	int64_t drainedBytes = (int64_t)m_unsentBytes + m_writeBytes - unsentBytes;
+
+	//when the buffer ran empty the client kept up and the rate says nothing
+	if (unsentBytes > 0) {
+		int64_t elapsed = std::max<int64_t>(1, now - sampleStart);
+		m_sendRate = (m_sendRate * 3 + std::max<int64_t>(0, drainedBytes) * 1000 / elapsed) / 4;
+	}
+
+	m_unsentBytes = unsentBytes;
+	m_sampleTime = now;
+}
+
 uint32_t Connection::getIP() const
 {
 	//Ip is expressed in network byte order
@@ -389,16 +589,22 @@ uint32_t Connection::getIP() const
 	return htonl(endpoint.address().to_v4().to_ulong());
 }
 
-void Connection::onWriteOperation(OutputMessage_ptr msg, const boost::system::error_code& error)
+void Connection::onWriteOperation(const boost::system::error_code& error)
 {
 	m_connectionLock.lock();
 	m_writeTimer.cancel();
 
-	msg.reset();
+	m_writeBatch.clear();
+
+	// uncorked after every write, so its tail is not held back while the next batch is gathered
+	setCork(false);
 
 	if (error) {
 		handleWriteError(error);
+	} else {
+		updateSendRate();
 	}
+	m_writeBytes = 0;
 
 	if (m_connectionState != CONNECTION_STATE_OPEN || m_writeError) {
 		closeSocket();
@@ -407,7 +613,13 @@ void Connection::onWriteOperation(OutputMessage_ptr msg, const boost::system::er
 		return;
 	}
 
-	--m_pendingWrite;
+	if (hasQueuedMessages()) {
+		//the write stays pending, messages queued meanwhile are written right away
+		writeQueuedMessages();
+	} else {
+		--m_pendingWrite;
+	}
+
 	m_connectionLock.unlock();
 }
 
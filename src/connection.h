@@ -22,20 +22,33 @@
 
 #include "definitions.h"
 
+#include <atomic>
 #include <set>
+#include <vector>
 
 #include <boost/asio.hpp>
 
 #include <boost/utility.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/enable_shared_from_this.hpp>
 
-#include "networkmessage.h"
+#include "inputmessage.h"
+
+// low priority messages are dropped once the bytes waiting for a client
+// exceed what it received in this many milliseconds at its recent send rate
+#define CONNECTION_LOW_PRIORITY_BACKLOG_TIME 250
+
+// without a way to read the unsent bytes of a socket, only writes that took
+// at least this many milliseconds are used to measure the send rate
+#define CONNECTION_BLOCKED_WRITE_TIME 10
 
 class Protocol;
 class OutputMessage;
-typedef boost::shared_ptr<OutputMessage> OutputMessage_ptr;
+void intrusive_ptr_add_ref(OutputMessage* msg);
+void intrusive_ptr_release(OutputMessage* msg);
+typedef boost::intrusive_ptr<OutputMessage> OutputMessage_ptr;
 class Connection;
 typedef boost::shared_ptr<Connection> Connection_ptr;
 class ServiceBase;
@@ -98,6 +111,12 @@ class Connection : public boost::enable_shared_from_this<Connection>, boost::non
 			m_protocol = nullptr;
 			m_pendingWrite = 0;
 			m_pendingRead = 0;
+			m_queuedBytes = 0;
+			m_writeBytes = 0;
+			m_writeStart = 0;
+			m_sendRate = 0;
+			m_unsentBytes = 0;
+			m_sampleTime = 0;
 			m_connectionState = CONNECTION_STATE_OPEN;
 			m_receivedFirst = false;
 			m_writeError = false;
@@ -142,7 +161,7 @@ class Connection : public boost::enable_shared_from_this<Connection>, boost::non
 		void parseHeader(const boost::system::error_code& error);
 		void parsePacket(const boost::system::error_code& error);
 
-		void onWriteOperation(OutputMessage_ptr msg, const boost::system::error_code& error);
+		void onWriteOperation(const boost::system::error_code& error);
 
 		void onStopOperation();
 		void handleReadError(const boost::system::error_code& error);
@@ -158,9 +177,25 @@ class Connection : public boost::enable_shared_from_this<Connection>, boost::non
 		void onReadTimeout();
 		void onWriteTimeout();
 
-		void internalSend(OutputMessage_ptr msg);
-
-		NetworkMessage m_msg;
+		void internalSend();
+		void onSendOperation();
+		void writeQueuedMessages();
+		bool hasQueuedMessages() const;
+		void dropLowPriorityMessages();
+		int32_t getLowPriorityBacklog(int32_t sendBudget) const;
+		void setCork(bool cork);
+		int32_t getUnsentBytes();
+		void updateSendRate();
+
+		// size of the packet being read and the packet itself, each packet
+		// gets its own buffer that is passed on to the game tasks
+		uint8_t m_msgHeader[NetworkMessage::header_length];
+		InputMessage_ptr m_msg;
+		// messages handed to the connection by priority, written together by the next write
+		std::vector<OutputMessage_ptr> m_messageQueue[OUTPUT_PRIORITY_LAST];
+		// messages of the write in progress and their buffers
+		std::vector<OutputMessage_ptr> m_writeBatch;
+		std::vector<boost::asio::const_buffer> m_writeBuffers;
 		boost::asio::ip::tcp::socket* m_socket;
 		boost::asio::deadline_timer m_readTimer;
 		boost::asio::deadline_timer m_writeTimer;
@@ -172,8 +207,18 @@ class Connection : public boost::enable_shared_from_this<Connection>, boost::non
 
 		int32_t m_pendingWrite;
 		int32_t m_pendingRead;
+		// bytes waiting in the queue and in the write in progress
+		int32_t m_queuedBytes;
+		int32_t m_writeBytes;
+		int64_t m_writeStart;
+		// bytes per second the recent writes were received at
+		int64_t m_sendRate;
+		// bytes left in the socket buffer when the send rate was last sampled
+		int32_t m_unsentBytes;
+		int64_t m_sampleTime;
 		ConnectionState_t m_connectionState;
-		uint32_t m_refCount;
+		// taken by output messages on the network threads, released on the dispatcher
+		std::atomic<uint32_t> m_refCount;
 		static bool m_logError;
 		boost::recursive_mutex m_connectionLock;
 
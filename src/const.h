@@ -24,6 +24,16 @@
 
 #define NETWORKMESSAGE_MAXSIZE 24590
 
+// lanes of the outbound messages of a connection, a lower lane is written
+// after the ones above it and its messages are dropped first when the client
+// does not keep up
+enum OutputPriority_t {
+	OUTPUT_PRIORITY_HIGH = 0, // movement, health and everything else changing the game state
+	OUTPUT_PRIORITY_CHAT = 1,
+	OUTPUT_PRIORITY_LOW = 2, // visual effects
+	OUTPUT_PRIORITY_LAST /* this must be the last one */
+};
+
 enum MagicEffectClasses {
 	NM_ME_FIRST			= 0x00,
 	NM_ME_DRAW_BLOOD		= NM_ME_FIRST,
@@ -352,7 +352,7 @@ void Creature::addEventWalk(bool firstStep)
 	}
 
 	eventWalk = g_scheduler.addEvent(createSchedulerTask(
-	                                     std::max<int64_t>(SCHEDULER_MINTICKS, ticks), boost::bind(&Game::checkCreatureWalk, &g_game, getID())));
+	                                     std::max<int64_t>(SCHEDULER_MINTICKS, ticks), boost::bind(&Game::checkCreatureWalk, &g_game, getID())), TASK_ORIGIN_CREATURE_WALK);
 }
 
 void Creature::stopEventWalk()
@@ -986,7 +986,7 @@ void Creature::goToFollowCreature()
 				startAutoWalk(listWalkDir);
 			}
 		} else {
-			if (g_game.getPathToEx(this, followCreature->getPosition(), listWalkDir, fpp)) {
+			if (g_game.getPathToCreature(this, followCreature, listWalkDir, fpp)) {
 				hasFollowPath = true;
 				startAutoWalk(listWalkDir);
 			} else {
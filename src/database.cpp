@@ -25,6 +25,9 @@
 #include <string>
 
 #include <errmsg.h>
+#include <mysqld_error.h>
+
+#include <boost/thread/locks.hpp>
 
 extern ConfigManager g_config;
 
@@ -214,6 +217,11 @@ void Database::freeResult(DBResult* res)
 	delete res;
 }
 
+void Database::freeResult(DBStatementResult* res)
+{
+	delete res;
+}
+
 DBResult* Database::verifyResult(DBResult* result)
 {
 	if (!result->next()) {
@@ -295,6 +303,250 @@ bool DBResult::next()
 	return m_row != nullptr;
 }
 
+const DBStatementResult::Value* DBStatementResult::getValue(uint32_t column) const
+{
+	if (column >= m_columnCount) {
+		std::cout << "[Error - DBStatementResult::getValue] Column " << column << " does not exist in result set." << std::endl;
+		return nullptr;
+	}
+	return &m_values[m_offset + column];
+}
+
+std::string DBStatementResult::getDataString(uint32_t column) const
+{
+	const Value* value = getValue(column);
+	if (!value) {
+		return std::string();
+	}
+
+	if (value->isNumber) {
+		return boost::lexical_cast<std::string>(value->number);
+	}
+	return value->data;
+}
+
+const char* DBStatementResult::getDataStream(uint32_t column, unsigned long& size) const
+{
+	const Value* value = getValue(column);
+	if (!value || value->isNumber) {
+		size = 0;
+		return nullptr;
+	}
+
+	size = value->data.length();
+	return value->data.data();
+}
+
+bool DBStatementResult::next()
+{
+	if (m_offset + m_columnCount >= m_values.size()) {
+		return false;
+	}
+
+	m_offset += m_columnCount;
+	return true;
+}
+
+static bool isIntegerField(enum_field_types type)
+{
+	switch (type) {
+		case MYSQL_TYPE_TINY:
+		case MYSQL_TYPE_SHORT:
+		case MYSQL_TYPE_LONG:
+		case MYSQL_TYPE_LONGLONG:
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_YEAR:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+DBStatement::~DBStatement()
+{
+	if (m_handle) {
+		mysql_stmt_close(m_handle);
+	}
+}
+
+bool DBStatement::prepare(Database* db)
+{
+	m_handle = mysql_stmt_init(db->m_handle);
+	if (!m_handle) {
+		std::cout << "[Error - mysql_stmt_init] Message: " << mysql_error(db->m_handle) << std::endl;
+		return false;
+	}
+
+	if (mysql_stmt_prepare(m_handle, m_query.c_str(), m_query.length()) != 0) {
+		std::cout << "[Error - mysql_stmt_prepare] Query: " << m_query << std::endl << "Message: " << mysql_stmt_error(m_handle) << std::endl;
+		mysql_stmt_close(m_handle);
+		m_handle = nullptr;
+		return false;
+	}
+
+	// string columns are read into buffers sized after the longest value
+	my_bool updateMaxLength = true;
+	mysql_stmt_attr_set(m_handle, STMT_ATTR_UPDATE_MAX_LENGTH, &updateMaxLength);
+	return true;
+}
+
+bool DBStatement::execute(Database* db, const DBParams& params)
+{
+	for (uint32_t tries = 0; tries < 2; ++tries) {
+		if (!m_handle && !prepare(db)) {
+			return false;
+		}
+
+		if (mysql_stmt_param_count(m_handle) != params.size()) {
+			std::cout << "[Error - DBStatement::execute] Query: " << m_query << std::endl << "Message: " << params.size() << " parameters given, " << mysql_stmt_param_count(m_handle) << " expected." << std::endl;
+			return false;
+		}
+
+		std::vector<MYSQL_BIND> binds(params.size());
+		std::vector<unsigned long> lengths(params.size());
+		for (size_t i = 0; i < params.size(); ++i) {
+			const DBParam& param = params[i];
+			MYSQL_BIND& bind = binds[i];
+			if (param.isString) {
+				lengths[i] = param.data.length();
+				bind.buffer_type = MYSQL_TYPE_STRING;
+				bind.buffer = const_cast<char*>(param.data.data());
+				bind.buffer_length = lengths[i];
+				bind.length = &lengths[i];
+			} else {
+				bind.buffer_type = MYSQL_TYPE_LONGLONG;
+				bind.buffer = const_cast<int64_t*>(&param.number);
+			}
+		}
+
+		if ((binds.empty() || mysql_stmt_bind_param(m_handle, &binds[0]) == 0) && mysql_stmt_execute(m_handle) == 0) {
+			return true;
+		}
+
+		unsigned int error = mysql_stmt_errno(m_handle);
+		bool staleHandle = error == ER_UNKNOWN_STMT_HANDLER || error == CR_NO_PREPARE_STMT;
+		if (!staleHandle || tries != 0) {
+			std::cout << "[Error - mysql_stmt_execute] Query: " << m_query << std::endl << "Message: " << mysql_stmt_error(m_handle) << std::endl;
+		}
+
+		mysql_stmt_close(m_handle);
+		m_handle = nullptr;
+
+		if (error == CR_SERVER_LOST || error == CR_SERVER_GONE_ERROR) {
+			db->m_connected = false;
+		}
+
+		// a reconnect drops the prepared statements, prepare it once more
+		if (!staleHandle) {
+			return false;
+		}
+	}
+	return false;
+}
+
+bool DBStatement::executeQuery(const DBParams& params/* = DBParams()*/)
+{
+	Database* db = Database::getInstance();
+	if (!db->isConnected()) {
+		return false;
+	}
+
+	boost::lock_guard<boost::recursive_mutex> lockClass(db->database_lock);
+	if (!execute(db, params)) {
+		return false;
+	}
+
+	mysql_stmt_free_result(m_handle);
+	return true;
+}
+
+DBStatementResult* DBStatement::storeQuery(const DBParams& params/* = DBParams()*/)
+{
+	Database* db = Database::getInstance();
+	if (!db->isConnected()) {
+		return nullptr;
+	}
+
+	boost::lock_guard<boost::recursive_mutex> lockClass(db->database_lock);
+	if (!execute(db, params)) {
+		return nullptr;
+	}
+
+	if (mysql_stmt_store_result(m_handle) != 0) {
+		std::cout << "[Error - mysql_stmt_store_result] Query: " << m_query << std::endl << "Message: " << mysql_stmt_error(m_handle) << std::endl;
+		mysql_stmt_free_result(m_handle);
+		return nullptr;
+	}
+
+	MYSQL_RES* metadata = mysql_stmt_result_metadata(m_handle);
+	if (!metadata) {
+		std::cout << "[Error - DBStatement::storeQuery] Query: " << m_query << std::endl << "Message: the statement has no result set." << std::endl;
+		mysql_stmt_free_result(m_handle);
+		return nullptr;
+	}
+
+	uint32_t columnCount = mysql_num_fields(metadata);
+	MYSQL_FIELD* fields = mysql_fetch_fields(metadata);
+
+	std::vector<MYSQL_BIND> binds(columnCount);
+	std::vector<int64_t> numbers(columnCount);
+	std::vector<std::string> buffers(columnCount);
+	std::vector<unsigned long> lengths(columnCount);
+	std::vector<my_bool> nulls(columnCount);
+	for (uint32_t i = 0; i < columnCount; ++i) {
+		MYSQL_BIND& bind = binds[i];
+		bind.length = &lengths[i];
+		bind.is_null = &nulls[i];
+
+		if (isIntegerField(fields[i].type)) {
+			bind.buffer_type = MYSQL_TYPE_LONGLONG;
+			bind.buffer = &numbers[i];
+			bind.is_unsigned = (fields[i].flags & UNSIGNED_FLAG) != 0;
+		} else {
+			buffers[i].resize(std::max<unsigned long>(1, fields[i].max_length));
+			bind.buffer_type = MYSQL_TYPE_BLOB;
+			bind.buffer = &buffers[i][0];
+			bind.buffer_length = buffers[i].size();
+		}
+	}
+
+	DBStatementResult* result = new DBStatementResult(columnCount);
+	if (mysql_stmt_bind_result(m_handle, &binds[0]) == 0) {
+		int ret;
+		while ((ret = mysql_stmt_fetch(m_handle)) == 0) {
+			size_t offset = result->m_values.size();
+			result->m_values.resize(offset + columnCount);
+
+			for (uint32_t i = 0; i < columnCount; ++i) {
+				DBStatementResult::Value& value = result->m_values[offset + i];
+				if (binds[i].buffer_type == MYSQL_TYPE_LONGLONG) {
+					value.number = nulls[i] ? 0 : numbers[i];
+					value.isNumber = true;
+				} else if (!nulls[i]) {
+					value.data.assign(buffers[i], 0, lengths[i]);
+				}
+			}
+		}
+
+		if (ret != MYSQL_NO_DATA) {
+			std::cout << "[Error - mysql_stmt_fetch] Query: " << m_query << std::endl << "Message: " << mysql_stmt_error(m_handle) << std::endl;
+			result->m_values.clear();
+		}
+	} else {
+		std::cout << "[Error - mysql_stmt_bind_result] Query: " << m_query << std::endl << "Message: " << mysql_stmt_error(m_handle) << std::endl;
+	}
+
+	mysql_free_result(metadata);
+	mysql_stmt_free_result(m_handle);
+
+	if (result->m_values.empty()) {
+		db->freeResult(result);
+		return nullptr;
+	}
+	return result;
+}
+
 void DBInsert::setQuery(const std::string& query)
 {
 	m_query = query;
@@ -342,6 +594,12 @@ bool DBInsert::execute()
 		return true;
 	}
 
+	if (m_queries) {
+		m_queries->push_back(m_query + m_buf);
+		m_buf.clear();
+		return true;
+	}
+
 	// executes buffer
 	bool res = Database::getInstance()->executeQuery(m_query + m_buf);
 	m_buf.clear();
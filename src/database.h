@@ -23,13 +23,16 @@
 #include "definitions.h"
 
 #include <iostream>
+#include <vector>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/utility.hpp>
 
 #include <mysql.h>
 
 class DBResult;
+class DBStatementResult;
 
 class Database
 {
@@ -112,6 +115,7 @@ class Database
 		* @param DBResult* resource to be freed
 		*/
 		void freeResult(DBResult* res);
+		void freeResult(DBStatementResult* res);
 
 		/**
 		 * Retrieve id of last inserted row
@@ -131,6 +135,18 @@ class Database
 			return mysql_get_client_info();
 		}
 
+		/**
+		* Thread registration.
+		*
+		* Every thread other than the main one has to call initThread before it uses a connection and endThread before it exits.
+		*/
+		static void initThread() {
+			mysql_thread_init();
+		}
+		static void endThread() {
+			mysql_thread_end();
+		}
+
 	protected:
 		/**
 		* Transaction related methods.
@@ -156,6 +172,8 @@ class Database
 		bool m_connected;
 
 	friend class DBTransaction;
+	friend class DatabaseTasks;
+	friend class DBStatement;
 };
 
 class DBResult
@@ -202,12 +220,135 @@ class DBResult
 	friend class Database;
 };
 
+/**
+ * Parameter of a prepared statement, bound to its ? in the order given.
+ */
+struct DBParam {
+	DBParam(int64_t _number) : number(_number), isString(false) {}
+	DBParam(const std::string& _data) : number(0), data(_data), isString(true) {}
+
+	int64_t number;
+	std::string data;
+	bool isString;
+};
+
+typedef std::vector<DBParam> DBParams;
+
+/**
+ * Result of a prepared statement.
+ *
+ * The rows arrive in the binary protocol and are copied out of the statement, integer
+ * columns as numbers. Columns are addressed by their position in the SELECT list.
+ */
+class DBStatementResult
+{
+	public:
+		template<typename T>
+		T getNumber(uint32_t column) const
+		{
+			const Value* value = getValue(column);
+			if (!value) {
+				return static_cast<T>(0);
+			}
+
+			if (value->isNumber) {
+				return static_cast<T>(value->number);
+			}
+
+			T data;
+			try {
+				data = boost::lexical_cast<T>(value->data);
+			} catch (boost::bad_lexical_cast&) {
+				data = 0;
+			}
+			return data;
+		}
+
+		int32_t getDataInt(uint32_t column) const {
+			return getNumber<int32_t>(column);
+		}
+		std::string getDataString(uint32_t column) const;
+		const char* getDataStream(uint32_t column, unsigned long& size) const;
+
+		bool next();
+
+	protected:
+		DBStatementResult(uint32_t columnCount) : m_columnCount(columnCount), m_offset(0) {}
+		~DBStatementResult() {}
+
+		struct Value {
+			Value() : number(0), isNumber(false) {}
+
+			int64_t number;
+			std::string data;
+			bool isNumber;
+		};
+
+		const Value* getValue(uint32_t column) const;
+
+	private:
+		std::vector<Value> m_values;
+		uint32_t m_columnCount;
+		size_t m_offset;
+
+	friend class Database;
+	friend class DBStatement;
+};
+
+/**
+ * Prepared statement on the main connection.
+ *
+ * It is prepared when it first runs and again after the connection dropped it.
+ */
+class DBStatement : boost::noncopyable
+{
+	public:
+		/**
+		* Creates a prepared statement.
+		*
+		* @param std::string query with a ? for each parameter
+		*/
+		DBStatement(const std::string& query) : m_query(query), m_handle(nullptr) {}
+		~DBStatement();
+
+		/**
+		* Executes command.
+		*
+		* @param DBParams parameters, one for each ?
+		* @return true on success, false on error
+		*/
+		bool executeQuery(const DBParams& params = DBParams());
+
+		/**
+		* Queries database.
+		*
+		* @param DBParams parameters, one for each ?
+		* @return results object (nullptr on error or when no row was found)
+		*/
+		DBStatementResult* storeQuery(const DBParams& params = DBParams());
+
+	private:
+		// the database lock has to be held
+		bool prepare(Database* db);
+		bool execute(Database* db, const DBParams& params);
+
+		std::string m_query;
+		MYSQL_STMT* m_handle;
+};
+
 /**
  * INSERT statement.
  */
 class DBInsert
 {
 	public:
+		/**
+		* Creates an INSERT statement.
+		*
+		* @param std::vector<std::string>* when set, the statements are collected in it instead of being executed
+		*/
+		DBInsert(std::vector<std::string>* queries = nullptr) : m_queries(queries) {}
+
 		/**
 		* Sets query prototype.
 		*
@@ -234,6 +375,7 @@ class DBInsert
 	protected:
 		std::string m_query;
 		std::string m_buf;
+		std::vector<std::string>* m_queries;
 };
 
 class DBTransaction
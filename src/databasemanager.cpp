@@ -28,6 +28,7 @@
 #include "ban.h"
 
 #include "configmanager.h"
+#include "iologindata.h"
 extern ConfigManager g_config;
 
 bool DatabaseManager::optimizeTables()
@@ -265,6 +266,60 @@ void DatabaseManager::checkEncryption()
 	registerDatabaseConfig("encryption", currentValue);
 }
 
+void DatabaseManager::checkItemStorage()
+{
+	std::string currentValue = g_config.getBoolean(ConfigManager::PLAYER_ITEM_BLOBS) ? "blobs" : "rows";
+
+	// databases from before the blobs only have rows
+	std::string oldValue;
+	bool registered = getDatabaseConfig("item_storage", oldValue);
+	if (!registered) {
+		oldValue = "rows";
+	}
+
+	if (currentValue == oldValue) {
+		if (!registered) {
+			registerDatabaseConfig("item_storage", currentValue);
+		}
+		return;
+	}
+
+	std::cout << "> Converting player items to " << currentValue << "..." << std::endl;
+
+	Database* db = Database::getInstance();
+	DBResult* result = db->storeQuery("SELECT `id` FROM `players`");
+
+	uint32_t playerCount = 0, failedCount = 0;
+	uint64_t itemCount = 0, blobBytes = 0;
+	int64_t startTime = OTSYS_STEADY_TIME_US();
+	if (result) {
+		do {
+			uint32_t guid = result->getDataInt("id");
+			if (IOLoginData::getInstance()->convertPlayerItems(guid, currentValue == "blobs", itemCount, blobBytes)) {
+				++playerCount;
+			} else {
+				++failedCount;
+			}
+		} while (result->next());
+		db->freeResult(result);
+	}
+	int64_t duration = OTSYS_STEADY_TIME_US() - startTime;
+
+	std::cout << "> Converted " << itemCount << " items (" << blobBytes << " bytes of blobs) of " << playerCount << " players in " << duration / 1000 << " ms";
+	if (playerCount != 0) {
+		std::cout << ", " << duration / playerCount << " us per player";
+	}
+	std::cout << '.' << std::endl;
+
+	// players that failed keep their items where they were and are tried again next time
+	if (failedCount != 0) {
+		std::cout << "> WARNING: The items of " << failedCount << " players could not be converted." << std::endl;
+		return;
+	}
+
+	registerDatabaseConfig("item_storage", currentValue);
+}
+
 void DatabaseManager::checkTriggers()
 {
 	//
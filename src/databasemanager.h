@@ -48,6 +48,7 @@ class DatabaseManager
 		void registerDatabaseConfig(const std::string& config, const std::string& value);
 
 		void checkEncryption();
+		void checkItemStorage();
 		void checkTriggers();
 };
 #endif
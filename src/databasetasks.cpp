@@ -0,0 +1,165 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "otpch.h"
+
+#include "databasetasks.h"
+#include "database.h"
+#include "tasks.h"
+#include "stats.h"
+
+#include <iostream>
+
+DatabaseTasks::DatabaseTasks()
+{
+	m_startedThreads = 0;
+	m_connectedThreads = 0;
+	m_running = false;
+}
+
+bool DatabaseTasks::start(uint32_t connections)
+{
+	if (connections == 0) {
+		return true;
+	}
+
+	boost::unique_lock<boost::mutex> lockClass(m_taskLock);
+	m_running = true;
+	m_startedThreads = 0;
+	m_connectedThreads = 0;
+
+	for (uint32_t i = 0; i < connections; ++i) {
+		m_threads.create_thread(boost::bind(&DatabaseTasks::databaseThread, this, i + 1, connections));
+	}
+
+	// every thread opens its connection on its own, wait until all of them tried
+	while (m_startedThreads < connections) {
+		m_startSignal.wait(lockClass);
+	}
+
+	if (m_connectedThreads == 0) {
+		m_running = false;
+		lockClass.unlock();
+		m_threads.join_all();
+		return false;
+	}
+	return m_connectedThreads == connections;
+}
+
+void DatabaseTasks::shutdown()
+{
+	m_taskLock.lock();
+	bool wasRunning = m_running;
+	m_running = false;
+	m_taskLock.unlock();
+
+	if (!wasRunning) {
+		return;
+	}
+
+	m_taskSignal.notify_all();
+	m_threads.join_all();
+}
+
+void DatabaseTasks::addTask(const std::string& query, const DatabaseCallback& callback/* = DatabaseCallback()*/, bool store/* = false*/)
+{
+	DatabaseTask* task = new DatabaseTask(query, callback, store);
+
+	boost::unique_lock<boost::mutex> lockClass(m_taskLock);
+	if (!m_running) {
+		lockClass.unlock();
+		runTask(Database::getInstance(), *task);
+		delete task;
+		return;
+	}
+
+	m_taskList.push_back(task);
+	lockClass.unlock();
+
+	m_taskSignal.notify_one();
+}
+
+size_t DatabaseTasks::getTaskCount()
+{
+	boost::lock_guard<boost::mutex> lockClass(m_taskLock);
+	return m_taskList.size();
+}
+
+void DatabaseTasks::databaseThread(uint32_t index, uint32_t connections)
+{
+	// the connection is opened, used and closed on this thread only
+	Database::initThread();
+
+	Database* db = new Database();
+	bool connected = db->connect();
+	if (!connected) {
+		std::cout << "[Error - DatabaseTasks::start] Could not open connection " << index << " of " << connections << '.' << std::endl;
+	}
+
+	boost::unique_lock<boost::mutex> taskLockUnique(m_taskLock);
+	++m_startedThreads;
+	if (connected) {
+		++m_connectedThreads;
+	}
+	m_startSignal.notify_one();
+
+	while (connected) {
+		while (m_running && m_taskList.empty()) {
+			m_taskSignal.wait(taskLockUnique);
+		}
+
+		// the queue is run out before the threads stop
+		if (m_taskList.empty()) {
+			break;
+		}
+
+		DatabaseTask* task = m_taskList.front();
+		m_taskList.pop_front();
+		taskLockUnique.unlock();
+
+		runTask(db, *task);
+		delete task;
+
+		taskLockUnique.lock();
+	}
+	taskLockUnique.unlock();
+
+	delete db;
+	Database::endThread();
+}
+
+void DatabaseTasks::runTask(Database* db, const DatabaseTask& task)
+{
+	DBResult* result = nullptr;
+	bool success;
+	if (task.store) {
+		result = db->storeQuery(task.query);
+		success = result != nullptr;
+	} else {
+		success = db->executeQuery(task.query);
+	}
+
+	if (task.callback) {
+		Task* callbackTask = createTask(boost::bind(task.callback, result, success));
+		callbackTask->setStats(Stats::getInstance()->getOriginStats(TASK_ORIGIN_DATABASE));
+		g_dispatcher.addTask(callbackTask);
+	} else if (result) {
+		db->freeResult(result);
+	}
+}
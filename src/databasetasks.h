@@ -0,0 +1,84 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __OTSERV_DATABASETASKS_H__
+#define __OTSERV_DATABASETASKS_H__
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+#include <deque>
+#include <string>
+
+class Database;
+class DBResult;
+
+// called on the dispatcher, it owns the result (nullptr when the query
+// failed, stored nothing or was not a stored query)
+typedef boost::function<void(DBResult*, bool)> DatabaseCallback;
+
+struct DatabaseTask {
+	DatabaseTask(const std::string& _query, const DatabaseCallback& _callback, bool _store) :
+		query(_query), callback(_callback), store(_store) {}
+
+	std::string query;
+	DatabaseCallback callback;
+	bool store;
+};
+
+// Runs queries off the dispatcher. Every thread has a connection of its own,
+// so they neither wait for each other nor for Database::getInstance(); the
+// queries are not ordered against each other or against the main connection.
+class DatabaseTasks : boost::noncopyable
+{
+	public:
+		static DatabaseTasks* getInstance() {
+			static DatabaseTasks instance;
+			return &instance;
+		}
+
+		// false when a connection could not be opened
+		bool start(uint32_t connections);
+		// runs the remaining queries before the threads stop
+		void shutdown();
+
+		// without started threads the query runs right away on the main
+		// connection, the callback is still posted to the dispatcher
+		void addTask(const std::string& query, const DatabaseCallback& callback = DatabaseCallback(), bool store = false);
+		size_t getTaskCount();
+
+	protected:
+		DatabaseTasks();
+
+		void databaseThread(uint32_t index, uint32_t connections);
+		static void runTask(Database* db, const DatabaseTask& task);
+
+		boost::thread_group m_threads;
+		boost::mutex m_taskLock;
+		boost::condition_variable m_taskSignal;
+		boost::condition_variable m_startSignal;
+
+		std::deque<DatabaseTask*> m_taskList;
+		// threads that tried to open their connection and those that succeeded
+		uint32_t m_startedThreads;
+		uint32_t m_connectedThreads;
+		bool m_running;
+};
+
+#endif
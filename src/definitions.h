@@ -108,4 +108,16 @@ inline int64_t OTSYS_TIME()
 	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
+// Monotonic clock for measuring intervals, unaffected by wall clock adjustments
+inline int64_t OTSYS_STEADY_TIME()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Same clock in microseconds, for timing short pieces of work
+inline int64_t OTSYS_STEADY_TIME_US()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 #endif
@@ -201,6 +201,11 @@ class PropStream
 			return end - p;
 		}
 
+		// the unread part, valid while the buffer passed to init is
+		const char* getStream() const {
+			return p;
+		}
+
 		template <typename T>
 		inline bool GET_STRUCT(T* &ret) {
 			if (size() < (long)sizeof(T)) {
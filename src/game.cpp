@@ -36,6 +36,7 @@
 #include "commands.h"
 #include "creature.h"
 #include "player.h"
+#include "networkmessage.h"
 #include "monster.h"
 #include "game.h"
 #include "tile.h"
@@ -55,6 +56,9 @@
 #include "ioguild.h"
 #include "globalevent.h"
 #include "beds.h"
+#include "packetcapture.h"
+#include "savemanager.h"
+#include "databasetasks.h"
 
 extern ConfigManager g_config;
 extern Actions* g_actions;
@@ -83,6 +87,12 @@ Game::Game() :
 	stagesEnabled = false;
 	stateTime = OTSYS_TIME();
 
+	savePlayerIndex = 0;
+	saveHouseIndex = 0;
+	saveStartTime = 0;
+	saveId = 0;
+	saving = false;
+
 	for (int16_t i = 0; i < 3; i++) {
 		serverSaveMessage[i] = false;
 	}
@@ -115,14 +125,14 @@ void Game::start(ServiceManager* servicer)
 	services = servicer;
 
 	checkLightEvent = g_scheduler.addEvent(createSchedulerTask(EVENT_LIGHTINTERVAL,
-	                                       boost::bind(&Game::checkLight, this)));
+	                                       boost::bind(&Game::checkLight, this)), TASK_ORIGIN_CHECK_LIGHT);
 
 	checkCreatureLastIndex = 0;
 	checkCreatureEvent = g_scheduler.addEvent(createSchedulerTask(EVENT_CREATURE_THINK_INTERVAL,
-	                     boost::bind(&Game::checkCreatures, this)));
+	                     boost::bind(&Game::checkCreatures, this)), TASK_ORIGIN_CHECK_CREATURES);
 
 	checkDecayEvent = g_scheduler.addEvent(createSchedulerTask(EVENT_DECAYINTERVAL,
-	                                       boost::bind(&Game::checkDecay, this)));
+	                                       boost::bind(&Game::checkDecay, this)), TASK_ORIGIN_CHECK_DECAY);
 }
 
 GameState_t Game::getGameState() const
@@ -175,7 +185,7 @@ void Game::setGameState(GameState_t newState)
 			}
 
 			saveMotdNum();
-			saveGameState();
+			saveGameState(true);
 
 			g_dispatcher.addTask(
 				createTask(boost::bind(&Game::shutdown, this)));
@@ -206,28 +216,108 @@ void Game::setGameState(GameState_t newState)
 	}
 }
 
-void Game::saveGameState()
+void Game::saveGameState(bool wait/* = false*/)
 {
-	if (gameState == GAME_STATE_NORMAL) {
-		setGameState(GAME_STATE_MAINTAIN);
+	if (!saving) {
+		std::cout << "Saving server..." << std::endl;
+		saving = true;
+		saveStartTime = OTSYS_TIME();
+		++saveId;
+
+		savePlayerIds.clear();
+		for (const auto& it : players) {
+			savePlayerIds.push_back(it.first);
+		}
+
+		saveHouseIds.clear();
+		for (const auto& it : Houses::getInstance().getHouses()) {
+			saveHouseIds.push_back(it.second->getHouseId());
+		}
+
+		savePlayerIndex = 0;
+		saveHouseIndex = 0;
+
+		SaveEntry* entry = new SaveEntry();
+		map->saveHouseList(*entry);
+		SaveManager::getInstance()->addEntry(entry);
+
+		if (!wait) {
+			Task* task = createTask(boost::bind(&Game::saveGameStateTask, this, saveId));
+			task->setStats(Stats::getInstance()->getOriginStats(TASK_ORIGIN_SAVE));
+			g_dispatcher.addTask(task);
+			return;
+		}
 	}
 
-	stateTime = 0;
-	std::cout << "Saving server..." << std::endl;
-	IOLoginData* ioLoginData = IOLoginData::getInstance();
+	if (wait) {
+		stateTime = 0;
+		while (saveGameStateStep()) {}
+		SaveManager::getInstance()->flush();
+		stateTime = OTSYS_TIME() + STATE_TIME;
+	}
+}
 
-	for (const auto& it : players) {
-		it.second->loginPosition = it.second->getPosition();
-		ioLoginData->savePlayer(it.second);
+void Game::saveGameStateTask(uint32_t _saveId)
+{
+	// a save completed by saveGameState(true) leaves this task behind
+	if (!saving || _saveId != saveId) {
+		return;
 	}
 
-	map->saveMap();
-	ScriptEnvironment::saveGameState();
-	stateTime = OTSYS_TIME() + STATE_TIME;
+	if (saveGameStateStep()) {
+		Task* task = createTask(boost::bind(&Game::saveGameStateTask, this, saveId));
+		task->setStats(Stats::getInstance()->getOriginStats(TASK_ORIGIN_SAVE));
+		g_dispatcher.addTask(task);
+	}
+}
 
-	if (gameState == GAME_STATE_MAINTAIN) {
-		setGameState(GAME_STATE_NORMAL);
+bool Game::saveGameStateStep()
+{
+	SaveManager* saveManager = SaveManager::getInstance();
+	uint32_t snapshotsPerStep = std::max<int32_t>(1, g_config.getNumber(ConfigManager::SAVE_SNAPSHOTS_PER_STEP));
+
+	uint32_t saved = 0;
+	while (saved < snapshotsPerStep) {
+		if (savePlayerIndex < savePlayerIds.size()) {
+			// players that logged out since were saved on logout
+			Player* player = getPlayerByID(savePlayerIds[savePlayerIndex++]);
+			if (!player) {
+				continue;
+			}
+
+			player->loginPosition = player->getPosition();
+
+			SaveEntry* entry = new SaveEntry();
+			if (IOLoginData::getInstance()->buildPlayerSave(player, *entry, true)) {
+				saveManager->addEntry(entry);
+			} else {
+				std::cout << "[Error - Game::saveGameStateStep] Could not save player " << player->getName() << '.' << std::endl;
+				delete entry;
+			}
+		} else if (saveHouseIndex < saveHouseIds.size()) {
+			House* house = Houses::getInstance().getHouse(saveHouseIds[saveHouseIndex++]);
+			if (!house) {
+				continue;
+			}
+
+			SaveEntry* entry = new SaveEntry();
+			map->saveHouse(house, *entry);
+			saveManager->addEntry(entry);
+		} else {
+			SaveEntry* entry = new SaveEntry();
+			if (ScriptEnvironment::saveGameState(*entry)) {
+				saveManager->addEntry(entry);
+			} else {
+				delete entry;
+			}
+
+			saving = false;
+			std::cout << "> Saved " << savePlayerIds.size() << " players and " << saveHouseIds.size() << " houses in: " << (OTSYS_TIME() - saveStartTime) / (1000.) << " s, " << saveManager->getQueuedCount() << " left to write." << std::endl;
+			return false;
+		}
+		++saved;
 	}
+	return true;
 }
 
 void Game::loadGameState()
@@ -3777,10 +3867,13 @@ bool Game::internalCreatureSay(Creature* creature, SpeakClasses type, const std:
 	}
 
 	//send to client
+	NetworkMessage msg;
+	ProtocolGame::AddCreatureSpeak(msg, creature, type, text, 0, &destPos);
+
 	for (Creature* spectator : list) {
 		if (Player* tmpPlayer = spectator->getPlayer()) {
 			if (!ghostMode || tmpPlayer->canSeeCreature(creature)) {
-				tmpPlayer->sendCreatureSay(creature, type, text, &destPos);
+				tmpPlayer->sendSharedMessage(msg, OUTPUT_PRIORITY_CHAT);
 			}
 		}
 	}
@@ -3813,6 +3906,11 @@ bool Game::getPathToEx(const Creature* creature, const Position& targetPos, std:
 	return getPathToEx(creature, targetPos, dirList, fpp);
 }
 
+bool Game::getPathToCreature(const Creature* creature, const Creature* target, std::list<Direction>& dirList, const FindPathParams& fpp)
+{
+	return map->getPathToCreature(creature, target, dirList, fpp);
+}
+
 void Game::checkCreatureWalk(uint32_t creatureId)
 {
 	Creature* creature = getCreatureByID(creatureId);
@@ -3867,7 +3965,7 @@ void Game::removeCreatureCheck(Creature* creature)
 
 void Game::checkCreatures()
 {
-	checkCreatureEvent = g_scheduler.addEvent(createSchedulerTask(EVENT_CHECK_CREATURE_INTERVAL, boost::bind(&Game::checkCreatures, this)));
+	checkCreatureEvent = g_scheduler.addEvent(createSchedulerTask(EVENT_CHECK_CREATURE_INTERVAL, boost::bind(&Game::checkCreatures, this)), TASK_ORIGIN_CHECK_CREATURES);
 
 	Creature* creature;
 	std::vector<Creature*>::iterator it;
@@ -4273,9 +4371,12 @@ void Game::addCreatureHealth(const Creature* target)
 
 void Game::addCreatureHealth(const SpectatorVec& list, const Creature* target)
 {
+	NetworkMessage msg;
+	ProtocolGame::AddCreatureHealth(msg, target);
+
 	for (Creature* spectator : list) {
 		if (Player* tmpPlayer = spectator->getPlayer()) {
-			tmpPlayer->sendCreatureHealth(target);
+			tmpPlayer->sendSharedMessage(msg);
 		}
 	}
 }
@@ -4289,9 +4390,12 @@ void Game::addAnimatedText(const Position& pos, uint8_t textColor, const std::st
 
 void Game::addAnimatedText(const SpectatorVec& list, const Position& pos, uint8_t textColor, const std::string& text)
 {
+	NetworkMessage msg;
+	ProtocolGame::AddAnimatedText(msg, pos, textColor, text);
+
 	for (Creature* spectator : list) {
 		if (Player* tmpPlayer = spectator->getPlayer()) {
-			tmpPlayer->sendAnimatedText(pos, textColor, text);
+			tmpPlayer->sendSharedMessage(pos, msg, OUTPUT_PRIORITY_LOW);
 		}
 	}
 }
@@ -4313,9 +4417,12 @@ void Game::addMagicEffect(const SpectatorVec& list, const Position& pos, uint8_t
 		return;
 	}
 
+	NetworkMessage msg;
+	ProtocolGame::AddMagicEffect(msg, pos, effect);
+
 	for (Creature* spectator : list) {
 		if (Player* tmpPlayer = spectator->getPlayer()) {
-			tmpPlayer->sendMagicEffect(pos, effect);
+			tmpPlayer->sendSharedMessage(pos, msg, OUTPUT_PRIORITY_LOW);
 		}
 	}
 }
@@ -4338,9 +4445,12 @@ void Game::addDistanceEffect(const SpectatorVec& list, const Position& fromPos,
 		return;
 	}
 
+	NetworkMessage msg;
+	ProtocolGame::AddDistanceShoot(msg, fromPos, toPos, effect);
+
 	for (Creature* spectator : list) {
 		if (Player* tmpPlayer = spectator->getPlayer()) {
-			tmpPlayer->sendDistanceShoot(fromPos, toPos, effect);
+			tmpPlayer->sendSharedMessage(msg, OUTPUT_PRIORITY_LOW);
 		}
 	}
 }
@@ -4383,7 +4493,7 @@ void Game::internalDecayItem(Item* item)
 
 void Game::checkDecay()
 {
-	checkDecayEvent = g_scheduler.addEvent(createSchedulerTask(EVENT_DECAYINTERVAL, boost::bind(&Game::checkDecay, this)));
+	checkDecayEvent = g_scheduler.addEvent(createSchedulerTask(EVENT_DECAYINTERVAL, boost::bind(&Game::checkDecay, this)), TASK_ORIGIN_CHECK_DECAY);
 
 	size_t bucket = (lastBucket + 1) % EVENT_DECAY_BUCKETS;
 
@@ -4430,7 +4540,7 @@ void Game::checkDecay()
 
 void Game::checkLight()
 {
-	checkLightEvent = g_scheduler.addEvent(createSchedulerTask(EVENT_LIGHTINTERVAL, boost::bind(&Game::checkLight, this)));
+	checkLightEvent = g_scheduler.addEvent(createSchedulerTask(EVENT_LIGHTINTERVAL, boost::bind(&Game::checkLight, this)), TASK_ORIGIN_CHECK_LIGHT);
 
 	lightHour += lightHourDelta;
 
@@ -4507,6 +4617,10 @@ void Game::shutdown()
 {
 	std::cout << "Shutting down server..." << std::flush;
 
+	g_cryptoPool.shutdown();
+	g_databasePool.shutdown();
+	SaveManager::getInstance()->shutdown();
+	DatabaseTasks::getInstance()->shutdown();
 	g_scheduler.shutdown();
 	g_dispatcher.shutdown();
 	Spawns::getInstance()->clear();
@@ -4518,6 +4632,9 @@ void Game::shutdown()
 		services->stop();
 	}
 
+	PacketCapture::getInstance()->close();
+	Stats::getInstance()->stopWatchdog();
+
 	std::cout << " done!" << std::endl;
 }
 
@@ -4629,8 +4746,10 @@ void Game::autoSave()
 		return;
 	}
 
-	g_dispatcher.addTask(createTask(boost::bind(&Game::saveGameState, this)));
-	g_scheduler.addEvent(createSchedulerTask(autoSaveEachMinutes * 1000 * 60, boost::bind(&Game::autoSave, this)));
+	Task* task = createTask(boost::bind(&Game::saveGameState, this, false));
+	task->setStats(Stats::getInstance()->getOriginStats(TASK_ORIGIN_SAVE));
+	g_dispatcher.addTask(task);
+	g_scheduler.addEvent(createSchedulerTask(autoSaveEachMinutes * 1000 * 60, boost::bind(&Game::autoSave, this)), TASK_ORIGIN_SAVE);
 }
 
 void Game::prepareServerSave()
@@ -4638,15 +4757,15 @@ void Game::prepareServerSave()
 	if (!serverSaveMessage[0]) {
 		serverSaveMessage[0] = true;
 		broadcastMessage("Server is saving game in 5 minutes. Please logout.", MSG_STATUS_WARNING);
-		g_scheduler.addEvent(createSchedulerTask(120000, boost::bind(&Game::prepareServerSave, this)));
+		g_scheduler.addEvent(createSchedulerTask(120000, boost::bind(&Game::prepareServerSave, this)), TASK_ORIGIN_SAVE);
 	} else if (!serverSaveMessage[1]) {
 		serverSaveMessage[1] = true;
 		broadcastMessage("Server is saving game in 3 minutes. Please logout.", MSG_STATUS_WARNING);
-		g_scheduler.addEvent(createSchedulerTask(120000, boost::bind(&Game::prepareServerSave, this)));
+		g_scheduler.addEvent(createSchedulerTask(120000, boost::bind(&Game::prepareServerSave, this)), TASK_ORIGIN_SAVE);
 	} else if (!serverSaveMessage[2]) {
 		serverSaveMessage[2] = true;
 		broadcastMessage("Server is saving game in one minute. Please logout.", MSG_STATUS_WARNING);
-		g_scheduler.addEvent(createSchedulerTask(60000, boost::bind(&Game::prepareServerSave, this)));
+		g_scheduler.addEvent(createSchedulerTask(60000, boost::bind(&Game::prepareServerSave, this)), TASK_ORIGIN_SAVE);
 	} else {
 		serverSave();
 	}
@@ -4672,7 +4791,7 @@ void Game::serverSave()
 		}
 
 		//prepare for next serversave after 24 hours
-		g_scheduler.addEvent(createSchedulerTask(86100000, boost::bind(&Game::prepareServerSave, this)));
+		g_scheduler.addEvent(createSchedulerTask(86100000, boost::bind(&Game::prepareServerSave, this)), TASK_ORIGIN_SAVE);
 
 		//open server
 		setGameState(GAME_STATE_NORMAL);
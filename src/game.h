@@ -275,16 +275,10 @@ class Game
 			map->getSpectators(list, centerPos, multifloor, onlyPlayers, minRangeX, maxRangeX, minRangeY, maxRangeY);
 		}
 
-		const SpectatorVec& getSpectators(const Position& centerPos) {
+		SpectatorVec getSpectators(const Position& centerPos) {
 			return map->getSpectators(centerPos);
 		}
 
-		void clearSpectatorCache() {
-			if (map) {
-				map->clearSpectatorCache();
-			}
-		}
-
 		ReturnValue internalMoveCreature(Creature* creature, Direction direction, uint32_t flags = 0);
 		ReturnValue internalMoveCreature(Creature* creature, Cylinder* fromCylinder, Cylinder* toCylinder, uint32_t flags = 0);
 
@@ -453,6 +447,8 @@ class Game
 
 		bool getPathToEx(const Creature* creature, const Position& targetPos, std::list<Direction>& dirList, uint32_t minTargetDist, uint32_t maxTargetDist, bool fullPathSearch = true, bool clearSight = true, int32_t maxSearchDist = -1);
 
+		bool getPathToCreature(const Creature* creature, const Creature* target, std::list<Direction>& dirList, const FindPathParams& fpp);
+
 		void changeSpeed(Creature* creature, int32_t varSpeedDelta);
 		void internalCreatureChangeOutfit(Creature* creature, const Outfit_t& oufit);
 		void internalCreatureChangeVisible(Creature* creature, bool visible);
@@ -464,7 +460,12 @@ class Game
 
 		GameState_t getGameState() const;
 		void setGameState(GameState_t newState);
-		void saveGameState();
+		// saves in steps between the other dispatcher tasks, with wait the
+		// save is completed and written before this returns
+		void saveGameState(bool wait = false);
+		bool isSaving() const {
+			return saving;
+		}
 		void loadGameState();
 		void refreshMap();
 		void cleanMap() {
@@ -585,6 +586,18 @@ class Game
 
 		int64_t stateTime;
 
+		void saveGameStateTask(uint32_t _saveId);
+		bool saveGameStateStep();
+
+		// players and houses of the save in progress, the next ones to save at the indexes
+		std::vector<uint32_t> savePlayerIds;
+		std::vector<uint32_t> saveHouseIds;
+		size_t savePlayerIndex;
+		size_t saveHouseIndex;
+		int64_t saveStartTime;
+		uint32_t saveId;
+		bool saving;
+
 		uint32_t checkLightEvent;
 		uint32_t checkCreatureEvent;
 		uint32_t checkDecayEvent;
@@ -85,7 +85,7 @@ bool GlobalEvents::registerEvent(Event* event, const pugi::xml_node& node)
 			timerMap.insert(std::make_pair(globalEvent->getName(), globalEvent));
 			if (timerEventId == 0) {
 				timerEventId = g_scheduler.addEvent(createSchedulerTask(SCHEDULER_MINTICKS,
-				                                    boost::bind(&GlobalEvents::timer, this)));
+				                                    boost::bind(&GlobalEvents::timer, this)), TASK_ORIGIN_GLOBAL_EVENT);
 			}
 
 			return true;
@@ -102,7 +102,7 @@ bool GlobalEvents::registerEvent(Event* event, const pugi::xml_node& node)
 			thinkMap.insert(std::make_pair(globalEvent->getName(), globalEvent));
 			if (thinkEventId == 0) {
 				thinkEventId = g_scheduler.addEvent(createSchedulerTask(SCHEDULER_MINTICKS,
-				                                    boost::bind(&GlobalEvents::think, this)));
+				                                    boost::bind(&GlobalEvents::think, this)), TASK_ORIGIN_GLOBAL_EVENT);
 			}
 			return true;
 		}
@@ -158,7 +158,7 @@ void GlobalEvents::timer()
 
 	if (nextScheduledTime != std::numeric_limits<int64_t>::max()) {
 		timerEventId = g_scheduler.addEvent(createSchedulerTask(std::max<int64_t>(1000, nextScheduledTime * 1000),
-							                boost::bind(&GlobalEvents::timer, this)));
+							                boost::bind(&GlobalEvents::timer, this)), TASK_ORIGIN_GLOBAL_EVENT);
 	}
 }
 
@@ -193,7 +193,7 @@ void GlobalEvents::think()
 
 	if (nextScheduledTime != std::numeric_limits<int64_t>::max()) {
 		thinkEventId = g_scheduler.addEvent(createSchedulerTask(std::max<int64_t>(SCHEDULER_MINTICKS, nextScheduledTime),
-											boost::bind(&GlobalEvents::think, this)));
+											boost::bind(&GlobalEvents::think, this)), TASK_ORIGIN_GLOBAL_EVENT);
 	}
 }
 
@@ -0,0 +1,156 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __OTSERV_HISTOGRAM_H__
+#define __OTSERV_HISTOGRAM_H__
+
+#include <algorithm>
+#include <atomic>
+
+// every power of two is split into this many linear steps, so a recorded
+// value is off by at most 1 / (LATENCY_HISTOGRAM_SUB_BUCKETS / 2)
+#define LATENCY_HISTOGRAM_SUB_BUCKET_BITS 4
+#define LATENCY_HISTOGRAM_SUB_BUCKETS (1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS)
+
+// values up to 2^40 (about 12 days in microseconds) are tracked, larger ones are clamped
+#define LATENCY_HISTOGRAM_MAX_SHIFT (40 - LATENCY_HISTOGRAM_SUB_BUCKET_BITS)
+#define LATENCY_HISTOGRAM_BUCKETS ((LATENCY_HISTOGRAM_MAX_SHIFT + 2) * (LATENCY_HISTOGRAM_SUB_BUCKETS / 2))
+
+// Log-linear histogram in the spirit of HdrHistogram. Recording a value is
+// a couple of shifts and an increment, percentiles are computed on demand.
+// There may only be one thread recording into a histogram, but any thread
+// may read it while it does.
+class LatencyHistogram
+{
+	public:
+		LatencyHistogram() {
+			reset();
+		}
+
+		void reset() {
+			for (uint32_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; ++i) {
+				m_counts[i].store(0, std::memory_order_relaxed);
+			}
+
+			m_count.store(0, std::memory_order_relaxed);
+			m_total.store(0, std::memory_order_relaxed);
+			m_max.store(0, std::memory_order_relaxed);
+		}
+
+		void record(uint64_t value) {
+			// single writer, so plain loads and stores are enough
+			increment(m_counts[getBucketIndex(value)], 1);
+			increment(m_count, 1);
+			increment(m_total, value);
+			if (value > m_max.load(std::memory_order_relaxed)) {
+				m_max.store(value, std::memory_order_relaxed);
+			}
+		}
+
+		uint64_t getCount() const {
+			return m_count.load(std::memory_order_relaxed);
+		}
+		uint64_t getTotal() const {
+			return m_total.load(std::memory_order_relaxed);
+		}
+		uint64_t getMax() const {
+			return m_max.load(std::memory_order_relaxed);
+		}
+		uint64_t getMean() const {
+			uint64_t count = getCount();
+			return count != 0 ? getTotal() / count : 0;
+		}
+
+		// highest value below which the given percentage (0-100) of the values fall
+		uint64_t getPercentile(double percentile) const {
+			// the buckets are counted again, the total may be ahead of them while recording
+			uint64_t count = 0;
+			for (uint32_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; ++i) {
+				count += m_counts[i].load(std::memory_order_relaxed);
+			}
+
+			if (count == 0) {
+				return 0;
+			}
+
+			uint64_t target = static_cast<uint64_t>(count * percentile / 100.0 + 0.5);
+			if (target == 0) {
+				target = 1;
+			}
+
+			uint64_t max = getMax();
+			uint64_t seen = 0;
+			for (uint32_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; ++i) {
+				seen += m_counts[i].load(std::memory_order_relaxed);
+				if (seen >= target) {
+					return std::min<uint64_t>(getBucketHighestValue(i), max);
+				}
+			}
+			return max;
+		}
+
+	private:
+		LatencyHistogram(const LatencyHistogram&);
+		LatencyHistogram& operator=(const LatencyHistogram&);
+
+		static void increment(std::atomic<uint64_t>& counter, uint64_t value) {
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+
+		static uint32_t getHighestBit(uint64_t value) {
+#ifdef __GNUC__
+			return 63 - __builtin_clzll(value);
+#else
+			uint32_t bit = 0;
+			while (value >>= 1) {
+				++bit;
+			}
+			return bit;
+#endif
+		}
+
+		static uint32_t getBucketIndex(uint64_t value) {
+			if (value < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+				return static_cast<uint32_t>(value);
+			}
+
+			uint32_t shift = getHighestBit(value) - (LATENCY_HISTOGRAM_SUB_BUCKET_BITS - 1);
+			if (shift > LATENCY_HISTOGRAM_MAX_SHIFT) {
+				return LATENCY_HISTOGRAM_BUCKETS - 1;
+			}
+			return shift * (LATENCY_HISTOGRAM_SUB_BUCKETS / 2) + static_cast<uint32_t>(value >> shift);
+		}
+
+		static uint64_t getBucketHighestValue(uint32_t index) {
+			if (index < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+				return index;
+			}
+
+			uint32_t shift = index / (LATENCY_HISTOGRAM_SUB_BUCKETS / 2) - 1;
+			uint64_t top = index - shift * (LATENCY_HISTOGRAM_SUB_BUCKETS / 2);
+			return ((top + 1) << shift) - 1;
+		}
+
+		std::atomic<uint64_t> m_counts[LATENCY_HISTOGRAM_BUCKETS];
+		std::atomic<uint64_t> m_count;
+		std::atomic<uint64_t> m_total;
+		std::atomic<uint64_t> m_max;
+};
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "otpch.h"
+
+#include "inputmessage.h"
+#include "outputmessage.h"
+
+void intrusive_ptr_add_ref(InputMessage* msg)
+{
+	msg->m_refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void intrusive_ptr_release(InputMessage* msg)
+{
+	if (msg->m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		delete msg;
+	}
+}
+
+void* InputMessage::operator new(size_t size)
+{
+	return OutputMessagePool::allocateMessageBlock();
+}
+
+void InputMessage::operator delete(void* p, size_t size)
+{
+	OutputMessagePool::releaseMessageBlock(p);
+}
+
+InputMessage::InputMessage(uint8_t* buffer, int32_t bufferSize) :
+	BasicNetworkMessage(buffer, bufferSize)
+{
+	m_refCount = 0;
+}
+
+InputMessage::~InputMessage()
+{
+	OutputMessagePool::releaseBuffer(m_MsgBuf, m_bufferSize);
+}
+
+InputMessage_ptr InputMessage::create(int32_t bodySize)
+{
+	// reads are checked against the body plus the crypto header, keep the
+	// same room behind the body as a NetworkMessage would have
+	int32_t bufferSize;
+	uint8_t* buffer = OutputMessagePool::allocateBuffer(header_length + bodySize + crypto_length + xtea_multiple, bufferSize);
+	return InputMessage_ptr(new InputMessage(buffer, bufferSize));
+}
@@ -0,0 +1,82 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __OTSERV_INPUT_MESSAGE_H__
+#define __OTSERV_INPUT_MESSAGE_H__
+
+#include "networkmessage.h"
+
+#include <atomic>
+
+#include <boost/intrusive_ptr.hpp>
+#include <boost/utility.hpp>
+
+class InputMessage;
+void intrusive_ptr_add_ref(InputMessage* msg);
+void intrusive_ptr_release(InputMessage* msg);
+typedef boost::intrusive_ptr<InputMessage> InputMessage_ptr;
+
+// A packet read from a connection. Every packet gets its own buffer from the
+// output message pool, so the connection can read the next one while game
+// tasks still hold string views into this one.
+class InputMessage : public BasicNetworkMessage, boost::noncopyable
+{
+	public:
+		~InputMessage();
+
+		// the buffer holds a body of bodySize bytes after the header
+		static InputMessage_ptr create(int32_t bodySize);
+
+		static void* operator new(size_t size);
+		static void operator delete(void* p, size_t size);
+
+	protected:
+		InputMessage(uint8_t* buffer, int32_t bufferSize);
+
+		friend void intrusive_ptr_add_ref(InputMessage* msg);
+		friend void intrusive_ptr_release(InputMessage* msg);
+
+		// references held by InputMessage_ptr, the last one returns the buffer to the pool
+		std::atomic<uint32_t> m_refCount;
+};
+
+// Game task that keeps the message alive until the bound call has run, the
+// string views bound into the call point into its buffer.
+template<class FunctionType>
+class InputMessageTask
+{
+	public:
+		InputMessageTask(InputMessage& msg, const FunctionType& func) : m_msg(&msg), m_func(func) {}
+
+		void operator()() {
+			m_func();
+		}
+
+	protected:
+		InputMessage_ptr m_msg;
+		FunctionType m_func;
+};
+
+template<class FunctionType>
+inline InputMessageTask<FunctionType> keepInputMessage(InputMessage& msg, const FunctionType& func)
+{
+	return InputMessageTask<FunctionType>(msg, func);
+}
+
+#endif
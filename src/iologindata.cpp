@@ -20,6 +20,7 @@
 #include "otpch.h"
 
 #include "iologindata.h"
+#include "savemanager.h"
 #include <algorithm>
 #include <functional>
 #include "item.h"
@@ -31,33 +32,204 @@
 #include "vocation.h"
 #include "house.h"
 #include "ban.h"
+#include "stats.h"
 #include <iostream>
 #include <iomanip>
 
+#include <boost/functional/hash.hpp>
+
 extern ConfigManager g_config;
 extern Vocations g_vocations;
 extern Game g_game;
 
-Account IOLoginData::loadAccount(uint32_t accno)
+// columns of playerColumns, in order
+enum PlayerColumn_t {
+	PLAYERCOLUMN_ID,
+	PLAYERCOLUMN_NAME,
+	PLAYERCOLUMN_ACCOUNT_ID,
+	PLAYERCOLUMN_GROUP_ID,
+	PLAYERCOLUMN_SEX,
+	PLAYERCOLUMN_VOCATION,
+	PLAYERCOLUMN_EXPERIENCE,
+	PLAYERCOLUMN_LEVEL,
+	PLAYERCOLUMN_MAGLEVEL,
+	PLAYERCOLUMN_HEALTH,
+	PLAYERCOLUMN_HEALTHMAX,
+	PLAYERCOLUMN_BLESSINGS,
+	PLAYERCOLUMN_MANA,
+	PLAYERCOLUMN_MANAMAX,
+	PLAYERCOLUMN_MANASPENT,
+	PLAYERCOLUMN_SOUL,
+	PLAYERCOLUMN_LOOKBODY,
+	PLAYERCOLUMN_LOOKFEET,
+	PLAYERCOLUMN_LOOKHEAD,
+	PLAYERCOLUMN_LOOKLEGS,
+	PLAYERCOLUMN_LOOKTYPE,
+	PLAYERCOLUMN_LOOKADDONS,
+	PLAYERCOLUMN_POSX,
+	PLAYERCOLUMN_POSY,
+	PLAYERCOLUMN_POSZ,
+	PLAYERCOLUMN_CAP,
+	PLAYERCOLUMN_LASTLOGIN,
+	PLAYERCOLUMN_LASTLOGOUT,
+	PLAYERCOLUMN_LASTIP,
+	PLAYERCOLUMN_CONDITIONS,
+	PLAYERCOLUMN_SKULLTIME,
+	PLAYERCOLUMN_SKULL,
+	PLAYERCOLUMN_TOWN_ID,
+	PLAYERCOLUMN_BALANCE,
+	PLAYERCOLUMN_OFFLINETRAINING_TIME,
+	PLAYERCOLUMN_OFFLINETRAINING_SKILL,
+	PLAYERCOLUMN_STAMINA,
+	// the level and tries of each skill follow in skills_t order
+	PLAYERCOLUMN_SKILL_FIST
+};
+
+static const std::string playerColumns = "`id`, `name`, `account_id`, `group_id`, `sex`, `vocation`, `experience`, `level`, `maglevel`, `health`, `healthmax`, `blessings`, `mana`, `manamax`, `manaspent`, `soul`, `lookbody`, `lookfeet`, `lookhead`, `looklegs`, `looktype`, `lookaddons`, `posx`, `posy`, `posz`, `cap`, `lastlogin`, `lastlogout`, `lastip`, `conditions`, `skulltime`, `skull`, `town_id`, `balance`, `offlinetraining_time`, `offlinetraining_skill`, `stamina`, `skill_fist`, `skill_fist_tries`, `skill_club`, `skill_club_tries`, `skill_sword`, `skill_sword_tries`, `skill_axe`, `skill_axe_tries`, `skill_dist`, `skill_dist_tries`, `skill_shielding`, `skill_shielding_tries`, `skill_fishing`, `skill_fishing_tries`";
+
+// columns of the item tables, in order
+enum ItemColumn_t {
+	ITEMCOLUMN_PID,
+	ITEMCOLUMN_SID,
+	ITEMCOLUMN_ITEMTYPE,
+	ITEMCOLUMN_COUNT,
+	ITEMCOLUMN_ATTRIBUTES
+};
+
+// the rows of each item blob section
+static const char* itemTables[ITEMBLOB_LAST] = {
+	"player_items",
+	"player_depotitems",
+	"player_inboxitems"
+};
+
+// An item blob is a uint8 version and a uint32 item count, followed by the
+// uint32 pid (slot, depot id or 0 for the inbox, as in the rows) and the item
+// for each of them. An item is its uint16 type and uint16 count, the size and
+// bytes written by serializeAttr and a uint32 count of the items inside it,
+// which follow in container order.
+#define ITEMBLOB_VERSION 1
+
+// type, count, attributes size and item count
+#define ITEMBLOB_MIN_ITEM_SIZE 12
+
+static void serializeItemNode(PropWriteStream& propWriteStream, const Item* item)
 {
-	Account account;
+	propWriteStream.ADD_USHORT(item->getID());
+	propWriteStream.ADD_USHORT(item->getSubType());
 
-	Database* db = Database::getInstance();
+	PropWriteStream attributes;
+	item->serializeAttr(attributes);
 
-	std::ostringstream query;
-	query << "SELECT `id`, `name`, `password`, `type`, `premdays`, `lastday` FROM `accounts` WHERE `id` = " << accno;
+	uint32_t attributesSize;
+	const char* data = attributes.getStream(attributesSize);
+	propWriteStream.ADD_LSTRING(std::string(data, attributesSize));
 
-	DBResult* result = db->storeQuery(query.str());
+	const Container* container = item->getContainer();
+	if (!container) {
+		propWriteStream.ADD_ULONG(0);
+		return;
+	}
+
+	propWriteStream.ADD_ULONG(container->size());
+	for (const Item* subItem : container->getItemList()) {
+		serializeItemNode(propWriteStream, subItem);
+	}
+}
+
+// item is nullptr if its type no longer exists, the items inside it are dropped with it
+static bool unserializeItemNode(PropStream& propStream, Item*& item)
+{
+	item = nullptr;
+
+	uint16_t type, count;
+	uint32_t attributesSize;
+	if (!propStream.GET_USHORT(type) || !propStream.GET_USHORT(count) || !propStream.GET_ULONG(attributesSize)) {
+		return false;
+	}
+
+	PropStream attributes;
+	attributes.init(propStream.getStream(), attributesSize);
+
+	uint32_t itemCount;
+	if (!propStream.SKIP_N(attributesSize) || !propStream.GET_ULONG(itemCount) || itemCount > propStream.size() / ITEMBLOB_MIN_ITEM_SIZE) {
+		return false;
+	}
+
+	std::vector<Item*> subItems;
+	subItems.reserve(itemCount);
+	for (uint32_t i = 0; i < itemCount; ++i) {
+		Item* subItem;
+		if (!unserializeItemNode(propStream, subItem)) {
+			for (Item* it : subItems) {
+				delete it;
+			}
+			return false;
+		}
+
+		if (subItem) {
+			subItems.push_back(subItem);
+		}
+	}
+
+	item = Item::CreateItem(type, count);
+	if (item && !item->unserializeAttr(attributes)) {
+		std::cout << "WARNING: Serialize error in IOLoginData::unserializeItemBlob" << std::endl;
+	}
+
+	Container* container = item ? item->getContainer() : nullptr;
+	if (!container) {
+		for (Item* it : subItems) {
+			delete it;
+		}
+		return true;
+	}
+
+	// added to the front, so the last one goes first
+	for (std::vector<Item*>::reverse_iterator it = subItems.rbegin(); it != subItems.rend(); ++it) {
+		container->__internalAddThing(*it);
+	}
+	return true;
+}
+
+IOLoginData::IOLoginData() :
+	m_loadAccountStatement("SELECT `id`, `name`, `type`, `premdays`, `lastday` FROM `accounts` WHERE `id` = ?"),
+	m_accountByNameStatement("SELECT `id`, `name`, `password`, `type`, `premdays`, `lastday` FROM `accounts` WHERE `name` = ?"),
+	m_characterListStatement("SELECT `name`, `deletion` FROM `players` WHERE `account_id` = ?"),
+	m_characterStatement("SELECT `account_id`, `name`, `deletion` FROM `players` WHERE `name` = ?"),
+	m_preloadPlayerStatement("SELECT `players`.`id`, `account_id`, `group_id`, `deletion`, `accounts`.`type`, `accounts`.`premdays` FROM `players` INNER JOIN `accounts` ON `accounts`.`id` = `players`.`account_id` WHERE `players`.`name` = ?"),
+	m_loadPlayerByIdStatement("SELECT " + playerColumns + " FROM `players` WHERE `id` = ?"),
+	m_loadPlayerByNameStatement("SELECT " + playerColumns + " FROM `players` WHERE `name` = ?"),
+	m_loadGuildMembershipStatement("SELECT `guild_id`, `rank_id`, `nick` FROM `guild_membership` WHERE `player_id` = ?"),
+	m_loadSpellsStatement("SELECT `name` FROM `player_spells` WHERE `player_id` = ?"),
+	m_loadItemsStatement("SELECT `pid`, `sid`, `itemtype`, `count`, `attributes` FROM `player_items` WHERE `player_id` = ? ORDER BY `sid` DESC"),
+	m_loadDepotItemsStatement("SELECT `pid`, `sid`, `itemtype`, `count`, `attributes` FROM `player_depotitems` WHERE `player_id` = ? ORDER BY `sid` DESC"),
+	m_loadInboxItemsStatement("SELECT `pid`, `sid`, `itemtype`, `count`, `attributes` FROM `player_inboxitems` WHERE `player_id` = ? ORDER BY `sid` DESC"),
+	m_loadItemBlobsStatement("SELECT `section`, `data` FROM `player_itemblobs` WHERE `player_id` = ?"),
+	m_loadStorageStatement("SELECT `key`, `value` FROM `player_storage` WHERE `player_id` = ?"),
+	m_loadVipStatement("SELECT `player_id` FROM `account_viplist` WHERE `account_id` = ?"),
+	m_addOnlineStatement("INSERT INTO `players_online` VALUES (?)"),
+	m_removeOnlineStatement("DELETE FROM `players_online` WHERE `player_id` = ?")
+{
+	//
+}
+
+Account IOLoginData::loadAccount(uint32_t accno)
+{
+	Account account;
+
+	DBStatementResult* result = m_loadAccountStatement.storeQuery({accno});
 	if (!result) {
 		return account;
 	}
 
-	account.id = result->getDataInt("id");
-	account.name = result->getDataInt("name");
-	account.accountType = (AccountType_t)result->getDataInt("type");
-	account.premiumDays = result->getDataInt("premdays");
-	account.lastDay = result->getDataInt("lastday");
-	db->freeResult(result);
+	// id, name, type, premdays, lastday
+	account.id = result->getDataInt(0);
+	account.name = result->getDataInt(1);
+	account.accountType = (AccountType_t)result->getDataInt(2);
+	account.premiumDays = result->getDataInt(3);
+	account.lastDay = result->getDataInt(4);
+	Database::getInstance()->freeResult(result);
 	return account;
 }
 
@@ -72,33 +244,31 @@ bool IOLoginData::loginserverAuthentication(uint32_t name, const std::string& pa
 {
 	Database* db = Database::getInstance();
 
-	std::ostringstream query;
-	query << "SELECT `id`, `name`, `password`, `type`, `premdays`, `lastday` FROM `accounts` WHERE `name` = " << name;
-
-	DBResult* result = db->storeQuery(query.str());
+	// id, name, password, type, premdays, lastday
+	// the name column is text, a number would not use its index
+	DBStatementResult* result = m_accountByNameStatement.storeQuery({std::to_string(name)});
 	if (!result) {
 		return false;
 	}
 
-	if (!passwordTest(password, result->getDataString("password"))) {
+	if (!passwordTest(password, result->getDataString(2))) {
 		db->freeResult(result);
 		return false;
 	}
 
-	account.id = result->getDataInt("id");
-	account.name = result->getDataInt("name");
-	account.accountType = (AccountType_t)result->getDataInt("type");
-	account.premiumDays = result->getDataInt("premdays");
-	account.lastDay = result->getDataInt("lastday");
+	account.id = result->getDataInt(0);
+	account.name = result->getDataInt(1);
+	account.accountType = (AccountType_t)result->getDataInt(3);
+	account.premiumDays = result->getDataInt(4);
+	account.lastDay = result->getDataInt(5);
 	db->freeResult(result);
 
-	query.str("");
-	query << "SELECT `name`, `deletion` FROM `players` WHERE `account_id` = " << account.id;
-	result = db->storeQuery(query.str());
+	// name, deletion
+	result = m_characterListStatement.storeQuery({account.id});
 	if (result) {
 		do {
-			if (result->getDataInt("deletion") == 0) {
-				account.charList.push_back(result->getDataString("name"));
+			if (result->getDataInt(1) == 0) {
+				account.charList.push_back(result->getDataString(0));
 			}
 		} while (result->next());
 		db->freeResult(result);
@@ -112,34 +282,31 @@ uint32_t IOLoginData::gameworldAuthentication(uint32_t accountName, const std::s
 {
 	Database* db = Database::getInstance();
 
-	std::ostringstream query;
-	query << "SELECT `id`, `password` FROM `accounts` WHERE `name` = " << accountName;
-
-	DBResult* result = db->storeQuery(query.str());
+	// id, name, password, type, premdays, lastday
+	DBStatementResult* result = m_accountByNameStatement.storeQuery({std::to_string(accountName)});
 	if (!result) {
 		return 0;
 	}
 
-	if (!passwordTest(password, result->getDataString("password"))) {
+	if (!passwordTest(password, result->getDataString(2))) {
 		db->freeResult(result);
 		return 0;
 	}
 
-	uint32_t accountId = result->getDataInt("id");
+	uint32_t accountId = result->getDataInt(0);
 	db->freeResult(result);
 
-	query.str("");
-	query << "SELECT `account_id`, `name`, `deletion` FROM `players` WHERE `name` = " << db->escapeString(characterName);
-	result = db->storeQuery(query.str());
+	// account_id, name, deletion
+	result = m_characterStatement.storeQuery({characterName});
 	if (!result) {
 		return 0;
 	}
 
-	if ((uint32_t)result->getDataInt("account_id") != accountId || result->getDataInt("deletion") != 0) {
+	if ((uint32_t)result->getDataInt(0) != accountId || result->getDataInt(2) != 0) {
 		db->freeResult(result);
 		return 0;
 	}
-	characterName = result->getDataString("name");
+	characterName = result->getDataString(1);
 
 	db->freeResult(result);
 	return accountId;
@@ -191,52 +358,39 @@ uint32_t IOLoginData::getLastIPByName(const std::string& name)
 
 bool IOLoginData::updateOnlineStatus(uint32_t guid, bool login)
 {
-	Database* db = Database::getInstance();
-
-	std::ostringstream query;
-
 	if (login) {
-		query << "INSERT INTO `players_online` VALUES (" << guid << ')';
-	} else {
-		query << "DELETE FROM `players_online` WHERE `player_id` = " << guid;
+		return m_addOnlineStatement.executeQuery({guid});
 	}
-
-	return db->executeQuery(query.str());
+	return m_removeOnlineStatement.executeQuery({guid});
 }
 
 bool IOLoginData::preloadPlayer(Player* player, const std::string& name)
 {
 	Database* db = Database::getInstance();
 
-	std::ostringstream query;
-	query << "SELECT `id`, `account_id`, `group_id`, `deletion`, (SELECT `type` FROM `accounts` WHERE `accounts`.`id` = `account_id`) AS `account_type`";
-	if (!g_config.getBoolean(ConfigManager::FREE_PREMIUM)) {
-		query << ", (SELECT `premdays` FROM `accounts` WHERE `accounts`.`id` = `account_id`) AS `premium_days`";
-	}
-	query << " FROM `players` WHERE `name` = " << db->escapeString(name);
-
-	DBResult* result = db->storeQuery(query.str());
+	// id, account_id, group_id, deletion, account type, premdays
+	DBStatementResult* result = m_preloadPlayerStatement.storeQuery({name});
 	if (!result) {
 		return false;
 	}
 
-	if (result->getDataInt("deletion") != 0) {
+	if (result->getDataInt(3) != 0) {
 		db->freeResult(result);
 		return false;
 	}
 
-	player->setGUID(result->getDataInt("id"));
-	Group* group = g_game.getGroup(result->getDataInt("group_id"));
+	player->setGUID(result->getDataInt(0));
+	Group* group = g_game.getGroup(result->getDataInt(2));
 	if (!group) {
-		std::cout << "[Error - IOLoginData::preloadPlayer] " << player->name << " has Group ID " << result->getDataInt("group_id") << " which doesn't exist." << std::endl;
+		std::cout << "[Error - IOLoginData::preloadPlayer] " << player->name << " has Group ID " << result->getDataInt(2) << " which doesn't exist." << std::endl;
 		db->freeResult(result);
 		return false;
 	}
 	player->setGroup(group);
-	player->accountNumber = (uint32_t)result->getDataInt("account_id");
-	player->accountType = (AccountType_t)result->getDataInt("account_type");
+	player->accountNumber = (uint32_t)result->getDataInt(1);
+	player->accountType = (AccountType_t)result->getDataInt(4);
 	if (!g_config.getBoolean(ConfigManager::FREE_PREMIUM)) {
-		player->premiumDays = result->getDataInt("premium_days");
+		player->premiumDays = result->getDataInt(5);
 	} else {
 		player->premiumDays = 0xFFFF;
 	}
@@ -246,20 +400,15 @@ bool IOLoginData::preloadPlayer(Player* player, const std::string& name)
 
 bool IOLoginData::loadPlayerById(Player* player, uint32_t id)
 {
-	std::ostringstream query;
-	query << "SELECT `id`, `name`, `account_id`, `group_id`, `sex`, `vocation`, `experience`, `level`, `maglevel`, `health`, `healthmax`, `blessings`, `mana`, `manamax`, `manaspent`, `soul`, `lookbody`, `lookfeet`, `lookhead`, `looklegs`, `looktype`, `lookaddons`, `posx`, `posy`, `posz`, `cap`, `lastlogin`, `lastlogout`, `lastip`, `conditions`, `skulltime`, `skull`, `town_id`, `balance`, `offlinetraining_time`, `offlinetraining_skill`, `stamina`, `skill_fist`, `skill_fist_tries`, `skill_club`, `skill_club_tries`, `skill_sword`, `skill_sword_tries`, `skill_axe`, `skill_axe_tries`, `skill_dist`, `skill_dist_tries`, `skill_shielding`, `skill_shielding_tries`, `skill_fishing`, `skill_fishing_tries` FROM `players` WHERE `id` = " << id;
-	return loadPlayer(player, Database::getInstance()->storeQuery(query.str()));
+	return loadPlayer(player, m_loadPlayerByIdStatement.storeQuery({id}));
 }
 
-bool IOLoginData::loadPlayerByName(Player* player, const std::string& name)
+bool IOLoginData::loadPlayerByName(Player* player, const std::string& name, GuildMembership* membership/* = nullptr*/)
 {
-	Database* db = Database::getInstance();
-	std::ostringstream query;
-	query << "SELECT `id`, `name`, `account_id`, `group_id`, `sex`, `vocation`, `experience`, `level`, `maglevel`, `health`, `healthmax`, `blessings`, `mana`, `manamax`, `manaspent`, `soul`, `lookbody`, `lookfeet`, `lookhead`, `looklegs`, `looktype`, `lookaddons`, `posx`, `posy`, `posz`, `cap`, `lastlogin`, `lastlogout`, `lastip`, `conditions`, `skulltime`, `skull`, `town_id`, `balance`, `offlinetraining_time`, `offlinetraining_skill`, `stamina`, `skill_fist`, `skill_fist_tries`, `skill_club`, `skill_club_tries`, `skill_sword`, `skill_sword_tries`, `skill_axe`, `skill_axe_tries`, `skill_dist`, `skill_dist_tries`, `skill_shielding`, `skill_shielding_tries`, `skill_fishing`, `skill_fishing_tries` FROM `players` WHERE `name` = " << db->escapeString(name);
-	return loadPlayer(player, db->storeQuery(query.str()));
+	return loadPlayer(player, m_loadPlayerByNameStatement.storeQuery({name}), membership);
 }
 
-bool IOLoginData::loadPlayer(Player* player, DBResult* result)
+bool IOLoginData::loadPlayer(Player* player, DBStatementResult* result, GuildMembership* membership/* = nullptr*/)
 {
 	if (!result) {
 		return false;
@@ -267,11 +416,11 @@ bool IOLoginData::loadPlayer(Player* player, DBResult* result)
 
 	Database* db = Database::getInstance();
 
-	uint32_t accno = result->getDataInt("account_id");
+	uint32_t accno = result->getDataInt(PLAYERCOLUMN_ACCOUNT_ID);
 	Account acc = loadAccount(accno);
 
-	player->setGUID(result->getDataInt("id"));
-	player->name = result->getDataString("name");
+	player->setGUID(result->getDataInt(PLAYERCOLUMN_ID));
+	player->name = result->getDataString(PLAYERCOLUMN_NAME);
 	player->accountNumber = accno;
 
 	player->accountType = acc.accountType;
@@ -282,20 +431,20 @@ bool IOLoginData::loadPlayer(Player* player, DBResult* result)
 		player->premiumDays = acc.premiumDays;
 	}
 
-	Group* group = g_game.getGroup(result->getDataInt("group_id"));
+	Group* group = g_game.getGroup(result->getDataInt(PLAYERCOLUMN_GROUP_ID));
 	if (!group) {
-		std::cout << "[Error - IOLoginData::loadPlayer] " << player->name << " has Group ID " << result->getDataInt("group_id") << " which doesn't exist." << std::endl;
+		std::cout << "[Error - IOLoginData::loadPlayer] " << player->name << " has Group ID " << result->getDataInt(PLAYERCOLUMN_GROUP_ID) << " which doesn't exist." << std::endl;
 		db->freeResult(result);
 		return false;
 	}
 	player->setGroup(group);
 
-	player->bankBalance = result->getNumber<uint64_t>("balance");
+	player->bankBalance = result->getNumber<uint64_t>(PLAYERCOLUMN_BALANCE);
 
-	player->setSex((PlayerSex_t)result->getDataInt("sex"));
-	player->level = std::max<uint32_t>(1, result->getDataInt("level"));
+	player->setSex((PlayerSex_t)result->getDataInt(PLAYERCOLUMN_SEX));
+	player->level = std::max<uint32_t>(1, result->getDataInt(PLAYERCOLUMN_LEVEL));
 
-	uint64_t experience = result->getNumber<uint64_t>("experience");
+	uint64_t experience = result->getNumber<uint64_t>(PLAYERCOLUMN_EXPERIENCE);
 
 	uint64_t currExpCount = Player::getExpForLevel(player->level);
 	uint64_t nextExpCount = Player::getExpForLevel(player->level + 1);
@@ -311,12 +460,12 @@ bool IOLoginData::loadPlayer(Player* player, DBResult* result)
 		player->levelPercent = 0;
 	}
 
-	player->soul = result->getDataInt("soul");
-	player->capacity = result->getDataInt("cap");
-	player->blessings = result->getDataInt("blessings");
+	player->soul = result->getDataInt(PLAYERCOLUMN_SOUL);
+	player->capacity = result->getDataInt(PLAYERCOLUMN_CAP);
+	player->blessings = result->getDataInt(PLAYERCOLUMN_BLESSINGS);
 
 	unsigned long conditionsSize;
-	const char* conditions = result->getDataStream("conditions", conditionsSize);
+	const char* conditions = result->getDataStream(PLAYERCOLUMN_CONDITIONS, conditionsSize);
 	PropStream propStream;
 	propStream.init(conditions, conditionsSize);
 
@@ -330,18 +479,18 @@ bool IOLoginData::loadPlayer(Player* player, DBResult* result)
 		condition = Condition::createCondition(propStream);
 	}
 
-	if (!player->setVocation(result->getDataInt("vocation"))) {
-		std::cout << "[Error - IOLoginData::loadPlayer] " << player->name << " has Vocation ID " << result->getDataInt("vocation") << " which doesn't exist." << std::endl;
+	if (!player->setVocation(result->getDataInt(PLAYERCOLUMN_VOCATION))) {
+		std::cout << "[Error - IOLoginData::loadPlayer] " << player->name << " has Vocation ID " << result->getDataInt(PLAYERCOLUMN_VOCATION) << " which doesn't exist." << std::endl;
 		db->freeResult(result);
 		return false;
 	}
 
-	player->mana = result->getDataInt("mana");
-	player->manaMax = result->getDataInt("manamax");
-	player->magLevel = result->getDataInt("maglevel");
+	player->mana = result->getDataInt(PLAYERCOLUMN_MANA);
+	player->manaMax = result->getDataInt(PLAYERCOLUMN_MANAMAX);
+	player->magLevel = result->getDataInt(PLAYERCOLUMN_MAGLEVEL);
 
 	uint64_t nextManaCount = player->vocation->getReqMana(player->magLevel + 1);
-	uint64_t manaSpent = result->getNumber<uint64_t>("manaspent");
+	uint64_t manaSpent = result->getNumber<uint64_t>(PLAYERCOLUMN_MANASPENT);
 
 	if (manaSpent > nextManaCount) {
 		manaSpent = 0;
@@ -350,23 +499,23 @@ bool IOLoginData::loadPlayer(Player* player, DBResult* result)
 	player->manaSpent = manaSpent;
 	player->magLevelPercent = Player::getPercentLevel(player->manaSpent, nextManaCount);
 
-	player->health = result->getDataInt("health");
-	player->healthMax = result->getDataInt("healthmax");
+	player->health = result->getDataInt(PLAYERCOLUMN_HEALTH);
+	player->healthMax = result->getDataInt(PLAYERCOLUMN_HEALTHMAX);
 
-	player->defaultOutfit.lookType = result->getDataInt("looktype");
-	player->defaultOutfit.lookHead = result->getDataInt("lookhead");
-	player->defaultOutfit.lookBody = result->getDataInt("lookbody");
-	player->defaultOutfit.lookLegs = result->getDataInt("looklegs");
-	player->defaultOutfit.lookFeet = result->getDataInt("lookfeet");
+	player->defaultOutfit.lookType = result->getDataInt(PLAYERCOLUMN_LOOKTYPE);
+	player->defaultOutfit.lookHead = result->getDataInt(PLAYERCOLUMN_LOOKHEAD);
+	player->defaultOutfit.lookBody = result->getDataInt(PLAYERCOLUMN_LOOKBODY);
+	player->defaultOutfit.lookLegs = result->getDataInt(PLAYERCOLUMN_LOOKLEGS);
+	player->defaultOutfit.lookFeet = result->getDataInt(PLAYERCOLUMN_LOOKFEET);
 	player->currentOutfit = player->defaultOutfit;
 
 	if (g_game.getWorldType() != WORLD_TYPE_PVP_ENFORCED) {
-		int32_t skullSeconds = result->getDataInt("skulltime") - time(nullptr);
+		int32_t skullSeconds = result->getDataInt(PLAYERCOLUMN_SKULLTIME) - time(nullptr);
 
 		if (skullSeconds > 0) {
 			//ensure that we round up the number of ticks
 			player->skullTicks = (skullSeconds + 2) * 1000;
-			int32_t skull = result->getDataInt("skull");
+			int32_t skull = result->getDataInt(PLAYERCOLUMN_SKULL);
 
 			if (skull == SKULL_RED) {
 				player->skull = SKULL_RED;
@@ -374,19 +523,19 @@ bool IOLoginData::loadPlayer(Player* player, DBResult* result)
 		}
 	}
 
-	player->loginPosition.x = result->getDataInt("posx");
-	player->loginPosition.y = result->getDataInt("posy");
-	player->loginPosition.z = result->getDataInt("posz");
+	player->loginPosition.x = result->getDataInt(PLAYERCOLUMN_POSX);
+	player->loginPosition.y = result->getDataInt(PLAYERCOLUMN_POSY);
+	player->loginPosition.z = result->getDataInt(PLAYERCOLUMN_POSZ);
 
-	player->lastLoginSaved = result->getNumber<uint64_t>("lastlogin");
-	player->lastLogout = result->getNumber<uint64_t>("lastlogout");
+	player->lastLoginSaved = result->getNumber<uint64_t>(PLAYERCOLUMN_LASTLOGIN);
+	player->lastLogout = result->getNumber<uint64_t>(PLAYERCOLUMN_LASTLOGOUT);
 
-	player->offlineTrainingTime = result->getDataInt("offlinetraining_time") * 1000;
-	player->offlineTrainingSkill = result->getDataInt("offlinetraining_skill");
+	player->offlineTrainingTime = result->getDataInt(PLAYERCOLUMN_OFFLINETRAINING_TIME) * 1000;
+	player->offlineTrainingSkill = result->getDataInt(PLAYERCOLUMN_OFFLINETRAINING_SKILL);
 
-	Town* town = Towns::getInstance().getTown(result->getDataInt("town_id"));
+	Town* town = Towns::getInstance().getTown(result->getDataInt(PLAYERCOLUMN_TOWN_ID));
 	if (!town) {
-		std::cout << "[Error - IOLoginData::loadPlayer] " << player->name << " has Town ID " << result->getDataInt("town_id") << " which doesn't exist." << std::endl;
+		std::cout << "[Error - IOLoginData::loadPlayer] " << player->name << " has Town ID " << result->getDataInt(PLAYERCOLUMN_TOWN_ID) << " which doesn't exist." << std::endl;
 		db->freeResult(result);
 		return false;
 	}
@@ -398,14 +547,11 @@ bool IOLoginData::loadPlayer(Player* player, DBResult* result)
 		player->loginPosition = player->getTemplePosition();
 	}
 
-	player->staminaMinutes = result->getDataInt("stamina");
+	player->staminaMinutes = result->getDataInt(PLAYERCOLUMN_STAMINA);
 
-	static const std::string skillNames[] = {"skill_fist", "skill_club", "skill_sword", "skill_axe", "skill_dist", "skill_shielding", "skill_fishing"};
-	static const std::string skillNameTries[] = {"skill_fist_tries", "skill_club_tries", "skill_sword_tries", "skill_axe_tries", "skill_dist_tries", "skill_shielding_tries", "skill_fishing_tries"};
-	static const size_t size = sizeof(skillNames) / sizeof(std::string);
-	for (size_t i = 0; i < size; ++i) {
-		uint32_t skillLevel = result->getDataInt(skillNames[i]);
-		uint64_t skillTries = result->getNumber<uint64_t>(skillNameTries[i]);
+	for (uint32_t i = SKILL_FIRST; i <= SKILL_LAST; ++i) {
+		uint32_t skillLevel = result->getDataInt(PLAYERCOLUMN_SKILL_FIST + i * 2);
+		uint64_t skillTries = result->getNumber<uint64_t>(PLAYERCOLUMN_SKILL_FIST + i * 2 + 1);
 		uint64_t nextSkillTries = player->vocation->getReqSkillTries(i, skillLevel + 1);
 		if (skillTries > nextSkillTries) {
 			skillTries = 0;
@@ -417,71 +563,118 @@ bool IOLoginData::loadPlayer(Player* player, DBResult* result)
 
 	db->freeResult(result);
 
-	std::ostringstream query;
-	query << "SELECT `guild_id`, `rank_id`, `nick` FROM `guild_membership` WHERE `player_id` = " << player->getGUID();
-	if ((result = db->storeQuery(query.str()))) {
-		uint32_t guildId = result->getDataInt("guild_id");
-		uint32_t playerRankId = result->getDataInt("rank_id");
-		player->guildNick = result->getDataString("nick");
+	// the guild objects belong to the game, only read the membership here
+	// when the player is loaded away from the dispatcher
+	GuildMembership loadedMembership;
+	GuildMembership& guildMembership = membership ? *membership : loadedMembership;
+
+	// guild_id, rank_id, nick
+	if ((result = m_loadGuildMembershipStatement.storeQuery({player->getGUID()}))) {
+		guildMembership.guildId = result->getDataInt(0);
+		guildMembership.rankId = result->getDataInt(1);
+		player->guildNick = result->getDataString(2);
 		db->freeResult(result);
 
-		Guild* guild = g_game.getGuild(guildId);
-		if (!guild) {
-			query.str("");
-			query << "SELECT `name` FROM `guilds` WHERE `id` = " << guildId;
-			if ((result = db->storeQuery(query.str()))) {
-				guild = new Guild(guildId, result->getDataString("name"));
-				db->freeResult(result);
-				g_game.addGuild(guild);
+		std::ostringstream query;
+		DBResult* guildResult;
 
-				query.str("");
-				query << "SELECT `id`, `name`, `level` FROM `guild_ranks` WHERE `guild_id` = " << guildId << " LIMIT 3";
+		// a guild the game already knows needs no name and ranks
+		bool guildExists = !membership && g_game.getGuild(guildMembership.guildId);
+		if (!guildExists) {
+			query << "SELECT `name` FROM `guilds` WHERE `id` = " << guildMembership.guildId;
+			if ((guildResult = db->storeQuery(query.str()))) {
+				guildMembership.guildName = guildResult->getDataString("name");
+				db->freeResult(guildResult);
+				guildExists = true;
 
-				if ((result = db->storeQuery(query.str()))) {
+				query.str("");
+				query << "SELECT `id`, `name`, `level` FROM `guild_ranks` WHERE `guild_id` = " << guildMembership.guildId << " LIMIT 3";
+				if ((guildResult = db->storeQuery(query.str()))) {
 					do {
-						guild->addRank(result->getDataInt("id"), result->getDataString("name"), result->getDataInt("level"));
-					} while (result->next());
-					db->freeResult(result);
+						guildMembership.ranks.push_back(GuildRank(guildResult->getDataInt("id"), guildResult->getDataString("name"), guildResult->getDataInt("level")));
+					} while (guildResult->next());
+					db->freeResult(guildResult);
 				}
 			}
 		}
 
-		if (guild) {
-			player->guild = guild;
-			GuildRank* rank = guild->getRankById(playerRankId);
-			if (rank) {
-				player->guildLevel = rank->level;
-			} else {
-				player->guildLevel = 1;
-			}
-
-			IOGuild::getInstance()->getWarList(guildId, player->guildWarList);
+		if (guildExists) {
+			IOGuild::getInstance()->getWarList(guildMembership.guildId, player->guildWarList);
 
 			query.str("");
-			query << "SELECT COUNT(*) AS `members` FROM `guild_membership` WHERE `guild_id` = " << guildId;
-			if ((result = db->storeQuery(query.str()))) {
-				guild->setMemberCount(result->getDataInt("members"));
-				db->freeResult(result);
+			query << "SELECT COUNT(*) AS `members` FROM `guild_membership` WHERE `guild_id` = " << guildMembership.guildId;
+			if ((guildResult = db->storeQuery(query.str()))) {
+				guildMembership.memberCount = guildResult->getDataInt("members");
+				db->freeResult(guildResult);
 			}
+		} else {
+			guildMembership.guildId = 0;
 		}
 	}
 
-	query.str("");
-	query << "SELECT `player_id`, `name` FROM `player_spells` WHERE `player_id` = " << player->getGUID();
-	if ((result = db->storeQuery(query.str()))) {
+	if (!membership) {
+		loadPlayerGuild(player, guildMembership);
+	}
+
+	if ((result = m_loadSpellsStatement.storeQuery({player->getGUID()}))) {
 		do {
-			std::string spellName = result->getDataString("name");
+			std::string spellName = result->getDataString(0);
 			player->learnedInstantSpellList.push_back(spellName);
 		} while (result->next());
 		db->freeResult(result);
 	}
 
+	//load item blobs, their sections are not read from the rows
+	int64_t itemsStartTime = OTSYS_STEADY_TIME_US();
+
+	ItemBlockList blobItems[ITEMBLOB_LAST];
+	bool hasBlob[ITEMBLOB_LAST] = {false, false, false};
+
+	if ((result = m_loadItemBlobsStatement.storeQuery({player->getGUID()}))) {
+		bool damaged = false;
+		do {
+			uint32_t section = result->getDataInt(0);
+			if (section >= ITEMBLOB_LAST) {
+				continue;
+			}
+
+			unsigned long size;
+			const char* data = result->getDataStream(1, size);
+
+			PropStream propStream;
+			propStream.init(data, size);
+			if (!unserializeItemBlob(propStream, blobItems[section])) {
+				std::cout << "[Error - IOLoginData::loadPlayer] Item blob " << section << " of player " << player->getName() << " is damaged." << std::endl;
+				damaged = true;
+				break;
+			}
+			hasBlob[section] = true;
+		} while (result->next());
+		db->freeResult(result);
+
+		if (damaged) {
+			for (const ItemBlockList& itemList : blobItems) {
+				for (const auto& it : itemList) {
+					delete it.second;
+				}
+			}
+			return false;
+		}
+	}
+
 	//load inventory items
 	ItemMap itemMap;
 
-	query.str("");
-	query << "SELECT `pid`, `sid`, `itemtype`, `count`, `attributes` FROM `player_items` WHERE `player_id` = " << player->getGUID() << " ORDER BY `sid` DESC";
-	if ((result = db->storeQuery(query.str()))) {
+	if (hasBlob[ITEMBLOB_INVENTORY]) {
+		for (const auto& it : blobItems[ITEMBLOB_INVENTORY]) {
+			int32_t pid = it.first;
+			if (pid >= 1 && pid <= 10) {
+				player->__internalAddThing(pid, it.second);
+			} else {
+				delete it.second;
+			}
+		}
+	} else if ((result = m_loadItemsStatement.storeQuery({player->getGUID()}))) {
 		loadItems(itemMap, result);
 		db->freeResult(result);
 
@@ -508,9 +701,22 @@ bool IOLoginData::loadPlayer(Player* player, DBResult* result)
 	//load depot items
 	itemMap.clear();
 
-	query.str("");
-	query << "SELECT `pid`, `sid`, `itemtype`, `count`, `attributes` FROM `player_depotitems` WHERE `player_id` = " << player->getGUID() << " ORDER BY `sid` DESC";
-	if ((result = db->storeQuery(query.str()))) {
+	if (hasBlob[ITEMBLOB_DEPOT]) {
+		// added to the front, so the last one goes first
+		for (ItemBlockList::const_reverse_iterator it = blobItems[ITEMBLOB_DEPOT].rbegin(); it != blobItems[ITEMBLOB_DEPOT].rend(); ++it) {
+			int32_t pid = it->first;
+			DepotChest* depotChest = nullptr;
+			if (pid >= 0 && pid < 100) {
+				depotChest = player->getDepotChest(pid, true);
+			}
+
+			if (depotChest) {
+				depotChest->__internalAddThing(it->second);
+			} else {
+				delete it->second;
+			}
+		}
+	} else if ((result = m_loadDepotItemsStatement.storeQuery({player->getGUID()}))) {
 		loadItems(itemMap, result);
 		db->freeResult(result);
 
@@ -541,9 +747,15 @@ bool IOLoginData::loadPlayer(Player* player, DBResult* result)
 	//load inbox items
 	itemMap.clear();
 
-	query.str("");
-	query << "SELECT `pid`, `sid`, `itemtype`, `count`, `attributes` FROM `player_inboxitems` WHERE `player_id` = " << player->getGUID() << " ORDER BY `sid` DESC";
-	if ((result = db->storeQuery(query.str()))) {
+	if (hasBlob[ITEMBLOB_INBOX]) {
+		for (ItemBlockList::const_reverse_iterator it = blobItems[ITEMBLOB_INBOX].rbegin(); it != blobItems[ITEMBLOB_INBOX].rend(); ++it) {
+			if (it->first >= 0 && it->first < 100) {
+				player->getInbox()->__internalAddThing(it->second);
+			} else {
+				delete it->second;
+			}
+		}
+	} else if ((result = m_loadInboxItemsStatement.storeQuery({player->getGUID()}))) {
 		loadItems(itemMap, result);
 		db->freeResult(result);
 
@@ -569,22 +781,20 @@ bool IOLoginData::loadPlayer(Player* player, DBResult* result)
 		}
 	}
 
+	Stats::getInstance()->recordPlayerItems(g_config.getBoolean(ConfigManager::PLAYER_ITEM_BLOBS) ? PLAYER_ITEMS_LOAD_BLOBS : PLAYER_ITEMS_LOAD_ROWS, OTSYS_STEADY_TIME_US() - itemsStartTime);
+
 	//load storage map
-	query.str("");
-	query << "SELECT `key`, `value` FROM `player_storage` WHERE `player_id` = " << player->getGUID();
-	if ((result = db->storeQuery(query.str()))) {
+	if ((result = m_loadStorageStatement.storeQuery({player->getGUID()}))) {
 		do {
-			player->addStorageValue(result->getDataInt("key"), result->getDataInt("value"), true);
+			player->addStorageValue(result->getDataInt(0), result->getDataInt(1), true);
 		} while (result->next());
 		db->freeResult(result);
 	}
 
 	//load vip
-	query.str("");
-	query << "SELECT `player_id` FROM `account_viplist` WHERE `account_id` = " << player->getAccount();
-	if ((result = db->storeQuery(query.str()))) {
+	if ((result = m_loadVipStatement.storeQuery({player->getAccount()}))) {
 		do {
-			player->addVIPInternal(result->getDataInt("player_id"));
+			player->addVIPInternal(result->getDataInt(0));
 		} while (result->next());
 		db->freeResult(result);
 	}
@@ -595,6 +805,32 @@ bool IOLoginData::loadPlayer(Player* player, DBResult* result)
 	return true;
 }
 
+void IOLoginData::loadPlayerGuild(Player* player, const GuildMembership& membership)
+{
+	if (membership.guildId == 0) {
+		return;
+	}
+
+	Guild* guild = g_game.getGuild(membership.guildId);
+	if (!guild) {
+		guild = new Guild(membership.guildId, membership.guildName);
+		for (const GuildRank& rank : membership.ranks) {
+			guild->addRank(rank.id, rank.name, rank.level);
+		}
+		g_game.addGuild(guild);
+	}
+
+	player->guild = guild;
+	GuildRank* rank = guild->getRankById(membership.rankId);
+	if (rank) {
+		player->guildLevel = rank->level;
+	} else {
+		player->guildLevel = 1;
+	}
+
+	guild->setMemberCount(membership.memberCount);
+}
+
 bool IOLoginData::saveItems(const Player* player, const ItemBlockList& itemList, DBInsert& query_insert)
 {
 	std::ostringstream stream;
@@ -656,6 +892,15 @@ bool IOLoginData::saveItems(const Player* player, const ItemBlockList& itemList,
 }
 
 bool IOLoginData::savePlayer(Player* player)
+{
+	SaveEntry entry;
+	if (!buildPlayerSave(player, entry)) {
+		return false;
+	}
+	return SaveManager::getInstance()->writeEntry(entry);
+}
+
+bool IOLoginData::buildPlayerSave(Player* player, SaveEntry& entry, bool changedOnly/* = false*/)
 {
 	if (player->getHealth() <= 0) {
 		player->changeHealth(1);
@@ -663,22 +908,12 @@ bool IOLoginData::savePlayer(Player* player)
 
 	Database* db = Database::getInstance();
 
-	std::ostringstream query;
-	query << "SELECT `save` FROM `players` WHERE `id` = " << player->getGUID();
-
-	DBResult* result = db->storeQuery(query.str());
-	if (!result) {
-		return false;
-	}
-
-	if (result->getDataInt("save") == 0) {
-		db->freeResult(result);
-		query.str("");
-		query << "UPDATE `players` SET `lastlogin` = " << player->lastLoginSaved << ", `lastip` = " << player->lastIP << " WHERE `id` = " << player->getGUID();
-		return db->executeQuery(query.str());
-	}
+	entry.description = "player " + player->getName();
+	entry.playerGuid = player->getGUID();
 
-	db->freeResult(result);
+	std::ostringstream query;
+	query << "UPDATE `players` SET `lastlogin` = " << player->lastLoginSaved << ", `lastip` = " << player->lastIP << " WHERE `id` = " << player->getGUID();
+	entry.loginQuery = query.str();
 
 	//serialize conditions
 	PropWriteStream propWriteStream;
@@ -780,46 +1015,39 @@ bool IOLoginData::savePlayer(Player* player)
 	query << "`blessings` = " << player->blessings;
 	query << " WHERE `id` = " << player->getGUID();
 
-	DBTransaction transaction;
-	if (!transaction.begin()) {
-		return false;
-	}
-
-	if (!db->executeQuery(query.str())) {
-		return false;
-	}
+	entry.queries.push_back(query.str());
 
 	// learned spells
-	query.str("");
-	query << "DELETE FROM `player_spells` WHERE `player_id` = " << player->getGUID();
-	if (!db->executeQuery(query.str())) {
-		return false;
-	}
+	if (!changedOnly || (player->saveDirty & PLAYERSAVE_SPELLS)) {
+		query.str("");
+		query << "DELETE FROM `player_spells` WHERE `player_id` = " << player->getGUID();
+		entry.queries.push_back(query.str());
 
-	query.str("");
+		query.str("");
+
+		DBInsert stmt(&entry.queries);
+		stmt.setQuery("INSERT INTO `player_spells` (`player_id`, `name` ) VALUES ");
 
-	DBInsert stmt;
-	stmt.setQuery("INSERT INTO `player_spells` (`player_id`, `name` ) VALUES ");
+		for (const std::string& spellName : player->learnedInstantSpellList) {
+			query << player->getGUID() << ',' << db->escapeString(spellName);
+			if (!stmt.addRow(query)) {
+				return false;
+			}
+		}
 
-	for (const std::string& spellName : player->learnedInstantSpellList) {
-		query << player->getGUID() << ',' << db->escapeString(spellName);
-		if (!stmt.addRow(query)) {
+		if (!stmt.execute()) {
 			return false;
 		}
 	}
 
-	if (!stmt.execute()) {
-		return false;
-	}
+	// item saving, only written when the items differ from the last save
+	int64_t itemsStartTime = OTSYS_STEADY_TIME_US();
 
-	//item saving
-	query << "DELETE FROM `player_items` WHERE `player_id` = " << player->getGUID();
-	if (!db->executeQuery(query.str())) {
-		return false;
+	size_t itemsHash[3];
+	for (size_t i = 0; i < 3; ++i) {
+		itemsHash[i] = player->savedItemsHash[i];
 	}
 
-	stmt.setQuery("INSERT INTO `player_items` (`player_id`, `pid`, `sid`, `itemtype`, `count`, `attributes`) VALUES ");
-
 	ItemBlockList itemList;
 	for (int32_t slotId = 1; slotId <= 10; ++slotId) {
 		Item* item = player->inventory[slotId];
@@ -828,20 +1056,11 @@ bool IOLoginData::savePlayer(Player* player)
 		}
 	}
 
-	if (!saveItems(player, itemList, stmt)) {
+	if (!saveItemSection(player, ITEMBLOB_INVENTORY, itemList, !changedOnly || (player->saveDirty & PLAYERSAVE_INVENTORY), itemsHash[0], entry)) {
 		return false;
 	}
 
 	if (player->lastDepotId != -1) {
-		//save depot items
-		query.str("");
-		query << "DELETE FROM `player_depotitems` WHERE `player_id` = " << player->getGUID();
-
-		if (!db->executeQuery(query.str())) {
-			return false;
-		}
-
-		stmt.setQuery("INSERT INTO `player_depotitems` (`player_id`, `pid`, `sid`, `itemtype`, `count`, `attributes`) VALUES ");
 		itemList.clear();
 
 		for (const auto& it : player->depotChests) {
@@ -851,52 +1070,396 @@ bool IOLoginData::savePlayer(Player* player)
 			}
 		}
 
-		if (!saveItems(player, itemList, stmt)) {
+		if (!saveItemSection(player, ITEMBLOB_DEPOT, itemList, !changedOnly || (player->saveDirty & PLAYERSAVE_DEPOT), itemsHash[1], entry)) {
 			return false;
 		}
 	}
 
-	//save inbox items
-	query.str("");
-	query << "DELETE FROM `player_inboxitems` WHERE `player_id` = " << player->getGUID();
-	if (!db->executeQuery(query.str())) {
-		return false;
-	}
-
-	stmt.setQuery("INSERT INTO `player_inboxitems` (`player_id`, `pid`, `sid`, `itemtype`, `count`, `attributes`) VALUES ");
 	itemList.clear();
 
 	for (Item* item : player->getInbox()->getItemList()) {
 		itemList.emplace_back(0, item);
 	}
 
-	if (!saveItems(player, itemList, stmt)) {
+	if (!saveItemSection(player, ITEMBLOB_INBOX, itemList, !changedOnly || (player->saveDirty & PLAYERSAVE_INBOX), itemsHash[2], entry)) {
 		return false;
 	}
 
-	query.str("");
-	query << "DELETE FROM `player_storage` WHERE `player_id` = " << player->getGUID();
+	Stats::getInstance()->recordPlayerItems(g_config.getBoolean(ConfigManager::PLAYER_ITEM_BLOBS) ? PLAYER_ITEMS_SAVE_BLOBS : PLAYER_ITEMS_SAVE_ROWS, OTSYS_STEADY_TIME_US() - itemsStartTime);
+
+	if (!changedOnly || (player->saveDirty & PLAYERSAVE_STORAGE)) {
+		query.str("");
+		query << "DELETE FROM `player_storage` WHERE `player_id` = " << player->getGUID();
+		entry.queries.push_back(query.str());
+
+		query.str("");
+
+		DBInsert stmt(&entry.queries);
+		stmt.setQuery("INSERT INTO `player_storage` (`player_id`, `key`, `value`) VALUES ");
 
-	if (!db->executeQuery(query.str())) {
+		for (const auto& it : player->storageMap) {
+			query << player->getGUID() << ',' << it.first << ',' << it.second;
+			if (!stmt.addRow(query)) {
+				return false;
+			}
+		}
+
+		if (!stmt.execute()) {
+			return false;
+		}
+	}
+
+	player->saveDirty = 0;
+	for (size_t i = 0; i < 3; ++i) {
+		player->savedItemsHash[i] = itemsHash[i];
+	}
+	return true;
+}
+
+// an item as it is stored in the rows, for moving it between the layouts
+// without creating it
+struct ItemRow {
+	std::string attributes;
+	int32_t pid;
+	int32_t sid;
+	uint16_t type;
+	uint16_t count;
+};
+
+static void serializeItemRow(PropWriteStream& propWriteStream, const std::vector<ItemRow>& rows, const std::map<int32_t, std::vector<size_t>>& contents, size_t index)
+{
+	const ItemRow& row = rows[index];
+	propWriteStream.ADD_USHORT(row.type);
+	propWriteStream.ADD_USHORT(row.count);
+	propWriteStream.ADD_LSTRING(row.attributes);
+
+	auto it = contents.find(row.sid);
+	if (it == contents.end()) {
+		propWriteStream.ADD_ULONG(0);
+		return;
+	}
+
+	propWriteStream.ADD_ULONG(it->second.size());
+	for (size_t subIndex : it->second) {
+		serializeItemRow(propWriteStream, rows, contents, subIndex);
+	}
+}
+
+// an item gets the next sid, the items inside it the ones after
+static bool unserializeItemRows(PropStream& propStream, int32_t pid, int32_t& runningId, std::vector<ItemRow>& rows)
+{
+	ItemRow row;
+	row.pid = pid;
+	row.sid = ++runningId;
+
+	uint32_t itemCount;
+	if (!propStream.GET_USHORT(row.type) || !propStream.GET_USHORT(row.count) || !propStream.GET_LSTRING(row.attributes) || !propStream.GET_ULONG(itemCount) || itemCount > propStream.size() / ITEMBLOB_MIN_ITEM_SIZE) {
 		return false;
 	}
 
-	query.str("");
+	int32_t sid = row.sid;
+	rows.push_back(std::move(row));
+
+	for (uint32_t i = 0; i < itemCount; ++i) {
+		if (!unserializeItemRows(propStream, sid, runningId, rows)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool IOLoginData::saveItemSection(const Player* player, ItemBlobSection_t section, const ItemBlockList& itemList, bool changed, size_t& hash, SaveEntry& entry)
+{
+	Database* db = Database::getInstance();
+
+	// the other layout is cleared as well, it is only left over from before
+	// playerItemBlobs was changed
+	std::vector<std::string> queries;
+	std::ostringstream query;
+	if (g_config.getBoolean(ConfigManager::PLAYER_ITEM_BLOBS)) {
+		query << "DELETE FROM `" << itemTables[section] << "` WHERE `player_id` = " << player->getGUID();
+		queries.push_back(query.str());
+
+		PropWriteStream propWriteStream;
+		serializeItemBlob(propWriteStream, itemList);
+
+		uint32_t dataSize;
+		const char* data = propWriteStream.getStream(dataSize);
+
+		query.str("");
+		query << "INSERT INTO `player_itemblobs` (`player_id`, `section`, `data`) VALUES (" << player->getGUID() << ',' << section << ',' << db->escapeBlob(data, dataSize) << ") ON DUPLICATE KEY UPDATE `data` = VALUES(`data`)";
+		queries.push_back(query.str());
+	} else {
+		query << "DELETE FROM `player_itemblobs` WHERE `player_id` = " << player->getGUID() << " AND `section` = " << section;
+		queries.push_back(query.str());
+
+		query.str("");
+		query << "DELETE FROM `" << itemTables[section] << "` WHERE `player_id` = " << player->getGUID();
+		queries.push_back(query.str());
+
+		DBInsert stmt(&queries);
+		stmt.setQuery(std::string("INSERT INTO `") + itemTables[section] + "` (`player_id`, `pid`, `sid`, `itemtype`, `count`, `attributes`) VALUES ");
+		if (!saveItems(player, itemList, stmt)) {
+			return false;
+		}
+	}
+
+	// item attributes change in place without notifying the player, so the
+	// queries are compared instead of tracked
+	size_t newHash = 0;
+	for (const std::string& it : queries) {
+		boost::hash_combine(newHash, it);
+	}
+
+	if (!changed && newHash == hash) {
+		return true;
+	}
+	hash = newHash;
+
+	entry.queries.insert(entry.queries.end(), queries.begin(), queries.end());
+	return true;
+}
+
+void IOLoginData::serializeItemBlob(PropWriteStream& propWriteStream, const ItemBlockList& itemList)
+{
+	propWriteStream.ADD_UCHAR(ITEMBLOB_VERSION);
+	propWriteStream.ADD_ULONG(itemList.size());
+
+	for (const auto& it : itemList) {
+		propWriteStream.ADD_ULONG(it.first);
+		serializeItemNode(propWriteStream, it.second);
+	}
+}
+
+bool IOLoginData::unserializeItemBlob(PropStream& propStream, ItemBlockList& itemList)
+{
+	uint8_t version;
+	uint32_t itemCount;
+	if (!propStream.GET_UCHAR(version) || version != ITEMBLOB_VERSION || !propStream.GET_ULONG(itemCount)) {
+		return false;
+	}
+
+	for (uint32_t i = 0; i < itemCount; ++i) {
+		uint32_t pid;
+		Item* item;
+		if (!propStream.GET_ULONG(pid) || !unserializeItemNode(propStream, item)) {
+			for (const auto& it : itemList) {
+				delete it.second;
+			}
+			itemList.clear();
+			return false;
+		}
+
+		if (item) {
+			itemList.emplace_back(pid, item);
+		}
+	}
+	return true;
+}
+
+void IOLoginData::resetPlayerSave(uint32_t guid)
+{
+	Player* player = g_game.getPlayerByGUID(guid);
+	if (player) {
+		player->saveDirty = PLAYERSAVE_ALL;
+	}
+}
+
+// the rows of a section ordered by sid, so containers come before their contents
+static bool loadItemRows(Database* db, uint32_t guid, uint32_t section, std::vector<ItemRow>& rows)
+{
+	std::ostringstream query;
+	query << "SELECT `pid`, `sid`, `itemtype`, `count`, `attributes` FROM `" << itemTables[section] << "` WHERE `player_id` = " << guid << " ORDER BY `sid`";
 
-	stmt.setQuery("INSERT INTO `player_storage` (`player_id`, `key`, `value`) VALUES ");
+	DBResult* result = db->storeQuery(query.str());
+	if (!result) {
+		return false;
+	}
 
-	for (const auto& it : player->storageMap) {
-		query << player->getGUID() << ',' << it.first << ',' << it.second;
-		if (!stmt.addRow(query)) {
+	do {
+		ItemRow row;
+		row.pid = result->getDataInt("pid");
+		row.sid = result->getDataInt("sid");
+		row.type = result->getDataInt("itemtype");
+		row.count = result->getDataInt("count");
+
+		unsigned long attributesSize;
+		const char* attributes = result->getDataStream("attributes", attributesSize);
+		row.attributes.assign(attributes, attributesSize);
+		rows.push_back(std::move(row));
+	} while (result->next());
+	db->freeResult(result);
+	return true;
+}
+
+// rows whose container is missing are left out, as loading the rows does
+static void serializeItemRowBlob(PropWriteStream& propWriteStream, const std::vector<ItemRow>& rows)
+{
+	std::vector<size_t> topItems;
+	std::map<int32_t, std::vector<size_t>> contents;
+	for (size_t index = 0; index < rows.size(); ++index) {
+		if (rows[index].pid < 100) {
+			topItems.push_back(index);
+		} else {
+			contents[rows[index].pid].push_back(index);
+		}
+	}
+
+	propWriteStream.ADD_UCHAR(ITEMBLOB_VERSION);
+	propWriteStream.ADD_ULONG(topItems.size());
+	for (size_t index : topItems) {
+		propWriteStream.ADD_ULONG(rows[index].pid);
+		serializeItemRow(propWriteStream, rows, contents, index);
+	}
+}
+
+static bool unserializeItemRowBlob(const char* data, size_t dataSize, std::vector<ItemRow>& rows)
+{
+	PropStream propStream;
+	propStream.init(data, dataSize);
+
+	uint8_t version;
+	uint32_t topItemCount;
+	if (!propStream.GET_UCHAR(version) || version != ITEMBLOB_VERSION || !propStream.GET_ULONG(topItemCount)) {
+		return false;
+	}
+
+	// numbered like saveItems does, above the range of the pids
+	int32_t runningId = 100;
+	for (uint32_t i = 0; i < topItemCount; ++i) {
+		uint32_t pid;
+		if (!propStream.GET_ULONG(pid) || !unserializeItemRows(propStream, pid, runningId, rows)) {
 			return false;
 		}
 	}
+	return true;
+}
+
+// the sids may be numbered differently, the trees of items have to match
+static bool isSameItemRows(const std::vector<ItemRow>& lhs, const std::vector<ItemRow>& rhs)
+{
+	PropWriteStream lhsStream, rhsStream;
+	serializeItemRowBlob(lhsStream, lhs);
+	serializeItemRowBlob(rhsStream, rhs);
+
+	uint32_t lhsSize, rhsSize;
+	const char* lhsData = lhsStream.getStream(lhsSize);
+	const char* rhsData = rhsStream.getStream(rhsSize);
+	return lhsSize == rhsSize && memcmp(lhsData, rhsData, lhsSize) == 0;
+}
 
-	if (!stmt.execute()) {
+bool IOLoginData::convertPlayerItems(uint32_t guid, bool toBlobs, uint64_t& itemCount, uint64_t& blobBytes)
+{
+	Database* db = Database::getInstance();
+
+	DBTransaction transaction;
+	if (!transaction.begin()) {
 		return false;
 	}
 
-	//End the transaction
+	std::ostringstream query;
+	for (uint32_t section = ITEMBLOB_INVENTORY; section < ITEMBLOB_LAST; ++section) {
+		std::vector<ItemRow> rows;
+		std::vector<ItemRow> storedRows;
+		uint32_t dataSize;
+
+		if (toBlobs) {
+			if (!loadItemRows(db, guid, section, rows)) {
+				continue;
+			}
+
+			PropWriteStream propWriteStream;
+			serializeItemRowBlob(propWriteStream, rows);
+
+			const char* data = propWriteStream.getStream(dataSize);
+
+			query.str("");
+			query << "INSERT INTO `player_itemblobs` (`player_id`, `section`, `data`) VALUES (" << guid << ',' << section << ',' << db->escapeBlob(data, dataSize) << ") ON DUPLICATE KEY UPDATE `data` = VALUES(`data`)";
+			if (!db->executeQuery(query.str())) {
+				return false;
+			}
+
+			query.str("");
+			query << "DELETE FROM `" << itemTables[section] << "` WHERE `player_id` = " << guid;
+			if (!db->executeQuery(query.str())) {
+				return false;
+			}
+
+			// read the blob back, it has to give the rows it was made of
+			query.str("");
+			query << "SELECT `data` FROM `player_itemblobs` WHERE `player_id` = " << guid << " AND `section` = " << section;
+
+			DBResult* result = db->storeQuery(query.str());
+			if (result) {
+				unsigned long storedSize;
+				const char* storedData = result->getDataStream("data", storedSize);
+				if (!unserializeItemRowBlob(storedData, storedSize, storedRows)) {
+					storedRows.clear();
+				}
+				db->freeResult(result);
+			}
+		} else {
+			query.str("");
+			query << "SELECT `data` FROM `player_itemblobs` WHERE `player_id` = " << guid << " AND `section` = " << section;
+
+			DBResult* result = db->storeQuery(query.str());
+			if (!result) {
+				continue;
+			}
+
+			unsigned long blobSize;
+			const char* data = result->getDataStream("data", blobSize);
+			dataSize = blobSize;
+
+			bool damaged = !unserializeItemRowBlob(data, blobSize, rows);
+			db->freeResult(result);
+
+			if (damaged) {
+				std::cout << "[Error - IOLoginData::convertPlayerItems] Item blob " << section << " of player " << guid << " is damaged." << std::endl;
+				return false;
+			}
+
+			query.str("");
+			query << "DELETE FROM `" << itemTables[section] << "` WHERE `player_id` = " << guid;
+			if (!db->executeQuery(query.str())) {
+				return false;
+			}
+
+			DBInsert stmt;
+			stmt.setQuery(std::string("INSERT INTO `") + itemTables[section] + "` (`player_id`, `pid`, `sid`, `itemtype`, `count`, `attributes`) VALUES ");
+
+			// addRow takes the row from the stream, which still holds the DELETE
+			query.str("");
+			for (const ItemRow& row : rows) {
+				query << guid << ',' << row.pid << ',' << row.sid << ',' << row.type << ',' << row.count << ',' << db->escapeBlob(row.attributes.c_str(), row.attributes.length());
+				if (!stmt.addRow(query)) {
+					return false;
+				}
+			}
+
+			if (!stmt.execute()) {
+				return false;
+			}
+
+			query.str("");
+			query << "DELETE FROM `player_itemblobs` WHERE `player_id` = " << guid << " AND `section` = " << section;
+			if (!db->executeQuery(query.str())) {
+				return false;
+			}
+
+			// read the rows back, they have to give the items of the blob
+			loadItemRows(db, guid, section, storedRows);
+		}
+
+		// the transaction is rolled back, the player keeps the old layout
+		if (!isSameItemRows(rows, storedRows)) {
+			std::cout << "[Error - IOLoginData::convertPlayerItems] Items of section " << section << " of player " << guid << " did not convert back to the same items." << std::endl;
+			return false;
+		}
+
+		itemCount += rows.size();
+		blobBytes += dataSize;
+	}
 	return transaction.commit();
 }
 
@@ -997,16 +1560,16 @@ bool IOLoginData::formatPlayerName(std::string& name)
 	return true;
 }
 
-void IOLoginData::loadItems(ItemMap& itemMap, DBResult* result)
+void IOLoginData::loadItems(ItemMap& itemMap, DBStatementResult* result)
 {
 	do {
-		int32_t sid = result->getDataInt("sid");
-		int32_t pid = result->getDataInt("pid");
-		int32_t type = result->getDataInt("itemtype");
-		int32_t count = result->getDataInt("count");
+		int32_t sid = result->getDataInt(ITEMCOLUMN_SID);
+		int32_t pid = result->getDataInt(ITEMCOLUMN_PID);
+		int32_t type = result->getDataInt(ITEMCOLUMN_ITEMTYPE);
+		int32_t count = result->getDataInt(ITEMCOLUMN_COUNT);
 
 		unsigned long attrSize;
-		const char* attr = result->getDataStream("attributes", attrSize);
+		const char* attr = result->getDataStream(ITEMCOLUMN_ATTRIBUTES, attrSize);
 
 		PropStream propStream;
 		propStream.init(attr, attrSize);
@@ -28,6 +28,32 @@
 typedef std::pair<int32_t, Item*> itemBlock;
 typedef std::list<itemBlock> ItemBlockList;
 
+struct SaveEntry;
+class PropStream;
+class PropWriteStream;
+
+// sections of the player_itemblobs table, each holds the items of one
+// player_*items table when playerItemBlobs is enabled
+enum ItemBlobSection_t {
+	ITEMBLOB_INVENTORY,
+	ITEMBLOB_DEPOT,
+	ITEMBLOB_INBOX,
+
+	ITEMBLOB_LAST /* this must be the last one */
+};
+
+// Guild of a player as read from the database. A player loaded away from the
+// dispatcher carries it until loadPlayerGuild attaches the shared Guild object.
+struct GuildMembership {
+	GuildMembership() : guildId(0), rankId(0), memberCount(0) {}
+
+	std::string guildName;
+	std::vector<GuildRank> ranks;
+	uint32_t guildId;
+	uint32_t rankId;
+	uint32_t memberCount;
+};
+
 class IOLoginData
 {
 	public:
@@ -48,9 +74,18 @@ class IOLoginData
 		bool preloadPlayer(Player* player, const std::string& name);
 
 		bool loadPlayerById(Player* player, uint32_t id);
-		bool loadPlayerByName(Player* player, const std::string& name);
-		bool loadPlayer(Player* player, DBResult* result);
+		bool loadPlayerByName(Player* player, const std::string& name, GuildMembership* membership = nullptr);
+		bool loadPlayer(Player* player, DBStatementResult* result, GuildMembership* membership = nullptr);
+		void loadPlayerGuild(Player* player, const GuildMembership& membership);
 		bool savePlayer(Player* player);
+		// the queries savePlayer runs, to be written later by the save manager,
+		// changedOnly leaves out the sections that did not change since the last save
+		bool buildPlayerSave(Player* player, SaveEntry& entry, bool changedOnly = false);
+		// a save that was built could not be written, write everything next time
+		void resetPlayerSave(uint32_t guid);
+		// moves the stored items of a player between the rows and the blobs,
+		// sections already stored the other way are left alone
+		bool convertPlayerItems(uint32_t guid, bool toBlobs, uint64_t& itemCount, uint64_t& blobBytes);
 		bool getGuidByName(uint32_t& guid, std::string& name);
 		bool getGuidByNameEx(uint32_t& guid, bool& specialVip, std::string& name);
 		bool getNameByGuid(uint32_t guid, std::string& name);
@@ -74,10 +109,35 @@ class IOLoginData
 		void removePremiumDays(uint32_t accountId, int32_t removeDays);
 
 	protected:
+		IOLoginData();
+
 		typedef std::map<int32_t , std::pair<Item*, int32_t> > ItemMap;
 
-		void loadItems(ItemMap& itemMap, DBResult* result);
+		void loadItems(ItemMap& itemMap, DBStatementResult* result);
 		bool saveItems(const Player* player, const ItemBlockList& itemList, DBInsert& query_insert);
+		bool saveItemSection(const Player* player, ItemBlobSection_t section, const ItemBlockList& itemList, bool changed, size_t& hash, SaveEntry& entry);
+
+		void serializeItemBlob(PropWriteStream& propWriteStream, const ItemBlockList& itemList);
+		bool unserializeItemBlob(PropStream& propStream, ItemBlockList& itemList);
+
+		// the queries every login runs
+		DBStatement m_loadAccountStatement;
+		DBStatement m_accountByNameStatement;
+		DBStatement m_characterListStatement;
+		DBStatement m_characterStatement;
+		DBStatement m_preloadPlayerStatement;
+		DBStatement m_loadPlayerByIdStatement;
+		DBStatement m_loadPlayerByNameStatement;
+		DBStatement m_loadGuildMembershipStatement;
+		DBStatement m_loadSpellsStatement;
+		DBStatement m_loadItemsStatement;
+		DBStatement m_loadDepotItemsStatement;
+		DBStatement m_loadInboxItemsStatement;
+		DBStatement m_loadItemBlobsStatement;
+		DBStatement m_loadStorageStatement;
+		DBStatement m_loadVipStatement;
+		DBStatement m_addOnlineStatement;
+		DBStatement m_removeOnlineStatement;
 };
 
 #endif
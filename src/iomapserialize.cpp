@@ -20,6 +20,7 @@
 #include "otpch.h"
 
 #include "iomapserialize.h"
+#include "savemanager.h"
 #include "house.h"
 #include "configmanager.h"
 #include "game.h"
@@ -82,55 +83,6 @@ bool IOMapSerialize::loadMap(Map* map)
 	return true;
 }
 
-bool IOMapSerialize::saveMap(Map* map)
-{
-	int64_t start = OTSYS_TIME();
-	Database* db = Database::getInstance();
-	std::ostringstream query;
-
-	//Start the transaction
-	DBTransaction transaction;
-	if (!transaction.begin()) {
-		return false;
-	}
-
-	if (!db->executeQuery("DELETE FROM `tile_store`")) {
-		return false;
-	}
-
-	DBInsert stmt;
-	stmt.setQuery("INSERT INTO `tile_store` (`house_id`, `data`) VALUES ");
-
-	//clear old tile data
-	for (const auto& it : Houses::getInstance().getHouses()) {
-		//save house items
-		House* house = it.second;
-		for (HouseTile* tile : house->getTiles()) {
-			PropWriteStream stream;
-			saveTile(stream, tile);
-
-			uint32_t attributesSize;
-			const char* attributes = stream.getStream(attributesSize);
-			if (attributesSize > 0) {
-				query << house->getHouseId() << ',' << db->escapeBlob(attributes, attributesSize);
-				if (!stmt.addRow(query)) {
-					return false;
-				}
-			}
-		}
-	}
-
-	if (!stmt.execute()) {
-		return false;
-	}
-
-	//End the transaction
-	bool success = transaction.commit();
-	std::cout << "> Saved house items in: " <<
-	          (OTSYS_TIME() - start) / (1000.) << " s" << std::endl;
-	return success;
-}
-
 bool IOMapSerialize::loadContainer(PropStream& propStream, Container* container)
 {
 	while (container->serializationCount > 0) {
@@ -320,73 +272,91 @@ bool IOMapSerialize::loadHouseInfo(Map* map)
 	return true;
 }
 
-bool IOMapSerialize::saveHouseInfo(Map* map)
+void IOMapSerialize::saveHouse(House* house, SaveEntry& entry)
 {
 	Database* db = Database::getInstance();
 
-	DBTransaction transaction;
-	if (!transaction.begin()) {
-		return false;
-	}
-
-	if (!db->executeQuery("DELETE FROM `house_lists`")) {
-		return false;
-	}
+	std::ostringstream ss;
+	ss << "house " << house->getHouseId();
+	entry.description = ss.str();
 
 	std::ostringstream query;
-	for (const auto& it : Houses::getInstance().getHouses()) {
-		House* house = it.second;
-		query << "SELECT `id` FROM `houses` WHERE `id` = " << house->getHouseId();
-		DBResult* result = db->storeQuery(query.str());
-		if (result) {
-			db->freeResult(result);
-			query.str("");
-			query << "UPDATE `houses` SET `owner` = " << house->getHouseOwner() << ", `paid` = " << house->getPaidUntil() << ", `warnings` = " << house->getPayRentWarnings() << ", `name` = " << db->escapeString(house->getName()) << ", `town_id` = " << house->getTownId() << ", `rent` = " << house->getRent() << ", `size` = " << house->getTiles().size() << ", `beds` = " << house->getBedCount() << " WHERE `id` = " << house->getHouseId();
-		} else {
-			query.str("");
-			query << "INSERT INTO `houses` (`id`, `owner`, `paid`, `warnings`, `name`, `town_id`, `rent`, `size`, `beds`) VALUES (" << house->getHouseId() << ',' << house->getHouseOwner() << ',' << house->getPaidUntil() << ',' << house->getPayRentWarnings() << ',' << db->escapeString(house->getName()) << ',' << house->getTownId() << ',' << house->getRent() << ',' << house->getTiles().size() << ',' << house->getBedCount() << ')';
-		}
+	query << "INSERT INTO `houses` (`id`, `owner`, `paid`, `warnings`, `name`, `town_id`, `rent`, `size`, `beds`) VALUES (" << house->getHouseId() << ',' << house->getHouseOwner() << ',' << house->getPaidUntil() << ',' << house->getPayRentWarnings() << ',' << db->escapeString(house->getName()) << ',' << house->getTownId() << ',' << house->getRent() << ',' << house->getTiles().size() << ',' << house->getBedCount() << ')';
+	query << " ON DUPLICATE KEY UPDATE `owner` = VALUES(`owner`), `paid` = VALUES(`paid`), `warnings` = VALUES(`warnings`), `name` = VALUES(`name`), `town_id` = VALUES(`town_id`), `rent` = VALUES(`rent`), `size` = VALUES(`size`), `beds` = VALUES(`beds`)";
+	entry.queries.push_back(query.str());
 
-		db->executeQuery(query.str());
-		query.str("");
-	}
+	query.str("");
+	query << "DELETE FROM `house_lists` WHERE `house_id` = " << house->getHouseId();
+	entry.queries.push_back(query.str());
 
-	DBInsert stmt;
-	stmt.setQuery("INSERT INTO `house_lists` (`house_id` , `listid` , `list`) VALUES ");
+	query.str("");
+	query << "DELETE FROM `tile_store` WHERE `house_id` = " << house->getHouseId();
+	entry.queries.push_back(query.str());
 
-	for (const auto& it : Houses::getInstance().getHouses()) {
-		House* house = it.second;
+	query.str("");
 
-		std::string listText;
+	DBInsert stmt(&entry.queries);
+	stmt.setQuery("INSERT INTO `house_lists` (`house_id` , `listid` , `list`) VALUES ");
 
-		if (house->getAccessList(GUEST_LIST, listText) && !listText.empty()) {
-			query << house->getHouseId() << ',' << GUEST_LIST << ',' << db->escapeString(listText);
+	std::string listText;
+	if (house->getAccessList(GUEST_LIST, listText) && !listText.empty()) {
+		query << house->getHouseId() << ',' << GUEST_LIST << ',' << db->escapeString(listText);
+		stmt.addRow(query);
+	}
 
-			if (!stmt.addRow(query)) {
-				return false;
-			}
+	if (house->getAccessList(SUBOWNER_LIST, listText) && !listText.empty()) {
+		query << house->getHouseId() << ',' << SUBOWNER_LIST << ',' << db->escapeString(listText);
+		stmt.addRow(query);
+	}
+
+	for (Door* door : house->getDoors()) {
+		if (door->getAccessList(listText) && !listText.empty()) {
+			query << house->getHouseId() << ',' << door->getDoorId() << ',' << db->escapeString(listText);
+			stmt.addRow(query);
 		}
+	}
 
-		if (house->getAccessList(SUBOWNER_LIST, listText) && !listText.empty()) {
-			query << house->getHouseId() << ',' << SUBOWNER_LIST << ',' << db->escapeString(listText);
-			if (!stmt.addRow(query)) {
-				return false;
-			}
+	stmt.execute();
+
+	stmt.setQuery("INSERT INTO `tile_store` (`house_id`, `data`) VALUES ");
+	for (HouseTile* tile : house->getTiles()) {
+		PropWriteStream stream;
+		saveTile(stream, tile);
+
+		uint32_t attributesSize;
+		const char* attributes = stream.getStream(attributesSize);
+		if (attributesSize > 0) {
+			query << house->getHouseId() << ',' << db->escapeBlob(attributes, attributesSize);
+			stmt.addRow(query);
 		}
+	}
 
-		for (Door* door : house->getDoors()) {
-			if (door->getAccessList(listText) && !listText.empty()) {
-				query << house->getHouseId() << ',' << door->getDoorId() << ',' << db->escapeString(listText);
-				if (!stmt.addRow(query)) {
-					return false;
-				}
-			}
+	stmt.execute();
+}
+
+void IOMapSerialize::saveHouseList(SaveEntry& entry)
+{
+	entry.description = "house list";
+
+	std::ostringstream houseIds;
+	for (const auto& it : Houses::getInstance().getHouses()) {
+		if (houseIds.tellp() > 0) {
+			houseIds << ',';
 		}
+		houseIds << it.second->getHouseId();
 	}
 
-	if (!stmt.execute()) {
-		return false;
+	if (houseIds.tellp() == 0) {
+		entry.queries.push_back("DELETE FROM `house_lists`");
+		entry.queries.push_back("DELETE FROM `tile_store`");
+		return;
 	}
 
-	return transaction.commit();
+	std::ostringstream query;
+	query << "DELETE FROM `house_lists` WHERE `house_id` NOT IN (" << houseIds.str() << ')';
+	entry.queries.push_back(query.str());
+
+	query.str("");
+	query << "DELETE FROM `tile_store` WHERE `house_id` NOT IN (" << houseIds.str() << ')';
+	entry.queries.push_back(query.str());
 }
@@ -25,6 +25,8 @@
 
 #include <string>
 
+struct SaveEntry;
+
 class IOMapSerialize
 {
 	public:
@@ -32,9 +34,12 @@ class IOMapSerialize
 		~IOMapSerialize() {}
 
 		bool loadMap(Map* map);
-		bool saveMap(Map* map);
 		bool loadHouseInfo(Map* map);
-		bool saveHouseInfo(Map* map);
+
+		// the house row, its access lists and the items on its tiles
+		void saveHouse(House* house, SaveEntry& entry);
+		// removes what is stored for houses that are no longer on the map
+		void saveHouseList(SaveEntry& entry);
 
 	protected:
 		// Relational storage uses a row for each item/tile
@@ -44,6 +44,9 @@
 #include "ban.h"
 #include "databasemanager.h"
 #include "beds.h"
+#include "stats.h"
+#include "savemanager.h"
+#include "databasetasks.h"
 
 #include <boost/range/adaptor/reversed.hpp>
 
@@ -105,25 +108,24 @@ void ScriptEnvironment::resetEnv()
 	m_tempResults.clear();
 }
 
-bool ScriptEnvironment::saveGameState()
+bool ScriptEnvironment::saveGameState(SaveEntry& entry)
 {
 	if (!g_config.getBoolean(ConfigManager::SAVE_GLOBAL_STORAGE)) {
-		return true;
+		return false;
 	}
 
-	Database* db = Database::getInstance();
+	entry.description = "global storage";
 
-	db->executeQuery("TRUNCATE TABLE `global_storage`");
+	// TRUNCATE would commit the transaction the entry is written in
+	entry.queries.push_back("DELETE FROM `global_storage`");
 
-	DBInsert stmt;
+	DBInsert stmt(&entry.queries);
 	stmt.setQuery("INSERT INTO `global_storage` (`key`, `value`) VALUES ");
 
 	std::ostringstream query;
 	for (const auto& it : m_globalStorageMap) {
 		query << it.first << ',' << it.second;
-		if (!stmt.addRow(query)) {
-			return false;
-		}
+		stmt.addRow(query);
 	}
 	return stmt.execute();
 }
@@ -560,6 +562,20 @@ const std::string& LuaScriptInterface::getFileById(int32_t scriptId)
 	return it->second;
 }
 
+TaskStats* LuaScriptInterface::getScriptStats(int32_t scriptId)
+{
+	TaskStats*& stats = m_scriptStats[scriptId];
+	if (!stats) {
+		auto it = m_cacheFiles.find(scriptId);
+		if (it != m_cacheFiles.end()) {
+			stats = Stats::getInstance()->getScriptStats(it->second);
+		} else {
+			stats = Stats::getInstance()->getScriptStats(m_interfaceName);
+		}
+	}
+	return stats;
+}
+
 std::string LuaScriptInterface::getStackTrace(const std::string& error_desc)
 {
 	lua_getglobal(m_luaState, "debug");
@@ -652,6 +668,7 @@ bool LuaScriptInterface::closeState()
 	}
 
 	m_cacheFiles.clear();
+	m_scriptStats.clear();
 	if (m_eventTableRef != -1) {
 		luaL_unref(m_luaState, LUA_REGISTRYINDEX, m_eventTableRef);
 		m_eventTableRef = -1;
@@ -673,7 +690,10 @@ bool LuaScriptInterface::callFunction(uint32_t nParams)
 	bool result = false;
 	int32_t size0 = lua_gettop(m_luaState);
 
+	TaskStats* stats = getScriptStats(getScriptEnv()->getScriptId());
+	int64_t startTime = Stats::getInstance()->enter(stats);
 	int32_t ret = protectedCall(m_luaState, nParams, 1);
+	Stats::getInstance()->leave(stats, startTime);
 	if (ret != 0) {
 		LuaScriptInterface::reportError(nullptr, LuaScriptInterface::popString(m_luaState));
 	} else {
@@ -5205,7 +5225,7 @@ int32_t LuaScriptInterface::luaAddEvent(lua_State* L)
 	auto& lastTimerEventId = g_luaEnvironment.m_lastEventTimerId;
 	eventDesc.eventId = g_scheduler.addEvent(createSchedulerTask(
 		delay, boost::bind(&LuaEnvironment::executeTimerEvent, &g_luaEnvironment, lastTimerEventId)
-	));
+	), TASK_ORIGIN_LUA_TIMER);
 
 	g_luaEnvironment.m_timerEvents[lastTimerEventId] = eventDesc;
 	pushNumber(L, lastTimerEventId++);
@@ -5272,7 +5292,7 @@ int32_t LuaScriptInterface::luaGetCreatureCondition(lua_State* L)
 int32_t LuaScriptInterface::luaSaveServer(lua_State* L)
 {
 	g_dispatcher.addTask(
-	    createTask(boost::bind(&Game::saveGameState, &g_game)));
+	    createTask(boost::bind(&Game::saveGameState, &g_game, false)));
 	pushBoolean(L, true);
 	return 1;
 }
@@ -5589,6 +5609,8 @@ const luaL_Reg LuaScriptInterface::luaDatabaseTable[] = {
 	{"lastInsertId", LuaScriptInterface::luaDatabaseLastInsertId},
 	{"connected", LuaScriptInterface::luaDatabaseConnected},
 	{"tableExists", LuaScriptInterface::luaDatabaseTableExists},
+	{"asyncQuery", LuaScriptInterface::luaDatabaseAsyncExecute},
+	{"asyncStoreQuery", LuaScriptInterface::luaDatabaseAsyncStoreQuery},
 	{nullptr, nullptr}
 };
 
@@ -5639,6 +5661,50 @@ int32_t LuaScriptInterface::luaDatabaseTableExists(lua_State* L)
 	return 1;
 }
 
+int32_t LuaScriptInterface::luaDatabaseAsyncExecute(lua_State* L)
+{
+	//db.asyncQuery(query[, callback(success)])
+	return addAsyncQuery(L, false);
+}
+
+int32_t LuaScriptInterface::luaDatabaseAsyncStoreQuery(lua_State* L)
+{
+	//db.asyncStoreQuery(query[, callback(resultId or false)])
+	return addAsyncQuery(L, true);
+}
+
+int32_t LuaScriptInterface::addAsyncQuery(lua_State* L, bool store)
+{
+	lua_State* globalState = g_luaEnvironment.getLuaState();
+	if (!globalState) {
+		reportErrorFunc("No valid script interface!");
+		pushBoolean(L, false);
+		return 1;
+	}
+
+	DatabaseCallback callback;
+	if (getStackTop(L) >= 2) {
+		if (!isFunction(globalState, -1)) {
+			reportErrorFunc("callback parameter should be a function.");
+			pushBoolean(L, false);
+			return 1;
+		}
+
+		LuaQueryCallbackDesc callbackDesc;
+		callbackDesc.function = luaL_ref(globalState, LUA_REGISTRYINDEX);
+		callbackDesc.scriptId = getScriptEnv()->getScriptId();
+		callbackDesc.store = store;
+
+		uint32_t callbackId = g_luaEnvironment.m_lastQueryCallbackId++;
+		g_luaEnvironment.m_queryCallbacks[callbackId] = callbackDesc;
+		callback = boost::bind(&LuaEnvironment::executeQueryCallback, &g_luaEnvironment, callbackId, _1, _2);
+	}
+
+	DatabaseTasks::getInstance()->addTask(popString(L), callback, store);
+	pushBoolean(L, true);
+	return 1;
+}
+
 const luaL_Reg LuaScriptInterface::luaResultTable[] = {
 	{"getDataInt", LuaScriptInterface::luaResultGetDataInt},
 	{"getDataLong", LuaScriptInterface::luaResultGetDataLong},
@@ -10508,6 +10574,7 @@ LuaEnvironment::LuaEnvironment() :
 	LuaScriptInterface("Main Interface"),
 	m_testInterface(nullptr),
 	m_lastEventTimerId(0),
+	m_lastQueryCallbackId(0),
 	m_lastCombatId(0),
 	m_lastConditionId(0),
 	m_lastAreaId(0)
@@ -10576,7 +10643,13 @@ bool LuaEnvironment::closeState()
 	}
 	m_timerEvents.clear();
 
+	for (const auto& queryEntry : m_queryCallbacks) {
+		luaL_unref(m_luaState, LUA_REGISTRYINDEX, queryEntry.second.function);
+	}
+	m_queryCallbacks.clear();
+
 	m_cacheFiles.clear();
+	m_scriptStats.clear();
 
 	lua_close(m_luaState);
 	m_luaState = nullptr;
@@ -10731,3 +10804,45 @@ void LuaEnvironment::executeTimerEvent(uint32_t eventIndex)
 
 	m_timerEvents.erase(it);
 }
+
+void LuaEnvironment::executeQueryCallback(uint32_t callbackId, DBResult* result, bool success)
+{
+	auto it = m_queryCallbacks.find(callbackId);
+	if (it == m_queryCallbacks.end()) {
+		// the script state was closed while the query ran
+		if (result) {
+			Database::getInstance()->freeResult(result);
+		}
+		return;
+	}
+
+	const LuaQueryCallbackDesc& callbackDesc = it->second;
+
+	//push function
+	lua_rawgeti(m_luaState, LUA_REGISTRYINDEX, callbackDesc.function);
+
+	//call the function, the result is freed with the script environment
+	if (reserveScriptEnv()) {
+		ScriptEnvironment* env = getScriptEnv();
+		env->setScriptId(callbackDesc.scriptId, this);
+
+		if (!callbackDesc.store) {
+			pushBoolean(m_luaState, success);
+		} else if (result) {
+			lua_pushnumber(m_luaState, env->addResult(result));
+		} else {
+			pushBoolean(m_luaState, false);
+		}
+		callFunction(1);
+	} else {
+		std::cout << "[Error - LuaScriptInterface::executeQueryCallback] Call stack overflow" << std::endl;
+		lua_pop(m_luaState, 1);
+		if (result) {
+			Database::getInstance()->freeResult(result);
+		}
+	}
+
+	//free resources
+	luaL_unref(m_luaState, LUA_REGISTRYINDEX, callbackDesc.function);
+	m_queryCallbacks.erase(it);
+}
@@ -59,6 +59,7 @@ class Combat;
 class Condition;
 class Npc;
 class Monster;
+class TaskStats;
 
 enum LuaVariantType_t {
 	VARIANT_NONE = 0,
@@ -101,9 +102,16 @@ struct LuaTimerEventDesc {
 	uint32_t eventId;
 };
 
+struct LuaQueryCallbackDesc {
+	int32_t scriptId;
+	int32_t function;
+	bool store;
+};
+
 class LuaScriptInterface;
 class Game;
 class Npc;
+struct SaveEntry;
 
 class ScriptEnvironment
 {
@@ -113,7 +121,8 @@ class ScriptEnvironment
 
 		void resetEnv();
 
-		static bool saveGameState();
+		// false when the global storage is not saved
+		static bool saveGameState(SaveEntry& entry);
 		static bool loadGameState();
 
 		void setScriptId(int32_t scriptId, LuaScriptInterface* scriptInterface) {
@@ -247,6 +256,7 @@ class LuaScriptInterface
 		int32_t loadFile(const std::string& file, Npc* npc = nullptr);
 
 		const std::string& getFileById(int32_t scriptId);
+		TaskStats* getScriptStats(int32_t scriptId);
 		int32_t getEvent(const std::string& eventName);
 
 		static ScriptEnvironment* getScriptEnv() {
@@ -416,7 +426,7 @@ class LuaScriptInterface
 		static const luaL_Reg luaBitReg[13];
 #endif
 		static const luaL_Reg luaConfigManagerTable[4];
-		static const luaL_Reg luaDatabaseTable[8];
+		static const luaL_Reg luaDatabaseTable[10];
 		static const luaL_Reg luaResultTable[7];
 
 		static int32_t protectedCall(lua_State* L, int32_t nargs, int32_t nresults);
@@ -645,6 +655,9 @@ class LuaScriptInterface
 		static int32_t luaDatabaseLastInsertId(lua_State* L);
 		static int32_t luaDatabaseConnected(lua_State* L);
 		static int32_t luaDatabaseTableExists(lua_State* L);
+		static int32_t luaDatabaseAsyncExecute(lua_State* L);
+		static int32_t luaDatabaseAsyncStoreQuery(lua_State* L);
+		static int32_t addAsyncQuery(lua_State* L, bool store);
 
 		static int32_t luaResultGetDataInt(lua_State* L);
 		static int32_t luaResultGetDataLong(lua_State* L);
@@ -1082,6 +1095,9 @@ class LuaScriptInterface
 
 		//script file cache
 		std::map<int32_t, std::string> m_cacheFiles;
+
+		//statistics entry of each script, filled on the first call
+		std::unordered_map<int32_t, TaskStats*> m_scriptStats;
 };
 
 class LuaEnvironment : public LuaScriptInterface
@@ -1110,6 +1126,7 @@ class LuaEnvironment : public LuaScriptInterface
 
 	private:
 		void executeTimerEvent(uint32_t eventIndex);
+		void executeQueryCallback(uint32_t callbackId, DBResult* result, bool success);
 
 		//
 		LuaScriptInterface* m_testInterface;
@@ -1117,6 +1134,9 @@ class LuaEnvironment : public LuaScriptInterface
 		std::map<uint32_t, LuaTimerEventDesc> m_timerEvents;
 		uint32_t m_lastEventTimerId;
 
+		std::map<uint32_t, LuaQueryCallbackDesc> m_queryCallbacks;
+		uint32_t m_lastQueryCallbackId;
+
 		std::unordered_map<uint32_t, Combat*> m_combatMap;
 		std::unordered_map<uint32_t, Condition*> m_conditionMap;
 		std::unordered_map<uint32_t, AreaCombat*> m_areaMap;
@@ -44,6 +44,7 @@
 #include "player.h"
 #include "configmanager.h"
 #include "game.h"
+#include "networkmessage.h"
 
 extern Game g_game;
 extern ConfigManager g_config;
@@ -53,6 +54,8 @@ Map::Map()
 {
 	mapWidth = 0;
 	mapHeight = 0;
+	nextFlowFieldCleanup = 0;
+	useTileGrid = (asLowerCaseString(g_config.getString(ConfigManager::MAP_STORAGE_TYPE)) == "grid");
 }
 
 Map::~Map()
@@ -81,31 +84,14 @@ bool Map::loadMap(const std::string& identifier)
 	return true;
 }
 
-bool Map::saveMap()
+void Map::saveHouse(House* house, SaveEntry& entry)
 {
-	bool saved = false;
-
-	for (uint32_t tries = 0; tries < 3; tries++) {
-		if (IOMapSerialize.saveHouseInfo(this)) {
-			saved = true;
-			break;
-		}
-	}
-
-	if (!saved) {
-		return false;
-	}
-
-	saved = false;
-
-	for (uint32_t tries = 0; tries < 3; tries++) {
-		if (IOMapSerialize.saveMap(this)) {
-			saved = true;
-			break;
-		}
-	}
+	IOMapSerialize.saveHouse(house, entry);
+}
 
-	return saved;
+void Map::saveHouseList(SaveEntry& entry)
+{
+	IOMapSerialize.saveHouseList(entry);
 }
 
 Tile* Map::getTile(int32_t x, int32_t y, int32_t z)
@@ -114,6 +100,10 @@ Tile* Map::getTile(int32_t x, int32_t y, int32_t z)
 		return nullptr;
 	}
 
+	if (useTileGrid) {
+		return tileGrid.getTile(x, y, z);
+	}
+
 	QTreeLeafNode* leaf = QTreeNode::getLeafStatic(&root, x, y);
 	if (leaf) {
 		Floor* floor = leaf->getFloor(z);
@@ -136,46 +126,53 @@ void Map::setTile(int32_t x, int32_t y, int32_t z, Tile* newTile)
 		return;
 	}
 
-	QTreeLeafNode::newLeaf = false;
-	QTreeLeafNode* leaf = root.createLeaf(x, y, 15);
-
-	if (QTreeLeafNode::newLeaf) {
-		//update north
-		QTreeLeafNode* northLeaf = root.getLeaf(x, y - FLOOR_SIZE);
-		if (northLeaf) {
-			northLeaf->m_leafS = leaf;
+	if (useTileGrid) {
+		if (!tileGrid.setTile(x, y, z, newTile)) {
+			std::cout << "Error: Map::setTile() already exists." << std::endl;
 		}
+	} else {
+		QTreeLeafNode::newLeaf = false;
+		QTreeLeafNode* leaf = root.createLeaf(x, y, 15);
+
+		if (QTreeLeafNode::newLeaf) {
+			//update north
+			QTreeLeafNode* northLeaf = root.getLeaf(x, y - FLOOR_SIZE);
+			if (northLeaf) {
+				northLeaf->m_leafS = leaf;
+			}
 
-		//update west leaf
-		QTreeLeafNode* westLeaf = root.getLeaf(x - FLOOR_SIZE, y);
-		if (westLeaf) {
-			westLeaf->m_leafE = leaf;
-		}
+			//update west leaf
+			QTreeLeafNode* westLeaf = root.getLeaf(x - FLOOR_SIZE, y);
+			if (westLeaf) {
+				westLeaf->m_leafE = leaf;
+			}
 
-		//update south
-		QTreeLeafNode* southLeaf = root.getLeaf(x, y + FLOOR_SIZE);
-		if (southLeaf) {
-			leaf->m_leafS = southLeaf;
-		}
+			//update south
+			QTreeLeafNode* southLeaf = root.getLeaf(x, y + FLOOR_SIZE);
+			if (southLeaf) {
+				leaf->m_leafS = southLeaf;
+			}
 
-		//update east
-		QTreeLeafNode* eastLeaf = root.getLeaf(x + FLOOR_SIZE, y);
-		if (eastLeaf) {
-			leaf->m_leafE = eastLeaf;
+			//update east
+			QTreeLeafNode* eastLeaf = root.getLeaf(x + FLOOR_SIZE, y);
+			if (eastLeaf) {
+				leaf->m_leafE = eastLeaf;
+			}
 		}
-	}
 
-	Floor* floor = leaf->createFloor(z);
-	uint32_t offsetX = x & FLOOR_MASK;
-	uint32_t offsetY = y & FLOOR_MASK;
+		Floor* floor = leaf->createFloor(z);
+		uint32_t offsetX = x & FLOOR_MASK;
+		uint32_t offsetY = y & FLOOR_MASK;
 
-	if (!floor->tiles[offsetX][offsetY]) {
-		floor->tiles[offsetX][offsetY] = newTile;
-		newTile->qt_node = leaf;
-	} else {
-		std::cout << "Error: Map::setTile() already exists." << std::endl;
+		if (!floor->tiles[offsetX][offsetY]) {
+			floor->tiles[offsetX][offsetY] = newTile;
+		} else {
+			std::cout << "Error: Map::setTile() already exists." << std::endl;
+		}
 	}
 
+	tileDescriptionCache.invalidate(Position(x, y, z));
+
 	if (newTile->hasFlag(TILESTATE_REFRESH)) {
 		RefreshBlock_t rb;
 		rb.lastRefresh = OTSYS_TIME();
@@ -280,8 +277,7 @@ bool Map::placeCreature(const Position& centerPos, Creature* creature, bool exte
 	uint32_t flags = 0;
 	Cylinder* toCylinder = tile->__queryDestination(index, creature, &toItem, flags);
 	toCylinder->__internalAddThing(creature);
-	Tile* toTile = toCylinder->getTile();
-	toTile->qt_node->addCreature(creature);
+	spectatorIndex.addCreature(creature, toCylinder->getTile()->getPosition());
 	return true;
 }
 
@@ -292,69 +288,86 @@ bool Map::removeCreature(Creature* creature)
 		return false;
 	}
 
-	tile->qt_node->removeCreature(creature);
+	spectatorIndex.removeCreature(creature, tile->getPosition());
 	tile->__removeThing(creature, 0);
+
+	eraseFlowField(creature->getID());
 	return true;
 }
 
-void Map::getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, int32_t minRangeX, int32_t maxRangeX, int32_t minRangeY, int32_t maxRangeY, int32_t minRangeZ, int32_t maxRangeZ, bool onlyPlayers)
+static void getSpectatorFloors(int32_t z, int32_t& minRangeZ, int32_t& maxRangeZ)
+{
+	if (z > 7) {
+		//underground
+
+		//8->15
+		minRangeZ = std::max<int32_t>(z - 2, 0);
+		maxRangeZ = std::min<int32_t>(z + 2, MAP_MAX_LAYERS - 1);
+	}
+	//above ground
+	else if (z == 6) {
+		minRangeZ = 0;
+		maxRangeZ = 8;
+	} else if (z == 7) {
+		minRangeZ = 0;
+		maxRangeZ = 9;
+	} else {
+		minRangeZ = 0;
+		maxRangeZ = 7;
+	}
+}
+
+static void filterSpectators(SpectatorVec& list, const CreatureVector& creatures, const Position& centerPos,
+                             int32_t minRangeX, int32_t maxRangeX, int32_t minRangeY, int32_t maxRangeY,
+                             int32_t minRangeZ, int32_t maxRangeZ)
 {
 	int_fast16_t min_y = centerPos.y + minRangeY;
 	int_fast16_t min_x = centerPos.x + minRangeX;
 	int_fast16_t max_y = centerPos.y + maxRangeY;
 	int_fast16_t max_x = centerPos.x + maxRangeX;
 
-	int32_t minoffset = centerPos.getZ() - maxRangeZ;
-	int32_t x1 = std::min<int32_t>(0xFFFF, std::max<int32_t>(0, (min_x + minoffset)));
-	int32_t y1 = std::min<int32_t>(0xFFFF, std::max<int32_t>(0, (min_y + minoffset)));
+	for (Creature* creature : creatures) {
+		const Position& cpos = creature->getPosition();
+		if (cpos.z < minRangeZ || cpos.z > maxRangeZ) {
+			continue;
+		}
 
-	int32_t maxoffset = centerPos.getZ() - minRangeZ;
-	int32_t x2 = std::min<int32_t>(0xFFFF, std::max<int32_t>(0, (max_x + maxoffset)));
-	int32_t y2 = std::min<int32_t>(0xFFFF, std::max<int32_t>(0, (max_y + maxoffset)));
-
-	int32_t startx1 = x1 - (x1 % FLOOR_SIZE);
-	int32_t starty1 = y1 - (y1 % FLOOR_SIZE);
-	int32_t endx2 = x2 - (x2 % FLOOR_SIZE);
-	int32_t endy2 = y2 - (y2 % FLOOR_SIZE);
-
-	QTreeLeafNode* startLeaf = getLeaf(startx1, starty1);
-	QTreeLeafNode* leafS = startLeaf;
-	QTreeLeafNode* leafE;
-
-	for (int32_t ny = starty1; ny <= endy2; ny += FLOOR_SIZE) {
-		leafE = leafS;
-		for (int32_t nx = startx1; nx <= endx2; nx += FLOOR_SIZE) {
-			if (leafE) {
-				const CreatureVector& node_list = (onlyPlayers ? leafE->player_list : leafE->creature_list);
-				for (Creature* creature : node_list) {
-					const Position& cpos = creature->getPosition();
-					if (cpos.z < minRangeZ || cpos.z > maxRangeZ) {
-						continue;
-					}
+		int_fast16_t offsetZ = Position::getOffsetZ(centerPos, cpos);
+		if (cpos.y < (min_y + offsetZ) || cpos.y > (max_y + offsetZ)) {
+			continue;
+		}
 
-					int_fast16_t offsetZ = Position::getOffsetZ(centerPos, cpos);
-					if (cpos.y < (min_y + offsetZ) || cpos.y > (max_y + offsetZ)) {
-						continue;
-					}
+		if (cpos.x < (min_x + offsetZ) || cpos.x > (max_x + offsetZ)) {
+			continue;
+		}
 
-					if (cpos.x < (min_x + offsetZ) || cpos.x > (max_x + offsetZ)) {
-						continue;
-					}
+		list.push_back(creature);
+	}
+}
 
-					list.insert(creature);
-				}
+void Map::getSpectatorsInternal(SpectatorVec& list, const Position& centerPos, int32_t minRangeX, int32_t maxRangeX, int32_t minRangeY, int32_t maxRangeY, int32_t minRangeZ, int32_t maxRangeZ, bool onlyPlayers)
+{
+	int32_t minoffset = centerPos.getZ() - maxRangeZ;
+	int32_t x1 = std::min<int32_t>(0xFFFF, std::max<int32_t>(0, (centerPos.x + minRangeX + minoffset)));
+	int32_t y1 = std::min<int32_t>(0xFFFF, std::max<int32_t>(0, (centerPos.y + minRangeY + minoffset)));
 
-				leafE = leafE->stepEast();
-			} else {
-				leafE = getLeaf(nx + FLOOR_SIZE, ny);
+	int32_t maxoffset = centerPos.getZ() - minRangeZ;
+	int32_t x2 = std::min<int32_t>(0xFFFF, std::max<int32_t>(0, (centerPos.x + maxRangeX + maxoffset)));
+	int32_t y2 = std::min<int32_t>(0xFFFF, std::max<int32_t>(0, (centerPos.y + maxRangeY + maxoffset)));
+
+	int32_t startCellX = x1 >> SPECTATOR_CELL_BITS;
+	int32_t startCellY = y1 >> SPECTATOR_CELL_BITS;
+	int32_t endCellX = x2 >> SPECTATOR_CELL_BITS;
+	int32_t endCellY = y2 >> SPECTATOR_CELL_BITS;
+
+	for (int32_t cellY = startCellY; cellY <= endCellY; ++cellY) {
+		for (int32_t cellX = startCellX; cellX <= endCellX; ++cellX) {
+			const SpectatorCell* cell = spectatorIndex.getCell(cellX, cellY);
+			if (cell) {
+				filterSpectators(list, (onlyPlayers ? cell->players : cell->creatures), centerPos,
+				                 minRangeX, maxRangeX, minRangeY, maxRangeY, minRangeZ, maxRangeZ);
 			}
 		}
-
-		if (leafS) {
-			leafS = leafS->stepSouth();
-		} else {
-			leafS = getLeaf(startx1, ny + FLOOR_SIZE);
-		}
 	}
 }
 
@@ -366,145 +379,43 @@ void Map::getSpectators(SpectatorVec& list, const Position& centerPos, bool mult
 		return;
 	}
 
-	bool foundCache = false;
-	bool cacheResult = false;
-
 	minRangeX = (minRangeX == 0 ? -maxViewportX : -minRangeX);
 	maxRangeX = (maxRangeX == 0 ? maxViewportX : maxRangeX);
 	minRangeY = (minRangeY == 0 ? -maxViewportY : -minRangeY);
 	maxRangeY = (maxRangeY == 0 ? maxViewportY : maxRangeY);
 
-	if (minRangeX == -maxViewportX && maxRangeX == maxViewportX && minRangeY == -maxViewportY && maxRangeY == maxViewportY && multifloor) {
-		if (onlyPlayers) {
-			auto it = playersSpectatorCache.find(centerPos);
-			if (it != playersSpectatorCache.end()) {
-				if (!list.empty()) {
-					const SpectatorVec& cachedList = *it->second;
-					list.insert(cachedList.begin(), cachedList.end());
-				} else {
-					list = *it->second;
-				}
-
-				foundCache = true;
-			}
-		}
-
-		if (!foundCache) {
-			auto it = spectatorCache.find(centerPos);
-			if (it != spectatorCache.end()) {
-				if (!onlyPlayers) {
-					if (!list.empty()) {
-						const SpectatorVec& cachedList = *it->second;
-						list.insert(cachedList.begin(), cachedList.end());
-					} else {
-						list = *it->second;
-					}
-				} else {
-					const SpectatorVec& cachedList = *it->second;
-					for (Creature* spectator : cachedList) {
-						if (spectator->getPlayer()) {
-							list.insert(spectator);
-						}
-					}
-				}
+	int32_t minRangeZ;
+	int32_t maxRangeZ;
 
-				foundCache = true;
-			} else {
-				cacheResult = true;
-			}
-		}
+	if (multifloor) {
+		getSpectatorFloors(centerPos.z, minRangeZ, maxRangeZ);
+	} else {
+		minRangeZ = centerPos.z;
+		maxRangeZ = centerPos.z;
 	}
 
-	if (!foundCache) {
-		int32_t minRangeZ;
-		int32_t maxRangeZ;
-
-		if (multifloor) {
-			if (centerPos.z > 7) {
-				//underground
-
-				//8->15
-				minRangeZ = std::max<int32_t>(centerPos.getZ() - 2, 0);
-				maxRangeZ = std::min<int32_t>(centerPos.getZ() + 2, MAP_MAX_LAYERS - 1);
-			}
-			//above ground
-			else if (centerPos.z == 6) {
-				minRangeZ = 0;
-				maxRangeZ = 8;
-			} else if (centerPos.z == 7) {
-				minRangeZ = 0;
-				maxRangeZ = 9;
-			} else {
-				minRangeZ = 0;
-				maxRangeZ = 7;
-			}
-		} else {
-			minRangeZ = centerPos.z;
-			maxRangeZ = centerPos.z;
-		}
+	//every creature is in exactly one cell and at most once in a sector,
+	//so only merging into earlier results can add duplicates
+	bool merge = !list.empty();
 
+	if (minRangeX >= -maxViewportX && maxRangeX <= maxViewportX && minRangeY >= -maxViewportY && maxRangeY <= maxViewportY) {
+		const SpectatorSector& sector = spectatorIndex.getSector(centerPos);
+		filterSpectators(list, (onlyPlayers ? sector.players : sector.creatures), centerPos,
+		                 minRangeX, maxRangeX, minRangeY, maxRangeY, minRangeZ, maxRangeZ);
+	} else {
 		getSpectatorsInternal(list, centerPos, minRangeX, maxRangeX, minRangeY, maxRangeY, minRangeZ, maxRangeZ, onlyPlayers);
-
-		if (cacheResult) {
-			if (onlyPlayers) {
-				playersSpectatorCache[centerPos].reset(new SpectatorVec(list));
-			} else {
-				spectatorCache[centerPos].reset(new SpectatorVec(list));
-			}
-		}
 	}
-}
 
-const SpectatorVec& Map::getSpectators(const Position& centerPos)
-{
-	if (centerPos.z >= MAP_MAX_LAYERS) {
-		std::shared_ptr<SpectatorVec> p(new SpectatorVec());
-		SpectatorVec& list = *p;
-		return list;
+	if (merge) {
+		list.removeDuplicates();
 	}
-
-	auto it = spectatorCache.find(centerPos);
-	if (it != spectatorCache.end()) {
-		return *it->second;
-	}
-
-	std::shared_ptr<SpectatorVec> p(new SpectatorVec());
-	spectatorCache[centerPos] = p;
-	SpectatorVec& list = *p;
-
-	int32_t minRangeX = -maxViewportX;
-	int32_t maxRangeX = maxViewportX;
-	int32_t minRangeY = -maxViewportY;
-	int32_t maxRangeY = maxViewportY;
-	int32_t minRangeZ, maxRangeZ;
-
-	if (centerPos.z > 7) {
-		//underground
-
-		//8->15
-		minRangeZ = std::max<int32_t>(centerPos.z - 2, 0);
-		maxRangeZ = std::min<int32_t>(centerPos.z + 2, MAP_MAX_LAYERS - 1);
-	}
-	//above ground
-	else if (centerPos.z == 6) {
-		minRangeZ = 0;
-		maxRangeZ = 8;
-	} else if (centerPos.z == 7) {
-		minRangeZ = 0;
-		maxRangeZ = 9;
-	} else {
-		minRangeZ = 0;
-		maxRangeZ = 7;
-	}
-
-	getSpectatorsInternal(list, centerPos, minRangeX, maxRangeX, minRangeY, maxRangeY, minRangeZ, maxRangeZ, false);
-	return list;
 }
 
-void Map::clearSpectatorCache()
+SpectatorVec Map::getSpectators(const Position& centerPos)
 {
-	spectatorCache.clear();
-	playersSpectatorCache.clear();
+	SpectatorVec list;
+	getSpectators(list, centerPos, true);
+	return list;
 }
 
 bool Map::canThrowObjectTo(const Position& fromPos, const Position& toPos, bool checkLineOfSight /*= true*/,
@@ -628,20 +539,14 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
 		return false;
 	}
 
-	std::unordered_map<uint32_t, AStarNode*> nodeTable;
-
-	AStarNodes nodes;
-	AStarNode* startNode = nodes.createOpenNode();
-
-	nodeTable[(destPos.x * 0xFFFF) + destPos.y] = startNode;
-
-	startNode->x = destPos.x;
-	startNode->y = destPos.y;
+	AStarNodes& nodes = pathNodes;
+	nodes.clear();
 
+	AStarNode* startNode = nodes.createNode(nullptr, destPos.x, destPos.y);
 	startNode->g = 0;
 	startNode->h = nodes.getEstimatedDistance(destPos.x, destPos.y, endPos.x, endPos.y);
 	startNode->f = startNode->h;
-	startNode->parent = nullptr;
+	nodes.openNode(startNode);
 
 	Position pos;
 	pos.z = destPos.z;
@@ -688,39 +593,24 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
 						const int_fast32_t cost = nodes.getMapWalkCost(creature, n, tile, pos);
 						const int_fast32_t extraCost = nodes.getTileWalkCost(creature, tile);
 						const int_fast32_t newg = n->g + cost + extraCost;
-						const uint32_t tableIndex = (pos.x * 0xFFFF) + pos.y;
 
 						//Check if the node is already in the closed/open list
 						//If it exists and the nodes already on them has a lower cost (g) then we can ignore this neighbour node
 
-						AStarNode* neighbourNode;
-						auto it = nodeTable.find(tableIndex);
-						if (it != nodeTable.end()) {
-							neighbourNode = it->second;
-						} else {
-							neighbourNode = nullptr;
-						}
-
+						AStarNode* neighbourNode = nodes.getNodeByPosition(pos.x, pos.y);
 						if (neighbourNode) {
 							if (neighbourNode->g <= newg) {
 								continue;    //The node on the closed/open list is cheaper than this one
 							}
-
-							nodes.openNode(neighbourNode);
 						} else {
 							//Does not exist in the open/closed list, create a new node
-							neighbourNode = nodes.createOpenNode();
+							neighbourNode = nodes.createNode(n, pos.x, pos.y);
 
 							if (!neighbourNode) {
 								//seems we ran out of nodes
 								listDir.clear();
 								return false;
 							}
-
-							nodeTable[tableIndex] = neighbourNode;
-
-							neighbourNode->x = pos.x;
-							neighbourNode->y = pos.y;
 						}
 
 						//This node is the best node so far with this state
@@ -728,6 +618,7 @@ bool Map::getPathTo(const Creature* creature, const Position& destPos,
 						neighbourNode->g = newg;
 						neighbourNode->h = nodes.getEstimatedDistance(pos.x, pos.y, endPos.x, endPos.y);
 						neighbourNode->f = newg + neighbourNode->h;
+						nodes.openNode(neighbourNode);
 					}
 				}
 			}
@@ -782,18 +673,12 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
 	Position startPos = creature->getPosition();
 	Position endPos;
 
-	std::unordered_map<uint32_t, AStarNode*> nodeTable;
-
-	AStarNodes nodes;
-	AStarNode* startNode = nodes.createOpenNode();
-
-	nodeTable[(startPos.x * 0xFFFF) + startPos.y] = startNode;
-
-	startNode->x = startPos.x;
-	startNode->y = startPos.y;
+	AStarNodes& nodes = pathNodes;
+	nodes.clear();
 
+	AStarNode* startNode = nodes.createNode(nullptr, startPos.x, startPos.y);
 	startNode->f = 0;
-	startNode->parent = nullptr;
+	nodes.openNode(startNode);
 
 	Position pos(0, 0, startPos.z);
 	int32_t bestMatch = 0;
@@ -859,29 +744,19 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
 					const int_fast32_t cost = nodes.getMapWalkCost(creature, n, tile, pos);
 					const int_fast32_t extraCost = nodes.getTileWalkCost(creature, tile);
 					const int_fast32_t newf = n->f + cost + extraCost;
-					const uint32_t tableIndex = (pos.x * 0xFFFF) + pos.y;
 
 					//Check if the node is already in the closed/open list
 					//If it exists and the nodes already on them has a lower cost (g) then we can ignore this neighbour node
 
-					AStarNode* neighbourNode;
-					auto it = nodeTable.find(tableIndex);
-					if (it != nodeTable.end()) {
-						neighbourNode = it->second;
-					} else {
-						neighbourNode = nullptr;
-					}
-
+					AStarNode* neighbourNode = nodes.getNodeByPosition(pos.x, pos.y);
 					if (neighbourNode) {
 						if (neighbourNode->f <= newf) {
 							//The node on the closed/open list is cheaper than this one
 							continue;
 						}
-
-						nodes.openNode(neighbourNode);
 					} else {
 						//Does not exist in the open/closed list, create a new node
-						neighbourNode = nodes.createOpenNode();
+						neighbourNode = nodes.createNode(n, pos.x, pos.y);
 
 						if (!neighbourNode) {
 							if (found) {
@@ -893,16 +768,12 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
 							dirList.clear();
 							return false;
 						}
-
-						nodeTable[tableIndex] = neighbourNode;
-
-						neighbourNode->x = pos.x;
-						neighbourNode->y = pos.y;
 					}
 
 					//This node is the best node so far with this state
 					neighbourNode->parent = n;
 					neighbourNode->f = newf;
+					nodes.openNode(neighbourNode);
 				}
 			}
 		}
@@ -952,90 +823,379 @@ bool Map::getPathMatching(const Creature* creature, std::list<Direction>& dirLis
 	return true;
 }
 
+bool Map::getPathToCreature(const Creature* creature, const Creature* target,
+                            std::list<Direction>& dirList, const FindPathParams& fpp)
+{
+	if (getFlowFieldPath(creature, target, dirList, fpp)) {
+		return true;
+	}
+	return getPathMatching(creature, dirList, FrozenPathingConditionCall(target->getPosition()), fpp);
+}
+
+bool Map::getFlowFieldPath(const Creature* creature, const Creature* target,
+                           std::list<Direction>& dirList, const FindPathParams& fpp)
+{
+	//the field only describes monsters walking next to their target
+	if (!creature->getMonster() || fpp.maxTargetDist != 1 || fpp.minTargetDist > 1 || fpp.keepDistance || !fpp.allowDiagonal) {
+		return false;
+	}
+
+	const Position& startPos = creature->getPosition();
+	const Position& targetPos = target->getPosition();
+	if (!FlowField::isInRange(targetPos, startPos)) {
+		return false;
+	}
+
+	int64_t now = OTSYS_TIME();
+	if (now >= nextFlowFieldCleanup) {
+		cleanFlowFields(now);
+		nextFlowFieldCleanup = now + FLOW_FIELD_EXPIRATION;
+	}
+
+	const uint32_t targetId = target->getID();
+	FlowField& field = flowFields[targetId];
+	field.setLastQuery(now);
+
+	if (!field.isBuiltFor(targetPos)) {
+		//a field that moved with its target covers other cells now
+		bool moved = !field.hasTargetPos() || field.getTargetPos() != targetPos;
+		if (moved && field.hasTargetPos()) {
+			removeFlowFieldCells(targetId, field.getTargetPos());
+		}
+
+		field.build(*this, targetPos);
+
+		if (moved) {
+			addFlowFieldCells(targetId, targetPos);
+		}
+	}
+
+	uint16_t distance = field.getDistance(startPos);
+	if (distance == 0 || distance == FLOW_FIELD_UNREACHABLE) {
+		return false;
+	}
+
+	static const struct {
+		int32_t dx, dy;
+		Direction dir;
+	} neighbours[8] = {
+		{-1, 0, WEST},
+		{0, 1, SOUTH},
+		{1, 0, EAST},
+		{0, -1, NORTH},
+
+		//diagonal
+		{-1, -1, NORTHWEST},
+		{1, -1, NORTHEAST},
+		{1, 1, SOUTHEAST},
+		{-1, 1, SOUTHWEST},
+	};
+
+	//follow the field downhill, any step this creature can not take on its own
+	//terms (blocked, a creature or a magic field in the way) hands over to A*
+	dirList.clear();
+
+	Position pos = startPos;
+	while (distance != 0) {
+		bool stepped = false;
+
+		for (int32_t i = 0; i < 8; ++i) {
+			Position nextPos(pos.x + neighbours[i].dx, pos.y + neighbours[i].dy, pos.z);
+			if (!FlowField::isInRange(targetPos, nextPos)) {
+				continue;
+			}
+
+			const uint16_t cost = (i < 4 ? MAP_NORMALWALKCOST : MAP_DIAGONALWALKCOST);
+			if (field.getDistance(nextPos) + cost != distance) {
+				continue;
+			}
+
+			if (fpp.maxSearchDist != -1 && (Position::getDistanceX(startPos, nextPos) > fpp.maxSearchDist ||
+			                                Position::getDistanceY(startPos, nextPos) > fpp.maxSearchDist)) {
+				continue;
+			}
+
+			const Tile* tile = canWalkTo(creature, nextPos);
+			if (!tile || AStarNodes::getTileWalkCost(creature, tile) != 0) {
+				continue;
+			}
+
+			dirList.push_back(neighbours[i].dir);
+			pos = nextPos;
+			distance -= cost;
+			stepped = true;
+			break;
+		}
+
+		if (!stepped) {
+			dirList.clear();
+			return false;
+		}
+	}
+
+	int32_t bestMatch = 0;
+	if (!FrozenPathingConditionCall(targetPos)(startPos, pos, fpp, bestMatch)) {
+		dirList.clear();
+		return false;
+	}
+	return true;
+}
+
+static uint32_t getFlowFieldCell(int32_t cellX, int32_t cellY, int32_t z)
+{
+	return (static_cast<uint32_t>(z) << 24) | (static_cast<uint32_t>(cellY) << 12) | static_cast<uint32_t>(cellX);
+}
+
+void Map::onTileChange(const Tile* tile)
+{
+	const Position& pos = tile->getPosition();
+	auto it = flowFieldCells.find(getFlowFieldCell(pos.x >> FLOW_FIELD_CELL_BITS, pos.y >> FLOW_FIELD_CELL_BITS, pos.z));
+	if (it == flowFieldCells.end()) {
+		return;
+	}
+
+	for (uint32_t targetId : it->second) {
+		auto fieldIt = flowFields.find(targetId);
+		if (fieldIt != flowFields.end()) {
+			fieldIt->second.onTileChange(tile);
+		}
+	}
+}
+
+void Map::addFlowFieldCells(uint32_t targetId, const Position& targetPos)
+{
+	int32_t minCellX = std::max<int32_t>(0, targetPos.x - FLOW_FIELD_RADIUS) >> FLOW_FIELD_CELL_BITS;
+	int32_t maxCellX = (targetPos.x + FLOW_FIELD_RADIUS) >> FLOW_FIELD_CELL_BITS;
+	int32_t minCellY = std::max<int32_t>(0, targetPos.y - FLOW_FIELD_RADIUS) >> FLOW_FIELD_CELL_BITS;
+	int32_t maxCellY = (targetPos.y + FLOW_FIELD_RADIUS) >> FLOW_FIELD_CELL_BITS;
+
+	for (int32_t cellY = minCellY; cellY <= maxCellY; ++cellY) {
+		for (int32_t cellX = minCellX; cellX <= maxCellX; ++cellX) {
+			flowFieldCells[getFlowFieldCell(cellX, cellY, targetPos.z)].push_back(targetId);
+		}
+	}
+}
+
+void Map::removeFlowFieldCells(uint32_t targetId, const Position& targetPos)
+{
+	int32_t minCellX = std::max<int32_t>(0, targetPos.x - FLOW_FIELD_RADIUS) >> FLOW_FIELD_CELL_BITS;
+	int32_t maxCellX = (targetPos.x + FLOW_FIELD_RADIUS) >> FLOW_FIELD_CELL_BITS;
+	int32_t minCellY = std::max<int32_t>(0, targetPos.y - FLOW_FIELD_RADIUS) >> FLOW_FIELD_CELL_BITS;
+	int32_t maxCellY = (targetPos.y + FLOW_FIELD_RADIUS) >> FLOW_FIELD_CELL_BITS;
+
+	for (int32_t cellY = minCellY; cellY <= maxCellY; ++cellY) {
+		for (int32_t cellX = minCellX; cellX <= maxCellX; ++cellX) {
+			auto it = flowFieldCells.find(getFlowFieldCell(cellX, cellY, targetPos.z));
+			if (it == flowFieldCells.end()) {
+				continue;
+			}
+
+			std::vector<uint32_t>& targetIds = it->second;
+			auto targetIt = std::find(targetIds.begin(), targetIds.end(), targetId);
+			if (targetIt != targetIds.end()) {
+				*targetIt = targetIds.back();
+				targetIds.pop_back();
+			}
+
+			if (targetIds.empty()) {
+				flowFieldCells.erase(it);
+			}
+		}
+	}
+}
+
+void Map::eraseFlowField(uint32_t targetId)
+{
+	auto it = flowFields.find(targetId);
+	if (it == flowFields.end()) {
+		return;
+	}
+
+	if (it->second.hasTargetPos()) {
+		removeFlowFieldCells(targetId, it->second.getTargetPos());
+	}
+	flowFields.erase(it);
+}
+
+void Map::cleanFlowFields(int64_t time)
+{
+	auto it = flowFields.begin();
+	while (it != flowFields.end()) {
+		FlowField& field = it->second;
+		if (time - field.getLastQuery() < FLOW_FIELD_EXPIRATION) {
+			++it;
+			continue;
+		}
+
+		if (field.hasTargetPos()) {
+			removeFlowFieldCells(it->first, field.getTargetPos());
+		}
+		it = flowFields.erase(it);
+	}
+}
+
 //*********** AStarNodes *************
 
 AStarNodes::AStarNodes()
 {
 	curNode = 0;
-	openNodes.reset();
+	openCount = 0;
+	generation = 1;
+	memset(nodeTable, 0, sizeof(nodeTable));
 }
 
-AStarNode* AStarNodes::createOpenNode()
+void AStarNodes::clear()
 {
-	if (curNode >= MAX_NODES) {
-		return nullptr;
-	}
+	curNode = 0;
+	openCount = 0;
 
-	uint32_t ret_node = curNode++;
-	openNodes[ret_node] = 1;
-	return &nodes[ret_node];
+	// table entries of older searches are recognized by their generation
+	if (++generation == 0) {
+		memset(nodeTable, 0, sizeof(nodeTable));
+		generation = 1;
+	}
 }
 
-AStarNode* AStarNodes::getBestNode()
+AStarNode* AStarNodes::createNode(AStarNode* parent, int32_t x, int32_t y)
 {
-	if (curNode == 0) {
+	if (curNode >= MAX_NODES) {
 		return nullptr;
 	}
 
-	int32_t best_node_f = std::numeric_limits<int32_t>::max();
-	int32_t best_node = -1;
-	for (uint32_t i = 0; i < curNode; i++) {
-		if (nodes[i].f < best_node_f && openNodes[i] == 1) {
-			best_node_f = nodes[i].f;
-			best_node = i;
-		}
+	uint16_t index = curNode++;
+	heapPosition[index] = -1;
+
+	AStarNode* node = &nodes[index];
+	node->x = x;
+	node->y = y;
+	node->parent = parent;
+	node->f = 0;
+	node->g = 0;
+	node->h = 0;
+
+	const uint32_t key = getNodeKey(x, y);
+	uint32_t slot = (key * 2654435761U) & (NODE_TABLE_SIZE - 1);
+	while (nodeTable[slot].generation == generation) {
+		slot = (slot + 1) & (NODE_TABLE_SIZE - 1);
 	}
 
-	if (best_node >= 0) {
-		return &nodes[best_node];
+	NodeTableEntry& entry = nodeTable[slot];
+	entry.key = key;
+	entry.generation = generation;
+	entry.node = index;
+	return node;
+}
+
+AStarNode* AStarNodes::getNodeByPosition(int32_t x, int32_t y)
+{
+	const uint32_t key = getNodeKey(x, y);
+	uint32_t slot = (key * 2654435761U) & (NODE_TABLE_SIZE - 1);
+	while (nodeTable[slot].generation == generation) {
+		if (nodeTable[slot].key == key) {
+			return &nodes[nodeTable[slot].node];
+		}
+		slot = (slot + 1) & (NODE_TABLE_SIZE - 1);
 	}
 	return nullptr;
 }
 
+AStarNode* AStarNodes::getBestNode()
+{
+	if (openCount == 0) {
+		return nullptr;
+	}
+	return &nodes[openHeap[0]];
+}
+
 void AStarNodes::closeNode(AStarNode* node)
 {
 	uint32_t pos = GET_NODE_INDEX(node);
-	if (pos >= MAX_NODES) {
-		assert(pos >= MAX_NODES);
+	if (pos >= curNode) {
 		std::cout << "AStarNodes. trying to close node out of range" << std::endl;
 		return;
 	}
 
-	openNodes[pos] = 0;
+	int32_t heapPos = heapPosition[pos];
+	if (heapPos < 0) {
+		return;
+	}
+
+	heapPosition[pos] = -1;
+	if (static_cast<uint32_t>(heapPos) == --openCount) {
+		return;
+	}
+
+	// move the last heap entry into the hole and restore the heap order
+	uint16_t moved = openHeap[openCount];
+	openHeap[heapPos] = moved;
+	heapPosition[moved] = heapPos;
+
+	siftUp(heapPos);
+	if (heapPosition[moved] == heapPos) {
+		siftDown(heapPos);
+	}
 }
 
 void AStarNodes::openNode(AStarNode* node)
 {
 	uint32_t pos = GET_NODE_INDEX(node);
-	if (pos >= MAX_NODES) {
-		assert(pos >= MAX_NODES);
+	if (pos >= curNode) {
 		std::cout << "AStarNodes. trying to open node out of range" << std::endl;
 		return;
 	}
 
-	openNodes[pos] = 1;
+	// the cost of a node only ever goes down, so it can only move up in the heap
+	if (heapPosition[pos] < 0) {
+		heapPosition[pos] = openCount;
+		openHeap[openCount] = pos;
+		siftUp(openCount++);
+	} else {
+		siftUp(heapPosition[pos]);
+	}
 }
 
-uint32_t AStarNodes::countClosedNodes()
+void AStarNodes::siftUp(uint32_t heapPos)
 {
-	uint32_t counter = 0;
-	for (uint32_t i = 0; i < curNode; i++) {
-		if (openNodes[i] == 0) {
-			counter++;
+	uint16_t index = openHeap[heapPos];
+	while (heapPos > 0) {
+		uint32_t parentPos = (heapPos - 1) / 2;
+		if (!isBetterNode(index, openHeap[parentPos])) {
+			break;
 		}
+
+		openHeap[heapPos] = openHeap[parentPos];
+		heapPosition[openHeap[heapPos]] = heapPos;
+		heapPos = parentPos;
 	}
-	return counter;
+
+	openHeap[heapPos] = index;
+	heapPosition[index] = heapPos;
 }
 
-uint32_t AStarNodes::countOpenNodes()
+void AStarNodes::siftDown(uint32_t heapPos)
 {
-	uint32_t counter = 0;
-	for (uint32_t i = 0; i < curNode; i++) {
-		if (openNodes[i] == 1) {
-			counter++;
+	uint16_t index = openHeap[heapPos];
+	while (true) {
+		uint32_t childPos = heapPos * 2 + 1;
+		if (childPos >= openCount) {
+			break;
 		}
+
+		if (childPos + 1 < openCount && isBetterNode(openHeap[childPos + 1], openHeap[childPos])) {
+			++childPos;
+		}
+
+		if (!isBetterNode(openHeap[childPos], index)) {
+			break;
+		}
+
+		openHeap[heapPos] = openHeap[childPos];
+		heapPosition[openHeap[heapPos]] = heapPos;
+		heapPos = childPos;
 	}
-	return counter;
+
+	openHeap[heapPos] = index;
+	heapPosition[index] = heapPos;
 }
 
 int32_t AStarNodes::getMapWalkCost(const Creature* creature, AStarNode* node,
@@ -1072,6 +1232,106 @@ int32_t AStarNodes::getEstimatedDistance(int32_t x, int32_t y, int32_t xGoal, in
 	return MAP_DIAGONALWALKCOST * h_diagonal + MAP_NORMALWALKCOST * (h_straight - 2 * h_diagonal);
 }
 
+//*********** FlowField **************
+
+void FlowField::build(Map& map, const Position& targetPos)
+{
+	this->targetPos = targetPos;
+	valid = true;
+	hasTarget = true;
+
+	for (int32_t y = -FLOW_FIELD_RADIUS; y <= FLOW_FIELD_RADIUS; ++y) {
+		for (int32_t x = -FLOW_FIELD_RADIUS; x <= FLOW_FIELD_RADIUS; ++x) {
+			uint32_t index = (y + FLOW_FIELD_RADIUS) * FLOW_FIELD_SIZE + (x + FLOW_FIELD_RADIUS);
+			walkable[index] = (x != 0 || y != 0) && isWalkable(map.getTile(targetPos.x + x, targetPos.y + y, targetPos.z));
+			distances[index] = FLOW_FIELD_UNREACHABLE;
+		}
+	}
+
+	//the open list is a min-heap of (distance << 16 | index)
+	openList.clear();
+	for (int32_t y = -1; y <= 1; ++y) {
+		for (int32_t x = -1; x <= 1; ++x) {
+			uint32_t index = (y + FLOW_FIELD_RADIUS) * FLOW_FIELD_SIZE + (x + FLOW_FIELD_RADIUS);
+			if (walkable[index]) {
+				distances[index] = 0;
+				openList.push_back(index);
+			}
+		}
+	}
+	std::make_heap(openList.begin(), openList.end(), std::greater<uint32_t>());
+
+	while (!openList.empty()) {
+		std::pop_heap(openList.begin(), openList.end(), std::greater<uint32_t>());
+		uint32_t distance = openList.back() >> 16;
+		uint32_t index = openList.back() & 0xFFFF;
+		openList.pop_back();
+
+		if (distance > distances[index]) {
+			continue;
+		}
+
+		int32_t x = index % FLOW_FIELD_SIZE;
+		int32_t y = index / FLOW_FIELD_SIZE;
+		for (int32_t dy = -1; dy <= 1; ++dy) {
+			int32_t ny = y + dy;
+			if (ny < 0 || ny >= FLOW_FIELD_SIZE) {
+				continue;
+			}
+
+			for (int32_t dx = -1; dx <= 1; ++dx) {
+				int32_t nx = x + dx;
+				if ((dx == 0 && dy == 0) || nx < 0 || nx >= FLOW_FIELD_SIZE) {
+					continue;
+				}
+
+				uint32_t neighbourIndex = ny * FLOW_FIELD_SIZE + nx;
+				if (!walkable[neighbourIndex]) {
+					continue;
+				}
+
+				uint32_t newDistance = distance + (dx != 0 && dy != 0 ? MAP_DIAGONALWALKCOST : MAP_NORMALWALKCOST);
+				if (newDistance < distances[neighbourIndex]) {
+					distances[neighbourIndex] = newDistance;
+					openList.push_back((newDistance << 16) | neighbourIndex);
+					std::push_heap(openList.begin(), openList.end(), std::greater<uint32_t>());
+				}
+			}
+		}
+	}
+}
+
+void FlowField::onTileChange(const Tile* tile)
+{
+	if (!valid) {
+		return;
+	}
+
+	const Position& pos = tile->getPosition();
+	if (!isInRange(targetPos, pos) || pos == targetPos) {
+		return;
+	}
+
+	if (walkable[getIndex(pos)] != isWalkable(tile)) {
+		valid = false;
+	}
+}
+
+bool FlowField::isWalkable(const Tile* tile)
+{
+	//everything Tile::__queryAdd lets at least one monster through while pathfinding
+	if (!tile || !tile->ground) {
+		return false;
+	}
+
+	if (tile->floorChange() || tile->positionChange()) {
+		return false;
+	}
+
+	return !tile->hasFlag(TILESTATE_PROTECTIONZONE) && !tile->hasFlag(TILESTATE_IMMOVABLEBLOCKSOLID) &&
+	       !tile->hasFlag(TILESTATE_IMMOVABLENOFIELDBLOCKPATH);
+}
+
 //*********** Floor **************
 
 Floor::~Floor()
@@ -1083,6 +1343,65 @@ Floor::~Floor()
 	}
 }
 
+//*********** TileGrid **************
+
+TileGridChunk::~TileGridChunk()
+{
+	for (uint32_t i = 0; i < TILE_GRID_SIZE; ++i) {
+		for (uint32_t j = 0; j < TILE_GRID_SIZE; ++j) {
+			delete tiles[i][j];
+		}
+	}
+}
+
+TileGrid::~TileGrid()
+{
+	for (uint32_t z = 0; z < MAP_MAX_LAYERS; ++z) {
+		for (TileGridChunk* chunk : m_chunks[z]) {
+			delete chunk;
+		}
+	}
+}
+
+bool TileGrid::setTile(uint32_t x, uint32_t y, uint32_t z, Tile* newTile)
+{
+	uint32_t chunkX = x >> TILE_GRID_BITS;
+	uint32_t chunkY = y >> TILE_GRID_BITS;
+	if (chunkX >= m_width || chunkY >= m_height) {
+		resize(std::max<uint32_t>(m_width, chunkX + 1), std::max<uint32_t>(m_height, chunkY + 1));
+	}
+
+	TileGridChunk*& chunk = m_chunks[z][chunkY * m_width + chunkX];
+	if (!chunk) {
+		chunk = new TileGridChunk();
+	}
+
+	Tile*& tile = chunk->tiles[x & TILE_GRID_MASK][y & TILE_GRID_MASK];
+	if (tile) {
+		return false;
+	}
+
+	tile = newTile;
+	return true;
+}
+
+void TileGrid::resize(uint32_t width, uint32_t height)
+{
+	// only happens while the map is being loaded
+	for (uint32_t z = 0; z < MAP_MAX_LAYERS; ++z) {
+		std::vector<TileGridChunk*> chunks(width * height, nullptr);
+		for (uint32_t chunkY = 0; chunkY < m_height; ++chunkY) {
+			for (uint32_t chunkX = 0; chunkX < m_width; ++chunkX) {
+				chunks[chunkY * width + chunkX] = m_chunks[z][chunkY * m_width + chunkX];
+			}
+		}
+		m_chunks[z].swap(chunks);
+	}
+
+	m_width = width;
+	m_height = height;
+}
+
 //**************** QTreeNode **********************
 QTreeNode::QTreeNode()
 {
@@ -1180,27 +1499,229 @@ Floor* QTreeLeafNode::createFloor(uint32_t z)
 	return m_array[z];
 }
 
-void QTreeLeafNode::addCreature(Creature* c)
+//*********** SpectatorIndex ************
+
+// swap-removes the element at index, returns the entry moved into its place
+static SpectatorEntry* eraseSpectator(CreatureVector& list, std::vector<SpectatorEntry*>& entries, uint32_t index)
+{
+	SpectatorEntry* moved = nullptr;
+	if (index + 1 != list.size()) {
+		list[index] = list.back();
+		entries[index] = entries.back();
+		moved = entries[index];
+	}
+
+	list.pop_back();
+	entries.pop_back();
+	return moved;
+}
+
+static SpectatorSlot& getSpectatorSlot(SpectatorEntry& entry, const SpectatorSector* sector)
+{
+	//a creature is only in the few sectors covering its cell
+	auto it = std::find_if(entry.slots.begin(), entry.slots.end(), [sector](const SpectatorSlot& slot) {
+		return slot.sector == sector;
+	});
+	assert(it != entry.slots.end());
+	return *it;
+}
+
+void SpectatorIndex::addCreature(Creature* creature, const Position& pos)
+{
+	SpectatorEntry& entry = m_entries[creature];
+	entry.creature = creature;
+	entry.isPlayer = (creature->getPlayer() != nullptr);
+	linkCreature(entry, pos);
+}
+
+void SpectatorIndex::removeCreature(Creature* creature, const Position& pos)
+{
+	auto it = m_entries.find(creature);
+	assert(it != m_entries.end());
+	unlinkCreature(it->second, pos);
+	m_entries.erase(it);
+}
+
+void SpectatorIndex::moveCreature(Creature* creature, const Position& oldPos, const Position& newPos)
+{
+	//sectors filter by floor, so a floor change has to be passed on even within a cell
+	if ((oldPos.x >> SPECTATOR_CELL_BITS) == (newPos.x >> SPECTATOR_CELL_BITS) &&
+	        (oldPos.y >> SPECTATOR_CELL_BITS) == (newPos.y >> SPECTATOR_CELL_BITS) && oldPos.z == newPos.z) {
+		return;
+	}
+
+	auto it = m_entries.find(creature);
+	assert(it != m_entries.end());
+	unlinkCreature(it->second, oldPos);
+	linkCreature(it->second, newPos);
+}
+
+void SpectatorIndex::linkCreature(SpectatorEntry& entry, const Position& pos)
+{
+	SpectatorCell& cell = m_cells[getCellKey(pos.x >> SPECTATOR_CELL_BITS, pos.y >> SPECTATOR_CELL_BITS)];
+
+	entry.creatureIndex = cell.creatures.size();
+	cell.creatures.push_back(entry.creature);
+	cell.creatureEntries.push_back(&entry);
+
+	if (entry.isPlayer) {
+		entry.playerIndex = cell.players.size();
+		cell.players.push_back(entry.creature);
+		cell.playerEntries.push_back(&entry);
+	}
+
+	for (SpectatorSector* sector : cell.sectors) {
+		if (pos.z >= sector->minRangeZ && pos.z <= sector->maxRangeZ) {
+			linkSector(entry, *sector);
+		}
+	}
+}
+
+void SpectatorIndex::unlinkCreature(SpectatorEntry& entry, const Position& pos)
 {
-	creature_list.push_back(c);
+	auto it = m_cells.find(getCellKey(pos.x >> SPECTATOR_CELL_BITS, pos.y >> SPECTATOR_CELL_BITS));
+	assert(it != m_cells.end());
+	SpectatorCell& cell = it->second;
+
+	SpectatorEntry* moved = eraseSpectator(cell.creatures, cell.creatureEntries, entry.creatureIndex);
+	if (moved) {
+		moved->creatureIndex = entry.creatureIndex;
+	}
+
+	if (entry.isPlayer) {
+		moved = eraseSpectator(cell.players, cell.playerEntries, entry.playerIndex);
+		if (moved) {
+			moved->playerIndex = entry.playerIndex;
+		}
+	}
+
+	for (const SpectatorSlot& slot : entry.slots) {
+		unlinkSector(entry, slot);
+	}
+	entry.slots.clear();
+
+	if (cell.creatures.empty() && cell.sectors.empty()) {
+		m_cells.erase(it);
+	}
+}
+
+void SpectatorIndex::linkSector(SpectatorEntry& entry, SpectatorSector& sector)
+{
+	SpectatorSlot slot;
+	slot.sector = &sector;
+	slot.creatureIndex = sector.creatures.size();
+	sector.creatures.push_back(entry.creature);
+	sector.creatureEntries.push_back(&entry);
+
+	if (entry.isPlayer) {
+		slot.playerIndex = sector.players.size();
+		sector.players.push_back(entry.creature);
+		sector.playerEntries.push_back(&entry);
+	} else {
+		slot.playerIndex = 0;
+	}
+
+	entry.slots.push_back(slot);
+}
+
+void SpectatorIndex::unlinkSector(SpectatorEntry& entry, const SpectatorSlot& slot)
+{
+	SpectatorSector* sector = slot.sector;
+
+	SpectatorEntry* moved = eraseSpectator(sector->creatures, sector->creatureEntries, slot.creatureIndex);
+	if (moved) {
+		getSpectatorSlot(*moved, sector).creatureIndex = slot.creatureIndex;
+	}
+
+	if (entry.isPlayer) {
+		moved = eraseSpectator(sector->players, sector->playerEntries, slot.playerIndex);
+		if (moved) {
+			getSpectatorSlot(*moved, sector).playerIndex = slot.playerIndex;
+		}
+	}
+}
+
+const SpectatorSector& SpectatorIndex::getSector(const Position& pos)
+{
+	if (++m_queries >= SPECTATOR_SECTOR_SWEEP_QUERIES) {
+		sweepSectors();
+		m_queries = 0;
+	}
+
+	uint32_t sectorX = pos.x >> SPECTATOR_CELL_BITS;
+	uint32_t sectorY = pos.y >> SPECTATOR_CELL_BITS;
+
+	uint64_t key = (static_cast<uint64_t>(getCellKey(sectorX, sectorY)) << 8) | pos.z;
+	auto it = m_sectors.find(key);
+	if (it != m_sectors.end()) {
+		++it->second.useCount;
+		return it->second;
+	}
+
+	SpectatorSector& sector = m_sectors[key];
+	sector.useCount = 1;
+	getSpectatorFloors(pos.z, sector.minRangeZ, sector.maxRangeZ);
+
+	//the cells seen from any position of the sector, see Map::getSpectatorsInternal
+	int32_t minoffset = pos.z - sector.maxRangeZ;
+	int32_t maxoffset = pos.z - sector.minRangeZ;
+
+	int32_t x1 = std::max<int32_t>(0, (sectorX << SPECTATOR_CELL_BITS) - Map::maxViewportX + minoffset);
+	int32_t y1 = std::max<int32_t>(0, (sectorY << SPECTATOR_CELL_BITS) - Map::maxViewportY + minoffset);
+	int32_t x2 = std::min<int32_t>(0xFFFF, ((sectorX + 1) << SPECTATOR_CELL_BITS) - 1 + Map::maxViewportX + maxoffset);
+	int32_t y2 = std::min<int32_t>(0xFFFF, ((sectorY + 1) << SPECTATOR_CELL_BITS) - 1 + Map::maxViewportY + maxoffset);
 
-	if (c->getPlayer()) {
-		player_list.push_back(c);
+	for (int32_t cellY = y1 >> SPECTATOR_CELL_BITS; cellY <= (y2 >> SPECTATOR_CELL_BITS); ++cellY) {
+		for (int32_t cellX = x1 >> SPECTATOR_CELL_BITS; cellX <= (x2 >> SPECTATOR_CELL_BITS); ++cellX) {
+			uint32_t cellKey = getCellKey(cellX, cellY);
+			SpectatorCell& cell = m_cells[cellKey];
+			cell.sectors.push_back(&sector);
+			sector.cells.push_back(cellKey);
+
+			for (SpectatorEntry* entry : cell.creatureEntries) {
+				const Position& cpos = entry->creature->getPosition();
+				if (cpos.z >= sector.minRangeZ && cpos.z <= sector.maxRangeZ) {
+					linkSector(*entry, sector);
+				}
+			}
+		}
 	}
+	return sector;
 }
 
-void QTreeLeafNode::removeCreature(Creature* c)
+void SpectatorIndex::sweepSectors()
 {
-	CreatureVector::iterator iter = std::find(creature_list.begin(), creature_list.end(), c);
-	assert(iter != creature_list.end());
-	std::swap(*iter, creature_list.back());
-	creature_list.pop_back();
+	auto it = m_sectors.begin();
+	while (it != m_sectors.end()) {
+		SpectatorSector& sector = it->second;
+		if (sector.useCount != 0) {
+			sector.useCount = 0;
+			++it;
+			continue;
+		}
+
+		//the whole sector goes, so its lists are left alone and only the slots are dropped
+		for (SpectatorEntry* entry : sector.creatureEntries) {
+			getSpectatorSlot(*entry, &sector) = entry->slots.back();
+			entry->slots.pop_back();
+		}
+
+		for (uint32_t cellKey : sector.cells) {
+			auto cellIt = m_cells.find(cellKey);
+			assert(cellIt != m_cells.end());
+
+			std::vector<SpectatorSector*>& sectors = cellIt->second.sectors;
+			auto sectorIt = std::find(sectors.begin(), sectors.end(), &sector);
+			assert(sectorIt != sectors.end());
+			*sectorIt = sectors.back();
+			sectors.pop_back();
+
+			if (sectors.empty() && cellIt->second.creatures.empty()) {
+				m_cells.erase(cellIt);
+			}
+		}
 
-	if (c->getPlayer()) {
-		iter = std::find(player_list.begin(), player_list.end(), c);
-		assert(iter != player_list.end());
-		std::swap(*iter, player_list.back());
-		player_list.pop_back();
+		it = m_sectors.erase(it);
 	}
 }
 
@@ -1247,3 +1768,106 @@ uint32_t Map::clean()
 	          << (OTSYS_TIME() - start) / (1000.) << " seconds." << std::endl;
 	return count;
 }
+
+//*********** TileDescriptionCache ************
+
+const TileDescription* TileDescriptionCache::getTileDescription(Map& map, int32_t x, int32_t y, int32_t z)
+{
+	if (x < 0 || x >= 0xFFFF || y < 0 || y >= 0xFFFF || z < 0 || z >= MAP_MAX_LAYERS) {
+		return nullptr;
+	}
+
+	const uint64_t key = getChunkKey(x, y, z);
+	if (!m_lastChunk || m_lastKey != key) {
+		if (m_chunks.size() >= TILE_DESCRIPTION_CACHE_MAX_CHUNKS) {
+			m_chunks.clear();
+		}
+
+		auto result = m_chunks.emplace(key, TileDescriptionChunk());
+		if (result.second) {
+			buildChunk(map, result.first->second, x & ~TILE_DESCRIPTION_CHUNK_MASK, y & ~TILE_DESCRIPTION_CHUNK_MASK, z);
+		}
+
+		m_lastKey = key;
+		m_lastChunk = &result.first->second;
+	}
+
+	const TileDescription& description = m_lastChunk->tiles[x & TILE_DESCRIPTION_CHUNK_MASK][y & TILE_DESCRIPTION_CHUNK_MASK];
+	if (!description.tile) {
+		return nullptr;
+	}
+	return &description;
+}
+
+void TileDescriptionCache::invalidate(const Position& pos)
+{
+	const uint64_t key = getChunkKey(pos.x, pos.y, pos.z);
+	if (m_lastKey == key) {
+		m_lastChunk = nullptr;
+	}
+	m_chunks.erase(key);
+}
+
+void TileDescriptionCache::buildChunk(Map& map, TileDescriptionChunk& chunk, int32_t x, int32_t y, int32_t z)
+{
+	// same order and limit as ProtocolGame::GetTileDescription, with the creatures left out
+	NetworkMessage msg;
+	std::vector<int32_t> starts;
+	starts.reserve(TILE_DESCRIPTION_CHUNK_SIZE * TILE_DESCRIPTION_CHUNK_SIZE);
+
+	for (int32_t cx = 0; cx < TILE_DESCRIPTION_CHUNK_SIZE; ++cx) {
+		for (int32_t cy = 0; cy < TILE_DESCRIPTION_CHUNK_SIZE; ++cy) {
+			TileDescription& description = chunk.tiles[cx][cy];
+			description.tile = map.getTile(x + cx, y + cy, z);
+			description.bytes = nullptr;
+			description.topCount = 0;
+			description.itemCount = 0;
+
+			Tile* tile = description.tile;
+			if (!tile) {
+				continue;
+			}
+
+			const int32_t start = msg.getMessageLength();
+			uint8_t count = 0;
+
+			if (tile->ground) {
+				msg.AddItem(tile->ground);
+				description.itemEnds[count++] = msg.getMessageLength() - start;
+			}
+
+			const TileItemVector* items = tile->getItemList();
+			if (items) {
+				for (auto it = items->getBeginTopItem(); it != items->getEndTopItem() && count < TILE_DESCRIPTION_MAX_THINGS; ++it) {
+					msg.AddItem(*it);
+					description.itemEnds[count++] = msg.getMessageLength() - start;
+				}
+			}
+
+			description.topCount = count;
+
+			if (items) {
+				for (auto it = items->getBeginDownItem(); it != items->getEndDownItem() && count < TILE_DESCRIPTION_MAX_THINGS; ++it) {
+					msg.AddItem(*it);
+					description.itemEnds[count++] = msg.getMessageLength() - start;
+				}
+			}
+
+			description.itemCount = count;
+			starts.push_back(start);
+		}
+	}
+
+	// the byte vector is complete now, point the tiles into it
+	chunk.bytes.assign(msg.getBuffer() + 4, msg.getBuffer() + 4 + msg.getMessageLength());
+
+	size_t tileIndex = 0;
+	for (int32_t cx = 0; cx < TILE_DESCRIPTION_CHUNK_SIZE; ++cx) {
+		for (int32_t cy = 0; cy < TILE_DESCRIPTION_CHUNK_SIZE; ++cy) {
+			TileDescription& description = chunk.tiles[cx][cy];
+			if (description.tile) {
+				description.bytes = chunk.bytes.data() + starts[tileIndex++];
+			}
+		}
+	}
+}
@@ -23,6 +23,7 @@
 #include <queue>
 #include <bitset>
 #include <map>
+#include <unordered_map>
 
 #include "position.h"
 #include "item.h"
@@ -36,6 +37,8 @@ class Player;
 class Game;
 class Tile;
 class Map;
+class House;
+struct SaveEntry;
 
 #define MAP_MAX_LAYERS 16
 
@@ -49,23 +52,38 @@ struct AStarNode {
 #define MAX_NODES 512
 #define GET_NODE_INDEX(a) (a - &nodes[0])
 
+// open addressing table from positions to nodes, must be a power of two larger than MAX_NODES
+#define NODE_TABLE_SIZE 1024
+
 #define MAP_NORMALWALKCOST 10
 #define MAP_DIAGONALWALKCOST 25
 
+/**
+  * Node storage of a path search.
+  * The open list is an indexed binary heap ordered by f and then by node
+  * index, which picks the same node as a linear scan for the lowest f would.
+  * All storage is reused between searches, clear() only invalidates it.
+  */
 class AStarNodes
 {
 	public:
 		AStarNodes();
 		~AStarNodes() {}
 
-		AStarNode* createOpenNode();
+		void clear();
+
+		AStarNode* createNode(AStarNode* parent, int32_t x, int32_t y);
+		AStarNode* getNodeByPosition(int32_t x, int32_t y);
+
 		AStarNode* getBestNode();
 		void closeNode(AStarNode* node);
 		void openNode(AStarNode* node);
-		uint32_t countClosedNodes();
-		uint32_t countOpenNodes();
-		bool isInList(int32_t x, int32_t y);
-		AStarNode* getNodeInList(int32_t x, int32_t y);
+		uint32_t countClosedNodes() const {
+			return curNode - openCount;
+		}
+		uint32_t countOpenNodes() const {
+			return openCount;
+		}
 
 		int32_t getMapWalkCost(const Creature* creature, AStarNode* node,
 		                       const Tile* neighbourTile, const Position& neighbourPos);
@@ -73,9 +91,103 @@ class AStarNodes
 		int32_t getEstimatedDistance(int32_t x, int32_t y, int32_t xGoal, int32_t yGoal);
 
 	private:
+		struct NodeTableEntry {
+			uint32_t key;
+			uint32_t generation;
+			uint16_t node;
+		};
+
+		static uint32_t getNodeKey(int32_t x, int32_t y) {
+			return (static_cast<uint32_t>(x & 0xFFFF) << 16) | static_cast<uint32_t>(y & 0xFFFF);
+		}
+
+		bool isBetterNode(uint16_t a, uint16_t b) const {
+			return nodes[a].f < nodes[b].f || (nodes[a].f == nodes[b].f && a < b);
+		}
+		void siftUp(uint32_t heapPos);
+		void siftDown(uint32_t heapPos);
+
 		AStarNode nodes[MAX_NODES];
-		std::bitset<MAX_NODES> openNodes;
 		uint32_t curNode;
+
+		uint16_t openHeap[MAX_NODES];
+		int16_t heapPosition[MAX_NODES];
+		uint32_t openCount;
+
+		NodeTableEntry nodeTable[NODE_TABLE_SIZE];
+		uint32_t generation;
+};
+
+#define FLOW_FIELD_RADIUS 12
+#define FLOW_FIELD_SIZE (FLOW_FIELD_RADIUS * 2 + 1)
+#define FLOW_FIELD_UNREACHABLE 0xFFFF
+
+// a field no monster followed for this long (ms) is dropped
+#define FLOW_FIELD_EXPIRATION 10000
+
+// the fields are indexed by the cells of this size they cover, so a tile
+// change only visits the fields around it
+#define FLOW_FIELD_CELL_BITS 5
+
+class Map;
+
+/**
+  * Walk costs towards the tiles next to a target, for every tile within
+  * FLOW_FIELD_RADIUS of it, built with one Dijkstra pass over the tiles a
+  * monster could ever enter. Creatures and magic fields are left out so that
+  * all monsters chasing the same target can share it; Map::getPathToCreature
+  * checks those for each chaser while following the field.
+  */
+class FlowField
+{
+	public:
+		FlowField() : lastQuery(0), valid(false), hasTarget(false) {}
+
+		void build(Map& map, const Position& targetPos);
+		bool isBuiltFor(const Position& pos) const {
+			return valid && targetPos == pos;
+		}
+
+		// the position the field was last built for, if it was built at all
+		bool hasTargetPos() const {
+			return hasTarget;
+		}
+		const Position& getTargetPos() const {
+			return targetPos;
+		}
+
+		int64_t getLastQuery() const {
+			return lastQuery;
+		}
+		void setLastQuery(int64_t time) {
+			lastQuery = time;
+		}
+
+		// drops the field when a tile change made a tile (un)walkable
+		void onTileChange(const Tile* tile);
+
+		static bool isInRange(const Position& targetPos, const Position& pos) {
+			return targetPos.z == pos.z && Position::getDistanceX(targetPos, pos) <= FLOW_FIELD_RADIUS &&
+			       Position::getDistanceY(targetPos, pos) <= FLOW_FIELD_RADIUS;
+		}
+		uint16_t getDistance(const Position& pos) const {
+			return distances[getIndex(pos)];
+		}
+
+		static bool isWalkable(const Tile* tile);
+
+	private:
+		uint32_t getIndex(const Position& pos) const {
+			return (pos.y - targetPos.y + FLOW_FIELD_RADIUS) * FLOW_FIELD_SIZE + (pos.x - targetPos.x + FLOW_FIELD_RADIUS);
+		}
+
+		Position targetPos;
+		uint16_t distances[FLOW_FIELD_SIZE * FLOW_FIELD_SIZE];
+		std::bitset<FLOW_FIELD_SIZE * FLOW_FIELD_SIZE> walkable;
+		std::vector<uint32_t> openList;
+		int64_t lastQuery;
+		bool valid;
+		bool hasTarget;
 };
 
 template<class T> class lessPointer : public std::binary_function<T*, T*, bool>
@@ -86,9 +198,6 @@ template<class T> class lessPointer : public std::binary_function<T*, T*, bool>
 		}
 };
 
-typedef std::unordered_set<Creature*> SpectatorVec;
-typedef std::map<Position, std::shared_ptr<SpectatorVec>> SpectatorCache;
-
 #define FLOOR_BITS 3
 #define FLOOR_SIZE (1 << FLOOR_BITS)
 #define FLOOR_MASK (FLOOR_SIZE - 1)
@@ -100,7 +209,211 @@ struct Floor {
 	Tile* tiles[FLOOR_SIZE][FLOOR_SIZE];
 };
 
+#define TILE_GRID_BITS 5
+#define TILE_GRID_SIZE (1 << TILE_GRID_BITS)
+#define TILE_GRID_MASK (TILE_GRID_SIZE - 1)
+
+struct TileGridChunk {
+	TileGridChunk() : tiles() {}
+	~TileGridChunk();
+
+	Tile* tiles[TILE_GRID_SIZE][TILE_GRID_SIZE];
+};
+
+/**
+  * Flat tile storage, an alternative to keeping the tiles in the quadtree floors.
+  * Every floor is a directory of TILE_GRID_SIZE x TILE_GRID_SIZE chunks indexed
+  * directly by x >> TILE_GRID_BITS and y >> TILE_GRID_BITS, so a lookup is two
+  * array accesses regardless of the map size.
+  */
+class TileGrid
+{
+	public:
+		TileGrid() : m_width(0), m_height(0) {}
+		~TileGrid();
+
+		Tile* getTile(uint32_t x, uint32_t y, uint32_t z) const {
+			uint32_t chunkX = x >> TILE_GRID_BITS;
+			uint32_t chunkY = y >> TILE_GRID_BITS;
+			if (chunkX >= m_width || chunkY >= m_height) {
+				return nullptr;
+			}
+
+			const TileGridChunk* chunk = m_chunks[z][chunkY * m_width + chunkX];
+			if (!chunk) {
+				return nullptr;
+			}
+			return chunk->tiles[x & TILE_GRID_MASK][y & TILE_GRID_MASK];
+		}
+
+		bool setTile(uint32_t x, uint32_t y, uint32_t z, Tile* newTile);
+
+	private:
+		void resize(uint32_t width, uint32_t height);
+
+		std::vector<TileGridChunk*> m_chunks[MAP_MAX_LAYERS];
+		uint32_t m_width, m_height;
+};
+
 class FrozenPathingConditionCall;
+#define SPECTATOR_CELL_BITS 4
+#define SPECTATOR_CELL_SIZE (1 << SPECTATOR_CELL_BITS)
+
+// a sector that was not queried for this many sector queries is dropped
+#define SPECTATOR_SECTOR_SWEEP_QUERIES 262144
+
+struct SpectatorSector;
+struct SpectatorEntry;
+
+struct SpectatorCell {
+	CreatureVector creatures;
+	CreatureVector players;
+
+	// entries of the creatures and players above, at the same indexes
+	std::vector<SpectatorEntry*> creatureEntries;
+	std::vector<SpectatorEntry*> playerEntries;
+
+	// cached sectors whose lists include this cell
+	std::vector<SpectatorSector*> sectors;
+};
+
+// Everything that can be seen from some position of a cell on one floor,
+// for the default multifloor viewport. Queries filter it by exact range.
+struct SpectatorSector {
+	CreatureVector creatures;
+	CreatureVector players;
+
+	// entries of the creatures and players above, at the same indexes
+	std::vector<SpectatorEntry*> creatureEntries;
+	std::vector<SpectatorEntry*> playerEntries;
+
+	// keys of the cells whose creatures are in the lists
+	std::vector<uint32_t> cells;
+
+	int32_t minRangeZ, maxRangeZ;
+
+	// queries since the last sweep
+	uint32_t useCount;
+};
+
+// the place of a creature in the lists of one sector
+struct SpectatorSlot {
+	SpectatorSector* sector;
+	uint32_t creatureIndex;
+	uint32_t playerIndex;
+};
+
+// Where a creature is kept in the lists of the index, so that it can be
+// removed by swapping the last element into its place instead of searching.
+struct SpectatorEntry {
+	Creature* creature;
+	bool isPlayer;
+	uint32_t creatureIndex;
+	uint32_t playerIndex;
+	std::vector<SpectatorSlot> slots;
+};
+
+/**
+  * Spatial hash of the creatures on the map, for the spectator queries.
+  * A cell covers SPECTATOR_CELL_SIZE x SPECTATOR_CELL_SIZE tiles on all
+  * floors and keeps its creatures and players in separate contiguous lists.
+  * Sectors are built on first use and then kept up to date as creatures
+  * enter and leave cells, so they stay valid across dispatcher tasks. Every
+  * SPECTATOR_SECTOR_SWEEP_QUERIES queries the sectors that were not used
+  * since the previous sweep are dropped.
+  */
+class SpectatorIndex
+{
+	public:
+		SpectatorIndex() : m_queries(0) {}
+
+		void addCreature(Creature* creature, const Position& pos);
+		void removeCreature(Creature* creature, const Position& pos);
+		void moveCreature(Creature* creature, const Position& oldPos, const Position& newPos);
+
+		const SpectatorCell* getCell(uint32_t cellX, uint32_t cellY) const {
+			auto it = m_cells.find(getCellKey(cellX, cellY));
+			if (it == m_cells.end()) {
+				return nullptr;
+			}
+			return &it->second;
+		}
+
+		const SpectatorSector& getSector(const Position& pos);
+
+	private:
+		static uint32_t getCellKey(uint32_t cellX, uint32_t cellY) {
+			return (cellX << 16) | cellY;
+		}
+
+		void linkCreature(SpectatorEntry& entry, const Position& pos);
+		void unlinkCreature(SpectatorEntry& entry, const Position& pos);
+		static void linkSector(SpectatorEntry& entry, SpectatorSector& sector);
+		static void unlinkSector(SpectatorEntry& entry, const SpectatorSlot& slot);
+
+		void sweepSectors();
+
+		std::unordered_map<uint32_t, SpectatorCell> m_cells;
+		std::unordered_map<uint64_t, SpectatorSector> m_sectors;
+		std::unordered_map<Creature*, SpectatorEntry> m_entries;
+		uint32_t m_queries;
+};
+
+#define TILE_DESCRIPTION_CHUNK_BITS 3
+#define TILE_DESCRIPTION_CHUNK_SIZE (1 << TILE_DESCRIPTION_CHUNK_BITS)
+#define TILE_DESCRIPTION_CHUNK_MASK (TILE_DESCRIPTION_CHUNK_SIZE - 1)
+// the cache is dropped as a whole once it holds more chunks than this
+#define TILE_DESCRIPTION_CACHE_MAX_CHUNKS 16384
+// the client is sent at most this many things per tile
+#define TILE_DESCRIPTION_MAX_THINGS 10
+
+// The items of a tile as they are sent to the client, creatures left out. The
+// first topCount items are the ground and the top items, the creatures seen
+// by a player go between them and the down items.
+struct TileDescription {
+	Tile* tile;
+	const uint8_t* bytes;
+	uint8_t topCount;
+	uint8_t itemCount;
+	uint8_t itemEnds[TILE_DESCRIPTION_MAX_THINGS];
+};
+
+struct TileDescriptionChunk {
+	TileDescription tiles[TILE_DESCRIPTION_CHUNK_SIZE][TILE_DESCRIPTION_CHUNK_SIZE];
+	std::vector<uint8_t> bytes;
+};
+
+/**
+  * Serialized items of the tiles, for the map descriptions sent to the
+  * players. A chunk covers TILE_DESCRIPTION_CHUNK_SIZE x TILE_DESCRIPTION_CHUNK_SIZE
+  * tiles of one floor, it is built on first use and dropped by invalidate
+  * when an item of one of its tiles changes.
+  */
+class TileDescriptionCache
+{
+	public:
+		TileDescriptionCache() : m_lastKey(0), m_lastChunk(nullptr) {}
+
+		// nullptr if there is no tile at the position
+		const TileDescription* getTileDescription(Map& map, int32_t x, int32_t y, int32_t z);
+
+		void invalidate(const Position& pos);
+
+	private:
+		static uint64_t getChunkKey(int32_t x, int32_t y, int32_t z) {
+			return (static_cast<uint64_t>(x >> TILE_DESCRIPTION_CHUNK_BITS) << 32) |
+			       (static_cast<uint64_t>(y >> TILE_DESCRIPTION_CHUNK_BITS) << 16) | z;
+		}
+
+		void buildChunk(Map& map, TileDescriptionChunk& chunk, int32_t x, int32_t y, int32_t z);
+
+		std::unordered_map<uint64_t, TileDescriptionChunk> m_chunks;
+
+		// the chunk of the previous lookup, descriptions walk the tiles in order
+		uint64_t m_lastKey;
+		TileDescriptionChunk* m_lastChunk;
+};
+
 class QTreeLeafNode;
 
 class QTreeNode
@@ -142,16 +455,11 @@ class QTreeLeafNode : public QTreeNode
 			return m_leafE;
 		}
 
-		void addCreature(Creature* c);
-		void removeCreature(Creature* c);
-
 	protected:
 		static bool newLeaf;
 		QTreeLeafNode* m_leafS;
 		QTreeLeafNode* m_leafE;
 		Floor* m_array[MAP_MAX_LAYERS];
-		CreatureVector creature_list;
-		CreatureVector player_list;
 
 		friend class Map;
 		friend class QTreeNode;
@@ -180,11 +488,17 @@ class Map
 		bool loadMap(const std::string& identifier);
 
 		/**
-		  * Save a map.
-		  * \param identifier file/database to save to
-		  * \returns true if the map was saved successfully
+		  * Build the queries that save a house and the items on its tiles.
+		  * \param house the house to save
+		  * \param entry receives the queries
 		  */
-		bool saveMap();
+		void saveHouse(House* house, SaveEntry& entry);
+
+		/**
+		  * Build the queries that remove houses no longer on the map.
+		  * \param entry receives the queries
+		  */
+		void saveHouseList(SaveEntry& entry);
 
 		/**
 		  * Get a single tile.
@@ -262,14 +576,29 @@ class Map
 		bool getPathMatching(const Creature* creature, std::list<Direction>& dirList,
 		                     const FrozenPathingConditionCall& pathCondition, const FindPathParams& fpp);
 
+		/**
+		  * Get a path towards another creature, monsters in melee range use the
+		  * flow field shared by everything chasing the same target.
+		  * \returns returns true if a path was found
+		  */
+		bool getPathToCreature(const Creature* creature, const Creature* target,
+		                       std::list<Direction>& dirList, const FindPathParams& fpp);
+
+		// called by Tile when an item was added or removed
+		void onTileChange(const Tile* tile);
+
 		std::map<std::string, Position> waypoints;
 
+		// creatures on the map by position, kept up to date by placeCreature, removeCreature and Tile::moveCreature
+		SpectatorIndex spectatorIndex;
+
+		// items of the tiles as sent to the client, invalidated by Tile whenever they change
+		TileDescriptionCache tileDescriptionCache;
+
 	protected:
 		uint32_t mapWidth, mapHeight;
 		std::string spawnfile;
 		std::string housefile;
-		SpectatorCache spectatorCache;
-		SpectatorCache playersSpectatorCache;
 
 		// Actually scans the map for spectators
 		void getSpectatorsInternal(SpectatorVec& list, const Position& centerPos,
@@ -277,20 +606,38 @@ class Map
 		                           int32_t minRangeY, int32_t maxRangeY,
 		                           int32_t minRangeZ, int32_t maxRangeZ, bool onlyPlayers);
 
-		// Use this when a custom spectator vector is needed, this support many
-		// more parameters than the heavily cached version below.
+		// Ranges within the default viewport are answered from the sector cache,
+		// larger ones scan the spectator index directly.
 		void getSpectators(SpectatorVec& list, const Position& centerPos, bool multifloor = false, bool onlyPlayers = false,
 		                   int32_t minRangeX = 0, int32_t maxRangeX = 0,
 		                   int32_t minRangeY = 0, int32_t maxRangeY = 0);
-		// The returned SpectatorVec is a temporary and should not be kept around
-		// Take special heed in that the vector will be destroyed if any function
-		// that calls clearSpectatorCache is called.
-		const SpectatorVec& getSpectators(const Position& centerPos);
-
-		void clearSpectatorCache();
+		// Everything within the default multifloor viewport
+		SpectatorVec getSpectators(const Position& centerPos);
 
 		QTreeNode root;
 
+		// search state of getPathTo/getPathMatching, reused between calls (dispatcher thread only)
+		AStarNodes pathNodes;
+
+		// flow fields by target creature id, rebuilt lazily when the target moved
+		std::unordered_map<uint32_t, FlowField> flowFields;
+
+		// target creature ids of the flow fields covering a cell, by cell
+		std::unordered_map<uint32_t, std::vector<uint32_t>> flowFieldCells;
+		int64_t nextFlowFieldCleanup;
+
+		bool getFlowFieldPath(const Creature* creature, const Creature* target,
+		                      std::list<Direction>& dirList, const FindPathParams& fpp);
+
+		void addFlowFieldCells(uint32_t targetId, const Position& targetPos);
+		void removeFlowFieldCells(uint32_t targetId, const Position& targetPos);
+		void eraseFlowField(uint32_t targetId);
+		void cleanFlowFields(int64_t time);
+
+		// when enabled the tiles live in tileGrid and the quadtree stays empty
+		TileGrid tileGrid;
+		bool useTileGrid;
+
 		struct RefreshBlock_t {
 			TileItemVector list;
 			uint64_t lastRefresh;
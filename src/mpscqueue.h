@@ -0,0 +1,100 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __OTSERV_MPSCQUEUE_H__
+#define __OTSERV_MPSCQUEUE_H__
+
+#include <atomic>
+#include <memory>
+
+// Bounded lock-free queue for many producers and a single consumer.
+// Every cell carries a sequence number telling whether it is free for the
+// producer claiming that position or published for the consumer.
+template<typename T, size_t N>
+class MPSCQueue
+{
+	public:
+		MPSCQueue() : m_cells(new Cell[N]), m_enqueuePos(0), m_dequeuePos(0) {
+			static_assert(N >= 2 && (N & (N - 1)) == 0, "MPSCQueue size must be a power of two");
+			for (size_t i = 0; i < N; ++i) {
+				m_cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		// may be called from any thread, returns false when the queue is full
+		bool push(const T& value) {
+			Cell* cell;
+			size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+			while (true) {
+				cell = &m_cells[pos & (N - 1)];
+				size_t sequence = cell->sequence.load(std::memory_order_acquire);
+				intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+				if (diff == 0) {
+					if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				} else if (diff < 0) {
+					return false;
+				} else {
+					pos = m_enqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+
+			cell->value = value;
+			cell->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		// consumer thread only
+		bool pop(T& value) {
+			Cell& cell = m_cells[m_dequeuePos & (N - 1)];
+			if (cell.sequence.load(std::memory_order_acquire) != m_dequeuePos + 1) {
+				return false;
+			}
+
+			value = cell.value;
+			cell.sequence.store(m_dequeuePos + N, std::memory_order_release);
+			++m_dequeuePos;
+			return true;
+		}
+
+		// consumer thread only
+		bool empty() const {
+			return m_cells[m_dequeuePos & (N - 1)].sequence.load(std::memory_order_acquire) != m_dequeuePos + 1;
+		}
+
+	private:
+		struct Cell {
+			std::atomic<size_t> sequence;
+			T value;
+		};
+
+		MPSCQueue(const MPSCQueue&);
+		MPSCQueue& operator=(const MPSCQueue&);
+
+		std::unique_ptr<Cell[]> m_cells;
+
+		// keep producers and the consumer on separate cache lines
+		char m_pad0[64];
+		std::atomic<size_t> m_enqueuePos;
+		char m_pad1[64];
+		size_t m_dequeuePos;
+};
+
+#endif
@@ -36,15 +36,15 @@
 #include "position.h"
 #include "rsa.h"
 
-int32_t NetworkMessage::decodeHeader()
+int32_t BasicNetworkMessage::decodeHeader()
 {
-	int32_t size = (int32_t)(m_RealBuf[0] | m_RealBuf[1] << 8);
+	int32_t size = (int32_t)(m_MsgBuf[0] | m_MsgBuf[1] << 8);
 	m_MsgSize = size;
 	return size;
 }
 
 /******************************************************************************/
-std::string NetworkMessage::GetString(uint16_t stringlen/* = 0*/)
+std::string BasicNetworkMessage::GetString(uint16_t stringlen/* = 0*/)
 {
 	if (stringlen == 0) {
 		stringlen = GetU16();
@@ -54,12 +54,27 @@ std::string NetworkMessage::GetString(uint16_t stringlen/* = 0*/)
 		return std::string();
 	}
 
-	char* v = (char*)m_RealBuf + m_ReadPos;
+	char* v = (char*)m_MsgBuf + m_ReadPos;
 	m_ReadPos += stringlen;
 	return std::string(v, stringlen);
 }
 
-Position NetworkMessage::GetPosition()
+StringView BasicNetworkMessage::GetStringView(uint16_t stringlen/* = 0*/)
+{
+	if (stringlen == 0) {
+		stringlen = GetU16();
+	}
+
+	if (!canRead(stringlen)) {
+		return StringView();
+	}
+
+	const char* v = (const char*)m_MsgBuf + m_ReadPos;
+	m_ReadPos += stringlen;
+	return StringView(v, stringlen);
+}
+
+Position BasicNetworkMessage::GetPosition()
 {
 	Position pos;
 	pos.x = GetU16();
@@ -69,7 +84,7 @@ Position NetworkMessage::GetPosition()
 }
 /******************************************************************************/
 
-void NetworkMessage::AddString(const std::string& value)
+void BasicNetworkMessage::AddString(const std::string& value)
 {
 	size_t stringlen = value.length();
 	if (!canAdd(stringlen + 2) || stringlen > 8192) {
@@ -82,7 +97,7 @@ void NetworkMessage::AddString(const std::string& value)
 	m_MsgSize += stringlen;
 }
 
-void NetworkMessage::AddString(const char* value)
+void BasicNetworkMessage::AddString(const char* value)
 {
 	size_t stringlen = strlen(value);
 	if (!canAdd(stringlen + 2) || stringlen > 8192) {
@@ -95,13 +110,13 @@ void NetworkMessage::AddString(const char* value)
 	m_MsgSize += stringlen;
 }
 
-void NetworkMessage::AddDouble(double value, uint8_t precision/* = 2*/)
+void BasicNetworkMessage::AddDouble(double value, uint8_t precision/* = 2*/)
 {
 	AddByte(precision);
 	AddU32((value * std::pow((float)10, precision)) + INT_MAX);
 }
 
-void NetworkMessage::AddBytes(const char* bytes, size_t size)
+void BasicNetworkMessage::AddBytes(const char* bytes, size_t size)
 {
 	if (!canAdd(size) || size > 8192) {
 		return;
@@ -112,7 +127,7 @@ void NetworkMessage::AddBytes(const char* bytes, size_t size)
 	m_MsgSize += size;
 }
 
-void NetworkMessage::AddPaddingBytes(size_t n)
+void BasicNetworkMessage::AddPaddingBytes(size_t n)
 {
 	if (!canAdd(n)) {
 		return;
@@ -122,14 +137,14 @@ void NetworkMessage::AddPaddingBytes(size_t n)
 	m_MsgSize += n;
 }
 
-void NetworkMessage::AddPosition(const Position& pos)
+void BasicNetworkMessage::AddPosition(const Position& pos)
 {
 	AddU16(pos.x);
 	AddU16(pos.y);
 	AddByte(pos.z);
 }
 
-void NetworkMessage::AddItem(uint16_t id, uint8_t count)
+void BasicNetworkMessage::AddItem(uint16_t id, uint8_t count)
 {
 	const ItemType& it = Item::items[id];
 
@@ -147,7 +162,7 @@ void NetworkMessage::AddItem(uint16_t id, uint8_t count)
 	}
 }
 
-void NetworkMessage::AddItem(const Item* item)
+void BasicNetworkMessage::AddItem(const Item* item)
 {
 	const ItemType& it = Item::items[item->getID()];
 
@@ -165,7 +180,7 @@ void NetworkMessage::AddItem(const Item* item)
 	}
 }
 
-void NetworkMessage::AddItemId(uint16_t itemId)
+void BasicNetworkMessage::AddItemId(uint16_t itemId)
 {
 	const ItemType& it = Item::items[itemId];
 	AddU16(it.clientId);
@@ -29,7 +29,42 @@ class Player;
 struct Position;
 class RSA;
 
-class NetworkMessage
+// Characters of a string inside a message buffer, only valid as long as the
+// buffer is. Converts to std::string where a copy is needed.
+class StringView
+{
+	public:
+		StringView() : m_data(nullptr), m_size(0) {}
+		StringView(const char* data, size_t size) : m_data(data), m_size(size) {}
+
+		const char* data() const {
+			return m_data;
+		}
+		size_t size() const {
+			return m_size;
+		}
+		bool empty() const {
+			return m_size == 0;
+		}
+
+		std::string str() const {
+			if (m_size == 0) {
+				return std::string();
+			}
+			return std::string(m_data, m_size);
+		}
+		operator std::string() const {
+			return str();
+		}
+
+	private:
+		const char* m_data;
+		size_t m_size;
+};
+
+// Reads and writes the wire format on a buffer provided by the derived class,
+// NetworkMessage keeps it inline while OutputMessage takes it from its pool.
+class BasicNetworkMessage
 {
 	public:
 		enum { header_length = 2 };
@@ -38,11 +73,12 @@ class NetworkMessage
 		enum { max_body_length = NETWORKMESSAGE_MAXSIZE - header_length - crypto_length - xtea_multiple };
 
 		// constructor/destructor
-		NetworkMessage() {
-			m_MsgBuf = m_RealBuf;
+		BasicNetworkMessage(uint8_t* buffer, int32_t bufferSize) {
+			m_MsgBuf = buffer;
+			m_bufferSize = bufferSize;
 			Reset();
 		}
-		virtual ~NetworkMessage() {}
+		virtual ~BasicNetworkMessage() {}
 
 		// resets the internal buffer to an empty message
 
@@ -60,7 +96,7 @@ class NetworkMessage
 				return 0;
 			}
 
-			return m_RealBuf[m_ReadPos++];
+			return m_MsgBuf[m_ReadPos++];
 		}
 		uint16_t GetU16() {
 			if (!canRead(2)) {
@@ -101,6 +137,8 @@ class NetworkMessage
 			return v;
 		}
 		std::string GetString(uint16_t stringlen = 0);
+		// like GetString, without copying the characters out of the buffer
+		StringView GetStringView(uint16_t stringlen = 0);
 		std::string GetRaw() {
 			return GetString(m_MsgSize - m_ReadPos);
 		}
@@ -117,7 +155,7 @@ class NetworkMessage
 				return;
 			}
 
-			m_RealBuf[m_ReadPos++] = value;
+			m_MsgBuf[m_ReadPos++] = value;
 			m_MsgSize++;
 		}
 		void AddU16(uint16_t value) {
@@ -148,6 +186,10 @@ class NetworkMessage
 			m_MsgSize += 8;
 		}
 		void AddBytes(const char* bytes, size_t size);
+		// overwrites a byte that was already added, pos is the offset from the start of the message body
+		void SetByte(int32_t pos, uint8_t value) {
+			m_MsgBuf[4 + pos] = value;
+		}
 		void AddPaddingBytes(size_t n);
 
 		void AddString(const std::string& value);
@@ -185,29 +227,48 @@ class NetworkMessage
 		}
 		char* getBodyBuffer() {
 			m_ReadPos = 2;
-			return (char*)&m_RealBuf[header_length];
+			return (char*)&m_MsgBuf[header_length];
+		}
+
+		int32_t getMaxBodyLength() const {
+			return m_bufferSize - header_length - crypto_length - xtea_multiple;
 		}
 
 	protected:
-		inline bool canAdd(size_t size) const {
-			return (size + m_ReadPos < max_body_length);
+		inline bool canAdd(size_t size) {
+			return (size + m_ReadPos < static_cast<size_t>(getMaxBodyLength())) || reserve(size);
 		}
 
 		inline bool canRead(int32_t size) {
-			if ((m_ReadPos + size) > (m_MsgSize + 4) || size >= (NETWORKMESSAGE_MAXSIZE - m_ReadPos)) {
+			if ((m_ReadPos + size) > (m_MsgSize + 4) || size >= (m_bufferSize - m_ReadPos)) {
 				m_overrun = true;
 				return false;
 			}
 			return true;
 		}
 
+		// called when size more bytes do not fit, a derived class may move the
+		// message to a larger buffer and return true
+		virtual bool reserve(size_t size) {
+			return false;
+		}
+
 		int32_t m_MsgSize;
 		int32_t m_ReadPos;
 
 		bool m_overrun;
 
-		uint8_t m_RealBuf[NETWORKMESSAGE_MAXSIZE];
 		uint8_t* m_MsgBuf;
+		int32_t m_bufferSize;
+};
+
+class NetworkMessage : public BasicNetworkMessage
+{
+	public:
+		NetworkMessage() : BasicNetworkMessage(m_RealBuf, NETWORKMESSAGE_MAXSIZE) {}
+
+	protected:
+		uint8_t m_RealBuf[NETWORKMESSAGE_MAXSIZE];
 };
 
 #endif // #ifndef __NETWORK_MESSAGE_H__
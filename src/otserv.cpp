@@ -59,9 +59,15 @@
 #include "house.h"
 
 #include "databasemanager.h"
+#include "packetcapture.h"
+#include "stats.h"
+#include "savemanager.h"
+#include "databasetasks.h"
 
 Dispatcher g_dispatcher;
 Scheduler g_scheduler;
+WorkerPool g_cryptoPool;
+WorkerPool g_databasePool;
 
 IPList serverIPs;
 
@@ -99,10 +105,16 @@ void badAllocationHandler()
 
 void shutdown()
 {
+	g_cryptoPool.shutdown();
+	g_databasePool.shutdown();
+	SaveManager::getInstance()->shutdown();
+	DatabaseTasks::getInstance()->shutdown();
 	g_scheduler.shutdown();
 	g_dispatcher.shutdown();
 }
 
+// the packet replay driver and the benchmarks bring their own main
+#if !defined(__PACKET_REPLAY__) && !defined(__BENCHMARK__)
 int main(int argc, char* argv[])
 {
 	// Setup bad allocation handler
@@ -141,6 +153,7 @@ int main(int argc, char* argv[])
 	}
 	return 0;
 }
+#endif
 
 void mainLoader(int argc, char* argv[], ServiceManager* services)
 {
@@ -226,6 +239,7 @@ void mainLoader(int argc, char* argv[], ServiceManager* services)
 	dbManager->updateDatabase();
 	dbManager->checkTriggers();
 	dbManager->checkEncryption();
+	dbManager->checkItemStorage();
 
 	if (g_config.getBoolean(ConfigManager::OPTIMIZE_DATABASE) && !dbManager->optimizeTables()) {
 		std::cout << "> No tables were optimized." << std::endl;
@@ -312,19 +326,41 @@ void mainLoader(int argc, char* argv[], ServiceManager* services)
 	std::cout << ">> Initializing gamestate" << std::endl;
 	g_game.setGameState(GAME_STATE_INIT);
 
-	// Tibia protocols
-	services->add<ProtocolGame>(g_config.getNumber(ConfigManager::GAME_PORT));
-	services->add<ProtocolLogin>(g_config.getNumber(ConfigManager::LOGIN_PORT));
+	// without a service manager the server runs headless (packet replay),
+	// it neither listens nor saves on its own
+	if (services) {
+		// logins are decrypted and loaded off the dispatcher
+		uint32_t maxPendingLogins = std::max<int32_t>(1, g_config.getNumber(ConfigManager::MAX_PENDING_LOGINS));
+		g_cryptoPool.start(g_config.getNumber(ConfigManager::CRYPTO_THREADS), maxPendingLogins);
+		g_databasePool.start(g_config.getNumber(ConfigManager::DATABASE_THREADS), maxPendingLogins, true);
+
+		// saves are written to the database on a thread of their own
+		SaveManager::getInstance()->start(g_config.getNumber(ConfigManager::SAVE_BATCH_SIZE));
+
+		// script queries that do not have to hold up the dispatcher
+		if (!DatabaseTasks::getInstance()->start(std::max<int32_t>(0, g_config.getNumber(ConfigManager::ASYNC_QUERY_CONNECTIONS)))) {
+			std::cout << "> Not all asynchronous query connections could be opened." << std::endl;
+		}
+
+		// Tibia protocols
+		services->add<ProtocolGame>(g_config.getNumber(ConfigManager::GAME_PORT));
+		services->add<ProtocolLogin>(g_config.getNumber(ConfigManager::LOGIN_PORT));
 
-	// OT protocols
-	services->add<ProtocolStatus>(g_config.getNumber(ConfigManager::STATUS_PORT));
+		// OT protocols
+		services->add<ProtocolStatus>(g_config.getNumber(ConfigManager::STATUS_PORT));
 
-	int32_t autoSaveEachMinutes = g_config.getNumber(ConfigManager::AUTO_SAVE_EACH_MINUTES);
-	if (autoSaveEachMinutes > 0) {
-		g_scheduler.addEvent(createSchedulerTask(autoSaveEachMinutes * 1000 * 60, boost::bind(&Game::autoSave, &g_game)));
+		const std::string& captureFile = g_config.getString(ConfigManager::PACKET_CAPTURE_FILE);
+		if (!captureFile.empty() && PacketCapture::getInstance()->open(captureFile)) {
+			std::cout << ">> Capturing game packets to " << captureFile << std::endl;
+		}
+
+		int32_t autoSaveEachMinutes = g_config.getNumber(ConfigManager::AUTO_SAVE_EACH_MINUTES);
+		if (autoSaveEachMinutes > 0) {
+			g_scheduler.addEvent(createSchedulerTask(autoSaveEachMinutes * 1000 * 60, boost::bind(&Game::autoSave, &g_game)), TASK_ORIGIN_SAVE);
+		}
 	}
 
-	if (g_config.getBoolean(ConfigManager::SERVERSAVE_ENABLED)) {
+	if (services && g_config.getBoolean(ConfigManager::SERVERSAVE_ENABLED)) {
 		int32_t serverSaveHour = g_config.getNumber(ConfigManager::SERVERSAVE_H);
 		if (serverSaveHour >= 0 && serverSaveHour <= 24) {
 			time_t timeNow = time(nullptr);
@@ -344,7 +380,7 @@ void mainLoader(int argc, char* argv[], ServiceManager* services)
 			if (difference < 0) {
 				difference += 86400;
 			}
-			g_scheduler.addEvent(createSchedulerTask(difference * 1000, boost::bind(&Game::prepareServerSave, &g_game)));
+			g_scheduler.addEvent(createSchedulerTask(difference * 1000, boost::bind(&Game::prepareServerSave, &g_game)), TASK_ORIGIN_SAVE);
 		}
 	}
 
@@ -397,6 +433,8 @@ void mainLoader(int argc, char* argv[], ServiceManager* services)
 	}
 #endif
 
+	Stats::getInstance()->startWatchdog(g_config.getNumber(ConfigManager::DISPATCHER_STALL_THRESHOLD));
+
 	g_game.start(services);
 	g_game.setGameState(GAME_STATE_NORMAL);
 	g_loaderSignal.notify_all();
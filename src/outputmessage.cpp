@@ -20,29 +20,200 @@
 #include "otpch.h"
 
 #include "outputmessage.h"
+#include "inputmessage.h"
 #include "protocol.h"
 #include "scheduler.h"
 
-extern Dispatcher g_dispatcher;
-
-#ifdef __ENABLE_SERVER_DIAGNOSTIC__
-uint32_t OutputMessagePool::OutputMessagePoolCount = OUTPUT_POOL_SIZE;
+#ifdef _MSC_VER
+#define OUTPUT_POOL_THREAD_LOCAL __declspec(thread)
+#else
+#define OUTPUT_POOL_THREAD_LOCAL __thread
 #endif
 
-OutputMessage::OutputMessage()
+// number of blocks moved between a thread cache and the shared pool at once,
+// a new slab holds exactly one batch
+#define OUTPUT_POOL_BATCH_SIZE 32
+
+namespace {
+
+struct OutputBlock {
+	OutputBlock* next;
+};
+
+// Every size class is a set of slabs cut into equally sized blocks. Blocks
+// freed by a thread go to its own cache first, full batches are handed over
+// to the shared pool since messages are mostly created on the dispatcher and
+// released on the network threads.
+struct OutputPoolCache {
+	OutputBlock* head;
+	uint32_t size;
+};
+
+struct OutputPoolClass {
+	OutputPoolClass() : blocks(0), hits(0), misses(0) {}
+
+	boost::mutex lock;
+	std::vector<OutputBlock*> batches;
+	std::atomic<uint64_t> blocks;
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+};
+
+// the last class holds the OutputMessage and InputMessage objects themselves
+const uint32_t outputPoolBlockSizes[OUTPUT_POOL_SIZE_CLASSES + 1] = {
+	OUTPUT_POOL_SMALL_BUFFER_SIZE,
+	OUTPUT_POOL_MEDIUM_BUFFER_SIZE,
+	NETWORKMESSAGE_MAXSIZE,
+	sizeof(OutputMessage) > sizeof(InputMessage) ? sizeof(OutputMessage) : sizeof(InputMessage)
+};
+
+OUTPUT_POOL_THREAD_LOCAL OutputPoolCache outputPoolCaches[OUTPUT_POOL_SIZE_CLASSES + 1];
+
+OutputPoolClass outputPoolClasses[OUTPUT_POOL_SIZE_CLASSES + 1];
+
+OutputBlock* allocateOutputSlab(uint32_t blockSize)
 {
-	freeMessage();
+	// keep every block aligned for the OutputMessage objects and the headers
+	const size_t stride = (blockSize + 15) & ~15;
+
+	uint8_t* slab = static_cast<uint8_t*>(::operator new(stride * OUTPUT_POOL_BATCH_SIZE));
+	for (uint32_t i = 0; i < OUTPUT_POOL_BATCH_SIZE - 1; ++i) {
+		reinterpret_cast<OutputBlock*>(slab + i * stride)->next = reinterpret_cast<OutputBlock*>(slab + (i + 1) * stride);
+	}
+	reinterpret_cast<OutputBlock*>(slab + (OUTPUT_POOL_BATCH_SIZE - 1) * stride)->next = nullptr;
+	return reinterpret_cast<OutputBlock*>(slab);
 }
 
-//*********** OutputMessagePool ****************//
+void* allocateOutputBlock(uint32_t sizeClass)
+{
+	OutputPoolClass& poolClass = outputPoolClasses[sizeClass];
+	OutputPoolCache& cache = outputPoolCaches[sizeClass];
+	if (cache.head) {
+		poolClass.hits.fetch_add(1, std::memory_order_relaxed);
+	} else {
+		poolClass.misses.fetch_add(1, std::memory_order_relaxed);
 
-OutputMessagePool::OutputMessagePool()
+		boost::unique_lock<boost::mutex> lockClass(poolClass.lock);
+		if (!poolClass.batches.empty()) {
+			cache.head = poolClass.batches.back();
+			poolClass.batches.pop_back();
+		} else {
+			lockClass.unlock();
+			cache.head = allocateOutputSlab(outputPoolBlockSizes[sizeClass]);
+			poolClass.blocks.fetch_add(OUTPUT_POOL_BATCH_SIZE, std::memory_order_relaxed);
+		}
+		cache.size = OUTPUT_POOL_BATCH_SIZE;
+	}
+
+	OutputBlock* block = cache.head;
+	cache.head = block->next;
+	--cache.size;
+	return block;
+}
+
+void releaseOutputBlock(uint32_t sizeClass, void* p)
 {
-	for (uint32_t i = 0; i < OUTPUT_POOL_SIZE; ++i) {
-		OutputMessage* msg = new OutputMessage();
-		m_outputMessages.push_back(msg);
+	OutputPoolCache& cache = outputPoolCaches[sizeClass];
+
+	OutputBlock* block = static_cast<OutputBlock*>(p);
+	block->next = cache.head;
+	cache.head = block;
+
+	if (++cache.size < OUTPUT_POOL_BATCH_SIZE * 2) {
+		return;
 	}
 
+	// hand the oldest batch of the cache over to the shared pool
+	OutputBlock* last = cache.head;
+	for (uint32_t i = 1; i < OUTPUT_POOL_BATCH_SIZE; ++i) {
+		last = last->next;
+	}
+
+	OutputBlock* batch = last->next;
+	last->next = nullptr;
+	cache.size = OUTPUT_POOL_BATCH_SIZE;
+
+	OutputPoolClass& poolClass = outputPoolClasses[sizeClass];
+	boost::lock_guard<boost::mutex> lockClass(poolClass.lock);
+	poolClass.batches.push_back(batch);
+}
+
+uint32_t getOutputBufferClass(size_t size)
+{
+	for (uint32_t i = 0; i < OUTPUT_POOL_SIZE_CLASSES - 1; ++i) {
+		if (size <= outputPoolBlockSizes[i]) {
+			return i;
+		}
+	}
+	return OUTPUT_POOL_SIZE_CLASSES - 1;
+}
+
+}
+
+void intrusive_ptr_add_ref(OutputMessage* msg)
+{
+	msg->m_refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void intrusive_ptr_release(OutputMessage* msg)
+{
+	if (msg->m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		OutputMessagePool::getInstance()->releaseMessage(msg);
+	}
+}
+
+void* OutputMessage::operator new(size_t size)
+{
+	return allocateOutputBlock(OUTPUT_POOL_SIZE_CLASSES);
+}
+
+void OutputMessage::operator delete(void* p, size_t size)
+{
+	releaseOutputBlock(OUTPUT_POOL_SIZE_CLASSES, p);
+}
+
+OutputMessage::OutputMessage() :
+	BasicNetworkMessage(static_cast<uint8_t*>(allocateOutputBlock(0)), OUTPUT_POOL_SMALL_BUFFER_SIZE)
+{
+	m_protocol = nullptr;
+	m_frame = 0;
+	//allocate enough size for headers
+	//2 bytes for unencrypted message size
+	//2 bytes for encrypted message size
+	m_outputBufferStart = 4;
+	m_state = STATE_FREE;
+	m_priority = OUTPUT_PRIORITY_HIGH;
+	m_refCount = 0;
+}
+
+OutputMessage::~OutputMessage()
+{
+	releaseOutputBlock(getOutputBufferClass(m_bufferSize), m_MsgBuf);
+}
+
+bool OutputMessage::reserve(size_t size)
+{
+	// the body has to stay below the maximum length of the new buffer
+	const size_t required = m_ReadPos + size + header_length + crypto_length + xtea_multiple + 1;
+	if (required > NETWORKMESSAGE_MAXSIZE) {
+		return false;
+	}
+
+	const uint32_t sizeClass = getOutputBufferClass(required);
+	uint8_t* buffer = static_cast<uint8_t*>(allocateOutputBlock(sizeClass));
+	memcpy(buffer, m_MsgBuf, m_ReadPos);
+	releaseOutputBlock(getOutputBufferClass(m_bufferSize), m_MsgBuf);
+
+	m_MsgBuf = buffer;
+	m_bufferSize = outputPoolBlockSizes[sizeClass];
+	return true;
+}
+
+//*********** OutputMessagePool ****************//
+
+OutputMessagePool::OutputMessagePool()
+{
+	m_messageCount = 0;
 	m_frameTime = OTSYS_TIME();
 }
 
@@ -55,9 +226,7 @@ void OutputMessagePool::startExecutionFrame()
 
 OutputMessagePool::~OutputMessagePool()
 {
-	for (OutputMessage* msg : m_outputMessages) {
-		delete msg;
-	}
+	//
 }
 
 void OutputMessagePool::send(OutputMessage_ptr msg)
@@ -80,26 +249,8 @@ void OutputMessagePool::sendAll()
 {
 	boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
 
-	const int64_t dropTime = m_frameTime - 10000;
 	const int64_t frameTime = m_frameTime - 10;
 
-	for (OutputMessage_ptr omsg : m_toAddQueue) {
-		const int64_t msgFrame = omsg->getFrame();
-		if (msgFrame >= dropTime) {
-			omsg->setState(OutputMessage::STATE_ALLOCATED);
-
-			if (frameTime > msgFrame) {
-				m_autoSendOutputMessages.push_front(omsg);
-			} else {
-				m_autoSendOutputMessages.push_back(omsg);
-			}
-		} else {
-			//drop messages that are older than 10 seconds
-			omsg->getProtocol()->onSendMessage(omsg);
-		}
-	}
-	m_toAddQueue.clear();
-
 	for (auto it = m_autoSendOutputMessages.begin(), end = m_autoSendOutputMessages.end(); it != end; it = m_autoSendOutputMessages.erase(it)) {
 		OutputMessage_ptr omsg = *it;
 		if (frameTime <= omsg->getFrame()) {
@@ -117,12 +268,7 @@ void OutputMessagePool::sendAll()
 
 void OutputMessagePool::releaseMessage(OutputMessage* msg)
 {
-	g_dispatcher.addTask(
-	    createTask(boost::bind(&OutputMessagePool::internalReleaseMessage, this, msg)));
-}
-
-void OutputMessagePool::internalReleaseMessage(OutputMessage* msg)
-{
+	//called by the thread dropping the last reference
 	if (msg->getProtocol()) {
 		msg->getProtocol()->unRef();
 	} else {
@@ -135,49 +281,31 @@ void OutputMessagePool::internalReleaseMessage(OutputMessage* msg)
 		std::cout << "No connection found." << std::endl;
 	}
 
-	msg->freeMessage();
-
-	m_outputPoolLock.lock();
-	m_outputMessages.push_back(msg);
-	m_outputPoolLock.unlock();
+	delete msg;
+	--m_messageCount;
 }
 
-OutputMessage_ptr OutputMessagePool::getOutputMessage(Protocol* protocol, bool autosend /*= true*/)
+OutputMessage_ptr OutputMessagePool::getOutputMessage(Protocol* protocol, bool autosend /*= true*/, OutputPriority_t priority /*= OUTPUT_PRIORITY_HIGH*/)
 {
 	if (!m_isOpen) {
 		return OutputMessage_ptr();
 	}
 
-	boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
-
 	if (!protocol->getConnection()) {
 		return OutputMessage_ptr();
 	}
 
-	if (m_outputMessages.empty()) {
-		OutputMessage* msg = new OutputMessage();
-		m_outputMessages.push_back(msg);
-
-#ifdef __ENABLE_SERVER_DIAGNOSTIC__
-		OutputMessagePoolCount++;
-#endif
-	}
-
-	OutputMessage_ptr outputmessage;
-	outputmessage.reset(m_outputMessages.back(),
-	                    boost::bind(&OutputMessagePool::releaseMessage, this, _1));
+	OutputMessage_ptr outputmessage(new OutputMessage());
+	++m_messageCount;
 
-	m_outputMessages.pop_back();
-
-	configureOutputMessage(outputmessage, protocol, autosend);
+	configureOutputMessage(outputmessage, protocol, autosend, priority);
 	return outputmessage;
 }
 
-void OutputMessagePool::configureOutputMessage(OutputMessage_ptr msg, Protocol* protocol, bool autosend)
+void OutputMessagePool::configureOutputMessage(OutputMessage_ptr msg, Protocol* protocol, bool autosend, OutputPriority_t priority)
 {
-	msg->Reset();
-
 	if (autosend) {
+		boost::recursive_mutex::scoped_lock lockClass(m_outputPoolLock);
 		msg->setState(OutputMessage::STATE_ALLOCATED);
 		m_autoSendOutputMessages.push_back(msg);
 	} else {
@@ -194,11 +322,47 @@ void OutputMessagePool::configureOutputMessage(OutputMessage_ptr msg, Protocol*
 	connection->addRef();
 
 	msg->setFrame(m_frameTime);
+	msg->setPriority(priority);
 }
 
-void OutputMessagePool::addToAutoSend(OutputMessage_ptr msg)
+uint32_t OutputMessagePool::getBufferSize(uint32_t sizeClass)
 {
-	m_outputPoolLock.lock();
-	m_toAddQueue.push_back(msg);
-	m_outputPoolLock.unlock();
+	return outputPoolBlockSizes[sizeClass];
+}
+
+uint64_t OutputMessagePool::getBufferCount(uint32_t sizeClass)
+{
+	return outputPoolClasses[sizeClass].blocks;
+}
+
+uint64_t OutputMessagePool::getPoolHits(uint32_t sizeClass)
+{
+	return outputPoolClasses[sizeClass].hits;
+}
+
+uint64_t OutputMessagePool::getPoolMisses(uint32_t sizeClass)
+{
+	return outputPoolClasses[sizeClass].misses;
+}
+
+uint8_t* OutputMessagePool::allocateBuffer(size_t size, int32_t& bufferSize)
+{
+	const uint32_t sizeClass = getOutputBufferClass(size);
+	bufferSize = outputPoolBlockSizes[sizeClass];
+	return static_cast<uint8_t*>(allocateOutputBlock(sizeClass));
+}
+
+void OutputMessagePool::releaseBuffer(uint8_t* buffer, int32_t bufferSize)
+{
+	releaseOutputBlock(getOutputBufferClass(bufferSize), buffer);
+}
+
+void* OutputMessagePool::allocateMessageBlock()
+{
+	return allocateOutputBlock(OUTPUT_POOL_SIZE_CLASSES);
+}
+
+void OutputMessagePool::releaseMessageBlock(void* p)
+{
+	releaseOutputBlock(OUTPUT_POOL_SIZE_CLASSES, p);
 }
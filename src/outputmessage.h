@@ -23,25 +23,33 @@
 #include "networkmessage.h"
 #include "connection.h"
 #include <boost/thread.hpp>
-#include <boost/shared_ptr.hpp>
 #include <boost/bind.hpp>
 #include "tools.h"
 
+#include <atomic>
 #include <list>
 
 #include <boost/utility.hpp>
 
 class Protocol;
 
-#define OUTPUT_POOL_SIZE 100
+// buffer sizes of the output message pool, a message starts in the smallest
+// one and is moved to a larger one when it fills up
+#define OUTPUT_POOL_SIZE_CLASSES 3
+#define OUTPUT_POOL_SMALL_BUFFER_SIZE 512
+#define OUTPUT_POOL_MEDIUM_BUFFER_SIZE 4096
 
-class OutputMessage : public NetworkMessage, boost::noncopyable
+class OutputMessage : public BasicNetworkMessage, boost::noncopyable
 {
 	private:
 		OutputMessage();
 
 	public:
-		~OutputMessage() {}
+		~OutputMessage();
+
+		// messages and their buffers are carved from the slabs of the pool
+		static void* operator new(size_t size);
+		static void operator delete(void* p, size_t size);
 
 		char* getOutputBuffer() {
 			return (char*)&m_MsgBuf[m_outputBufferStart];
@@ -71,19 +79,23 @@ class OutputMessage : public NetworkMessage, boost::noncopyable
 		int64_t getFrame() const {
 			return m_frame;
 		}
+		OutputPriority_t getPriority() const {
+			return m_priority;
+		}
 
-		inline void append(const NetworkMessage& msg) {
+		inline void append(const BasicNetworkMessage& msg) {
 			int32_t msgLen = msg.getMessageLength();
+			if (!canAdd(msgLen)) {
+				return;
+			}
+
 			memcpy(m_MsgBuf + m_ReadPos, msg.getBuffer() + 4, msgLen);
 			m_MsgSize += msgLen;
 			m_ReadPos += msgLen;
 		}
 
 		inline void append(OutputMessage_ptr msg) {
-			int32_t msgLen = msg->getMessageLength();
-			memcpy(m_MsgBuf + m_ReadPos, msg->getBuffer() + 4, msgLen);
-			m_MsgSize += msgLen;
-			m_ReadPos += msgLen;
+			append(*msg);
 		}
 
 		void setFrame(int64_t frame) {
@@ -105,20 +117,11 @@ class OutputMessage : public NetworkMessage, boost::noncopyable
 			m_MsgSize = m_MsgSize + sizeof(T);
 		}
 
-		void freeMessage() {
-			setConnection(Connection_ptr());
-			setProtocol(nullptr);
-			m_frame = 0;
-			//allocate enough size for headers
-			//2 bytes for unencrypted message size
-			//2 bytes for encrypted message size
-			m_outputBufferStart = 4;
-
-			//setState have to be the last one
-			setState(OutputMessage::STATE_FREE);
-		}
+		bool reserve(size_t size);
 
 		friend class OutputMessagePool;
+		friend void intrusive_ptr_add_ref(OutputMessage* msg);
+		friend void intrusive_ptr_release(OutputMessage* msg);
 
 		void setProtocol(Protocol* protocol) {
 			m_protocol = protocol;
@@ -127,6 +130,10 @@ class OutputMessage : public NetworkMessage, boost::noncopyable
 			m_connection = connection;
 		}
 
+		void setPriority(OutputPriority_t priority) {
+			m_priority = priority;
+		}
+
 		void setState(OutputMessageState state) {
 			m_state = state;
 		}
@@ -141,9 +148,11 @@ class OutputMessage : public NetworkMessage, boost::noncopyable
 		int64_t m_frame;
 
 		OutputMessageState m_state;
-};
+		OutputPriority_t m_priority;
 
-typedef boost::shared_ptr<OutputMessage> OutputMessage_ptr;
+		// references held by OutputMessage_ptr, the last one returns the message to the pool
+		std::atomic<uint32_t> m_refCount;
+};
 
 class OutputMessagePool
 {
@@ -158,53 +167,52 @@ class OutputMessagePool
 			return &instance;
 		}
 
-#ifdef __ENABLE_SERVER_DIAGNOSTIC__
-		static uint32_t OutputMessagePoolCount;
-#endif
-
 		void send(OutputMessage_ptr msg);
 		void sendAll();
 		void stop() {
 			m_isOpen = false;
 		}
-		OutputMessage_ptr getOutputMessage(Protocol* protocol, bool autosend = true);
+		OutputMessage_ptr getOutputMessage(Protocol* protocol, bool autosend = true, OutputPriority_t priority = OUTPUT_PRIORITY_HIGH);
 		void startExecutionFrame();
 
 		int64_t getFrameTime() const {
 			return m_frameTime;
 		}
 
-#ifdef __ENABLE_SERVER_DIAGNOSTIC__
-		size_t getTotalMessageCount() const {
-			return OutputMessagePoolCount;
-		}
-#else
 		size_t getTotalMessageCount() const {
-			return m_allOutputMessages.size();
-		}
-#endif
-		size_t getAvailableMessageCount() const {
-			return m_outputMessages.size();
+			return m_messageCount;
 		}
 		size_t getAutoMessageCount() const {
 			return m_autoSendOutputMessages.size();
 		}
-		void addToAutoSend(OutputMessage_ptr msg);
+
+		// statistics of the buffer size classes, hits are allocations served
+		// from the cache of the calling thread, misses had to go to the shared
+		// pool or carve a new slab
+		static uint32_t getBufferSize(uint32_t sizeClass);
+		static uint64_t getBufferCount(uint32_t sizeClass);
+		static uint64_t getPoolHits(uint32_t sizeClass);
+		static uint64_t getPoolMisses(uint32_t sizeClass);
+
+		// buffers of at least size bytes and message objects for the inbound
+		// messages, bufferSize is set to the size of the buffer handed out
+		static uint8_t* allocateBuffer(size_t size, int32_t& bufferSize);
+		static void releaseBuffer(uint8_t* buffer, int32_t bufferSize);
+		static void* allocateMessageBlock();
+		static void releaseMessageBlock(void* p);
 
 	protected:
-		void configureOutputMessage(OutputMessage_ptr msg, Protocol* protocol, bool autosend);
+		void configureOutputMessage(OutputMessage_ptr msg, Protocol* protocol, bool autosend, OutputPriority_t priority);
 		void releaseMessage(OutputMessage* msg);
-		void internalReleaseMessage(OutputMessage* msg);
 
-		typedef std::list<OutputMessage*> InternalOutputMessageList;
 		typedef std::list<OutputMessage_ptr> OutputMessageMessageList;
 
-		InternalOutputMessageList m_outputMessages;
-		InternalOutputMessageList m_allOutputMessages;
 		OutputMessageMessageList m_autoSendOutputMessages;
-		OutputMessageMessageList m_toAddQueue;
 		boost::recursive_mutex m_outputPoolLock;
+		std::atomic<size_t> m_messageCount;
 		int64_t m_frameTime;
 		bool m_isOpen;
+
+		friend void intrusive_ptr_release(OutputMessage* msg);
 };
 #endif
@@ -0,0 +1,152 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "otpch.h"
+
+#include "packetcapture.h"
+#include "networkmessage.h"
+
+#include <iostream>
+
+PacketCapture::PacketCapture() :
+	m_file(nullptr), m_startTime(0), m_isOpen(false) {}
+
+PacketCapture::~PacketCapture()
+{
+	close();
+}
+
+bool PacketCapture::open(const std::string& fileName)
+{
+	boost::lock_guard<boost::mutex> lockClass(m_lock);
+	if (m_file) {
+		return false;
+	}
+
+	m_file = fopen(fileName.c_str(), "wb");
+	if (!m_file) {
+		std::cout << "> ERROR: Unable to open packet capture file " << fileName << '.' << std::endl;
+		return false;
+	}
+
+	uint32_t magic = PACKET_CAPTURE_MAGIC;
+	uint16_t version = PACKET_CAPTURE_VERSION;
+	fwrite(&magic, sizeof(magic), 1, m_file);
+	fwrite(&version, sizeof(version), 1, m_file);
+
+	m_startTime = OTSYS_STEADY_TIME();
+	m_isOpen = true;
+	return true;
+}
+
+void PacketCapture::close()
+{
+	boost::lock_guard<boost::mutex> lockClass(m_lock);
+	if (!m_file) {
+		return;
+	}
+
+	m_isOpen = false;
+	fclose(m_file);
+	m_file = nullptr;
+}
+
+void PacketCapture::addLogin(uint32_t playerId, uint32_t accountId, OperatingSystem_t operatingSystem, const std::string& name)
+{
+	uint8_t header[6];
+	*reinterpret_cast<uint32_t*>(header) = accountId;
+	*reinterpret_cast<uint16_t*>(header + 4) = static_cast<uint16_t>(operatingSystem);
+	writeRecord(PACKET_CAPTURE_LOGIN, playerId, header, sizeof(header), reinterpret_cast<const uint8_t*>(name.c_str()), name.length());
+}
+
+void PacketCapture::addPacket(uint32_t playerId, const BasicNetworkMessage& msg)
+{
+	//network thread
+	int32_t readPos = msg.getReadPos();
+	int32_t length = std::min<int32_t>(msg.getMessageLength(), NETWORKMESSAGE_MAXSIZE - readPos);
+	if (length <= 0) {
+		return;
+	}
+
+	uint8_t header = static_cast<uint8_t>(readPos);
+	writeRecord(PACKET_CAPTURE_PACKET, playerId, &header, sizeof(header), msg.getBuffer() + readPos, length);
+}
+
+void PacketCapture::writeRecord(uint8_t type, uint32_t playerId, const uint8_t* header, size_t headerSize, const uint8_t* data, size_t size)
+{
+	uint8_t recordHeader[PACKET_CAPTURE_RECORD_HEADER_SIZE];
+	recordHeader[0] = type;
+	*reinterpret_cast<uint32_t*>(recordHeader + 1) = static_cast<uint32_t>(OTSYS_STEADY_TIME() - m_startTime);
+	*reinterpret_cast<uint32_t*>(recordHeader + 5) = playerId;
+	*reinterpret_cast<uint16_t*>(recordHeader + 9) = static_cast<uint16_t>(headerSize + size);
+
+	boost::lock_guard<boost::mutex> lockClass(m_lock);
+	if (!m_file) {
+		return;
+	}
+
+	fwrite(recordHeader, 1, sizeof(recordHeader), m_file);
+	fwrite(header, 1, headerSize, m_file);
+	fwrite(data, 1, size, m_file);
+}
+
+PacketCaptureReader::~PacketCaptureReader()
+{
+	if (m_file) {
+		fclose(m_file);
+	}
+}
+
+bool PacketCaptureReader::open(const std::string& fileName)
+{
+	m_file = fopen(fileName.c_str(), "rb");
+	if (!m_file) {
+		std::cout << "> ERROR: Unable to open packet capture file " << fileName << '.' << std::endl;
+		return false;
+	}
+
+	uint32_t magic;
+	uint16_t version;
+	if (fread(&magic, sizeof(magic), 1, m_file) != 1 || fread(&version, sizeof(version), 1, m_file) != 1 || magic != PACKET_CAPTURE_MAGIC) {
+		std::cout << "> ERROR: " << fileName << " is not a packet capture file." << std::endl;
+		return false;
+	}
+
+	if (version != PACKET_CAPTURE_VERSION) {
+		std::cout << "> ERROR: Unsupported packet capture version " << version << '.' << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool PacketCaptureReader::readRecord(PacketCaptureRecord& record)
+{
+	uint8_t recordHeader[PACKET_CAPTURE_RECORD_HEADER_SIZE];
+	if (fread(recordHeader, 1, sizeof(recordHeader), m_file) != sizeof(recordHeader)) {
+		return false;
+	}
+
+	record.type = recordHeader[0];
+	record.time = *reinterpret_cast<uint32_t*>(recordHeader + 1);
+	record.playerId = *reinterpret_cast<uint32_t*>(recordHeader + 5);
+
+	uint16_t size = *reinterpret_cast<uint16_t*>(recordHeader + 9);
+	record.payload.resize(size);
+	return size == 0 || fread(&record.payload[0], 1, size, m_file) == size;
+}
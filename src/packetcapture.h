@@ -0,0 +1,97 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __OTSERV_PACKETCAPTURE_H__
+#define __OTSERV_PACKETCAPTURE_H__
+
+#include <atomic>
+#include <boost/thread.hpp>
+
+#include "enums.h"
+
+class BasicNetworkMessage;
+
+// capture files start with the magic and the format version, followed by records
+#define PACKET_CAPTURE_MAGIC 0x43534654 // "TFSC"
+#define PACKET_CAPTURE_VERSION 1
+
+// type (1), time (4), player id (4), payload length (2)
+#define PACKET_CAPTURE_RECORD_HEADER_SIZE 11
+
+enum PacketCaptureRecord_t {
+	// payload: account id (4), operating system (2), character name
+	PACKET_CAPTURE_LOGIN = 0,
+	// payload: read position (1), decrypted message from the read position on
+	PACKET_CAPTURE_PACKET = 1
+};
+
+struct PacketCaptureRecord {
+	uint8_t type;
+	uint32_t time; // milliseconds since the capture was started
+	uint32_t playerId; // guid of the player
+	std::vector<uint8_t> payload;
+};
+
+// Records the decrypted packets received by the game protocol, so the load
+// of a live server can be replayed offline by the tfs-replay target.
+class PacketCapture
+{
+	public:
+		~PacketCapture();
+
+		static PacketCapture* getInstance() {
+			static PacketCapture instance;
+			return &instance;
+		}
+
+		bool open(const std::string& fileName);
+		void close();
+
+		bool isOpen() const {
+			return m_isOpen;
+		}
+
+		void addLogin(uint32_t playerId, uint32_t accountId, OperatingSystem_t operatingSystem, const std::string& name);
+		void addPacket(uint32_t playerId, const BasicNetworkMessage& msg);
+
+	private:
+		PacketCapture();
+
+		void writeRecord(uint8_t type, uint32_t playerId, const uint8_t* header, size_t headerSize, const uint8_t* data, size_t size);
+
+		boost::mutex m_lock;
+		FILE* m_file;
+		int64_t m_startTime;
+		std::atomic<bool> m_isOpen;
+};
+
+class PacketCaptureReader
+{
+	public:
+		PacketCaptureReader() : m_file(nullptr) {}
+		~PacketCaptureReader();
+
+		bool open(const std::string& fileName);
+		bool readRecord(PacketCaptureRecord& record);
+
+	private:
+		FILE* m_file;
+};
+
+#endif
@@ -0,0 +1,231 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "otpch.h"
+
+#include "definitions.h"
+
+#include <iostream>
+#include <iomanip>
+
+#include "configmanager.h"
+#include "game.h"
+#include "inputmessage.h"
+#include "protocolgame.h"
+#include "packetcapture.h"
+#include "histogram.h"
+#include "tasks.h"
+#include "scheduler.h"
+#include "server.h"
+
+// Replays a packet capture (see packetCaptureFile in config.lua) against a
+// headless server: the world is loaded from config.lua as usual, but no
+// ports are opened and the captured players are logged in with protocols
+// that have no connection. Every packet is parsed on this thread, like the
+// network threads do, and its latency is measured until the dispatcher has
+// run the tasks it queued. The database is written as by a live server:
+// players that log out in the capture are saved, the ones still logged in
+// when it ends are dropped unsaved. Run it against a copy of the database.
+
+extern ConfigManager g_config;
+extern Dispatcher g_dispatcher;
+extern Scheduler g_scheduler;
+extern Game g_game;
+
+extern boost::condition_variable g_loaderSignal;
+extern boost::unique_lock<boost::mutex> g_loaderUniqueLock;
+
+void mainLoader(int argc, char* argv[], ServiceManager* services);
+void shutdown();
+
+namespace {
+
+LatencyHistogram loginHistogram;
+LatencyHistogram opcodeHistograms[256];
+
+boost::mutex replayLock;
+boost::condition_variable replaySignal;
+bool replayTaskDone = false;
+
+void finishReplayTask(int64_t* finishTime)
+{
+	//dispatcher thread
+	*finishTime = OTSYS_STEADY_TIME_US();
+
+	boost::lock_guard<boost::mutex> lockClass(replayLock);
+	replayTaskDone = true;
+	replaySignal.notify_one();
+}
+
+// waits until the dispatcher has run every task queued so far
+uint64_t waitForDispatcher(int64_t startTime)
+{
+	int64_t finishTime = startTime;
+
+	boost::unique_lock<boost::mutex> lockClass(replayLock);
+	replayTaskDone = false;
+	g_dispatcher.addTask(createTask(boost::bind(&finishReplayTask, &finishTime)));
+	while (!replayTaskDone) {
+		replaySignal.wait(lockClass);
+	}
+	return finishTime - startTime;
+}
+
+void printHistogram(const std::string& name, const LatencyHistogram& histogram)
+{
+	std::cout << std::setw(8) << name
+	          << std::setw(10) << histogram.getCount()
+	          << std::setw(10) << histogram.getMean()
+	          << std::setw(10) << histogram.getPercentile(50)
+	          << std::setw(10) << histogram.getPercentile(90)
+	          << std::setw(10) << histogram.getPercentile(99)
+	          << std::setw(10) << histogram.getPercentile(99.9)
+	          << std::setw(10) << histogram.getMax() << std::endl;
+}
+
+uint64_t replay(PacketCaptureReader& reader, bool maxSpeed)
+{
+	std::map<uint32_t, ProtocolGame*> protocols;
+
+	uint64_t records = 0;
+	int64_t replayStart = OTSYS_STEADY_TIME();
+
+	PacketCaptureRecord record;
+	while (reader.readRecord(record)) {
+		++records;
+
+		if (!maxSpeed) {
+			int64_t delay = replayStart + record.time - OTSYS_STEADY_TIME();
+			if (delay > 0) {
+				boost::this_thread::sleep(boost::posix_time::milliseconds(delay));
+			}
+		}
+
+		if (record.type == PACKET_CAPTURE_LOGIN) {
+			if (record.payload.size() < 6) {
+				continue;
+			}
+
+			uint32_t accountId = *reinterpret_cast<uint32_t*>(&record.payload[0]);
+			OperatingSystem_t operatingSystem = static_cast<OperatingSystem_t>(*reinterpret_cast<uint16_t*>(&record.payload[4]));
+			std::string name(record.payload.begin() + 6, record.payload.end());
+
+			// a later login of the same player replaces the previous session, as it does online
+			ProtocolGame* protocol = new ProtocolGame(Connection_ptr());
+			protocols[record.playerId] = protocol;
+
+			// without started worker pools the database stages run on this
+			// thread and on the dispatcher, wait until every stage has run
+			int64_t startTime = OTSYS_STEADY_TIME_US();
+			protocol->login(name, accountId, operatingSystem, false);
+
+			uint64_t loginTime;
+			do {
+				loginTime = waitForDispatcher(startTime);
+			} while (protocol->isLoggingIn());
+			loginHistogram.record(loginTime);
+		} else if (record.type == PACKET_CAPTURE_PACKET) {
+			auto it = protocols.find(record.playerId);
+			if (it == protocols.end() || record.payload.size() < 2) {
+				continue;
+			}
+
+			int32_t readPos = record.payload[0];
+			int32_t length = record.payload.size() - 1;
+			if (readPos + length > NetworkMessage::max_body_length) {
+				continue;
+			}
+
+			// a buffer of its own per packet, the game tasks may still hold the previous one
+			InputMessage_ptr msg = InputMessage::create(readPos + length);
+			memcpy(msg->getBuffer() + readPos, &record.payload[1], length);
+			msg->setReadPos(readPos);
+			msg->setMessageLength(length);
+
+			int64_t startTime = OTSYS_STEADY_TIME_US();
+			it->second->onRecvMessage(*msg);
+			opcodeHistograms[record.payload[1]].record(waitForDispatcher(startTime));
+		}
+	}
+	return records;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		std::cout << "Usage: " << argv[0] << " <capture file> [--max-speed]" << std::endl;
+		std::cout << "Replays the captured packets in real time, or as fast as the server handles them." << std::endl;
+		std::cout << "Players that log out in the capture are saved, use a copy of the database." << std::endl;
+		return 1;
+	}
+
+	bool maxSpeed = false;
+	for (int i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "--max-speed") == 0) {
+			maxSpeed = true;
+		}
+	}
+
+	PacketCaptureReader reader;
+	if (!reader.open(argv[1])) {
+		return 1;
+	}
+
+	g_dispatcher.start();
+	g_scheduler.start();
+
+	g_dispatcher.addTask(createTask(boost::bind(mainLoader, argc, argv, static_cast<ServiceManager*>(nullptr))));
+
+	g_loaderSignal.wait(g_loaderUniqueLock);
+
+	int exitCode = 1;
+	if (g_game.getGameState() == GAME_STATE_NORMAL) {
+		std::cout << ">> Replaying " << argv[1] << (maxSpeed ? " at maximum speed" : " in real time") << std::endl;
+		std::cout << ">> Players that log out in the capture are saved to " << g_config.getString(ConfigManager::MYSQL_DB) << std::endl;
+
+		int64_t startTime = OTSYS_STEADY_TIME();
+		uint64_t records = replay(reader, maxSpeed);
+		std::cout << ">> Replayed " << records << " records in " << (OTSYS_STEADY_TIME() - startTime) << " ms" << std::endl << std::endl;
+
+		std::cout << "Handler latency (microseconds):" << std::endl;
+		std::cout << std::setw(8) << "opcode" << std::setw(10) << "count" << std::setw(10) << "mean"
+		          << std::setw(10) << "p50" << std::setw(10) << "p90" << std::setw(10) << "p99"
+		          << std::setw(10) << "p99.9" << std::setw(10) << "max" << std::endl;
+
+		printHistogram("login", loginHistogram);
+		for (int32_t opcode = 0; opcode < 256; ++opcode) {
+			if (opcodeHistograms[opcode].getCount() != 0) {
+				std::ostringstream ss;
+				ss << "0x" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << opcode;
+				printHistogram(ss.str(), opcodeHistograms[opcode]);
+			}
+		}
+		exitCode = 0;
+	}
+
+	// without a save thread the players that logged out were written right
+	// away, the ones still logged in are not saved and the world is dropped;
+	// shutdown() terminates both threads, stopping them first would refuse the task
+	g_dispatcher.addTask(createTask(boost::bind(shutdown)));
+	g_scheduler.join();
+	g_dispatcher.join();
+	return exitCode;
+}
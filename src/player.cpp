@@ -120,6 +120,11 @@ Player::Player(ProtocolGame* p) :
 
 	lastDepotId = -1;
 
+	saveDirty = PLAYERSAVE_ALL;
+	for (size_t i = 0; i < 3; ++i) {
+		savedItemsHash[i] = 0;
+	}
+
 	chaseMode = CHASEMODE_STANDSTILL;
 	fightMode = FIGHTMODE_ATTACK;
 
@@ -910,12 +915,15 @@ void Player::addStorageValue(const uint32_t key, const int32_t value, const bool
 {
 	if (value != -1) {
 		int32_t oldValue;
-		getStorageValue(key, oldValue);
+		if (getStorageValue(key, oldValue) && oldValue == value) {
+			return;
+		}
 
 		storageMap[key] = value;
-	} else {
-		storageMap.erase(key);
+	} else if (storageMap.erase(key) == 0) {
+		return;
 	}
+	saveDirty |= PLAYERSAVE_STORAGE;
 }
 
 bool Player::getStorageValue(const uint32_t key, int32_t& value) const
@@ -4061,6 +4069,7 @@ void Player::learnInstantSpell(const std::string& name)
 {
 	if (!hasLearnedInstantSpell(name)) {
 		learnedInstantSpellList.push_back(name);
+		saveDirty |= PLAYERSAVE_SPELLS;
 	}
 }
 
@@ -89,6 +89,16 @@ enum secureMode_t {
 	SECUREMODE_OFF
 };
 
+// parts of a player that periodic saves only write when they changed
+enum playersave_t {
+	PLAYERSAVE_INVENTORY = 1 << 0,
+	PLAYERSAVE_DEPOT = 1 << 1,
+	PLAYERSAVE_INBOX = 1 << 2,
+	PLAYERSAVE_STORAGE = 1 << 3,
+	PLAYERSAVE_SPELLS = 1 << 4,
+	PLAYERSAVE_ALL = PLAYERSAVE_INVENTORY | PLAYERSAVE_DEPOT | PLAYERSAVE_INBOX | PLAYERSAVE_STORAGE | PLAYERSAVE_SPELLS
+};
+
 enum tradestate_t {
 	TRADE_NONE,
 	TRADE_INITIATED,
@@ -708,9 +718,9 @@ class Player : public Creature, public Cylinder
 			}
 		}
 		void sendCreatureMove(const Creature* creature, const Tile* newTile, const Position& newPos,
-		                      const Tile* oldTile, const Position& oldPos, uint32_t oldStackPos, bool teleport) {
+		                      const Tile* oldTile, const Position& oldPos, uint32_t oldStackPos, bool teleport, NetworkMessage* stepMsg = nullptr) {
 			if (client) {
-				client->sendMoveCreature(creature, newTile, newPos, newTile->getClientIndexOfThing(this, creature), oldTile, oldPos, oldStackPos, teleport);
+				client->sendMoveCreature(creature, newTile, newPos, newTile->getClientIndexOfThing(this, creature), oldTile, oldPos, oldStackPos, teleport, stepMsg);
 			}
 		}
 		void sendCreatureTurn(const Creature* creature) {
@@ -866,6 +876,16 @@ class Player : public Creature, public Cylinder
 				client->sendMagicEffect(pos, type);
 			}
 		}
+		void sendSharedMessage(const NetworkMessage& msg, OutputPriority_t priority = OUTPUT_PRIORITY_HIGH) const {
+			if (client) {
+				client->sendSharedMessage(msg, priority);
+			}
+		}
+		void sendSharedMessage(const Position& pos, const NetworkMessage& msg, OutputPriority_t priority = OUTPUT_PRIORITY_HIGH) const {
+			if (client) {
+				client->sendSharedMessage(pos, msg, priority);
+			}
+		}
 		void sendPing();
 		void sendStats();
 		void sendSkills() const {
@@ -1119,6 +1139,11 @@ class Player : public Creature, public Cylinder
 		int16_t lastDepotId;
 		int16_t blessings;
 
+		// playersave_t sections changed since the last save was built, and the
+		// fingerprint of the inventory, depot and inbox items it wrote
+		uint32_t saveDirty;
+		size_t savedItemsHash[3];
+
 		uint8_t guildLevel;
 
 		bool mayNotMove;
@@ -26,28 +26,34 @@
 #include "connection.h"
 #include "outputmessage.h"
 #include "rsa.h"
+#include "xtea.h"
 
 extern RSA g_RSA;
 
 void Protocol::onSendMessage(OutputMessage_ptr msg)
 {
+	OutputMessage_ptr& outputBuffer = m_outputBuffers[msg->getPriority()];
+	if (msg == outputBuffer) {
+		outputBuffer.reset();
+	}
+}
+
+void Protocol::finalizeMessage(OutputMessage& msg)
+{
+	//network thread of the connection
 	if (!m_rawMessages) {
-		msg->writeMessageLength();
+		msg.writeMessageLength();
 
 		#ifdef __PROTOCOL_77__
 		if (m_encryptionEnabled) {
-			XTEA_encrypt(*msg);
-			msg->addCryptoHeader();
+			XTEA_encrypt(msg);
+			msg.addCryptoHeader();
 		}
 		#endif
 	}
-
-	if (msg == m_outputBuffer) {
-		m_outputBuffer.reset();
-	}
 }
 
-void Protocol::onRecvMessage(NetworkMessage& msg)
+void Protocol::onRecvMessage(InputMessage& msg)
 {
 	#ifdef __PROTOCOL_77__
 	if (m_encryptionEnabled && !XTEA_decrypt(msg)) {
@@ -58,13 +64,14 @@ void Protocol::onRecvMessage(NetworkMessage& msg)
 	parsePacket(msg);
 }
 
-OutputMessage_ptr Protocol::getOutputBuffer(int32_t size)
+OutputMessage_ptr Protocol::getOutputBuffer(int32_t size, OutputPriority_t priority/* = OUTPUT_PRIORITY_HIGH*/)
 {
-	if (m_outputBuffer && NetworkMessage::max_body_length >= m_outputBuffer->getMessageLength() + size) {
-		return m_outputBuffer;
+	OutputMessage_ptr& outputBuffer = m_outputBuffers[priority];
+	if (outputBuffer && outputBuffer->getReadPos() + size < NetworkMessage::max_body_length) {
+		return outputBuffer;
 	} else if (m_connection) {
-		m_outputBuffer = OutputMessagePool::getInstance()->getOutputMessage(this);
-		return m_outputBuffer;
+		outputBuffer = OutputMessagePool::getInstance()->getOutputMessage(this, true, priority);
+		return outputBuffer;
 	}
 
 	return OutputMessage_ptr();
@@ -91,73 +98,22 @@ void Protocol::deleteProtocolTask()
 
 void Protocol::XTEA_encrypt(OutputMessage& msg)
 {
-	const uint32_t delta = 0x61C88647;
-
-	uint32_t k[4];
-	k[0] = m_key[0];
-	k[1] = m_key[1];
-	k[2] = m_key[2];
-	k[3] = m_key[3];
-
 	//add bytes until reach 8 multiple
 	int32_t paddingBytes = msg.getMessageLength() % 8;
 	if (paddingBytes != 0) {
 		msg.AddPaddingBytes(4 - paddingBytes);
 	}
 
-	uint32_t* buffer = (uint32_t*)msg.getOutputBuffer();
-	const int32_t messageLength = msg.getMessageLength() / 4;
-	int32_t read_pos = 0;
-	while (read_pos < messageLength) {
-		uint32_t v0 = buffer[read_pos], v1 = buffer[read_pos + 1];
-		uint32_t sum = 0;
-
-		for (int32_t i = 0; i < 32; ++i) {
-			v0 += ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
-			sum -= delta;
-			v1 += ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum >> 11 & 3]);
-		}
-
-		buffer[read_pos++] = v0;
-		buffer[read_pos++] = v1;
-	}
+	xteaEncrypt((uint8_t*)msg.getOutputBuffer(), (msg.getMessageLength() / 4 + 1) / 2, m_key);
 }
 
-bool Protocol::XTEA_decrypt(NetworkMessage& msg)
+bool Protocol::XTEA_decrypt(InputMessage& msg)
 {
 	if ((msg.getMessageLength() - 2) % 8 != 0) {
 		return false;
 	}
 
-	const uint32_t delta = 0x61C88647;
-
-	const int32_t messageLength = (msg.getMessageLength() - 2) / 4;
-
-	//
-	uint32_t k[4];
-	k[0] = m_key[0];
-	k[1] = m_key[1];
-	k[2] = m_key[2];
-	k[3] = m_key[3];
-
-	uint32_t* buffer = (uint32_t*)(msg.getBuffer() + msg.getReadPos());
-
-	int32_t read_pos = 0;
-	while (read_pos < messageLength) {
-		uint32_t v0 = buffer[read_pos], v1 = buffer[read_pos + 1];
-		uint32_t sum = 0xC6EF3720;
-
-		for (int32_t i = 0; i < 32; ++i) {
-			v1 -= ((v0 << 4 ^ v0 >> 5) + v0) ^ (sum + k[sum >> 11 & 3]);
-			sum += delta;
-			v0 -= ((v1 << 4 ^ v1 >> 5) + v1) ^ (sum + k[sum & 3]);
-		}
-
-		buffer[read_pos++] = v0;
-		buffer[read_pos++] = v1;
-	}
-
-	//
+	xteaDecrypt(msg.getBuffer() + msg.getReadPos(), (msg.getMessageLength() - 2) / 8, m_key);
 
 	int tmp = msg.GetU16();
 	if (tmp > msg.getMessageLength() - 4) {
@@ -168,12 +124,12 @@ bool Protocol::XTEA_decrypt(NetworkMessage& msg)
 	return true;
 }
 
-bool Protocol::RSA_decrypt(NetworkMessage& msg)
+bool Protocol::RSA_decrypt(InputMessage& msg)
 {
 	return RSA_decrypt(&g_RSA, msg);
 }
 
-bool Protocol::RSA_decrypt(RSA* rsa, NetworkMessage& msg)
+bool Protocol::RSA_decrypt(RSA* rsa, InputMessage& msg)
 {
 	if (msg.getMessageLength() - msg.getReadPos() != 128) {
 		return false;
@@ -20,13 +20,20 @@
 #ifndef __OTSERV_PROTOCOL_H__
 #define __OTSERV_PROTOCOL_H__
 
+#include <atomic>
+
+#include "const.h"
+
 #include <boost/utility.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
 
-class NetworkMessage;
+class InputMessage;
 class OutputMessage;
 class Connection;
-typedef boost::shared_ptr<OutputMessage> OutputMessage_ptr;
+void intrusive_ptr_add_ref(OutputMessage* msg);
+void intrusive_ptr_release(OutputMessage* msg);
+typedef boost::intrusive_ptr<OutputMessage> OutputMessage_ptr;
 typedef boost::shared_ptr<Connection> Connection_ptr;
 class RSA;
 
@@ -50,11 +57,14 @@ class Protocol : boost::noncopyable
 			return 0x00;
 		}
 
-		virtual void parsePacket(NetworkMessage& msg) {}
+		virtual void parsePacket(InputMessage& msg) {}
 
+		// called when the message is handed to the connection, it may not be appended to any more
 		virtual void onSendMessage(OutputMessage_ptr msg);
-		void onRecvMessage(NetworkMessage& msg);
-		virtual void onRecvFirstMessage(NetworkMessage& msg) = 0;
+		// adds the headers and encrypts the message, called on the network thread right before writing it
+		void finalizeMessage(OutputMessage& msg);
+		void onRecvMessage(InputMessage& msg);
+		virtual void onRecvFirstMessage(InputMessage& msg) = 0;
 		virtual void onConnect() {}
 
 		Connection_ptr getConnection() {
@@ -76,8 +86,8 @@ class Protocol : boost::noncopyable
 			return --m_refCount;
 		}
 
-		//Use this function for autosend messages only
-		OutputMessage_ptr getOutputBuffer(int32_t size);
+		//Use this function for autosend messages only, every priority has a message of its own
+		OutputMessage_ptr getOutputBuffer(int32_t size, OutputPriority_t priority = OUTPUT_PRIORITY_HIGH);
 
 	protected:
 		void enableXTEAEncryption() {
@@ -91,9 +101,9 @@ class Protocol : boost::noncopyable
 		}
 
 		void XTEA_encrypt(OutputMessage& msg);
-		bool XTEA_decrypt(NetworkMessage& msg);
-		bool RSA_decrypt(NetworkMessage& msg);
-		bool RSA_decrypt(RSA* rsa, NetworkMessage& msg);
+		bool XTEA_decrypt(InputMessage& msg);
+		bool RSA_decrypt(InputMessage& msg);
+		bool RSA_decrypt(RSA* rsa, InputMessage& msg);
 
 		void setRawMessages(bool value) {
 			m_rawMessages = value;
@@ -103,14 +113,15 @@ class Protocol : boost::noncopyable
 		virtual void deleteProtocolTask();
 		friend class Connection;
 
-		OutputMessage_ptr m_outputBuffer;
+		OutputMessage_ptr m_outputBuffers[OUTPUT_PRIORITY_LAST];
 
 	private:
 		Connection_ptr m_connection;
 		bool m_encryptionEnabled;
 		bool m_rawMessages;
 		uint32_t m_key[4];
-		uint32_t m_refCount;
+		// taken by output messages on the network threads, released on the dispatcher
+		std::atomic<uint32_t> m_refCount;
 };
 
 #endif
@@ -22,6 +22,7 @@
 #include "protocolgame.h"
 
 #include "networkmessage.h"
+#include "inputmessage.h"
 #include "outputmessage.h"
 
 #include "items.h"
@@ -39,6 +40,8 @@
 #include "ban.h"
 #include "connection.h"
 #include "creatureevent.h"
+#include "packetcapture.h"
+#include "stats.h"
 
 #include <ctime>
 #include <list>
@@ -65,11 +68,15 @@ uint32_t ProtocolGame::protocolGameCount = 0;
 template<class FunctionType>
 void ProtocolGame::addGameTaskInternal(bool droppable, uint32_t delay, const FunctionType& func)
 {
+	Task* task;
 	if (droppable) {
-		g_dispatcher.addTask(createTask(delay, func));
+		task = createTask(delay, func);
 	} else {
-		g_dispatcher.addTask(createTask(func));
+		task = createTask(func);
 	}
+
+	task->setStats(m_packetStats);
+	g_dispatcher.addTask(task);
 }
 
 ProtocolGame::ProtocolGame(Connection_ptr connection) :
@@ -78,8 +85,10 @@ ProtocolGame::ProtocolGame(Connection_ptr connection) :
 	eventConnect(0),
 	// version(CLIENT_VERSION_MIN),
 	m_debugAssertSent(false),
-	m_acceptPackets(false)
+	m_acceptPackets(false),
+	m_packetStats(nullptr)
 {
+	m_loggingIn = false;
 #ifdef __ENABLE_SERVER_DIAGNOSTIC__
 	protocolGameCount++;
 #endif
@@ -118,128 +127,194 @@ void ProtocolGame::deleteProtocolTask()
 	Protocol::deleteProtocolTask();
 }
 
-bool ProtocolGame::login(const std::string& name, uint32_t accountId, OperatingSystem_t operatingSystem, bool gamemasterLogin)
+void ProtocolGame::login(const std::string& name, uint32_t accountId, OperatingSystem_t operatingSystem, bool gamemasterLogin)
 {
-	//dispatcher thread
-	Player* _player = g_game.getPlayerByName(name);
-	if (!_player || g_config.getBoolean(ConfigManager::ALLOW_CLONES)) {
-		player = new Player(this);
-		player->setName(name);
+	// the pipeline holds a reference until endLogin
+	m_loggingIn = true;
+	addRef();
 
-		player->useThing2();
-		player->setID();
+	if (!g_databasePool.addTask(createTask(boost::bind(&ProtocolGame::preloadLogin, this, name, accountId, operatingSystem, gamemasterLogin)))) {
+		disconnectWaitingList("Too many players are logging in.", (int32_t)g_databasePool.getTaskCount());
+		endLogin();
+	}
+}
 
-		if (!IOLoginData::getInstance()->preloadPlayer(player, name)) {
-			disconnectClient(0x14, "Your character could not be loaded.");
-			return false;
+void ProtocolGame::endLogin()
+{
+	m_loggingIn = false;
+	unRef();
+}
+
+void ProtocolGame::preloadLogin(const std::string& name, uint32_t accountId, OperatingSystem_t operatingSystem, bool gamemasterLogin)
+{
+	//database thread
+	Player* loadedPlayer = new Player(nullptr);
+	loadedPlayer->setName(name);
+	loadedPlayer->useThing2();
+
+	if (!IOLoginData::getInstance()->preloadPlayer(loadedPlayer, name)) {
+		loadedPlayer->releaseThing2();
+		disconnectClient(0x14, "Your character could not be loaded.");
+		endLogin();
+		return;
+	}
+
+	if (IOBan::getInstance()->isPlayerNamelocked(loadedPlayer->getGUID())) {
+		loadedPlayer->releaseThing2();
+		disconnectClient(0x14, "Your character has been namelocked.");
+		endLogin();
+		return;
+	}
+
+	if (!loadedPlayer->hasFlag(PlayerFlag_CannotBeBanned)) {
+		BanInfo banInfo;
+		if (IOBan::getInstance()->isAccountBanned(accountId, banInfo)) {
+			if (banInfo.reason.empty()) {
+				banInfo.reason = "(none)";
+			}
+
+			std::ostringstream ss;
+			if (banInfo.expiresAt > 0) {
+				ss << "Your account has been banned until " << formatDateShort(banInfo.expiresAt) << " by " << banInfo.bannedBy << ".\n\nReason specified:\n" << banInfo.reason;
+			} else {
+				ss << "Your account has been permanently banned by " << banInfo.bannedBy << ".\n\nReason specified:\n" << banInfo.reason;
+			}
+			loadedPlayer->releaseThing2();
+			disconnectClient(0x14, ss.str().c_str());
+			endLogin();
+			return;
 		}
+	}
 
-		if (IOBan::getInstance()->isPlayerNamelocked(player->getGUID())) {
-			disconnectClient(0x14, "Your character has been namelocked.");
-			return false;
+	Task* task = createTask(boost::bind(&ProtocolGame::admitLogin, this, loadedPlayer, accountId, operatingSystem, gamemasterLogin));
+	task->setStats(Stats::getInstance()->getOriginStats(TASK_ORIGIN_LOGIN));
+	g_dispatcher.addTask(task);
+}
+
+void ProtocolGame::admitLogin(Player* loadedPlayer, uint32_t accountId, OperatingSystem_t operatingSystem, bool gamemasterLogin)
+{
+	//dispatcher thread
+	WaitingList* waitingList = WaitingList::getInstance();
+	Player* _player = g_game.getPlayerByName(loadedPlayer->getName());
+	if (!_player || g_config.getBoolean(ConfigManager::ALLOW_CLONES)) {
+		if (!g_config.getBoolean(ConfigManager::ALLOW_CLONES) && waitingList->isPendingLogin(loadedPlayer->getName())) {
+			loadedPlayer->releaseThing2();
+			disconnectClient(0x14, "You are already logged in.");
+			endLogin();
+			return;
 		}
 
+		player = loadedPlayer;
+		player->client = this;
+		player->setID();
+
 		if (gamemasterLogin && player->getAccountType() < ACCOUNT_TYPE_GAMEMASTER) {
 			disconnectClient(0x14, "You are not a gamemaster!");
-			return false;
+			endLogin();
+			return;
 		}
 
 		if (g_game.getGameState() == GAME_STATE_CLOSING && !player->hasFlag(PlayerFlag_CanAlwaysLogin)) {
 			disconnectClient(0x14, "The game is just going down.\nPlease try again later.");
-			return false;
+			endLogin();
+			return;
 		}
 
 		if (g_game.getGameState() == GAME_STATE_CLOSED && !player->hasFlag(PlayerFlag_CanAlwaysLogin)) {
 			disconnectClient(0x14, "Server is currently closed. Please try again later.");
-			return false;
+			endLogin();
+			return;
 		}
 
-		if (g_config.getBoolean(ConfigManager::ONE_PLAYER_ON_ACCOUNT) && player->getAccountType() < ACCOUNT_TYPE_GAMEMASTER && g_game.getPlayerByAccount(player->getAccount())) {
+		if (g_config.getBoolean(ConfigManager::ONE_PLAYER_ON_ACCOUNT) && player->getAccountType() < ACCOUNT_TYPE_GAMEMASTER && (g_game.getPlayerByAccount(player->getAccount()) || waitingList->isPendingAccount(player->getAccount()))) {
 			disconnectClient(0x14, "You may only login with one character\nof your account at the same time.");
-			return false;
+			endLogin();
+			return;
 		}
 
-		if (!player->hasFlag(PlayerFlag_CannotBeBanned)) {
-			BanInfo banInfo;
-			if (IOBan::getInstance()->isAccountBanned(accountId, banInfo)) {
-				if (banInfo.reason.empty()) {
-					banInfo.reason = "(none)";
-				}
+		if (!waitingList->clientLogin(player)) {
+			disconnectWaitingList("Too many players online.", waitingList->getClientSlot(player));
+			endLogin();
+			return;
+		}
 
-				std::ostringstream ss;
-				if (banInfo.expiresAt > 0) {
-					ss << "Your account has been banned until " << formatDateShort(banInfo.expiresAt) << " by " << banInfo.bannedBy << ".\n\nReason specified:\n" << banInfo.reason;
-				} else {
-					ss << "Your account has been permanently banned by " << banInfo.bannedBy << ".\n\nReason specified:\n" << banInfo.reason;
-				}
-				disconnectClient(0x14, ss.str().c_str());
-				return false;
-			}
+		// the player keeps its place while it is loaded
+		waitingList->addPendingLogin(player);
+		if (!g_databasePool.addTask(createTask(boost::bind(&ProtocolGame::loadLogin, this, player, accountId, operatingSystem)))) {
+			waitingList->removePendingLogin(player);
+			disconnectWaitingList("Too many players are logging in.", (int32_t)g_databasePool.getTaskCount());
+			endLogin();
 		}
+		return;
+	}
 
-		if (!WaitingList::getInstance()->clientLogin(player)) {
-			int32_t currentSlot = WaitingList::getInstance()->getClientSlot(player);
-			int32_t retryTime = WaitingList::getTime(currentSlot);
-			std::ostringstream ss;
+	loadedPlayer->releaseThing2();
 
-			ss << "Too many players online.\nYou are at place "
-			   << currentSlot << " on the waiting list.";
+	if (eventConnect != 0 || !g_config.getBoolean(ConfigManager::REPLACE_KICK_ON_LOGIN)) {
+		//Already trying to connect
+		disconnectClient(0x14, "You are already logged in.");
+		endLogin();
+		return;
+	}
 
-			OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, false);
-			if (output) {
-				output->AddByte(0x16);
-				output->AddString(ss.str());
-				output->AddByte(retryTime);
-				OutputMessagePool::getInstance()->send(output);
-			}
+	// connect ends the login
+	if (_player->client) {
+		_player->disconnect();
+		_player->isConnecting = true;
 
-			getConnection()->closeConnection();
-			return false;
-		}
+		eventConnect = g_scheduler.addEvent(createSchedulerTask(1000, boost::bind(&ProtocolGame::connect, this, _player->getID(), operatingSystem)));
+		return;
+	}
 
-		if (!IOLoginData::getInstance()->loadPlayerByName(player, name)) {
-			disconnectClient(0x14, "Your character could not be loaded.");
-			return false;
-		}
+	connect(_player->getID(), operatingSystem);
+}
 
-		player->setOperatingSystem((OperatingSystem_t)operatingSystem);
+void ProtocolGame::loadLogin(Player* loadingPlayer, uint32_t accountId, OperatingSystem_t operatingSystem)
+{
+	//database thread
+	GuildMembership membership;
+	bool loaded = IOLoginData::getInstance()->loadPlayerByName(loadingPlayer, loadingPlayer->getName(), &membership);
 
-		if (!g_game.placeCreature(player, player->getLoginPosition())) {
-			if (!g_game.placeCreature(player, player->getTemplePosition(), false, true)) {
-				disconnectClient(0x14, "Temple position is wrong. Contact the administrator.");
-				return false;
-			}
-		}
+	Task* task = createTask(boost::bind(&ProtocolGame::finishLogin, this, loaded, membership, accountId, operatingSystem));
+	task->setStats(Stats::getInstance()->getOriginStats(TASK_ORIGIN_LOGIN));
+	g_dispatcher.addTask(task);
+}
 
-		player->lastIP = player->getIP();
-		player->lastLoginSaved = std::max<time_t>(time(nullptr), player->lastLoginSaved + 1);
-		m_acceptPackets = true;
-		return true;
-	} else {
-		if (eventConnect != 0 || !g_config.getBoolean(ConfigManager::REPLACE_KICK_ON_LOGIN)) {
-			//Already trying to connect
-			disconnectClient(0x14, "You are already logged in.");
-			return false;
-		}
+void ProtocolGame::finishLogin(bool loaded, const GuildMembership& membership, uint32_t accountId, OperatingSystem_t operatingSystem)
+{
+	//dispatcher thread
+	WaitingList::getInstance()->removePendingLogin(player);
+
+	if (!loaded) {
+		disconnectClient(0x14, "Your character could not be loaded.");
+		endLogin();
+		return;
+	}
 
-		if (_player->client) {
-			_player->disconnect();
-			_player->isConnecting = true;
+	IOLoginData::getInstance()->loadPlayerGuild(player, membership);
+	player->setOperatingSystem((OperatingSystem_t)operatingSystem);
 
-			addRef();
-			eventConnect = g_scheduler.addEvent(createSchedulerTask(1000, boost::bind(&ProtocolGame::connect, this, _player->getID(), operatingSystem)));
-			return true;
+	if (!g_game.placeCreature(player, player->getLoginPosition())) {
+		if (!g_game.placeCreature(player, player->getTemplePosition(), false, true)) {
+			disconnectClient(0x14, "Temple position is wrong. Contact the administrator.");
+			endLogin();
+			return;
 		}
+	}
 
-		addRef();
-		return connect(_player->getID(), operatingSystem);
+	player->lastIP = player->getIP();
+	player->lastLoginSaved = std::max<time_t>(time(nullptr), player->lastLoginSaved + 1);
+	m_acceptPackets = true;
+
+	if (PacketCapture::getInstance()->isOpen()) {
+		PacketCapture::getInstance()->addLogin(player->getGUID(), accountId, operatingSystem, player->getName());
 	}
-	return false;
+	endLogin();
 }
 
 bool ProtocolGame::connect(uint32_t playerId, OperatingSystem_t operatingSystem)
 {
-	unRef();
+	endLogin();
 	eventConnect = 0;
 
 	Player* _player = g_game.getPlayerByID(playerId);
@@ -260,6 +335,10 @@ bool ProtocolGame::connect(uint32_t playerId, OperatingSystem_t operatingSystem)
 	player->lastIP = player->getIP();
 	player->lastLoginSaved = std::max<time_t>(time(nullptr), player->lastLoginSaved + 1);
 	m_acceptPackets = true;
+
+	if (PacketCapture::getInstance()->isOpen()) {
+		PacketCapture::getInstance()->addLogin(player->getGUID(), player->getAccount(), operatingSystem, player->getName());
+	}
 	return true;
 }
 
@@ -300,58 +379,86 @@ bool ProtocolGame::logout(bool displayEffect, bool forced)
 	return g_game.removeCreature(player);
 }
 
-bool ProtocolGame::parseFirstPacket(NetworkMessage& msg)
+bool ProtocolGame::parseFirstPacket(InputMessage& msg)
 {
 	if (g_game.getGameState() == GAME_STATE_SHUTDOWN) {
 		getConnection()->closeConnection();
 		return false;
 	}
 
-	OperatingSystem_t operatingSystem = (OperatingSystem_t)msg.GetU16();
-	uint16_t version = msg.GetU16();
-
-	#ifdef __PROTOCOL_77__
-	if (!RSA_decrypt(msg)) {
+	// the message is decrypted and checked away from the network thread,
+	// both pools release this reference when the pipeline ends
+	addRef();
+	if (!g_cryptoPool.addTask(createTask(boost::bind(&ProtocolGame::decryptFirstPacket, this, InputMessage_ptr(&msg), getIP())))) {
+		unRef();
 		getConnection()->closeConnection();
 		return false;
 	}
+	return true;
+}
+
+void ProtocolGame::decryptFirstPacket(InputMessage_ptr msg, uint32_t clientIp)
+{
+	//crypto thread
+	OperatingSystem_t operatingSystem = (OperatingSystem_t)msg->GetU16();
+	uint16_t version = msg->GetU16();
+
+	#ifdef __PROTOCOL_77__
+	if (!RSA_decrypt(*msg)) {
+		disconnect();
+		unRef();
+		return;
+	}
 
 	uint32_t key[4];
-	key[0] = msg.GetU32();
-	key[1] = msg.GetU32();
-	key[2] = msg.GetU32();
-	key[3] = msg.GetU32();
+	key[0] = msg->GetU32();
+	key[1] = msg->GetU32();
+	key[2] = msg->GetU32();
+	key[3] = msg->GetU32();
 	enableXTEAEncryption();
 	setXTEAKey(key);
 	#endif
 
-	bool gamemasterFlag = msg.GetByte() != 0;
-	uint32_t accountName = msg.GetU32();
-	std::string characterName = msg.GetString();
-	std::string password = msg.GetString();
+	bool gamemasterFlag = msg->GetByte() != 0;
+	uint32_t accountName = msg->GetU32();
+	std::string characterName = msg->GetString();
+	std::string password = msg->GetString();
 
 	if (version < CLIENT_VERSION_MIN || version > CLIENT_VERSION_MAX) {
 		disconnectClient(0x14, "Only clients with protocol " CLIENT_VERSION_STR " allowed!");
-		return false;
+		unRef();
+		return;
 	}
 
 	if (!accountName) {
 		disconnectClient(0x14, "You must enter your account id.");
-		return false;
+		unRef();
+		return;
 	}
 
 	if (g_game.getGameState() == GAME_STATE_STARTUP || g_game.getServerSaveMessage(0)) {
 		disconnectClient(0x14, "Gameworld is starting up. Please wait.");
-		return false;
+		unRef();
+		return;
 	}
 
 	if (g_game.getGameState() == GAME_STATE_MAINTAIN) {
 		disconnectClient(0x14, "Gameworld is under maintenance. Please re-connect in a while.");
-		return false;
+		unRef();
+		return;
 	}
 
+	if (!g_databasePool.addTask(createTask(boost::bind(&ProtocolGame::authenticate, this, clientIp, accountName, password, characterName, operatingSystem, gamemasterFlag)))) {
+		disconnectWaitingList("Too many players are logging in.", (int32_t)g_databasePool.getTaskCount());
+		unRef();
+	}
+}
+
+void ProtocolGame::authenticate(uint32_t clientIp, uint32_t accountName, const std::string& password, std::string& characterName, OperatingSystem_t operatingSystem, bool gamemasterFlag)
+{
+	//database thread
 	BanInfo banInfo;
-	if (IOBan::getInstance()->isIpBanned(getIP(), banInfo)) {
+	if (IOBan::getInstance()->isIpBanned(clientIp, banInfo)) {
 		if (banInfo.reason.empty()) {
 			banInfo.reason = "(none)";
 		}
@@ -359,20 +466,22 @@ bool ProtocolGame::parseFirstPacket(NetworkMessage& msg)
 		std::ostringstream ss;
 		ss << "Your IP has been banned until " << formatDateShort(banInfo.expiresAt) << " by " << banInfo.bannedBy << ".\n\nReason specified:\n" << banInfo.reason;
 		disconnectClient(0x14, ss.str().c_str());
-		return false;
+		unRef();
+		return;
 	}
 
 	uint32_t accountId = IOLoginData::getInstance()->gameworldAuthentication(accountName, password, characterName);
 	if (accountId == 0) {
 		disconnectClient(0x14, "Account id or password is not correct.");
-		return false;
+		unRef();
+		return;
 	}
 
-	g_dispatcher.addTask(createTask(boost::bind(&ProtocolGame::login, this, characterName, accountId, operatingSystem, gamemasterFlag)));
-	return true;
+	login(characterName, accountId, operatingSystem, gamemasterFlag);
+	unRef();
 }
 
-void ProtocolGame::onRecvFirstMessage(NetworkMessage& msg)
+void ProtocolGame::onRecvFirstMessage(InputMessage& msg)
 {
 	parseFirstPacket(msg);
 }
@@ -393,6 +502,23 @@ void ProtocolGame::disconnectClient(uint8_t error, const char* message)
 	disconnect();
 }
 
+void ProtocolGame::disconnectWaitingList(const std::string& message, int32_t slot)
+{
+	slot = std::max<int32_t>(1, slot);
+
+	std::ostringstream ss;
+	ss << message << "\nYou are at place " << slot << " on the waiting list.";
+
+	OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, false);
+	if (output) {
+		output->AddByte(0x16);
+		output->AddString(ss.str());
+		output->AddByte(WaitingList::getTime(slot));
+		OutputMessagePool::getInstance()->send(output);
+	}
+	disconnect();
+}
+
 void ProtocolGame::disconnect()
 {
 	if (getConnection()) {
@@ -400,23 +526,42 @@ void ProtocolGame::disconnect()
 	}
 }
 
-void ProtocolGame::writeToOutputBuffer(const NetworkMessage& msg)
+void ProtocolGame::writeToOutputBuffer(const NetworkMessage& msg, OutputPriority_t priority/* = OUTPUT_PRIORITY_HIGH*/)
 {
-	OutputMessage_ptr out = getOutputBuffer(msg.getMessageLength());
+	OutputMessage_ptr out = getOutputBuffer(msg.getMessageLength(), priority);
 
 	if (out) {
 		out->append(msg);
 	}
 }
 
-void ProtocolGame::parsePacket(NetworkMessage& msg)
+void ProtocolGame::sendSharedMessage(const NetworkMessage& msg, OutputPriority_t priority/* = OUTPUT_PRIORITY_HIGH*/)
+{
+	writeToOutputBuffer(msg, priority);
+}
+
+void ProtocolGame::sendSharedMessage(const Position& pos, const NetworkMessage& msg, OutputPriority_t priority/* = OUTPUT_PRIORITY_HIGH*/)
+{
+	if (canSee(pos)) {
+		writeToOutputBuffer(msg, priority);
+	}
+}
+
+void ProtocolGame::parsePacket(InputMessage& msg)
 {
 	if (!m_acceptPackets || g_game.getGameState() == GAME_STATE_SHUTDOWN || msg.getMessageLength() <= 0) {
 		return;
 	}
 
+	if (player && PacketCapture::getInstance()->isOpen()) {
+		PacketCapture::getInstance()->addPacket(player->getGUID(), msg);
+	}
+
 	uint8_t recvbyte = msg.GetByte();
 
+	// the game tasks queued for this packet are accounted to its opcode
+	m_packetStats = Stats::getInstance()->getOpcodeStats(recvbyte);
+
 	if (!player) {
 		if (recvbyte == 0x0F) {
 			disconnect();
@@ -508,26 +653,25 @@ void ProtocolGame::parsePacket(NetworkMessage& msg)
 
 void ProtocolGame::GetTileDescription(const Tile* tile, NetworkMessage& msg)
 {
-	int32_t count;
-	if (tile->ground) {
-		msg.AddItem(tile->ground);
-		count = 1;
-	} else {
-		count = 0;
+	const Position& pos = tile->getPosition();
+	const TileDescription* description = g_game.getMap()->tileDescriptionCache.getTileDescription(*g_game.getMap(), pos.x, pos.y, pos.z);
+	if (description) {
+		GetTileDescription(*description, msg);
 	}
+}
 
-	const TileItemVector* items = tile->getItemList();
-	if (items) {
-		for (auto it = items->getBeginTopItem(); it != items->getEndTopItem(); ++it) {
-			msg.AddItem(*it);
-
-			if(++count == 10) {
-				return;
-			}
+void ProtocolGame::GetTileDescription(const TileDescription& description, NetworkMessage& msg)
+{
+	// the ground and the top items come from the cache
+	int32_t count = description.topCount;
+	if (count != 0) {
+		msg.AddBytes(reinterpret_cast<const char*>(description.bytes), description.itemEnds[count - 1]);
+		if (count == TILE_DESCRIPTION_MAX_THINGS) {
+			return;
 		}
 	}
 
-	const CreatureVector* creatures = tile->getCreatures();
+	const CreatureVector* creatures = description.tile->getCreatures();
 	if (creatures) {
 		for (auto it = creatures->begin(); it != creatures->end(); ++it) {
 			if (!player->canSeeCreature(*it)) {
@@ -539,20 +683,18 @@ void ProtocolGame::GetTileDescription(const Tile* tile, NetworkMessage& msg)
 			checkCreatureAsKnown((*it)->getID(), known, removedKnown);
 			AddCreature(msg, *it, known, removedKnown);
 
-			if(++count == 10) {
+			if (++count == TILE_DESCRIPTION_MAX_THINGS) {
 				return;
 			}
 		}
 	}
 
-	if (items) {
-		for (auto it = items->getBeginDownItem(); it != items->getEndDownItem(); ++it) {
-			msg.AddItem(*it);
-
-			if(++count == 10) {
-				return;
-			}
-		}
+	// as many of the down items as still fit
+	int32_t downCount = std::min<int32_t>(description.itemCount - description.topCount, TILE_DESCRIPTION_MAX_THINGS - count);
+	if (downCount > 0) {
+		const uint8_t start = description.topCount != 0 ? description.itemEnds[description.topCount - 1] : 0;
+		const uint8_t end = description.itemEnds[description.topCount + downCount - 1];
+		msg.AddBytes(reinterpret_cast<const char*>(description.bytes + start), end - start);
 	}
 }
 
@@ -583,17 +725,18 @@ void ProtocolGame::GetMapDescription(int32_t x, int32_t y, int32_t z, int32_t wi
 
 void ProtocolGame::GetFloorDescription(NetworkMessage& msg, int32_t x, int32_t y, int32_t z, int32_t width, int32_t height, int32_t offset, int32_t& skip)
 {
+	Map* map = g_game.getMap();
 	for (int32_t nx = 0; nx < width; nx++) {
 		for (int32_t ny = 0; ny < height; ny++) {
-			Tile* tile = g_game.getTile(x + nx + offset, y + ny + offset, z);
-			if (tile) {
+			const TileDescription* description = map->tileDescriptionCache.getTileDescription(*map, x + nx + offset, y + ny + offset, z);
+			if (description) {
 				if (skip >= 0) {
 					msg.AddByte(skip);
 					msg.AddByte(0xFF);
 				}
 
 				skip = 0;
-				GetTileDescription(tile, msg);
+				GetTileDescription(*description, msg);
 			} else if (skip == 0xFE) {
 				msg.AddByte(0xFF);
 				msg.AddByte(0xFF);
@@ -688,62 +831,62 @@ bool ProtocolGame::canSee(int32_t x, int32_t y, int32_t z) const
 }
 
 //********************** Parse methods *******************************//
-void ProtocolGame::parseLogout(NetworkMessage& msg)
+void ProtocolGame::parseLogout(InputMessage& msg)
 {
 	g_dispatcher.addTask(createTask(boost::bind(&ProtocolGame::logout, this, true, false)));
 }
 
-void ProtocolGame::parseCreatePrivateChannel(NetworkMessage& msg)
+void ProtocolGame::parseCreatePrivateChannel(InputMessage& msg)
 {
 	addGameTask(&Game::playerCreatePrivateChannel, player->getID());
 }
 
-void ProtocolGame::parseChannelInvite(NetworkMessage& msg)
+void ProtocolGame::parseChannelInvite(InputMessage& msg)
 {
-	const std::string name = msg.GetString();
-	addGameTask(&Game::playerChannelInvite, player->getID(), name);
+	StringView name = msg.GetStringView();
+	addGameTaskWithMessage(msg, &Game::playerChannelInvite, player->getID(), name);
 }
 
-void ProtocolGame::parseChannelExclude(NetworkMessage& msg)
+void ProtocolGame::parseChannelExclude(InputMessage& msg)
 {
-	const std::string name = msg.GetString();
-	addGameTask(&Game::playerChannelExclude, player->getID(), name);
+	StringView name = msg.GetStringView();
+	addGameTaskWithMessage(msg, &Game::playerChannelExclude, player->getID(), name);
 }
 
-void ProtocolGame::parseGetChannels(NetworkMessage& msg)
+void ProtocolGame::parseGetChannels(InputMessage& msg)
 {
 	addGameTask(&Game::playerRequestChannels, player->getID());
 }
 
-void ProtocolGame::parseOpenChannel(NetworkMessage& msg)
+void ProtocolGame::parseOpenChannel(InputMessage& msg)
 {
 	uint16_t channelId = msg.GetU16();
 	addGameTask(&Game::playerOpenChannel, player->getID(), channelId);
 }
 
-void ProtocolGame::parseCloseChannel(NetworkMessage& msg)
+void ProtocolGame::parseCloseChannel(InputMessage& msg)
 {
 	uint16_t channelId = msg.GetU16();
 	addGameTask(&Game::playerCloseChannel, player->getID(), channelId);
 }
 
-void ProtocolGame::parseOpenPrivateChannel(NetworkMessage& msg)
+void ProtocolGame::parseOpenPrivateChannel(InputMessage& msg)
 {
 	const std::string receiver = msg.GetString();
 	addGameTask(&Game::playerOpenPrivateChannel, player->getID(), receiver);
 }
 
-void ProtocolGame::parseCancelMove(NetworkMessage& msg)
+void ProtocolGame::parseCancelMove(InputMessage& msg)
 {
 	addGameTask(&Game::playerCancelAttackAndFollow, player->getID());
 }
 
-void ProtocolGame::parseReceivePing(NetworkMessage& msg)
+void ProtocolGame::parseReceivePing(InputMessage& msg)
 {
 	addGameTask(&Game::playerReceivePing, player->getID());
 }
 
-void ProtocolGame::parseAutoWalk(NetworkMessage& msg)
+void ProtocolGame::parseAutoWalk(InputMessage& msg)
 {
 	std::list<Direction> path;
 
@@ -770,22 +913,22 @@ void ProtocolGame::parseAutoWalk(NetworkMessage& msg)
 	addGameTask(&Game::playerAutoWalk, player->getID(), path);
 }
 
-void ProtocolGame::parseMove(NetworkMessage& msg, Direction dir)
+void ProtocolGame::parseMove(InputMessage& msg, Direction dir)
 {
 	addGameTask(&Game::playerMove, player->getID(), dir);
 }
 
-void ProtocolGame::parseTurn(NetworkMessage& msg, Direction dir)
+void ProtocolGame::parseTurn(InputMessage& msg, Direction dir)
 {
 	addGameTaskTimed(DISPATCHER_TASK_EXPIRATION, &Game::playerTurn, player->getID(), dir);
 }
 
-void ProtocolGame::parseRequestOutfit(NetworkMessage& msg)
+void ProtocolGame::parseRequestOutfit(InputMessage& msg)
 {
 	addGameTask(&Game::playerRequestOutfit, player->getID());
 }
 
-void ProtocolGame::parseSetOutfit(NetworkMessage& msg)
+void ProtocolGame::parseSetOutfit(InputMessage& msg)
 {
 	Outfit_t newOutfit;
 	#ifdef __PROTOCOL_77__
@@ -800,7 +943,7 @@ void ProtocolGame::parseSetOutfit(NetworkMessage& msg)
 	addGameTask(&Game::playerChangeOutfit, player->getID(), newOutfit);
 }
 
-void ProtocolGame::parseUseItem(NetworkMessage& msg)
+void ProtocolGame::parseUseItem(InputMessage& msg)
 {
 	Position pos = msg.GetPosition();
 	uint16_t spriteId = msg.GetSpriteId();
@@ -810,7 +953,7 @@ void ProtocolGame::parseUseItem(NetworkMessage& msg)
 	addGameTaskTimed(DISPATCHER_TASK_EXPIRATION, &Game::playerUseItem, player->getID(), pos, stackpos, index, spriteId, isHotkey);
 }
 
-void ProtocolGame::parseUseItemEx(NetworkMessage& msg)
+void ProtocolGame::parseUseItemEx(InputMessage& msg)
 {
 	Position fromPos = msg.GetPosition();
 	uint16_t fromSpriteId = msg.GetSpriteId();
@@ -822,7 +965,7 @@ void ProtocolGame::parseUseItemEx(NetworkMessage& msg)
 	addGameTaskTimed(DISPATCHER_TASK_EXPIRATION, &Game::playerUseItemEx, player->getID(), fromPos, fromStackPos, fromSpriteId, toPos, toStackPos, toSpriteId, isHotkey);
 }
 
-void ProtocolGame::parseUseWithCreature(NetworkMessage& msg)
+void ProtocolGame::parseUseWithCreature(InputMessage& msg)
 {
 	Position fromPos = msg.GetPosition();
 	uint16_t spriteId = msg.GetSpriteId();
@@ -832,31 +975,31 @@ void ProtocolGame::parseUseWithCreature(NetworkMessage& msg)
 	addGameTaskTimed(DISPATCHER_TASK_EXPIRATION, &Game::playerUseWithCreature, player->getID(), fromPos, fromStackPos, creatureId, spriteId, isHotkey);
 }
 
-void ProtocolGame::parseCloseContainer(NetworkMessage& msg)
+void ProtocolGame::parseCloseContainer(InputMessage& msg)
 {
 	uint8_t cid = msg.GetByte();
 	addGameTask(&Game::playerCloseContainer, player->getID(), cid);
 }
 
-void ProtocolGame::parseUpArrowContainer(NetworkMessage& msg)
+void ProtocolGame::parseUpArrowContainer(InputMessage& msg)
 {
 	uint8_t cid = msg.GetByte();
 	addGameTask(&Game::playerMoveUpContainer, player->getID(), cid);
 }
 
-void ProtocolGame::parseUpdateTile(NetworkMessage& msg)
+void ProtocolGame::parseUpdateTile(InputMessage& msg)
 {
 	// Position pos = msg.GetPosition();
 	// addGameTask(&Game::playerUpdateTile, player->getID(), pos);
 }
 
-void ProtocolGame::parseUpdateContainer(NetworkMessage& msg)
+void ProtocolGame::parseUpdateContainer(InputMessage& msg)
 {
 	uint8_t cid = msg.GetByte();
 	addGameTask(&Game::playerUpdateContainer, player->getID(), cid);
 }
 
-void ProtocolGame::parseThrow(NetworkMessage& msg)
+void ProtocolGame::parseThrow(InputMessage& msg)
 {
 	Position fromPos = msg.GetPosition();
 	uint16_t spriteId = msg.GetSpriteId();
@@ -869,7 +1012,7 @@ void ProtocolGame::parseThrow(NetworkMessage& msg)
 	}
 }
 
-void ProtocolGame::parseLookAt(NetworkMessage& msg)
+void ProtocolGame::parseLookAt(InputMessage& msg)
 {
 	Position pos = msg.GetPosition();
 	uint16_t spriteId = msg.GetSpriteId();
@@ -877,23 +1020,23 @@ void ProtocolGame::parseLookAt(NetworkMessage& msg)
 	addGameTaskTimed(DISPATCHER_TASK_EXPIRATION, &Game::playerLookAt, player->getID(), pos, spriteId, stackpos);
 }
 
-void ProtocolGame::parseLookInBattleList(NetworkMessage& msg)
+void ProtocolGame::parseLookInBattleList(InputMessage& msg)
 {
 	uint32_t creatureId = msg.GetU32();
 	addGameTaskTimed(DISPATCHER_TASK_EXPIRATION, &Game::playerLookInBattleList, player->getID(), creatureId);
 }
 
-void ProtocolGame::parseSay(NetworkMessage& msg)
+void ProtocolGame::parseSay(InputMessage& msg)
 {
 	SpeakClasses type = (SpeakClasses)msg.GetByte();
 
-	std::string receiver;
+	StringView receiver;
 	uint16_t channelId = 0;
 
 	switch (type) {
 		case SPEAK_PRIVATE:
 		case SPEAK_PRIVATE_RED:
-			receiver = msg.GetString();
+			receiver = msg.GetStringView();
 			break;
 
 		case SPEAK_CHANNEL_Y:
@@ -905,16 +1048,16 @@ void ProtocolGame::parseSay(NetworkMessage& msg)
 			break;
 	}
 
-	const std::string text = msg.GetString();
+	StringView text = msg.GetStringView();
 
-	if (text.length() > 255) {
+	if (text.size() > 255) {
 		return;
 	}
 
-	addGameTask(&Game::playerSay, player->getID(), channelId, type, receiver, text);
+	addGameTaskWithMessage(msg, &Game::playerSay, player->getID(), channelId, type, receiver, text);
 }
 
-void ProtocolGame::parseFightModes(NetworkMessage& msg)
+void ProtocolGame::parseFightModes(InputMessage& msg)
 {
 	uint8_t rawFightMode = msg.GetByte(); //1 - offensive, 2 - balanced, 3 - defensive
 	uint8_t rawChaseMode = msg.GetByte(); // 0 - stand while fightning, 1 - chase opponent
@@ -949,34 +1092,34 @@ void ProtocolGame::parseFightModes(NetworkMessage& msg)
 	addGameTask(&Game::playerSetFightModes, player->getID(), fightMode, chaseMode, secureMode);
 }
 
-void ProtocolGame::parseAttack(NetworkMessage& msg)
+void ProtocolGame::parseAttack(InputMessage& msg)
 {
 	uint32_t creatureId = msg.GetU32();
 	addGameTask(&Game::playerSetAttackedCreature, player->getID(), creatureId);
 }
 
-void ProtocolGame::parseFollow(NetworkMessage& msg)
+void ProtocolGame::parseFollow(InputMessage& msg)
 {
 	uint32_t creatureId = msg.GetU32();
 	addGameTask(&Game::playerFollowCreature, player->getID(), creatureId);
 }
 
-void ProtocolGame::parseTextWindow(NetworkMessage& msg)
+void ProtocolGame::parseTextWindow(InputMessage& msg)
 {
 	uint32_t windowTextId = msg.GetU32();
-	const std::string newText = msg.GetString();
-	addGameTask(&Game::playerWriteItem, player->getID(), windowTextId, newText);
+	StringView newText = msg.GetStringView();
+	addGameTaskWithMessage(msg, &Game::playerWriteItem, player->getID(), windowTextId, newText);
 }
 
-void ProtocolGame::parseHouseWindow(NetworkMessage& msg)
+void ProtocolGame::parseHouseWindow(InputMessage& msg)
 {
 	uint8_t doorId = msg.GetByte();
 	uint32_t id = msg.GetU32();
-	const std::string text = msg.GetString();
-	addGameTask(&Game::playerUpdateHouseWindow, player->getID(), doorId, id, text);
+	StringView text = msg.GetStringView();
+	addGameTaskWithMessage(msg, &Game::playerUpdateHouseWindow, player->getID(), doorId, id, text);
 }
 
-void ProtocolGame::parseRequestTrade(NetworkMessage& msg)
+void ProtocolGame::parseRequestTrade(InputMessage& msg)
 {
 	Position pos = msg.GetPosition();
 	uint16_t spriteId = msg.GetSpriteId();
@@ -985,12 +1128,12 @@ void ProtocolGame::parseRequestTrade(NetworkMessage& msg)
 	addGameTask(&Game::playerRequestTrade, player->getID(), pos, stackpos, playerId, spriteId);
 }
 
-void ProtocolGame::parseAcceptTrade(NetworkMessage& msg)
+void ProtocolGame::parseAcceptTrade(InputMessage& msg)
 {
 	addGameTask(&Game::playerAcceptTrade, player->getID());
 }
 
-void ProtocolGame::parseLookInTrade(NetworkMessage& msg)
+void ProtocolGame::parseLookInTrade(InputMessage& msg)
 {
 	bool counterOffer = (msg.GetByte() == 0x01);
 	uint8_t index = msg.GetByte();
@@ -1002,28 +1145,28 @@ void ProtocolGame::parseCloseTrade()
 	addGameTask(&Game::playerCloseTrade, player->getID());
 }
 
-void ProtocolGame::parseAddVip(NetworkMessage& msg)
+void ProtocolGame::parseAddVip(InputMessage& msg)
 {
-	const std::string name = msg.GetString();
-	addGameTask(&Game::playerRequestAddVip, player->getID(), name);
+	StringView name = msg.GetStringView();
+	addGameTaskWithMessage(msg, &Game::playerRequestAddVip, player->getID(), name);
 }
 
-void ProtocolGame::parseRemoveVip(NetworkMessage& msg)
+void ProtocolGame::parseRemoveVip(InputMessage& msg)
 {
 	uint32_t guid = msg.GetU32();
 	addGameTask(&Game::playerRequestRemoveVip, player->getID(), guid);
 }
 
-void ProtocolGame::parseEditVip(NetworkMessage& msg)
+void ProtocolGame::parseEditVip(InputMessage& msg)
 {
 	uint32_t guid = msg.GetU32();
-	const std::string description = msg.GetString();
+	StringView description = msg.GetStringView();
 	uint32_t icon = std::min<uint32_t>(10, msg.GetU32()); // 10 is max icon in 9.63
 	bool notify = msg.GetByte() != 0;
-	addGameTask(&Game::playerRequestEditVip, player->getID(), guid, description, icon, notify);
+	addGameTaskWithMessage(msg, &Game::playerRequestEditVip, player->getID(), guid, description, icon, notify);
 }
 
-void ProtocolGame::parseRotateItem(NetworkMessage& msg)
+void ProtocolGame::parseRotateItem(InputMessage& msg)
 {
 	Position pos = msg.GetPosition();
 	uint16_t spriteId = msg.GetSpriteId();
@@ -1031,13 +1174,13 @@ void ProtocolGame::parseRotateItem(NetworkMessage& msg)
 	addGameTaskTimed(DISPATCHER_TASK_EXPIRATION, &Game::playerRotateItem, player->getID(), pos, stackpos, spriteId);
 }
 
-void ProtocolGame::parseBugReport(NetworkMessage& msg)
+void ProtocolGame::parseBugReport(InputMessage& msg)
 {
-	std::string bug = msg.GetString();
-	addGameTask(&Game::playerReportBug, player->getID(), bug);
+	StringView bug = msg.GetStringView();
+	addGameTaskWithMessage(msg, &Game::playerReportBug, player->getID(), bug);
 }
 
-void ProtocolGame::parseDebugAssert(NetworkMessage& msg)
+void ProtocolGame::parseDebugAssert(InputMessage& msg)
 {
 	if (m_debugAssertSent) {
 		return;
@@ -1045,38 +1188,38 @@ void ProtocolGame::parseDebugAssert(NetworkMessage& msg)
 
 	m_debugAssertSent = true;
 
-	std::string assertLine = msg.GetString();
-	std::string date = msg.GetString();
-	std::string description = msg.GetString();
-	std::string comment = msg.GetString();
-	addGameTask(&Game::playerDebugAssert, player->getID(), assertLine, date, description, comment);
+	StringView assertLine = msg.GetStringView();
+	StringView date = msg.GetStringView();
+	StringView description = msg.GetStringView();
+	StringView comment = msg.GetStringView();
+	addGameTaskWithMessage(msg, &Game::playerDebugAssert, player->getID(), assertLine, date, description, comment);
 }
 
-void ProtocolGame::parseInviteToParty(NetworkMessage& msg)
+void ProtocolGame::parseInviteToParty(InputMessage& msg)
 {
 	uint32_t targetId = msg.GetU32();
 	addGameTask(&Game::playerInviteToParty, player->getID(), targetId);
 }
 
-void ProtocolGame::parseJoinParty(NetworkMessage& msg)
+void ProtocolGame::parseJoinParty(InputMessage& msg)
 {
 	uint32_t targetId = msg.GetU32();
 	addGameTask(&Game::playerJoinParty, player->getID(), targetId);
 }
 
-void ProtocolGame::parseRevokePartyInvite(NetworkMessage& msg)
+void ProtocolGame::parseRevokePartyInvite(InputMessage& msg)
 {
 	uint32_t targetId = msg.GetU32();
 	addGameTask(&Game::playerRevokePartyInvitation, player->getID(), targetId);
 }
 
-void ProtocolGame::parsePassPartyLeadership(NetworkMessage& msg)
+void ProtocolGame::parsePassPartyLeadership(InputMessage& msg)
 {
 	uint32_t targetId = msg.GetU32();
 	addGameTask(&Game::playerPassPartyLeadership, player->getID(), targetId);
 }
 
-void ProtocolGame::parseLeaveParty(NetworkMessage& msg)
+void ProtocolGame::parseLeaveParty(InputMessage& msg)
 {
 	addGameTask(&Game::playerLeaveParty, player->getID());
 }
@@ -1235,7 +1378,7 @@ void ProtocolGame::sendChannelMessage(const std::string& author, const std::stri
 	msg.AddByte(type);
 	msg.AddU16(channel);
 	msg.AddString(text);
-	writeToOutputBuffer(msg);
+	writeToOutputBuffer(msg, OUTPUT_PRIORITY_CHAT);
 }
 
 void ProtocolGame::sendIcons(uint16_t icons)
@@ -1344,14 +1487,14 @@ void ProtocolGame::sendCreatureSay(const Creature* creature, SpeakClasses type,
 {
 	NetworkMessage msg;
 	AddCreatureSpeak(msg, creature, type, text, 0, pos);
-	writeToOutputBuffer(msg);
+	writeToOutputBuffer(msg, OUTPUT_PRIORITY_CHAT);
 }
 
 void ProtocolGame::sendToChannel(const Creature* creature, SpeakClasses type, const std::string& text, uint16_t channelId)
 {
 	NetworkMessage msg;
 	AddCreatureSpeak(msg, creature, type, text, channelId);
-	writeToOutputBuffer(msg);
+	writeToOutputBuffer(msg, OUTPUT_PRIORITY_CHAT);
 }
 
 void ProtocolGame::sendCancelTarget()
@@ -1397,7 +1540,7 @@ void ProtocolGame::sendDistanceShoot(const Position& from, const Position& to, u
 {
 	NetworkMessage msg;
 	AddDistanceShoot(msg, from, to, type);
-	writeToOutputBuffer(msg);
+	writeToOutputBuffer(msg, OUTPUT_PRIORITY_LOW);
 }
 
 void ProtocolGame::sendAnimatedText(const Position& pos, uint8_t color, const std::string& text)
@@ -1408,7 +1551,7 @@ void ProtocolGame::sendAnimatedText(const Position& pos, uint8_t color, const st
 
 	NetworkMessage msg;
 	AddAnimatedText(msg, pos, color, text);
-	writeToOutputBuffer(msg);
+	writeToOutputBuffer(msg, OUTPUT_PRIORITY_LOW);
 }
 
 void ProtocolGame::sendMagicEffect(const Position& pos, uint8_t type)
@@ -1419,7 +1562,7 @@ void ProtocolGame::sendMagicEffect(const Position& pos, uint8_t type)
 
 	NetworkMessage msg;
 	AddMagicEffect(msg, pos, type);
-	writeToOutputBuffer(msg);
+	writeToOutputBuffer(msg, OUTPUT_PRIORITY_LOW);
 }
 
 void ProtocolGame::sendCreatureHealth(const Creature* creature)
@@ -1610,7 +1753,7 @@ void ProtocolGame::sendRemoveCreature(const Creature* creature, const Position&
 	writeToOutputBuffer(msg);
 }
 
-void ProtocolGame::sendMoveCreature(const Creature* creature, const Tile* newTile, const Position& newPos, uint32_t newStackPos, const Tile* oldTile, const Position& oldPos, uint32_t oldStackPos, bool teleport)
+void ProtocolGame::sendMoveCreature(const Creature* creature, const Tile* newTile, const Position& newPos, uint32_t newStackPos, const Tile* oldTile, const Position& oldPos, uint32_t oldStackPos, bool teleport, NetworkMessage* stepMsg/* = nullptr*/)
 {
 	if (creature == player) {
 		if (teleport || oldStackPos >= 10) {
@@ -1659,11 +1802,17 @@ void ProtocolGame::sendMoveCreature(const Creature* creature, const Tile* newTil
 			sendRemoveCreature(creature, oldPos, oldStackPos);
 			sendAddCreature(creature, newPos, newStackPos, false);
 		} else {
-			NetworkMessage msg;
-			msg.AddByte(0x6D);
-			msg.AddPosition(oldPos);
-			msg.AddByte(oldStackPos);
-			msg.AddPosition(creature->getPosition());
+			//a step is serialized once for all spectators, only the old stackpos differs between them
+			NetworkMessage localMsg;
+			NetworkMessage& msg = stepMsg ? *stepMsg : localMsg;
+			if (msg.getMessageLength() == 0) {
+				msg.AddByte(0x6D);
+				msg.AddPosition(oldPos);
+				msg.AddByte(oldStackPos);
+				msg.AddPosition(creature->getPosition());
+			} else {
+				msg.SetByte(6, oldStackPos);
+			}
 			writeToOutputBuffer(msg);
 		}
 	} else if (canSee(oldPos)) {
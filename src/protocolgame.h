@@ -22,6 +22,7 @@
 
 #include <string>
 #include "protocol.h"
+#include "inputmessage.h"
 #include "enums.h"
 #include "creature.h"
 
@@ -33,11 +34,15 @@ enum connectResult_t {
 };
 
 class NetworkMessage;
+class InputMessage;
 class Player;
 class Game;
 class House;
 class Container;
 class Tile;
+struct TileDescription;
+class TaskStats;
+struct GuildMembership;
 class Connection;
 
 typedef std::map<uint32_t, Player*> UsersMap;
@@ -63,7 +68,11 @@ class ProtocolGame : public Protocol
 			return 0x0A;
 		}
 
-		bool login(const std::string& name, uint32_t accnumber, OperatingSystem_t operatingSystem, bool gamemasterLogin);
+		// loads the player on the database pool and places it on the dispatcher
+		void login(const std::string& name, uint32_t accnumber, OperatingSystem_t operatingSystem, bool gamemasterLogin);
+		bool isLoggingIn() const {
+			return m_loggingIn;
+		}
 		bool logout(bool displayEffect, bool forced);
 
 		void setPlayer(Player* p);
@@ -78,13 +87,35 @@ class ProtocolGame : public Protocol
 			return knownCreatureSet;
 		}
 
+		// messages that look the same for every spectator are serialized once
+		// by the caller and only copied into the output buffer of each client
+		static void AddAnimatedText(NetworkMessage& msg, const Position& pos, uint8_t color, const std::string& text);
+		static void AddMagicEffect(NetworkMessage& msg, const Position& pos, uint8_t type);
+		static void AddDistanceShoot(NetworkMessage& msg, const Position& from, const Position& to, uint8_t type);
+		static void AddCreatureSpeak(NetworkMessage& msg, const Creature* creature, SpeakClasses type, const std::string& text, uint16_t channelId, Position* pos = nullptr);
+		static void AddCreatureHealth(NetworkMessage& msg, const Creature* creature);
+
+		// messages built once for all spectators, the priority picks the lane they are sent in
+		void sendSharedMessage(const NetworkMessage& msg, OutputPriority_t priority = OUTPUT_PRIORITY_HIGH);
+		void sendSharedMessage(const Position& pos, const NetworkMessage& msg, OutputPriority_t priority = OUTPUT_PRIORITY_HIGH);
+
 	private:
 		std::unordered_set<uint32_t> knownCreatureSet;
 
+		// login pipeline, the comment in each tells the thread it runs on
+		void decryptFirstPacket(InputMessage_ptr msg, uint32_t clientIp);
+		void authenticate(uint32_t clientIp, uint32_t accountName, const std::string& password, std::string& characterName, OperatingSystem_t operatingSystem, bool gamemasterFlag);
+		void preloadLogin(const std::string& name, uint32_t accountId, OperatingSystem_t operatingSystem, bool gamemasterLogin);
+		void admitLogin(Player* loadedPlayer, uint32_t accountId, OperatingSystem_t operatingSystem, bool gamemasterLogin);
+		void loadLogin(Player* loadingPlayer, uint32_t accountId, OperatingSystem_t operatingSystem);
+		void finishLogin(bool loaded, const GuildMembership& membership, uint32_t accountId, OperatingSystem_t operatingSystem);
+		void endLogin();
+
 		bool connect(uint32_t playerId, OperatingSystem_t operatingSystem);
 		void disconnect();
 		void disconnectClient(uint8_t error, const char* message);
-		void writeToOutputBuffer(const NetworkMessage& msg);
+		void disconnectWaitingList(const std::string& message, int32_t slot);
+		void writeToOutputBuffer(const NetworkMessage& msg, OutputPriority_t priority = OUTPUT_PRIORITY_HIGH);
 
 		virtual void releaseProtocol();
 		virtual void deleteProtocolTask();
@@ -96,70 +127,70 @@ class ProtocolGame : public Protocol
 		bool canSee(const Position& pos) const;
 
 		// we have all the parse methods
-		virtual void parsePacket(NetworkMessage& msg);
-		virtual void onRecvFirstMessage(NetworkMessage& msg);
+		virtual void parsePacket(InputMessage& msg);
+		virtual void onRecvFirstMessage(InputMessage& msg);
 		virtual void onConnect();
-		bool parseFirstPacket(NetworkMessage& msg);
+		bool parseFirstPacket(InputMessage& msg);
 
 		//Parse methods
-		void parseLogout(NetworkMessage& msg);
-		void parseCancelMove(NetworkMessage& msg);
-
-		void parseReceivePing(NetworkMessage& msg);
-		void parseAutoWalk(NetworkMessage& msg);
-		void parseMove(NetworkMessage& msg, Direction dir);
-		void parseTurn(NetworkMessage& msg, Direction dir);
-
-		void parseRequestOutfit(NetworkMessage& msg);
-		void parseSetOutfit(NetworkMessage& msg);
-		void parseSay(NetworkMessage& msg);
-		void parseLookAt(NetworkMessage& msg);
-		void parseLookInBattleList(NetworkMessage& msg);
-		void parseFightModes(NetworkMessage& msg);
-		void parseAttack(NetworkMessage& msg);
-		void parseFollow(NetworkMessage& msg);
-
-		void parseBugReport(NetworkMessage& msg);
-		void parseDebugAssert(NetworkMessage& msg);
-
-		void parseThrow(NetworkMessage& msg);
-		void parseUseItemEx(NetworkMessage& msg);
-		void parseUseWithCreature(NetworkMessage& msg);
-		void parseUseItem(NetworkMessage& msg);
-		void parseCloseContainer(NetworkMessage& msg);
-		void parseUpArrowContainer(NetworkMessage& msg);
-		void parseUpdateTile(NetworkMessage& msg);
-		void parseUpdateContainer(NetworkMessage& msg);
-		void parseTextWindow(NetworkMessage& msg);
-		void parseHouseWindow(NetworkMessage& msg);
-
-		void parseInviteToParty(NetworkMessage& msg);
-		void parseJoinParty(NetworkMessage& msg);
-		void parseRevokePartyInvite(NetworkMessage& msg);
-		void parsePassPartyLeadership(NetworkMessage& msg);
-		void parseLeaveParty(NetworkMessage& msg);
+		void parseLogout(InputMessage& msg);
+		void parseCancelMove(InputMessage& msg);
+
+		void parseReceivePing(InputMessage& msg);
+		void parseAutoWalk(InputMessage& msg);
+		void parseMove(InputMessage& msg, Direction dir);
+		void parseTurn(InputMessage& msg, Direction dir);
+
+		void parseRequestOutfit(InputMessage& msg);
+		void parseSetOutfit(InputMessage& msg);
+		void parseSay(InputMessage& msg);
+		void parseLookAt(InputMessage& msg);
+		void parseLookInBattleList(InputMessage& msg);
+		void parseFightModes(InputMessage& msg);
+		void parseAttack(InputMessage& msg);
+		void parseFollow(InputMessage& msg);
+
+		void parseBugReport(InputMessage& msg);
+		void parseDebugAssert(InputMessage& msg);
+
+		void parseThrow(InputMessage& msg);
+		void parseUseItemEx(InputMessage& msg);
+		void parseUseWithCreature(InputMessage& msg);
+		void parseUseItem(InputMessage& msg);
+		void parseCloseContainer(InputMessage& msg);
+		void parseUpArrowContainer(InputMessage& msg);
+		void parseUpdateTile(InputMessage& msg);
+		void parseUpdateContainer(InputMessage& msg);
+		void parseTextWindow(InputMessage& msg);
+		void parseHouseWindow(InputMessage& msg);
+
+		void parseInviteToParty(InputMessage& msg);
+		void parseJoinParty(InputMessage& msg);
+		void parseRevokePartyInvite(InputMessage& msg);
+		void parsePassPartyLeadership(InputMessage& msg);
+		void parseLeaveParty(InputMessage& msg);
 
 		//trade methods
-		void parseRequestTrade(NetworkMessage& msg);
-		void parseLookInTrade(NetworkMessage& msg);
-		void parseAcceptTrade(NetworkMessage& msg);
+		void parseRequestTrade(InputMessage& msg);
+		void parseLookInTrade(InputMessage& msg);
+		void parseAcceptTrade(InputMessage& msg);
 		void parseCloseTrade();
 
 		//VIP methods
-		void parseAddVip(NetworkMessage& msg);
-		void parseRemoveVip(NetworkMessage& msg);
-		void parseEditVip(NetworkMessage& msg);
+		void parseAddVip(InputMessage& msg);
+		void parseRemoveVip(InputMessage& msg);
+		void parseEditVip(InputMessage& msg);
 
-		void parseRotateItem(NetworkMessage& msg);
+		void parseRotateItem(InputMessage& msg);
 
 		//Channel tabs
-		void parseCreatePrivateChannel(NetworkMessage& msg);
-		void parseChannelInvite(NetworkMessage& msg);
-		void parseChannelExclude(NetworkMessage& msg);
-		void parseGetChannels(NetworkMessage& msg);
-		void parseOpenChannel(NetworkMessage& msg);
-		void parseOpenPrivateChannel(NetworkMessage& msg);
-		void parseCloseChannel(NetworkMessage& msg);
+		void parseCreatePrivateChannel(InputMessage& msg);
+		void parseChannelInvite(InputMessage& msg);
+		void parseChannelExclude(InputMessage& msg);
+		void parseGetChannels(InputMessage& msg);
+		void parseOpenChannel(InputMessage& msg);
+		void parseOpenPrivateChannel(InputMessage& msg);
+		void parseCloseChannel(InputMessage& msg);
 
 		//Send functions
 		void sendChannelMessage(const std::string& author, const std::string& text, SpeakClasses type, uint16_t channel);
@@ -218,7 +249,7 @@ class ProtocolGame : public Protocol
 
 		void sendAddCreature(const Creature* creature, const Position& pos, uint32_t stackpos, bool isLogin);
 		void sendRemoveCreature(const Creature* creature, const Position& pos, uint32_t stackpos);
-		void sendMoveCreature(const Creature* creature, const Tile* newTile, const Position& newPos, uint32_t newStackPos, const Tile* oldTile, const Position& oldPos, uint32_t oldStackPos, bool teleport);
+		void sendMoveCreature(const Creature* creature, const Tile* newTile, const Position& newPos, uint32_t newStackPos, const Tile* oldTile, const Position& oldPos, uint32_t oldStackPos, bool teleport, NetworkMessage* stepMsg = nullptr);
 
 		//containers
 		void sendAddContainerItem(uint8_t cid, uint16_t slot, const Item* item);
@@ -233,6 +264,7 @@ class ProtocolGame : public Protocol
 
 		// translate a tile to clientreadable format
 		void GetTileDescription(const Tile* tile, NetworkMessage& msg);
+		void GetTileDescription(const TileDescription& description, NetworkMessage& msg);
 
 		// translate a floor to clientreadable format
 		void GetFloorDescription(NetworkMessage& msg, int32_t x, int32_t y, int32_t z, int32_t width, int32_t height, int32_t offset, int32_t& skip);
@@ -241,13 +273,8 @@ class ProtocolGame : public Protocol
 		void GetMapDescription(int32_t x, int32_t y, int32_t z, int32_t width, int32_t height, NetworkMessage& msg);
 
 		void AddTextMessage(NetworkMessage& msg, MessageClasses mclass, const std::string& message);
-		void AddAnimatedText(NetworkMessage& msg, const Position& pos, uint8_t color, const std::string& text);
-		void AddMagicEffect(NetworkMessage& msg, const Position& pos, uint8_t type);
-		void AddDistanceShoot(NetworkMessage& msg, const Position& from, const Position& to, uint8_t type);
 		void AddCreature(NetworkMessage& msg, const Creature* creature, bool known, uint32_t remove);
 		void AddPlayerStats(NetworkMessage& msg);
-		void AddCreatureSpeak(NetworkMessage& msg, const Creature* creature, SpeakClasses type, const std::string& text, uint16_t channelId, Position* pos = nullptr);
-		void AddCreatureHealth(NetworkMessage& msg, const Creature* creature);
 		void AddCreatureOutfit(NetworkMessage& msg, const Creature* creature, const Outfit_t& outfit);
 		void AddPlayerSkills(NetworkMessage& msg);
 		void AddWorldLight(NetworkMessage& msg, const LightInfo& lightInfo);
@@ -275,6 +302,8 @@ class ProtocolGame : public Protocol
 		// Helper so we don't need to bind every time
 #define addGameTask(f, ...) addGameTaskInternal(false, 0, boost::bind(f, &g_game, __VA_ARGS__))
 #define addGameTaskTimed(delay, f, ...) addGameTaskInternal(true, delay, boost::bind(f, &g_game, __VA_ARGS__))
+		// for tasks that take string views of the message, which stays alive until the task ran
+#define addGameTaskWithMessage(msg, f, ...) addGameTaskInternal(false, 0, keepInputMessage(msg, boost::bind(f, &g_game, __VA_ARGS__)))
 
 		template<class FunctionType>
 		void addGameTaskInternal(bool droppable, uint32_t delay, const FunctionType&);
@@ -286,6 +315,10 @@ class ProtocolGame : public Protocol
 
 		bool m_debugAssertSent;
 		bool m_acceptPackets;
+		std::atomic<bool> m_loggingIn;
+
+		// statistics entry of the packet being parsed
+		TaskStats* m_packetStats;
 };
 
 #endif
@@ -22,6 +22,7 @@
 #include "protocollogin.h"
 
 #include "outputmessage.h"
+#include "inputmessage.h"
 #include "connection.h"
 #include "rsa.h"
 
@@ -31,6 +32,7 @@
 #include "ban.h"
 #include <iomanip>
 #include "game.h"
+#include "tasks.h"
 
 extern ConfigManager g_config;
 extern IPList serverIPs;
@@ -50,22 +52,36 @@ void ProtocolLogin::disconnectClient(uint8_t error, const char* message)
 		OutputMessagePool::getInstance()->send(output);
 	}
 
-	getConnection()->closeConnection();
+	if (Connection_ptr connection = getConnection()) {
+		connection->closeConnection();
+	}
 }
 
-bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
+bool ProtocolLogin::parseFirstPacket(InputMessage& msg)
 {
 	if (g_game.getGameState() == GAME_STATE_SHUTDOWN) {
 		getConnection()->closeConnection();
 		return false;
 	}
 
-	uint32_t clientip = getConnection()->getIP();
+	// decrypting and the account lookup run on the worker pools, which hold
+	// this reference until the character list is sent
+	addRef();
+	if (!g_cryptoPool.addTask(createTask(boost::bind(&ProtocolLogin::decryptFirstPacket, this, InputMessage_ptr(&msg), getIP())))) {
+		unRef();
+		getConnection()->closeConnection();
+		return false;
+	}
+	return true;
+}
 
+void ProtocolLogin::decryptFirstPacket(InputMessage_ptr msg, uint32_t clientIp)
+{
+	//crypto thread
 	/*uint16_t clientos = */
-	msg.GetU16();
-	uint16_t version = msg.GetU16();
-	msg.SkipBytes(12);
+	msg->GetU16();
+	uint16_t version = msg->GetU16();
+	msg->SkipBytes(12);
 
 	/*
 	 * Skipped bytes:
@@ -73,40 +89,55 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 	*/
 
 	#ifdef __PROTOCOL_77__
-	if (!RSA_decrypt(msg)) {
-		getConnection()->closeConnection();
-		return false;
+	if (!RSA_decrypt(*msg)) {
+		if (Connection_ptr connection = getConnection()) {
+			connection->closeConnection();
+		}
+		unRef();
+		return;
 	}
 
 	uint32_t key[4];
-	key[0] = msg.GetU32();
-	key[1] = msg.GetU32();
-	key[2] = msg.GetU32();
-	key[3] = msg.GetU32();
+	key[0] = msg->GetU32();
+	key[1] = msg->GetU32();
+	key[2] = msg->GetU32();
+	key[3] = msg->GetU32();
 	enableXTEAEncryption();
 	setXTEAKey(key);
 	#endif
 
-	uint32_t accountName = msg.GetU32();
-	std::string password = msg.GetString();
+	uint32_t accountName = msg->GetU32();
+	std::string password = msg->GetString();
 
 	if (version < CLIENT_VERSION_MIN || version > CLIENT_VERSION_MAX) {
 		disconnectClient(0x0A, "Only clients with protocol " CLIENT_VERSION_STR " allowed!");
-		return false;
+		unRef();
+		return;
 	}
 
 	if (g_game.getGameState() == GAME_STATE_STARTUP) {
 		disconnectClient(0x0A, "Gameworld is starting up. Please wait.");
-		return false;
+		unRef();
+		return;
 	}
 
 	if (g_game.getGameState() == GAME_STATE_MAINTAIN) {
 		disconnectClient(0x0A, "Gameworld is under maintenance. Please re-connect in a while.");
-		return false;
+		unRef();
+		return;
+	}
+
+	if (!g_databasePool.addTask(createTask(boost::bind(&ProtocolLogin::sendCharacterList, this, clientIp, accountName, password)))) {
+		disconnectClient(0x0A, "Too many players are logging in. Please try again in a while.");
+		unRef();
 	}
+}
 
+void ProtocolLogin::sendCharacterList(uint32_t clientIp, uint32_t accountName, const std::string& password)
+{
+	//database thread
 	BanInfo banInfo;
-	if (IOBan::getInstance()->isIpBanned(clientip, banInfo)) {
+	if (IOBan::getInstance()->isIpBanned(clientIp, banInfo)) {
 		if (banInfo.reason.empty()) {
 			banInfo.reason = "(none)";
 		}
@@ -114,12 +145,13 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 		std::ostringstream ss;
 		ss << "Your IP has been banned until " << formatDateShort(banInfo.expiresAt) << " by " << banInfo.bannedBy << ".\n\nReason specified:\n" << banInfo.reason;
 		disconnectClient(0x0A, ss.str().c_str());
-		return false;
+		unRef();
+		return;
 	}
 
 	uint32_t serverip = serverIPs[0].first;
 	for (uint32_t i = 0; i < serverIPs.size(); i++) {
-		if ((serverIPs[i].first & serverIPs[i].second) == (clientip & serverIPs[i].second)) {
+		if ((serverIPs[i].first & serverIPs[i].second) == (clientIp & serverIPs[i].second)) {
 			serverip = serverIPs[i].first;
 			break;
 		}
@@ -127,13 +159,15 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 
 	if (!accountName) {
 		disconnectClient(0x0A, "Invalid account id.");
-		return false;
+		unRef();
+		return;
 	}
 
 	Account account;
 	if (!IOLoginData::getInstance()->loginserverAuthentication(accountName, password, account)) {
 		disconnectClient(0x0A, "Account id or password is not correct.");
-		return false;
+		unRef();
+		return;
 	}
 
 	OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, false);
@@ -179,11 +213,13 @@ bool ProtocolLogin::parseFirstPacket(NetworkMessage& msg)
 		OutputMessagePool::getInstance()->send(output);
 	}
 
-	getConnection()->closeConnection();
-	return true;
+	if (Connection_ptr connection = getConnection()) {
+		connection->closeConnection();
+	}
+	unRef();
 }
 
-void ProtocolLogin::onRecvFirstMessage(NetworkMessage& msg)
+void ProtocolLogin::onRecvFirstMessage(InputMessage& msg)
 {
 	parseFirstPacket(msg);
 }
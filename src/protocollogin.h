@@ -21,8 +21,8 @@
 #define __OTSERV_PROTOCOL_LOGIN_H__
 
 #include "protocol.h"
+#include "inputmessage.h"
 
-class NetworkMessage;
 class OutputMessage;
 
 class ProtocolLogin : public Protocol
@@ -53,12 +53,16 @@ class ProtocolLogin : public Protocol
 			return 0x01;
 		}
 
-		virtual void onRecvFirstMessage(NetworkMessage& msg);
+		virtual void onRecvFirstMessage(InputMessage& msg);
 
 	protected:
 		void disconnectClient(uint8_t error, const char* message);
 
-		bool parseFirstPacket(NetworkMessage& msg);
+		bool parseFirstPacket(InputMessage& msg);
+
+		// crypto thread, then database thread
+		void decryptFirstPacket(InputMessage_ptr msg, uint32_t clientIp);
+		void sendCharacterList(uint32_t clientIp, uint32_t accountName, const std::string& password);
 };
 
 #endif
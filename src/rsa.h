@@ -20,7 +20,7 @@
 #ifndef __OTSERV_RSA_H__
 #define __OTSERV_RSA_H__
 
-#include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
 
 #include "gmp.h"
 
@@ -37,7 +37,8 @@ class RSA
 		void getPublicKey(char* buffer);
 
 	protected:
-		boost::recursive_mutex rsaLock;
+		// decrypts only read the key and may run on several threads at once
+		boost::shared_mutex rsaLock;
 
 		//use only GMP
 		mpz_t m_n, m_d;
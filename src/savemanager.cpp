@@ -0,0 +1,224 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "otpch.h"
+
+#include "savemanager.h"
+#include "database.h"
+#include "iologindata.h"
+#include "tasks.h"
+
+#include <iostream>
+
+SaveManager::SaveManager()
+{
+	m_writingCount = 0;
+	m_batchSize = 1;
+	m_started = false;
+	m_running = false;
+	m_writtenCount = 0;
+	m_failedCount = 0;
+}
+
+void SaveManager::start(uint32_t batchSize)
+{
+	boost::lock_guard<boost::mutex> lockClass(m_queueLock);
+	m_batchSize = std::max<uint32_t>(1, batchSize);
+	m_started = true;
+	m_running = true;
+	m_thread = boost::thread(boost::bind(&SaveManager::saveThread, this));
+}
+
+void SaveManager::shutdown()
+{
+	m_queueLock.lock();
+	bool wasRunning = m_running;
+	m_running = false;
+	m_queueLock.unlock();
+
+	if (!wasRunning) {
+		return;
+	}
+
+	m_queueSignal.notify_one();
+	m_thread.join();
+}
+
+void SaveManager::addEntry(SaveEntry* entry)
+{
+	boost::unique_lock<boost::mutex> lockClass(m_queueLock);
+	if (!m_running) {
+		lockClass.unlock();
+		writeEntry(*entry);
+		delete entry;
+		return;
+	}
+
+	m_queue.push_back(entry);
+	lockClass.unlock();
+
+	m_queueSignal.notify_one();
+}
+
+bool SaveManager::writeEntry(const SaveEntry& entry)
+{
+	// the save thread begins its transaction before it lets go of the queue,
+	// so this write waits for a batch taken earlier and is never overtaken
+	boost::lock_guard<boost::mutex> lockClass(m_queueLock);
+	if (entry.playerGuid != 0) {
+		for (auto it = m_queue.begin(); it != m_queue.end();) {
+			if ((*it)->playerGuid == entry.playerGuid) {
+				delete *it;
+				it = m_queue.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+	return writeTransaction(entry);
+}
+
+void SaveManager::flush()
+{
+	boost::unique_lock<boost::mutex> lockClass(m_queueLock);
+	while (!m_queue.empty() || m_writingCount != 0) {
+		m_flushSignal.wait(lockClass);
+	}
+}
+
+size_t SaveManager::getQueuedCount()
+{
+	boost::lock_guard<boost::mutex> lockClass(m_queueLock);
+	return m_queue.size() + m_writingCount;
+}
+
+void SaveManager::saveThread()
+{
+	Database::initThread();
+
+	std::vector<SaveEntry*> batch;
+	batch.reserve(m_batchSize);
+
+	boost::unique_lock<boost::mutex> lockClass(m_queueLock);
+	while (true) {
+		while (m_running && m_queue.empty()) {
+			m_queueSignal.wait(lockClass);
+		}
+
+		// the queue is written out before the thread stops
+		if (m_queue.empty()) {
+			break;
+		}
+
+		while (!m_queue.empty() && batch.size() < m_batchSize) {
+			batch.push_back(m_queue.front());
+			m_queue.pop_front();
+		}
+		m_writingCount = batch.size();
+
+		bool written;
+		{
+			DBTransaction transaction;
+			written = transaction.begin();
+			lockClass.unlock();
+
+			for (SaveEntry* entry : batch) {
+				if (!written) {
+					break;
+				}
+				written = executeEntry(*entry);
+			}
+
+			if (written) {
+				written = transaction.commit();
+			}
+		}
+
+		lockClass.lock();
+		if (written) {
+			m_writtenCount += batch.size();
+		} else {
+			// the batch was rolled back, retry the entries one by one while
+			// the queue is locked so no newer save of them is written first
+			for (SaveEntry* entry : batch) {
+				writeTransaction(*entry);
+			}
+		}
+
+		for (SaveEntry* entry : batch) {
+			delete entry;
+		}
+		batch.clear();
+		m_writingCount = 0;
+		m_flushSignal.notify_all();
+	}
+	m_flushSignal.notify_all();
+	lockClass.unlock();
+
+	Database::endThread();
+}
+
+bool SaveManager::writeTransaction(const SaveEntry& entry)
+{
+	for (uint32_t tries = 0; tries < 3; ++tries) {
+		DBTransaction transaction;
+		if (transaction.begin() && executeEntry(entry) && transaction.commit()) {
+			++m_writtenCount;
+			return true;
+		}
+	}
+
+	++m_failedCount;
+	std::cout << "[Error - SaveManager::writeTransaction] Could not save " << entry.description << '.' << std::endl;
+
+	// periodic saves leave out unchanged sections, the next one has to write them all
+	if (entry.playerGuid != 0) {
+		g_dispatcher.addTask(createTask(boost::bind(&IOLoginData::resetPlayerSave, IOLoginData::getInstance(), entry.playerGuid)));
+	}
+	return false;
+}
+
+bool SaveManager::executeEntry(const SaveEntry& entry)
+{
+	Database* db = Database::getInstance();
+
+	if (entry.playerGuid != 0) {
+		std::ostringstream query;
+		query << "SELECT `save` FROM `players` WHERE `id` = " << entry.playerGuid;
+
+		DBResult* result = db->storeQuery(query.str());
+		if (!result) {
+			return false;
+		}
+
+		bool save = result->getDataInt("save") != 0;
+		db->freeResult(result);
+
+		if (!save) {
+			return db->executeQuery(entry.loginQuery);
+		}
+	}
+
+	for (const std::string& query : entry.queries) {
+		if (!db->executeQuery(query)) {
+			return false;
+		}
+	}
+	return true;
+}
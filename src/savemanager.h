@@ -0,0 +1,95 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __OTSERV_SAVEMANAGER_H__
+#define __OTSERV_SAVEMANAGER_H__
+
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+
+// The queries that store one player, house or the global storage. They are
+// built on the dispatcher and run in a single transaction on the save thread.
+struct SaveEntry {
+	SaveEntry() : playerGuid(0) {}
+
+	std::string description;
+	std::vector<std::string> queries;
+
+	// a player whose `save` column is 0 only gets loginQuery written
+	uint32_t playerGuid;
+	std::string loginQuery;
+};
+
+// Writes save entries to the database on a thread of its own, a batch of
+// them per transaction, in the order they were added.
+class SaveManager : boost::noncopyable
+{
+	public:
+		static SaveManager* getInstance() {
+			static SaveManager instance;
+			return &instance;
+		}
+
+		void start(uint32_t batchSize);
+		// writes the remaining entries before the thread stops
+		void shutdown();
+
+		// takes the entry over; without a started save thread it is written right away
+		void addEntry(SaveEntry* entry);
+		// writes on the calling thread, a queued entry of the same player is
+		// dropped so it cannot overwrite this newer one
+		bool writeEntry(const SaveEntry& entry);
+		// waits until every added entry is written
+		void flush();
+
+		size_t getQueuedCount();
+		uint64_t getWrittenCount() const {
+			return m_writtenCount;
+		}
+		uint64_t getFailedCount() const {
+			return m_failedCount;
+		}
+
+	protected:
+		SaveManager();
+
+		void saveThread();
+		bool writeTransaction(const SaveEntry& entry);
+		static bool executeEntry(const SaveEntry& entry);
+
+		boost::thread m_thread;
+		boost::mutex m_queueLock;
+		boost::condition_variable m_queueSignal;
+		boost::condition_variable m_flushSignal;
+
+		std::deque<SaveEntry*> m_queue;
+		size_t m_writingCount;
+		uint32_t m_batchSize;
+		bool m_started;
+		bool m_running;
+
+		std::atomic<uint64_t> m_writtenCount;
+		std::atomic<uint64_t> m_failedCount;
+};
+
+#endif
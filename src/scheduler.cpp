@@ -20,16 +20,20 @@
 #include "otpch.h"
 
 #include <iostream>
+#include <limits>
 #include "scheduler.h"
 
 Scheduler::Scheduler()
 {
 	m_lastEventId = 0;
+	m_currentTick = 0;
+	m_wakeupTick = 0;
 	m_threadState = STATE_TERMINATED;
 }
 
 void Scheduler::start()
 {
+	m_currentTick = OTSYS_STEADY_TIME();
 	m_threadState = STATE_RUNNING;
 	m_thread = boost::thread(boost::bind(&Scheduler::schedulerThread, this));
 }
@@ -39,54 +43,47 @@ void Scheduler::schedulerThread()
 	// NOTE: second argument defer_lock is to prevent from immediate locking
 	boost::unique_lock<boost::mutex> eventLockUnique(m_eventLock, boost::defer_lock);
 
-	while (m_threadState != STATE_TERMINATED) {
-		SchedulerTask* task = nullptr;
-		bool runTask = false;
-		bool ret = true;
+	std::vector<SchedulerTask*> expired;
 
+	while (m_threadState != STATE_TERMINATED) {
 		// check if there are events waiting...
 		eventLockUnique.lock();
 
-		if (m_eventList.empty()) {
+		if (m_eventIds.empty()) {
+			m_wakeupTick = std::numeric_limits<int64_t>::max();
 			m_eventSignal.wait(eventLockUnique);
 		} else {
-			ret = m_eventSignal.timed_wait(eventLockUnique, m_eventList.top()->getCycle());
+			m_wakeupTick = getNextTick();
+
+			int64_t delay = m_wakeupTick - OTSYS_STEADY_TIME();
+			if (delay > 0) {
+				m_eventSignal.timed_wait(eventLockUnique, boost::posix_time::milliseconds(delay));
+			}
 		}
 
 		// the mutex is locked again now...
-		if (!ret && m_threadState != STATE_TERMINATED) {
-			// ok we had a timeout, so there has to be an event we have to execute...
-			task = m_eventList.top();
-			m_eventList.pop();
-
-			// check if the event was stopped
-			auto it = m_eventIds.find(task->getEventId());
-			if (it != m_eventIds.end()) {
-				// was not stopped so we should run it
-				runTask = true;
-				m_eventIds.erase(it);
-			}
+		if (m_threadState != STATE_TERMINATED) {
+			advanceTo(OTSYS_STEADY_TIME(), expired);
 		}
 
 		eventLockUnique.unlock();
 
-		// add task to dispatcher
-		if (task) {
-			// if it was not stopped
-			if (runTask) {
-				// Expiration has another meaning for dispatcher tasks, reset it
-				task->setDontExpire();
-				g_dispatcher.addTask(task);
-			} else {
-				// was stopped, have to be deleted here
-				delete task;
-			}
+		// add the expired tasks to the dispatcher
+		for (SchedulerTask* task : expired) {
+			// Expiration has another meaning for dispatcher tasks, reset it
+			task->setDontExpire();
+			g_dispatcher.addTask(task);
 		}
+		expired.clear();
 	}
 }
 
-uint32_t Scheduler::addEvent(SchedulerTask* task)
+uint32_t Scheduler::addEvent(SchedulerTask* task, TaskOrigin_t origin /*= TASK_ORIGIN_EVENT_OTHER*/)
 {
+	if (!task->getStats()) {
+		task->setStats(Stats::getInstance()->getOriginStats(origin));
+	}
+
 	bool do_signal = false;
 	m_eventLock.lock();
 
@@ -102,15 +99,19 @@ uint32_t Scheduler::addEvent(SchedulerTask* task)
 			task->setEventId(m_lastEventId);
 		}
 
+		// an empty wheel can jump straight to the present instead of walking the idle gap
+		if (m_eventIds.empty()) {
+			m_currentTick = std::max<int64_t>(m_currentTick, OTSYS_STEADY_TIME());
+		}
+
 		// insert the eventid in the list of active events
-		m_eventIds.insert(task->getEventId());
+		m_eventIds[task->getEventId()] = task;
 
-		// add the event to the queue
-		m_eventList.push(task);
+		// add the event to the wheel, the current tick has already been processed
+		linkTask(task, m_currentTick + 1);
 
-		// if the list was empty or this event is the top in the list
-		// we have to signal it
-		do_signal = (task == m_eventList.top());
+		// if the thread sleeps past this event we have to signal it
+		do_signal = (task->getCycle() < m_wakeupTick);
 	} else {
 		m_eventLock.unlock();
 		delete task;
@@ -142,8 +143,12 @@ bool Scheduler::stopEvent(uint32_t eventid)
 		return false;
 	}
 
+	SchedulerTask* task = it->second;
+	unlinkTask(task);
 	m_eventIds.erase(it);
 	m_eventLock.unlock();
+
+	delete task;
 	return true;
 }
 
@@ -160,16 +165,130 @@ void Scheduler::shutdown()
 	m_threadState = Scheduler::STATE_TERMINATED;
 
 	//this list should already be empty
-	while (!m_eventList.empty()) {
-		delete m_eventList.top();
-		m_eventList.pop();
+	for (const auto& it : m_eventIds) {
+		delete it.second;
 	}
 
 	m_eventIds.clear();
+
+	for (uint32_t level = 0; level < SCHEDULER_WHEEL_LEVELS; ++level) {
+		for (uint32_t slot = 0; slot < SCHEDULER_WHEEL_SLOTS; ++slot) {
+			m_wheel[level][slot] = WheelSlot();
+		}
+	}
+
 	m_eventLock.unlock();
+	m_eventSignal.notify_one();
 }
 
 void Scheduler::join()
 {
 	m_thread.join();
 }
+
+void Scheduler::linkTask(SchedulerTask* task, int64_t earliestTick)
+{
+	int64_t cycle = std::max<int64_t>(task->getCycle(), earliestTick);
+	uint64_t ticks = cycle - m_currentTick;
+
+	// pick the lowest level whose range still covers the remaining ticks
+	uint32_t level = 0;
+	while (level < SCHEDULER_WHEEL_LEVELS - 1 && ticks >= (1ULL << (SCHEDULER_WHEEL_BITS * (level + 1)))) {
+		++level;
+	}
+
+	task->m_wheelLevel = level;
+	task->m_wheelSlot = (cycle >> (SCHEDULER_WHEEL_BITS * level)) & SCHEDULER_WHEEL_MASK;
+
+	WheelSlot& slot = m_wheel[task->m_wheelLevel][task->m_wheelSlot];
+	task->m_prev = slot.tail;
+	task->m_next = nullptr;
+	if (slot.tail) {
+		slot.tail->m_next = task;
+	} else {
+		slot.head = task;
+	}
+	slot.tail = task;
+}
+
+void Scheduler::unlinkTask(SchedulerTask* task)
+{
+	WheelSlot& slot = m_wheel[task->m_wheelLevel][task->m_wheelSlot];
+	if (task->m_prev) {
+		task->m_prev->m_next = task->m_next;
+	} else {
+		slot.head = task->m_next;
+	}
+
+	if (task->m_next) {
+		task->m_next->m_prev = task->m_prev;
+	} else {
+		slot.tail = task->m_prev;
+	}
+
+	task->m_prev = nullptr;
+	task->m_next = nullptr;
+}
+
+void Scheduler::cascade(uint32_t level)
+{
+	// re-distribute the slot we just entered onto the lower levels
+	WheelSlot& slot = m_wheel[level][(m_currentTick >> (SCHEDULER_WHEEL_BITS * level)) & SCHEDULER_WHEEL_MASK];
+	SchedulerTask* task = slot.head;
+	slot = WheelSlot();
+
+	while (task) {
+		SchedulerTask* next = task->m_next;
+		linkTask(task, m_currentTick);
+		task = next;
+	}
+}
+
+void Scheduler::advanceTo(int64_t tick, std::vector<SchedulerTask*>& expired)
+{
+	while (m_currentTick < tick) {
+		int64_t nextTick = getNextTick();
+		if (nextTick > tick) {
+			// nothing is due and no slot boundary is crossed until then
+			m_currentTick = tick;
+			break;
+		}
+
+		m_currentTick = nextTick;
+
+		// entering a new rotation of a level pulls down the matching slot of the level above
+		for (uint32_t level = 1; level < SCHEDULER_WHEEL_LEVELS; ++level) {
+			if ((m_currentTick & ((1ULL << (SCHEDULER_WHEEL_BITS * level)) - 1)) != 0) {
+				break;
+			}
+			cascade(level);
+		}
+
+		WheelSlot& slot = m_wheel[0][m_currentTick & SCHEDULER_WHEEL_MASK];
+		SchedulerTask* task = slot.head;
+		slot = WheelSlot();
+
+		while (task) {
+			SchedulerTask* next = task->m_next;
+			task->m_prev = nullptr;
+			task->m_next = nullptr;
+
+			m_eventIds.erase(task->getEventId());
+			expired.push_back(task);
+			task = next;
+		}
+	}
+}
+
+int64_t Scheduler::getNextTick() const
+{
+	// first occupied slot in the rest of the current rotation of the lowest level,
+	// otherwise the start of the next rotation where the level above is cascaded
+	int64_t rotationEnd = m_currentTick | SCHEDULER_WHEEL_MASK;
+	for (int64_t tick = m_currentTick + 1; tick <= rotationEnd; ++tick) {
+		if (m_wheel[0][tick & SCHEDULER_WHEEL_MASK].head) {
+			return tick;
+		}
+	}
+	return rotationEnd + 1;
+}
@@ -21,14 +21,21 @@
 #define __OTSERV_SCHEDULER_H__
 
 #include "tasks.h"
+#include "stats.h"
 #include <boost/bind.hpp>
-#include <unordered_set>
+#include <unordered_map>
 #include <vector>
-#include <queue>
-#include <set>
 
 #define SCHEDULER_MINTICKS 50
 
+// The scheduler keeps its events in a hierarchical timing wheel: each level
+// holds SCHEDULER_WHEEL_SLOTS slots, a slot on level n spans
+// SCHEDULER_WHEEL_SLOTS^n milliseconds, so four levels cover any uint32_t delay.
+#define SCHEDULER_WHEEL_BITS 8
+#define SCHEDULER_WHEEL_SLOTS (1 << SCHEDULER_WHEEL_BITS)
+#define SCHEDULER_WHEEL_MASK (SCHEDULER_WHEEL_SLOTS - 1)
+#define SCHEDULER_WHEEL_LEVELS 4
+
 class SchedulerTask : public Task
 {
 	public:
@@ -41,48 +48,55 @@ class SchedulerTask : public Task
 			return m_eventid;
 		}
 
-		boost::system_time getCycle() const {
-			return m_expiration;
-		}
-
-		bool operator<(const SchedulerTask& other) const {
-			return getCycle() > other.getCycle();
+		int64_t getCycle() const {
+			return m_cycle;
 		}
 
 	protected:
-		SchedulerTask(uint32_t delay, const boost::function<void (void)>& f) : Task(delay, f) {
+		template<typename F>
+		SchedulerTask(uint32_t delay, F&& f) : Task(std::forward<F>(f)) {
 			m_eventid = 0;
+			m_cycle = OTSYS_STEADY_TIME() + delay;
+			m_prev = nullptr;
+			m_next = nullptr;
+			m_wheelLevel = 0;
+			m_wheelSlot = 0;
 		}
 
 		uint32_t m_eventid;
 
-		friend SchedulerTask* createSchedulerTask(uint32_t, const boost::function<void (void)>&);
+		// time (steady clock) at which the task should be added to the dispatcher
+		int64_t m_cycle;
+
+		// wheel slot the task currently sits in, and its intrusive links within it
+		SchedulerTask* m_prev;
+		SchedulerTask* m_next;
+		uint8_t m_wheelLevel;
+		uint8_t m_wheelSlot;
+
+		friend class Scheduler;
+		template<typename F>
+		friend SchedulerTask* createSchedulerTask(uint32_t, F&&);
 };
 
-inline SchedulerTask* createSchedulerTask(uint32_t delay, const boost::function<void (void)>& f)
+template<typename F>
+inline SchedulerTask* createSchedulerTask(uint32_t delay, F&& f)
 {
 	if (delay < SCHEDULER_MINTICKS) {
 		delay = SCHEDULER_MINTICKS;
 	}
 
-	return new SchedulerTask(delay, f);
+	return new SchedulerTask(delay, std::forward<F>(f));
 }
 
-class lessSchedTask : public std::binary_function<SchedulerTask*&, SchedulerTask*&, bool>
-{
-	public:
-		bool operator()(SchedulerTask*& t1, SchedulerTask*& t2) {
-			return (*t1) < (*t2);
-		}
-};
-
 class Scheduler
 {
 	public:
 		Scheduler();
 		~Scheduler() {}
 
-		uint32_t addEvent(SchedulerTask* task);
+		// the origin is only used when the task has no statistics entry yet
+		uint32_t addEvent(SchedulerTask* task, TaskOrigin_t origin = TASK_ORIGIN_EVENT_OTHER);
 		bool stopEvent(uint32_t eventId);
 
 		void start();
@@ -97,15 +111,31 @@ class Scheduler
 		};
 
 	protected:
+		struct WheelSlot {
+			WheelSlot() : head(nullptr), tail(nullptr) {}
+
+			SchedulerTask* head;
+			SchedulerTask* tail;
+		};
+
 		void schedulerThread();
 
+		// all of these require m_eventLock to be held
+		void linkTask(SchedulerTask* task, int64_t earliestTick);
+		void unlinkTask(SchedulerTask* task);
+		void cascade(uint32_t level);
+		void advanceTo(int64_t tick, std::vector<SchedulerTask*>& expired);
+		int64_t getNextTick() const;
+
 		boost::thread m_thread;
 		boost::mutex m_eventLock;
 		boost::condition_variable m_eventSignal;
 
 		uint32_t m_lastEventId;
-		std::priority_queue<SchedulerTask*, std::vector<SchedulerTask*>, lessSchedTask > m_eventList;
-		std::unordered_set<uint32_t> m_eventIds;
+		WheelSlot m_wheel[SCHEDULER_WHEEL_LEVELS][SCHEDULER_WHEEL_SLOTS];
+		std::unordered_map<uint32_t, SchedulerTask*> m_eventIds;
+		int64_t m_currentTick;
+		int64_t m_wakeupTick;
 		SchedulerState m_threadState;
 };
 
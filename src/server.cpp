@@ -55,6 +55,7 @@ std::list<uint16_t> ServiceManager::get_ports() const
 
 void ServiceManager::die()
 {
+	m_connectionPool.stop();
 	m_io_service.stop();
 }
 
@@ -62,7 +63,9 @@ void ServiceManager::run()
 {
 	assert(!running);
 	running = true;
+	m_connectionPool.run();
 	m_io_service.run();
+	m_connectionPool.join();
 }
 
 void ServiceManager::stop()
@@ -90,8 +93,69 @@ void ServiceManager::stop()
 	death_timer.async_wait(boost::bind(&ServiceManager::die, this));
 }
 
-ServicePort::ServicePort(boost::asio::io_service& io_service) :
+boost::asio::io_service& IOServicePool::getIOService()
+{
+	//acceptor thread, or the dispatcher while the services are added
+	if (m_services.empty()) {
+		createServices();
+	}
+
+	boost::asio::io_service& io_service = *m_services[m_nextService];
+	m_nextService = (m_nextService + 1) % m_services.size();
+	return io_service;
+}
+
+void IOServicePool::createServices()
+{
+	int32_t threads = g_config.getNumber(ConfigManager::NETWORK_THREADS);
+	if (threads <= 0) {
+		threads = std::max<int32_t>(1, boost::thread::hardware_concurrency());
+	}
+
+	for (int32_t i = 0; i < threads; ++i) {
+		boost::shared_ptr<boost::asio::io_service> io_service(new boost::asio::io_service());
+		m_work.push_back(boost::shared_ptr<boost::asio::io_service::work>(new boost::asio::io_service::work(*io_service)));
+		m_services.push_back(io_service);
+	}
+}
+
+void IOServicePool::run()
+{
+	if (m_services.empty()) {
+		createServices();
+	}
+
+	for (const boost::shared_ptr<boost::asio::io_service>& io_service : m_services) {
+		m_threads.push_back(boost::shared_ptr<boost::thread>(new boost::thread(
+		                        boost::bind(&IOServicePool::runService, io_service.get()))));
+	}
+}
+
+void IOServicePool::runService(boost::asio::io_service* io_service)
+{
+	io_service->run();
+}
+
+void IOServicePool::stop()
+{
+	m_work.clear();
+
+	for (const boost::shared_ptr<boost::asio::io_service>& io_service : m_services) {
+		io_service->stop();
+	}
+}
+
+void IOServicePool::join()
+{
+	for (const boost::shared_ptr<boost::thread>& thread : m_threads) {
+		thread->join();
+	}
+	m_threads.clear();
+}
+
+ServicePort::ServicePort(boost::asio::io_service& io_service, IOServicePool& connectionPool) :
 	m_io_service(io_service),
+	m_connectionPool(connectionPool),
 	m_acceptor(nullptr),
 	m_serverPort(0),
 	m_pendingStart(false)
@@ -130,13 +194,14 @@ void ServicePort::accept()
 		return;
 	}
 
-	boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(m_io_service);
+	boost::asio::io_service& socketService = m_connectionPool.getIOService();
+	boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(socketService);
 	m_acceptor->async_accept(*socket,
-	                         boost::bind(&ServicePort::onAccept, this, socket,
+	                         boost::bind(&ServicePort::onAccept, this, socket, &socketService,
 	                                     boost::asio::placeholders::error));
 }
 
-void ServicePort::onAccept(boost::asio::ip::tcp::socket* socket, const boost::system::error_code& error)
+void ServicePort::onAccept(boost::asio::ip::tcp::socket* socket, boost::asio::io_service* socketService, const boost::system::error_code& error)
 {
 	if (!error) {
 		if (m_services.empty()) {
@@ -152,7 +217,9 @@ void ServicePort::onAccept(boost::asio::ip::tcp::socket* socket, const boost::sy
 		}
 
 		if (remote_ip != 0 && g_bans.acceptConnection(remote_ip)) {
-			Connection_ptr connection = ConnectionManager::getInstance()->createConnection(socket, m_io_service, shared_from_this());
+			socket->set_option(boost::asio::ip::tcp::no_delay(g_config.getBoolean(ConfigManager::SOCKET_NO_DELAY)), socketError);
+
+			Connection_ptr connection = ConnectionManager::getInstance()->createConnection(socket, *socketService, shared_from_this());
 			Service_ptr service = m_services.front();
 
 			if (service->is_single_socket()) {
@@ -177,7 +244,7 @@ void ServicePort::onAccept(boost::asio::ip::tcp::socket* socket, const boost::sy
 	}
 }
 
-Protocol* ServicePort::make_protocol(NetworkMessage& msg) const
+Protocol* ServicePort::make_protocol(InputMessage& msg) const
 {
 	uint8_t protocolID = msg.GetByte();
 	for (Service_ptr service : m_services) {
@@ -220,8 +287,6 @@ void ServicePort::open(uint16_t port)
 			            boost::asio::ip::address(boost::asio::ip::address_v4(INADDR_ANY)), m_serverPort));
 		}
 
-		m_acceptor->set_option(boost::asio::ip::tcp::no_delay(true));
-
 		accept();
 	} catch (boost::system::system_error& e) {
 		std::cout << "[ServicePort::open] Error: " << e.what() << std::endl;
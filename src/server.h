@@ -26,12 +26,13 @@
 #include <boost/asio.hpp>
 #include <boost/utility.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/thread.hpp>
 #include <list>
 
 class Connection;
 typedef boost::shared_ptr<Connection> Connection_ptr;
 class Protocol;
-class NetworkMessage;
+class InputMessage;
 
 class ServiceBase;
 class ServicePort;
@@ -70,10 +71,37 @@ class Service : public ServiceBase
 		}
 };
 
+/**
+  * The io_services running the connections, one per network thread.
+  * Every connection is created on one of them and stays there, so the
+  * handlers of a connection never run concurrently with each other.
+  */
+class IOServicePool : boost::noncopyable
+{
+	public:
+		IOServicePool() : m_nextService(0) {}
+
+		// creates the io_services on first use, the acceptors need them before run()
+		boost::asio::io_service& getIOService();
+
+		void run();
+		void stop();
+		void join();
+
+	protected:
+		void createServices();
+		static void runService(boost::asio::io_service* io_service);
+
+		std::vector<boost::shared_ptr<boost::asio::io_service>> m_services;
+		std::vector<boost::shared_ptr<boost::asio::io_service::work>> m_work;
+		std::vector<boost::shared_ptr<boost::thread>> m_threads;
+		size_t m_nextService;
+};
+
 class ServicePort : boost::noncopyable, public boost::enable_shared_from_this<ServicePort>
 {
 	public:
-		ServicePort(boost::asio::io_service& io_service);
+		ServicePort(boost::asio::io_service& io_service, IOServicePool& connectionPool);
 		~ServicePort();
 
 		static void openAcceptor(boost::weak_ptr<ServicePort> weak_service, uint16_t port);
@@ -83,15 +111,16 @@ class ServicePort : boost::noncopyable, public boost::enable_shared_from_this<Se
 		std::string get_protocol_names() const;
 
 		bool add_service(Service_ptr);
-		Protocol* make_protocol(NetworkMessage& msg) const;
+		Protocol* make_protocol(InputMessage& msg) const;
 
 		void onStopServer();
-		void onAccept(boost::asio::ip::tcp::socket* socket, const boost::system::error_code& error);
+		void onAccept(boost::asio::ip::tcp::socket* socket, boost::asio::io_service* socketService, const boost::system::error_code& error);
 
 	protected:
 		void accept();
 
 		boost::asio::io_service& m_io_service;
+		IOServicePool& m_connectionPool;
 		boost::asio::ip::tcp::acceptor* m_acceptor;
 		std::vector<Service_ptr> m_services;
 
@@ -125,7 +154,9 @@ class ServiceManager : boost::noncopyable
 
 		std::map<uint16_t, ServicePort_ptr> m_acceptors;
 
+		// runs the acceptors, the connections run on m_connectionPool
 		boost::asio::io_service m_io_service;
+		IOServicePool m_connectionPool;
 		boost::asio::deadline_timer death_timer;
 		bool running;
 };
@@ -144,7 +175,7 @@ bool ServiceManager::add(uint16_t port)
 	    m_acceptors.find(port);
 
 	if (finder == m_acceptors.end()) {
-		service_port.reset(new ServicePort(m_io_service));
+		service_port.reset(new ServicePort(m_io_service, m_connectionPool));
 		service_port->open(port);
 		m_acceptors[port] = service_port;
 	} else {
@@ -0,0 +1,139 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __OTSERV_SPECTATORS_H__
+#define __OTSERV_SPECTATORS_H__
+
+#include <algorithm>
+#include <cstring>
+
+class Creature;
+
+#define SPECTATOR_VEC_INLINE_SIZE 32
+
+// Set of creatures seeing a position. Most lists are short, so the creatures
+// are kept in an inline array and only spill to the heap for crowded areas.
+// insert() keeps the entries unique, the order of the entries is unspecified.
+class SpectatorVec
+{
+	public:
+		typedef Creature* value_type;
+		typedef Creature** iterator;
+		typedef Creature* const* const_iterator;
+
+		SpectatorVec() : m_data(m_inline), m_size(0), m_capacity(SPECTATOR_VEC_INLINE_SIZE) {}
+		SpectatorVec(const SpectatorVec& other) : m_data(m_inline), m_size(0), m_capacity(SPECTATOR_VEC_INLINE_SIZE) {
+			assign(other);
+		}
+		~SpectatorVec() {
+			if (m_data != m_inline) {
+				delete[] m_data;
+			}
+		}
+
+		SpectatorVec& operator=(const SpectatorVec& other) {
+			if (this != &other) {
+				assign(other);
+			}
+			return *this;
+		}
+
+		iterator begin() {
+			return m_data;
+		}
+		iterator end() {
+			return m_data + m_size;
+		}
+		const_iterator begin() const {
+			return m_data;
+		}
+		const_iterator end() const {
+			return m_data + m_size;
+		}
+
+		size_t size() const {
+			return m_size;
+		}
+		bool empty() const {
+			return m_size == 0;
+		}
+		void clear() {
+			m_size = 0;
+		}
+
+		void insert(Creature* creature) {
+			if (std::find(begin(), end(), creature) == end()) {
+				push_back(creature);
+			}
+		}
+
+		template<typename InputIterator>
+		void insert(InputIterator first, InputIterator last) {
+			bool merge = !empty();
+			for (; first != last; ++first) {
+				push_back(*first);
+			}
+
+			if (merge) {
+				removeDuplicates();
+			}
+		}
+
+		// appends without checking for duplicates, for callers that know the creature is not in the list yet
+		void push_back(Creature* creature) {
+			if (m_size == m_capacity) {
+				reserve(m_capacity * 2);
+			}
+			m_data[m_size++] = creature;
+		}
+
+		void removeDuplicates() {
+			std::sort(begin(), end());
+			m_size = std::unique(begin(), end()) - begin();
+		}
+
+		void reserve(size_t capacity) {
+			if (capacity <= m_capacity) {
+				return;
+			}
+
+			Creature** data = new Creature*[capacity];
+			memcpy(data, m_data, m_size * sizeof(Creature*));
+			if (m_data != m_inline) {
+				delete[] m_data;
+			}
+			m_data = data;
+			m_capacity = capacity;
+		}
+
+	private:
+		void assign(const SpectatorVec& other) {
+			m_size = 0;
+			reserve(other.m_size);
+			memcpy(m_data, other.m_data, other.m_size * sizeof(Creature*));
+			m_size = other.m_size;
+		}
+
+		Creature** m_data;
+		size_t m_size;
+		size_t m_capacity;
+		Creature* m_inline[SPECTATOR_VEC_INLINE_SIZE];
+};
+
+#endif
@@ -0,0 +1,249 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "otpch.h"
+
+#include "stats.h"
+
+#include <iostream>
+#include <iomanip>
+
+namespace {
+
+struct TaskOriginName {
+	const char* group;
+	const char* name;
+};
+
+const TaskOriginName taskOriginNames[TASK_ORIGIN_LAST] = {
+	{"task", "other"},
+	{"task", "login"},
+	{"task", "save"},
+	{"task", "database"},
+	{"event", "other"},
+	{"event", "checkCreatures"},
+	{"event", "checkDecay"},
+	{"event", "checkLight"},
+	{"event", "creatureWalk"},
+	{"event", "spawn"},
+	{"event", "raid"},
+	{"event", "globalEvent"},
+	{"event", "luaTimer"}
+};
+
+const char* playerItemsNames[PLAYER_ITEMS_LAST] = {
+	"loadRows",
+	"loadBlobs",
+	"saveRows",
+	"saveBlobs"
+};
+
+}
+
+Stats::Stats() :
+	m_stackSize(0), m_taskStartTime(0), m_taskSequence(0), m_stallCount(0),
+	m_watchdogRunning(false), m_stallThreshold(0)
+{
+	for (uint32_t i = 0; i < TASK_ORIGIN_LAST; ++i) {
+		m_originStats[i] = new TaskStats(taskOriginNames[i].group, taskOriginNames[i].name);
+	}
+
+	for (uint32_t i = 0; i < 256; ++i) {
+		std::ostringstream ss;
+		ss << "0x" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << i;
+		m_opcodeStats[i] = new TaskStats("opcode", ss.str());
+	}
+
+	for (uint32_t i = 0; i < PLAYER_ITEMS_LAST; ++i) {
+		m_playerItemsStats[i] = new TaskStats("playerItems", playerItemsNames[i]);
+	}
+
+	for (uint32_t i = 0; i < STATS_STACK_SIZE; ++i) {
+		m_stack[i] = nullptr;
+	}
+}
+
+Stats::~Stats()
+{
+	stopWatchdog();
+
+	for (TaskStats* stats : m_originStats) {
+		delete stats;
+	}
+
+	for (TaskStats* stats : m_opcodeStats) {
+		delete stats;
+	}
+
+	for (TaskStats* stats : m_playerItemsStats) {
+		delete stats;
+	}
+
+	for (const auto& it : m_scriptStats) {
+		delete it.second;
+	}
+}
+
+TaskStats* Stats::getScriptStats(const std::string& fileName)
+{
+	boost::lock_guard<boost::mutex> lockClass(m_scriptStatsLock);
+
+	TaskStats*& stats = m_scriptStats[fileName];
+	if (!stats) {
+		stats = new TaskStats("script", fileName);
+	}
+	return stats;
+}
+
+void Stats::recordPlayerItems(PlayerItemsIO_t type, int64_t duration)
+{
+	boost::lock_guard<boost::mutex> lockClass(m_playerItemsStatsLock);
+	m_playerItemsStats[type]->getHistogram().record(duration);
+}
+
+std::vector<const TaskStats*> Stats::getEntries()
+{
+	std::vector<const TaskStats*> entries;
+
+	for (const TaskStats* stats : m_originStats) {
+		if (stats->getHistogram().getCount() != 0) {
+			entries.push_back(stats);
+		}
+	}
+
+	for (const TaskStats* stats : m_opcodeStats) {
+		if (stats->getHistogram().getCount() != 0) {
+			entries.push_back(stats);
+		}
+	}
+
+	{
+		boost::lock_guard<boost::mutex> lockClass(m_playerItemsStatsLock);
+		for (const TaskStats* stats : m_playerItemsStats) {
+			if (stats->getHistogram().getCount() != 0) {
+				entries.push_back(stats);
+			}
+		}
+	}
+
+	boost::lock_guard<boost::mutex> lockClass(m_scriptStatsLock);
+	for (const auto& it : m_scriptStats) {
+		if (it.second->getHistogram().getCount() != 0) {
+			entries.push_back(it.second);
+		}
+	}
+	return entries;
+}
+
+int64_t Stats::enter(TaskStats* stats)
+{
+	//dispatcher thread
+	int64_t startTime = OTSYS_STEADY_TIME_US();
+
+	uint32_t depth = m_stackSize.load(std::memory_order_relaxed);
+	if (depth < STATS_STACK_SIZE) {
+		m_stack[depth].store(stats, std::memory_order_relaxed);
+	}
+
+	if (depth == 0) {
+		m_taskStartTime.store(startTime, std::memory_order_relaxed);
+		m_taskSequence.store(m_taskSequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	m_stackSize.store(depth + 1, std::memory_order_release);
+	return startTime;
+}
+
+void Stats::leave(TaskStats* stats, int64_t startTime)
+{
+	//dispatcher thread
+	int64_t duration = OTSYS_STEADY_TIME_US() - startTime;
+	stats->getHistogram().record(duration);
+
+	uint32_t depth = m_stackSize.load(std::memory_order_relaxed) - 1;
+	m_stackSize.store(depth, std::memory_order_release);
+
+	if (depth == 0 && m_stallThreshold != 0 && duration >= m_stallThreshold * 1000LL) {
+		m_stallCount.store(m_stallCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+}
+
+void Stats::startWatchdog(uint32_t stallThreshold)
+{
+	if (m_watchdogRunning || stallThreshold == 0) {
+		return;
+	}
+
+	m_stallThreshold = stallThreshold;
+	m_watchdogRunning = true;
+	m_watchdogThread = boost::thread(boost::bind(&Stats::watchdogThread, this));
+}
+
+void Stats::stopWatchdog()
+{
+	{
+		boost::lock_guard<boost::mutex> lockClass(m_watchdogLock);
+		if (!m_watchdogRunning) {
+			return;
+		}
+		m_watchdogRunning = false;
+	}
+
+	m_watchdogSignal.notify_one();
+	m_watchdogThread.join();
+}
+
+void Stats::watchdogThread()
+{
+	// a task is reported once, the one running right now may have started long before the watchdog
+	uint64_t reportedSequence = m_taskSequence.load(std::memory_order_relaxed);
+	uint32_t interval = std::max<uint32_t>(10, m_stallThreshold / 4);
+
+	boost::unique_lock<boost::mutex> watchdogLockUnique(m_watchdogLock);
+	while (m_watchdogRunning) {
+		m_watchdogSignal.timed_wait(watchdogLockUnique, boost::posix_time::milliseconds(interval));
+
+		uint32_t depth = m_stackSize.load(std::memory_order_acquire);
+		if (depth == 0) {
+			continue;
+		}
+
+		uint64_t sequence = m_taskSequence.load(std::memory_order_relaxed);
+		int64_t runningTime = (OTSYS_STEADY_TIME_US() - m_taskStartTime.load(std::memory_order_relaxed)) / 1000;
+		if (sequence == reportedSequence || runningTime < m_stallThreshold) {
+			continue;
+		}
+
+		reportedSequence = sequence;
+
+		// the stack may change while it is read, it only names the culprit
+		std::ostringstream ss;
+		for (uint32_t i = 0; i < std::min<uint32_t>(depth, STATS_STACK_SIZE); ++i) {
+			const TaskStats* stats = m_stack[i].load(std::memory_order_relaxed);
+			if (stats) {
+				if (i != 0) {
+					ss << " > ";
+				}
+				ss << stats->getGroup() << ' ' << stats->getName();
+			}
+		}
+
+		std::cout << "[Warning - Dispatcher] Task running for " << runningTime << " ms: " << ss.str() << std::endl;
+	}
+}
@@ -0,0 +1,157 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __OTSERV_STATS_H__
+#define __OTSERV_STATS_H__
+
+#include <boost/thread.hpp>
+#include <atomic>
+
+#include "histogram.h"
+
+// depth of the nested work (task, script callbacks) the watchdog can name
+#define STATS_STACK_SIZE 8
+
+// where a dispatcher task or scheduler event comes from, packets are counted per opcode instead
+enum TaskOrigin_t {
+	// dispatcher tasks
+	TASK_ORIGIN_OTHER,
+	TASK_ORIGIN_LOGIN,
+	TASK_ORIGIN_SAVE,
+	TASK_ORIGIN_DATABASE,
+
+	// scheduler events
+	TASK_ORIGIN_EVENT_OTHER,
+	TASK_ORIGIN_CHECK_CREATURES,
+	TASK_ORIGIN_CHECK_DECAY,
+	TASK_ORIGIN_CHECK_LIGHT,
+	TASK_ORIGIN_CREATURE_WALK,
+	TASK_ORIGIN_SPAWN,
+	TASK_ORIGIN_RAID,
+	TASK_ORIGIN_GLOBAL_EVENT,
+	TASK_ORIGIN_LUA_TIMER,
+
+	TASK_ORIGIN_LAST /* this must be the last one */
+};
+
+// loading and saving the items of one player, per storage format
+enum PlayerItemsIO_t {
+	PLAYER_ITEMS_LOAD_ROWS,
+	PLAYER_ITEMS_LOAD_BLOBS,
+	PLAYER_ITEMS_SAVE_ROWS,
+	PLAYER_ITEMS_SAVE_BLOBS,
+
+	PLAYER_ITEMS_LAST /* this must be the last one */
+};
+
+// Time spent by one kind of work, mostly on the dispatcher thread, in microseconds.
+class TaskStats
+{
+	public:
+		TaskStats(const std::string& group, const std::string& name) :
+			m_group(group), m_name(name) {}
+
+		const std::string& getGroup() const {
+			return m_group;
+		}
+		const std::string& getName() const {
+			return m_name;
+		}
+
+		LatencyHistogram& getHistogram() {
+			return m_histogram;
+		}
+		const LatencyHistogram& getHistogram() const {
+			return m_histogram;
+		}
+
+	private:
+		std::string m_group;
+		std::string m_name;
+		LatencyHistogram m_histogram;
+};
+
+// Collects the time spent per packet opcode, task origin and script, and
+// runs a watchdog that warns about dispatcher tasks running for too long.
+class Stats
+{
+	public:
+		~Stats();
+
+		static Stats* getInstance() {
+			static Stats instance;
+			return &instance;
+		}
+
+		TaskStats* getOriginStats(TaskOrigin_t origin) {
+			return m_originStats[origin];
+		}
+		TaskStats* getOpcodeStats(uint8_t opcode) {
+			return m_opcodeStats[opcode];
+		}
+		TaskStats* getScriptStats(const std::string& fileName);
+
+		// any thread, players are loaded on the database threads
+		void recordPlayerItems(PlayerItemsIO_t type, int64_t duration);
+
+		std::vector<const TaskStats*> getEntries();
+
+		// dispatcher thread, the returned start time has to be passed to leave
+		int64_t enter(TaskStats* stats);
+		void leave(TaskStats* stats, int64_t startTime);
+
+		void startWatchdog(uint32_t stallThreshold);
+		void stopWatchdog();
+
+		uint32_t getStallThreshold() const {
+			return m_stallThreshold;
+		}
+		uint64_t getStallCount() const {
+			return m_stallCount;
+		}
+
+	private:
+		Stats();
+
+		void watchdogThread();
+
+		TaskStats* m_originStats[TASK_ORIGIN_LAST];
+		TaskStats* m_opcodeStats[256];
+
+		boost::mutex m_playerItemsStatsLock;
+		TaskStats* m_playerItemsStats[PLAYER_ITEMS_LAST];
+
+		boost::mutex m_scriptStatsLock;
+		std::map<std::string, TaskStats*> m_scriptStats;
+
+		// the work the dispatcher is currently doing, innermost last
+		std::atomic<TaskStats*> m_stack[STATS_STACK_SIZE];
+		std::atomic<uint32_t> m_stackSize;
+		std::atomic<int64_t> m_taskStartTime;
+		std::atomic<uint64_t> m_taskSequence;
+		std::atomic<uint64_t> m_stallCount;
+
+		boost::thread m_watchdogThread;
+		boost::mutex m_watchdogLock;
+		boost::condition_variable m_watchdogSignal;
+		bool m_watchdogRunning;
+		uint32_t m_stallThreshold;
+};
+
+#endif
@@ -26,6 +26,8 @@
 #include "networkmessage.h"
 #include "outputmessage.h"
 #include "tools.h"
+#include "stats.h"
+#include "savemanager.h"
 
 extern ConfigManager g_config;
 extern Game g_game;
@@ -46,36 +48,43 @@ enum RequestedInfo_t {
 };
 
 std::map<uint32_t, int64_t> ProtocolStatus::ipConnectMap;
+boost::mutex ProtocolStatus::ipConnectMapLock;
 
-void ProtocolStatus::onRecvFirstMessage(NetworkMessage& msg)
+void ProtocolStatus::onRecvFirstMessage(InputMessage& msg)
 {
 	uint32_t ip = getIP();
 
-	if (ip != 0x0100007F) {
-		std::string ipStr = convertIPToString(ip);
+	{
+		//status requests arrive on all network threads
+		boost::mutex::scoped_lock lockClass(ipConnectMapLock);
 
-		if (ipStr != g_config.getString(ConfigManager::IP)) {
-			std::map<uint32_t, int64_t>::const_iterator it = ipConnectMap.find(ip);
+		if (ip != 0x0100007F) {
+			std::string ipStr = convertIPToString(ip);
 
-			if (it != ipConnectMap.end()) {
-				if (OTSYS_TIME() < (it->second + g_config.getNumber(ConfigManager::STATUSQUERY_TIMEOUT))) {
-					getConnection()->closeConnection();
-					return;
+			if (ipStr != g_config.getString(ConfigManager::IP)) {
+				std::map<uint32_t, int64_t>::const_iterator it = ipConnectMap.find(ip);
+
+				if (it != ipConnectMap.end()) {
+					if (OTSYS_TIME() < (it->second + g_config.getNumber(ConfigManager::STATUSQUERY_TIMEOUT))) {
+						getConnection()->closeConnection();
+						return;
+					}
 				}
 			}
 		}
-	}
 
-	ipConnectMap[ip] = OTSYS_TIME();
+		ipConnectMap[ip] = OTSYS_TIME();
+	}
 
 	switch (msg.GetByte()) {
 		//XML info protocol
 		case 0xFF: {
-			if (msg.GetString(4) == "info") {
+			std::string request = msg.GetString(4);
+			if (request == "info" || request == "stat") {
 				OutputMessage_ptr output = OutputMessagePool::getInstance()->getOutputMessage(this, false);
 				if (output) {
 					Status* status = Status::getInstance();
-					std::string str = status->getStatusString();
+					std::string str = (request == "info" ? status->getStatusString() : status->getStatsString());
 					output->AddBytes(str.c_str(), str.size());
 					setRawMessages(true); // we dont want the size header, nor encryption
 					OutputMessagePool::getInstance()->send(output);
@@ -170,7 +179,79 @@ std::string Status::getStatusString() const
 	return ss.str();
 }
 
-void Status::getInfo(uint32_t requestedInfo, OutputMessage_ptr output, NetworkMessage& msg) const
+std::string Status::getStatsString() const
+{
+	pugi::xml_document doc;
+
+	pugi::xml_node decl = doc.prepend_child(pugi::node_declaration);
+	decl.append_attribute("version") = "1.0";
+
+	pugi::xml_node tsqp = doc.append_child("tsqp");
+	tsqp.append_attribute("version") = "1.0";
+
+	Stats* stats = Stats::getInstance();
+
+	pugi::xml_node dispatcher = tsqp.append_child("dispatcher");
+	dispatcher.append_attribute("uptime") = std::to_string(getUptime()).c_str();
+	dispatcher.append_attribute("stallthreshold") = std::to_string(stats->getStallThreshold()).c_str();
+	dispatcher.append_attribute("stalls") = std::to_string(stats->getStallCount()).c_str();
+
+	// entries are players, houses and the global storage
+	SaveManager* saveManager = SaveManager::getInstance();
+	pugi::xml_node save = tsqp.append_child("save");
+	save.append_attribute("running") = g_game.isSaving() ? "1" : "0";
+	save.append_attribute("queued") = std::to_string(saveManager->getQueuedCount()).c_str();
+	save.append_attribute("written") = std::to_string(saveManager->getWrittenCount()).c_str();
+	save.append_attribute("failed") = std::to_string(saveManager->getFailedCount()).c_str();
+
+	// the busiest entries first, as many as fit into a message
+	std::vector<const TaskStats*> entries = stats->getEntries();
+	std::sort(entries.begin(), entries.end(), [](const TaskStats* lhs, const TaskStats* rhs) {
+		return lhs->getHistogram().getTotal() > rhs->getHistogram().getTotal();
+	});
+
+	if (entries.size() > STATUS_MAX_STATS_ENTRIES) {
+		entries.resize(STATUS_MAX_STATS_ENTRIES);
+	}
+
+	pugi::xml_node tasks = tsqp.append_child("tasks");
+
+	// script entries are named by their path, so the size of every entry is
+	// counted and the list ends before the document outgrows the message
+	std::ostringstream ss;
+	doc.save(ss, "", pugi::format_raw);
+
+	// the empty <tasks/> becomes <tasks>...</tasks> with the first entry
+	size_t size = ss.str().size() + strlen("</tasks>");
+
+	// times are in microseconds
+	for (const TaskStats* taskStats : entries) {
+		const LatencyHistogram& histogram = taskStats->getHistogram();
+
+		pugi::xml_node task = tasks.append_child("task");
+		task.append_attribute("group") = taskStats->getGroup().c_str();
+		task.append_attribute("name") = taskStats->getName().c_str();
+		task.append_attribute("count") = std::to_string(histogram.getCount()).c_str();
+		task.append_attribute("total") = std::to_string(histogram.getTotal()).c_str();
+		task.append_attribute("p50") = std::to_string(histogram.getPercentile(50)).c_str();
+		task.append_attribute("p99") = std::to_string(histogram.getPercentile(99)).c_str();
+		task.append_attribute("max") = std::to_string(histogram.getMax()).c_str();
+
+		std::ostringstream taskStream;
+		task.print(taskStream, "", pugi::format_raw);
+		size += taskStream.str().size();
+		if (size > STATUS_MAX_STATS_SIZE) {
+			tasks.remove_child(task);
+			break;
+		}
+	}
+
+	ss.str("");
+	doc.save(ss, "", pugi::format_raw);
+	return ss.str();
+}
+
+void Status::getInfo(uint32_t requestedInfo, OutputMessage_ptr output, InputMessage& msg) const
 {
 	if (requestedInfo & REQUEST_BASIC_SERVER_INFO) {
 		output->AddByte(0x10);
@@ -21,10 +21,16 @@
 #define __OTSERV_STATUS_H
 
 #include <string>
+#include <boost/thread/mutex.hpp>
 #include "definitions.h"
-#include "networkmessage.h"
+#include "inputmessage.h"
 #include "protocol.h"
 
+// the task statistics report is limited to the busiest entries, as many as
+// fit into the bytes one raw status message takes (AddBytes stops at 8192)
+#define STATUS_MAX_STATS_ENTRIES 128
+#define STATUS_MAX_STATS_SIZE 8192
+
 class ProtocolStatus : public Protocol
 {
 	public:
@@ -53,10 +59,11 @@ class ProtocolStatus : public Protocol
 			return 0xFF;
 		}
 
-		virtual void onRecvFirstMessage(NetworkMessage& msg);
+		virtual void onRecvFirstMessage(InputMessage& msg);
 
 	protected:
 		static std::map<uint32_t, int64_t> ipConnectMap;
+		static boost::mutex ipConnectMapLock;
 };
 
 class Status
@@ -71,7 +78,8 @@ class Status
 		void removePlayer();
 
 		std::string getStatusString() const;
-		void getInfo(uint32_t requestedInfo, OutputMessage_ptr output, NetworkMessage& msg) const;
+		std::string getStatsString() const;
+		void getInfo(uint32_t requestedInfo, OutputMessage_ptr output, InputMessage& msg) const;
 
 		uint32_t getPlayersOnline() const {
 			return m_playersOnline;
@@ -20,14 +20,111 @@
 #include "otpch.h"
 
 #include "tasks.h"
+#include "scheduler.h"
 #include "outputmessage.h"
-#include "game.h"
+#include "stats.h"
+#include "database.h"
 
-extern Game g_game;
+#ifdef _MSC_VER
+#define TASK_POOL_THREAD_LOCAL __declspec(thread)
+#else
+#define TASK_POOL_THREAD_LOCAL __thread
+#endif
+
+// every pooled block can hold any kind of task
+#define TASK_POOL_BLOCK_SIZE (sizeof(SchedulerTask) > sizeof(Task) ? sizeof(SchedulerTask) : sizeof(Task))
+
+// number of blocks moved between a thread cache and the shared pool at once
+#define TASK_POOL_BATCH_SIZE 64
+
+namespace {
+
+struct TaskBlock {
+	TaskBlock* next;
+};
+
+// Blocks freed by a thread are kept in its own cache; full batches are handed
+// over to the shared pool so that threads creating tasks (network, scheduler)
+// can reuse the blocks freed by the dispatcher.
+struct TaskPoolCache {
+	TaskBlock* head;
+	uint32_t size;
+};
+
+TASK_POOL_THREAD_LOCAL TaskPoolCache taskPoolCache;
+
+boost::mutex taskPoolLock;
+std::vector<TaskBlock*> taskPoolBatches;
+
+void* allocateTaskBlock()
+{
+	TaskPoolCache& cache = taskPoolCache;
+	if (!cache.head) {
+		boost::lock_guard<boost::mutex> lockClass(taskPoolLock);
+		if (taskPoolBatches.empty()) {
+			return ::operator new(TASK_POOL_BLOCK_SIZE);
+		}
+
+		cache.head = taskPoolBatches.back();
+		cache.size = TASK_POOL_BATCH_SIZE;
+		taskPoolBatches.pop_back();
+	}
+
+	TaskBlock* block = cache.head;
+	cache.head = block->next;
+	--cache.size;
+	return block;
+}
+
+void releaseTaskBlock(void* p)
+{
+	TaskPoolCache& cache = taskPoolCache;
+
+	TaskBlock* block = static_cast<TaskBlock*>(p);
+	block->next = cache.head;
+	cache.head = block;
+
+	if (++cache.size < TASK_POOL_BATCH_SIZE * 2) {
+		return;
+	}
+
+	// hand the oldest batch of the cache over to the shared pool
+	TaskBlock* last = cache.head;
+	for (uint32_t i = 1; i < TASK_POOL_BATCH_SIZE; ++i) {
+		last = last->next;
+	}
+
+	TaskBlock* batch = last->next;
+	last->next = nullptr;
+	cache.size = TASK_POOL_BATCH_SIZE;
+
+	boost::lock_guard<boost::mutex> lockClass(taskPoolLock);
+	taskPoolBatches.push_back(batch);
+}
+
+}
+
+void* Task::operator new(size_t size)
+{
+	if (size > TASK_POOL_BLOCK_SIZE) {
+		return ::operator new(size);
+	}
+	return allocateTaskBlock();
+}
+
+void Task::operator delete(void* p, size_t size)
+{
+	if (size > TASK_POOL_BLOCK_SIZE) {
+		::operator delete(p);
+		return;
+	}
+	releaseTaskBlock(p);
+}
 
 Dispatcher::Dispatcher()
+	: m_overflowed(false), m_priorityOverflowed(false), m_sleeping(false), m_taskBatchPos(0), m_threadState(STATE_TERMINATED)
 {
-	m_threadState = STATE_TERMINATED;
+	m_taskBatch.reserve(DISPATCHER_BATCH_SIZE);
 }
 
 void Dispatcher::start()
@@ -38,68 +135,152 @@ void Dispatcher::start()
 
 void Dispatcher::dispatcherThread()
 {
-	OutputMessagePool* outputPool = OutputMessagePool::getInstance();
-
 	// NOTE: second argument defer_lock is to prevent from immediate locking
 	boost::unique_lock<boost::mutex> taskLockUnique(m_taskLock, boost::defer_lock);
 
 	while (m_threadState != STATE_TERMINATED) {
-		Task* task = nullptr;
+		fetchTasks();
 
-		// check if there are tasks waiting
-		taskLockUnique.lock();
+		if (m_taskBatch.empty() && m_priorityTaskQueue.empty() && !m_priorityOverflowed) {
+			// announce that we are going to sleep, producers wake us up through m_taskSignal
+			taskLockUnique.lock();
+			m_sleeping = true;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
 
-		if (m_taskList.empty()) {
-			//if the list is empty wait for signal
-			m_taskSignal.wait(taskLockUnique);
+			if (!hasPendingTasks() && m_threadState != STATE_TERMINATED) {
+				m_taskSignal.wait(taskLockUnique);
+			}
+
+			m_sleeping = false;
+			taskLockUnique.unlock();
+			continue;
 		}
 
-		if (!m_taskList.empty() && (m_threadState != STATE_TERMINATED)) {
-			// take the first task
-			task = m_taskList.front();
-			m_taskList.pop_front();
+		runPriorityTasks();
+
+		while (m_taskBatchPos < m_taskBatch.size() && m_threadState != STATE_TERMINATED) {
+			runTask(m_taskBatch[m_taskBatchPos++]);
+
+			// tasks pushed to the front must not wait for the rest of the batch
+			runPriorityTasks();
 		}
+	}
+}
 
-		taskLockUnique.unlock();
+void Dispatcher::fetchTasks()
+{
+	if (m_taskBatchPos < m_taskBatch.size()) {
+		return;
+	}
 
-		// finally execute the task...
-		if (task) {
-			if (!task->hasExpired()) {
-				outputPool->startExecutionFrame();
-				(*task)();
-				outputPool->sendAll();
+	m_taskBatch.clear();
+	m_taskBatchPos = 0;
 
-				g_game.clearSpectatorCache();
-			}
+	Task* task;
+	while (m_taskBatch.size() < DISPATCHER_BATCH_SIZE && m_taskQueue.pop(task)) {
+		m_taskBatch.push_back(task);
+	}
+
+	if (m_taskBatch.size() < DISPATCHER_BATCH_SIZE && m_overflowed) {
+		// the lane was full at some point, take everything that spilled over
+		boost::lock_guard<boost::mutex> lockClass(m_taskLock);
 
-			delete task;
+		// tasks published to the queue before they spilled over have to run first
+		while (m_taskQueue.pop(task)) {
+			m_taskBatch.push_back(task);
 		}
+
+		m_taskBatch.insert(m_taskBatch.end(), m_overflowTaskList.begin(), m_overflowTaskList.end());
+		m_overflowTaskList.clear();
+		m_overflowed = false;
 	}
 }
 
-void Dispatcher::addTask(Task* task, bool push_front /*= false*/)
+void Dispatcher::fetchPriorityOverflow(std::list<Task*>& tasks)
 {
-	bool do_signal = false;
+	boost::lock_guard<boost::mutex> lockClass(m_taskLock);
 
-	m_taskLock.lock();
+	// tasks published to the lane before they spilled over have to run first
+	Task* task;
+	while (m_priorityTaskQueue.pop(task)) {
+		tasks.push_back(task);
+	}
 
-	if (m_threadState == STATE_RUNNING) {
-		do_signal = m_taskList.empty();
+	tasks.splice(tasks.end(), m_priorityOverflowTaskList);
+	m_priorityOverflowed = false;
+}
 
-		if (push_front) {
-			m_taskList.push_front(task);
-		} else {
-			m_taskList.push_back(task);
+bool Dispatcher::hasPendingTasks()
+{
+	return m_taskBatchPos < m_taskBatch.size() || !m_taskQueue.empty() || !m_priorityTaskQueue.empty() || m_overflowed || m_priorityOverflowed;
+}
+
+void Dispatcher::runPriorityTasks()
+{
+	Task* task;
+	while (m_threadState != STATE_TERMINATED && m_priorityTaskQueue.pop(task)) {
+		runTask(task);
+	}
+
+	if (m_priorityOverflowed && m_threadState != STATE_TERMINATED) {
+		std::list<Task*> tasks;
+		fetchPriorityOverflow(tasks);
+		for (Task* overflowTask : tasks) {
+			runTask(overflowTask);
+		}
+	}
+}
+
+void Dispatcher::runTask(Task* task)
+{
+	if (!task->hasExpired()) {
+		Stats* stats = Stats::getInstance();
+
+		TaskStats* taskStats = task->getStats();
+		if (!taskStats) {
+			taskStats = stats->getOriginStats(TASK_ORIGIN_OTHER);
 		}
-	} else {
+
+		int64_t startTime = stats->enter(taskStats);
+
+		OutputMessagePool* outputPool = OutputMessagePool::getInstance();
+		outputPool->startExecutionFrame();
+		(*task)();
+		outputPool->sendAll();
+
+		stats->leave(taskStats, startTime);
+	}
+
+	delete task;
+}
+
+void Dispatcher::addTask(Task* task, bool push_front /*= false*/)
+{
+	if (m_threadState != STATE_RUNNING) {
 		delete task;
-		task = nullptr;
+		return;
 	}
 
-	m_taskLock.unlock();
+	// each lane spills over on its own, so priority tasks keep their lane
+	// while only the normal one is full
+	if (push_front) {
+		if (m_priorityOverflowed || !m_priorityTaskQueue.push(task)) {
+			boost::lock_guard<boost::mutex> lockClass(m_taskLock);
+			m_priorityOverflowTaskList.push_back(task);
+			m_priorityOverflowed = true;
+		}
+	} else if (m_overflowed || !m_taskQueue.push(task)) {
+		boost::lock_guard<boost::mutex> lockClass(m_taskLock);
+		m_overflowTaskList.push_back(task);
+		m_overflowed = true;
+	}
 
-	// send a signal if the list was empty
-	if (do_signal) {
+	// wake up the dispatcher thread if it is sleeping, the fence pairs with
+	// the one in dispatcherThread so either side sees the other's write
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_sleeping && m_sleeping.exchange(false)) {
+		m_taskLock.lock();
+		m_taskLock.unlock();
 		m_taskSignal.notify_one();
 	}
 }
@@ -108,9 +289,22 @@ void Dispatcher::flush()
 {
 	Task* task = nullptr;
 
-	while (!m_taskList.empty()) {
-		task = m_taskList.front();
-		m_taskList.pop_front();
+	while (true) {
+		if (m_priorityOverflowed) {
+			std::list<Task*> tasks;
+			fetchPriorityOverflow(tasks);
+			m_taskBatch.insert(m_taskBatch.begin() + m_taskBatchPos, tasks.begin(), tasks.end());
+		}
+
+		if (!m_priorityTaskQueue.pop(task)) {
+			fetchTasks();
+			if (m_taskBatchPos >= m_taskBatch.size()) {
+				break;
+			}
+
+			task = m_taskBatch[m_taskBatchPos++];
+		}
+
 		(*task)();
 		delete task;
 
@@ -118,27 +312,127 @@ void Dispatcher::flush()
 		if (outputPool) {
 			outputPool->sendAll();
 		}
-
-		g_game.clearSpectatorCache();
 	}
 }
 
 void Dispatcher::stop()
 {
-	m_taskLock.lock();
 	m_threadState = STATE_CLOSING;
-	m_taskLock.unlock();
 }
 
 void Dispatcher::shutdown()
 {
-	m_taskLock.lock();
 	m_threadState = STATE_TERMINATED;
 	flush();
+
+	m_taskLock.lock();
 	m_taskLock.unlock();
+	m_taskSignal.notify_one();
 }
 
 void Dispatcher::join()
 {
 	m_thread.join();
 }
+
+WorkerPool::WorkerPool()
+{
+	m_maxTasks = 0;
+	m_started = false;
+	m_running = false;
+	m_useDatabase = false;
+}
+
+void WorkerPool::start(uint32_t threads, size_t maxTasks, bool useDatabase/* = false*/)
+{
+	boost::lock_guard<boost::mutex> lockClass(m_taskLock);
+	m_maxTasks = maxTasks;
+	m_useDatabase = useDatabase;
+	m_started = true;
+	m_running = true;
+
+	for (uint32_t i = 0; i < std::max<uint32_t>(1, threads); ++i) {
+		m_threads.create_thread(boost::bind(&WorkerPool::workerThread, this));
+	}
+}
+
+void WorkerPool::shutdown()
+{
+	m_taskLock.lock();
+	bool wasRunning = m_running;
+	m_running = false;
+	m_taskLock.unlock();
+
+	if (!wasRunning) {
+		return;
+	}
+
+	m_taskSignal.notify_all();
+	m_threads.join_all();
+
+	for (Task* task : m_taskList) {
+		delete task;
+	}
+	m_taskList.clear();
+}
+
+bool WorkerPool::addTask(Task* task)
+{
+	boost::unique_lock<boost::mutex> lockClass(m_taskLock);
+	if (!m_started) {
+		lockClass.unlock();
+		(*task)();
+		delete task;
+		return true;
+	}
+
+	if (!m_running || m_taskList.size() >= m_maxTasks) {
+		lockClass.unlock();
+		delete task;
+		return false;
+	}
+
+	m_taskList.push_back(task);
+	lockClass.unlock();
+
+	m_taskSignal.notify_one();
+	return true;
+}
+
+size_t WorkerPool::getTaskCount()
+{
+	boost::lock_guard<boost::mutex> lockClass(m_taskLock);
+	return m_taskList.size();
+}
+
+void WorkerPool::workerThread()
+{
+	if (m_useDatabase) {
+		Database::initThread();
+	}
+
+	boost::unique_lock<boost::mutex> taskLockUnique(m_taskLock, boost::defer_lock);
+
+	while (true) {
+		taskLockUnique.lock();
+		while (m_running && m_taskList.empty()) {
+			m_taskSignal.wait(taskLockUnique);
+		}
+
+		if (!m_running) {
+			taskLockUnique.unlock();
+			break;
+		}
+
+		Task* task = m_taskList.front();
+		m_taskList.pop_front();
+		taskLockUnique.unlock();
+
+		(*task)();
+		delete task;
+	}
+
+	if (m_useDatabase) {
+		Database::endThread();
+	}
+}
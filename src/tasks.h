@@ -20,55 +20,167 @@
 #ifndef __OTSERV_TASKS_H__
 #define __OTSERV_TASKS_H__
 
-#include <boost/function.hpp>
 #include <boost/thread.hpp>
+#include <boost/utility.hpp>
+#include <atomic>
+#include <deque>
+#include <type_traits>
+
+#include "mpscqueue.h"
+
+class TaskStats;
 
 const int DISPATCHER_TASK_EXPIRATION = 2000;
 
+// capacity of the lock-free task lanes, tasks beyond it spill into the overflow list of their lane
+#define DISPATCHER_QUEUE_SIZE 65536
+#define DISPATCHER_PRIORITY_QUEUE_SIZE 4096
+
+// maximum number of tasks taken from the queue per wake-up
+#define DISPATCHER_BATCH_SIZE 256
+
+// size of the inline storage of a TaskFunction, larger callables are heap allocated
+#define TASK_FUNCTION_STORAGE_SIZE 64
+
+// Type-erased void() callable that keeps small functors (such as the result
+// of boost::bind) inside the object instead of allocating them.
+class TaskFunction
+{
+	public:
+		template<typename F>
+		explicit TaskFunction(F&& f) {
+			typedef typename std::decay<F>::type Functor;
+			m_operations = &Manager<Functor>::operations;
+			Manager<Functor>::construct(&m_storage, std::forward<F>(f));
+		}
+
+		~TaskFunction() {
+			m_operations->destroy(&m_storage);
+		}
+
+		void operator()() {
+			m_operations->invoke(&m_storage);
+		}
+
+	private:
+		typedef std::aligned_storage<TASK_FUNCTION_STORAGE_SIZE>::type Storage;
+
+		struct Operations {
+			void (*invoke)(Storage*);
+			void (*destroy)(Storage*);
+		};
+
+		template<typename Functor, bool Inline = (sizeof(Functor) <= sizeof(Storage))>
+		struct Manager {
+			template<typename F>
+			static void construct(Storage* storage, F&& f) {
+				new (storage) Functor(std::forward<F>(f));
+			}
+			static void invoke(Storage* storage) {
+				(*reinterpret_cast<Functor*>(storage))();
+			}
+			static void destroy(Storage* storage) {
+				reinterpret_cast<Functor*>(storage)->~Functor();
+			}
+
+			static const Operations operations;
+		};
+
+		template<typename Functor>
+		struct Manager<Functor, false> {
+			template<typename F>
+			static void construct(Storage* storage, F&& f) {
+				*reinterpret_cast<Functor**>(storage) = new Functor(std::forward<F>(f));
+			}
+			static void invoke(Storage* storage) {
+				(**reinterpret_cast<Functor**>(storage))();
+			}
+			static void destroy(Storage* storage) {
+				delete *reinterpret_cast<Functor**>(storage);
+			}
+
+			static const Operations operations;
+		};
+
+		TaskFunction(const TaskFunction&);
+		TaskFunction& operator=(const TaskFunction&);
+
+		Storage m_storage;
+		const Operations* m_operations;
+};
+
+template<typename Functor, bool Inline>
+const TaskFunction::Operations TaskFunction::Manager<Functor, Inline>::operations = {
+	&TaskFunction::Manager<Functor, Inline>::invoke,
+	&TaskFunction::Manager<Functor, Inline>::destroy
+};
+
+template<typename Functor>
+const TaskFunction::Operations TaskFunction::Manager<Functor, false>::operations = {
+	&TaskFunction::Manager<Functor, false>::invoke,
+	&TaskFunction::Manager<Functor, false>::destroy
+};
+
 class Task
 {
 	public:
 		// DO NOT allocate this class on the stack
-		Task(uint32_t ms, const boost::function<void (void)>& f) : m_f(f) {
-			m_expiration = boost::get_system_time() + boost::posix_time::milliseconds(ms);
+		template<typename F>
+		Task(uint32_t ms, F&& f) : m_stats(nullptr), m_f(std::forward<F>(f)) {
+			m_expiration = OTSYS_STEADY_TIME() + ms;
 		}
-		Task(const boost::function<void (void)>& f)
-			: m_expiration(boost::date_time::not_a_date_time), m_f(f) {}
+		template<typename F>
+		explicit Task(F&& f) : m_expiration(0), m_stats(nullptr), m_f(std::forward<F>(f)) {}
+
+		virtual ~Task() {}
 
-		~Task() {}
+		// tasks are recycled through a freelist instead of going through the heap
+		static void* operator new(size_t size);
+		static void operator delete(void* p, size_t size);
 
 		void operator()() {
 			m_f();
 		}
 
 		void setDontExpire() {
-			m_expiration = boost::date_time::not_a_date_time;
+			m_expiration = 0;
+		}
+
+		// the statistics entry the run time of the task is added to
+		void setStats(TaskStats* stats) {
+			m_stats = stats;
+		}
+		TaskStats* getStats() const {
+			return m_stats;
 		}
 
 		bool hasExpired() const {
-			if (m_expiration == boost::date_time::not_a_date_time) {
+			if (m_expiration == 0) {
 				return false;
 			}
 
-			return m_expiration < boost::get_system_time();
+			return m_expiration < OTSYS_STEADY_TIME();
 		}
 
 	protected:
 		// Expiration has another meaning for scheduler tasks,
 		// then it is the time the task should be added to the
 		// dispatcher
-		boost::system_time m_expiration;
-		boost::function<void (void)> m_f;
+		int64_t m_expiration;
+		TaskStats* m_stats;
+		TaskFunction m_f;
 };
 
-inline Task* createTask(boost::function<void (void)> f)
+template<typename F>
+inline Task* createTask(F&& f)
 {
-	return new Task(f);
+	return new Task(std::forward<F>(f));
 }
 
-inline Task* createTask(uint32_t expiration, boost::function<void (void)> f)
+template<typename F>
+inline Task* createTask(uint32_t expiration, F&& f)
 {
-	return new Task(expiration, f);
+	return new Task(expiration, std::forward<F>(f));
 }
 
 enum DispatcherState {
@@ -93,16 +205,69 @@ class Dispatcher
 	protected:
 		void dispatcherThread();
 
+		void fetchTasks();
+		void fetchPriorityOverflow(std::list<Task*>& tasks);
+		bool hasPendingTasks();
+		void runPriorityTasks();
+		void runTask(Task* task);
+
 		void flush();
 
 		boost::thread m_thread;
+
+		// only guards the overflow list and the sleep/wake-up handshake
+		boost::mutex m_taskLock;
+		boost::condition_variable m_taskSignal;
+
+		MPSCQueue<Task*, DISPATCHER_QUEUE_SIZE> m_taskQueue;
+		MPSCQueue<Task*, DISPATCHER_PRIORITY_QUEUE_SIZE> m_priorityTaskQueue;
+		std::list<Task*> m_overflowTaskList;
+		std::list<Task*> m_priorityOverflowTaskList;
+		std::atomic<bool> m_overflowed;
+		std::atomic<bool> m_priorityOverflowed;
+		std::atomic<bool> m_sleeping;
+
+		// tasks taken off the queues but not executed yet
+		std::vector<Task*> m_taskBatch;
+		size_t m_taskBatchPos;
+
+		std::atomic<DispatcherState> m_threadState;
+};
+
+// Runs tasks on threads of its own, for work that blocks or takes long and
+// does not touch the game state, such as decrypting and loading logins.
+class WorkerPool : boost::noncopyable
+{
+	public:
+		WorkerPool();
+		~WorkerPool() {}
+
+		// at most maxTasks tasks wait for a thread, further ones are refused;
+		// the threads of a pool whose tasks use the database register with it
+		void start(uint32_t threads, size_t maxTasks, bool useDatabase = false);
+		void shutdown();
+
+		// false (and the task is deleted) when the pool is full; a pool that
+		// was never started runs the task right away on the calling thread
+		bool addTask(Task* task);
+		size_t getTaskCount();
+
+	protected:
+		void workerThread();
+
+		boost::thread_group m_threads;
 		boost::mutex m_taskLock;
 		boost::condition_variable m_taskSignal;
 
-		std::list<Task*> m_taskList;
-		DispatcherState m_threadState;
+		std::deque<Task*> m_taskList;
+		size_t m_maxTasks;
+		bool m_started;
+		bool m_running;
+		bool m_useDatabase;
 };
 
 extern Dispatcher g_dispatcher;
+extern WorkerPool g_cryptoPool;
+extern WorkerPool g_databasePool;
 
 #endif
@@ -30,6 +30,7 @@
 #include "tile.h"
 #include "game.h"
 #include "player.h"
+#include "networkmessage.h"
 #include "creature.h"
 #include "teleport.h"
 #include "trashholder.h"
@@ -426,6 +427,7 @@ void Tile::onAddTileItem(Item* item)
 	updateTileFlags(item, false);
 
 	const Position& cylinderMapPos = getPosition();
+	g_game.getMap()->tileDescriptionCache.invalidate(cylinderMapPos);
 
 	const SpectatorVec& list = g_game.getSpectators(cylinderMapPos);
 
@@ -445,6 +447,7 @@ void Tile::onAddTileItem(Item* item)
 void Tile::onUpdateTileItem(Item* oldItem, const ItemType& oldType, Item* newItem, const ItemType& newType)
 {
 	const Position& cylinderMapPos = getPosition();
+	g_game.getMap()->tileDescriptionCache.invalidate(cylinderMapPos);
 
 	const SpectatorVec& list = g_game.getSpectators(cylinderMapPos);
 
@@ -466,6 +469,7 @@ void Tile::onRemoveTileItem(const SpectatorVec& list, const std::vector<uint32_t
 	updateTileFlags(item, true);
 
 	const Position& cylinderMapPos = getPosition();
+	g_game.getMap()->tileDescriptionCache.invalidate(cylinderMapPos);
 	const ItemType& iType = Item::items[item->getID()];
 
 	//send to client
@@ -520,11 +524,7 @@ void Tile::moveCreature(Creature* creature, Cylinder* toCylinder, bool forceTele
 	//remove the creature
 	__removeThing(creature, 0);
 
-	// Switch the node ownership
-	if (qt_node != newTile->qt_node) {
-		qt_node->removeCreature(creature);
-		newTile->qt_node->addCreature(creature);
-	}
+	g_game.getMap()->spectatorIndex.moveCreature(creature, oldPos, newPos);
 
 	//add the creature
 	newTile->__addThing(creature);
@@ -546,13 +546,14 @@ void Tile::moveCreature(Creature* creature, Cylinder* toCylinder, bool forceTele
 
 	//send to client
 	size_t i = 0;
+	NetworkMessage stepMsg;
 
 	for (Creature* spectator : list) {
 		if (Player* tmpPlayer = spectator->getPlayer()) {
 			//Use the correct stackpos
 			int32_t stackpos = oldStackPosVector[i++];
 			if (stackpos != -1) {
-				tmpPlayer->sendCreatureMove(creature, newTile, newPos, this, oldPos, stackpos, teleport);
+				tmpPlayer->sendCreatureMove(creature, newTile, newPos, this, oldPos, stackpos, teleport, &stepMsg);
 			}
 		}
 	}
@@ -921,7 +922,6 @@ void Tile::__addThing(int32_t index, Thing* thing)
 {
 	Creature* creature = thing->getCreature();
 	if (creature) {
-		g_game.clearSpectatorCache();
 		creature->setParent(this);
 		CreatureVector* creatures = makeCreatures();
 		creatures->insert(creatures->begin(), creature);
@@ -1135,7 +1135,6 @@ void Tile::__removeThing(Thing* thing, uint32_t count)
 		if (creatures) {
 			CreatureVector::iterator it = std::find(creatures->begin(), creatures->end(), thing);
 			if (it != creatures->end()) {
-				g_game.clearSpectatorCache();
 				creatures->erase(it);
 			}
 		}
@@ -1389,6 +1388,7 @@ void Tile::postAddNotification(Thing* thing, const Cylinder* oldParent, int32_t
 		item = thing->getItem();
 		if (item) {
 			item->useThing2();
+			g_game.getMap()->onTileChange(this);
 		}
 	}
 
@@ -1449,6 +1449,7 @@ void Tile::postRemoveNotification(Thing* thing, const Cylinder* newParent, int32
 	} else {
 		Item* item = thing->getItem();
 		if (item) {
+			g_game.getMap()->onTileChange(this);
 			g_moveEvents->onItemMove(item, this, false);
 		}
 	}
@@ -1465,7 +1466,6 @@ void Tile::__internalAddThing(uint32_t index, Thing* thing)
 
 	Creature* creature = thing->getCreature();
 	if (creature) {
-		g_game.clearSpectatorCache();
 		CreatureVector* creatures = makeCreatures();
 		creatures->insert(creatures->begin(), creature);
 	} else {
@@ -1502,6 +1502,7 @@ void Tile::__internalAddThing(uint32_t index, Thing* thing)
 		}
 
 		updateTileFlags(item, false);
+		g_game.getMap()->tileDescriptionCache.invalidate(getPosition());
 	}
 }
 
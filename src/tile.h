@@ -25,17 +25,16 @@
 #include "cylinder.h"
 #include "item.h"
 #include "tools.h"
+#include "spectators.h"
 
 class Creature;
 class Teleport;
 class TrashHolder;
 class Mailbox;
 class MagicField;
-class QTreeLeafNode;
 class BedItem;
 
 typedef std::vector<Creature*> CreatureVector;
-typedef std::unordered_set<Creature*> SpectatorVec;
 typedef std::vector<Item*> ItemVector;
 
 enum tileflags_t {
@@ -356,7 +355,6 @@ class Tile : public Cylinder
 		}
 
 	public:
-		QTreeLeafNode* qt_node;
 		Item* ground;
 
 	protected:
@@ -433,7 +431,6 @@ class StaticTile : public Tile
 };
 
 inline Tile::Tile(uint16_t x, uint16_t y, uint16_t z) :
-	qt_node(nullptr),
 	ground(nullptr),
 	tilePos(x, y, z),
 	m_flags(0)
@@ -71,7 +71,8 @@ bool WaitingList::clientLogin(const Player* player)
 		return true;
 	}
 
-	if (waitList.empty() && Status::getInstance()->getPlayersOnline() < (uint32_t)g_config.getNumber(ConfigManager::MAX_PLAYERS)) {
+	uint32_t playersOnline = Status::getInstance()->getPlayersOnline() + pendingLogins.size();
+	if (waitList.empty() && playersOnline < (uint32_t)g_config.getNumber(ConfigManager::MAX_PLAYERS)) {
 		//no waiting list and enough room
 		return true;
 	}
@@ -82,7 +83,7 @@ bool WaitingList::clientLogin(const Player* player)
 
 	WaitListIterator it = findClient(player, slot);
 	if (it != waitList.end()) {
-		if ((Status::getInstance()->getPlayersOnline() + slot) <= (uint32_t)g_config.getNumber(ConfigManager::MAX_PLAYERS)) {
+		if ((playersOnline + slot) <= (uint32_t)g_config.getNumber(ConfigManager::MAX_PLAYERS)) {
 			//should be able to login now
 			delete *it;
 			waitList.erase(it);
@@ -132,6 +133,46 @@ int32_t WaitingList::getClientSlot(const Player* player)
 	return -1;
 }
 
+void WaitingList::addPendingLogin(const Player* player)
+{
+	PendingLogin pendingLogin;
+	pendingLogin.player = player;
+	pendingLogin.name = player->getName();
+	pendingLogin.guid = player->getGUID();
+	pendingLogin.acc = player->getAccount();
+	pendingLogins.push_back(pendingLogin);
+}
+
+void WaitingList::removePendingLogin(const Player* player)
+{
+	for (auto it = pendingLogins.begin(); it != pendingLogins.end(); ++it) {
+		if (it->player == player) {
+			pendingLogins.erase(it);
+			return;
+		}
+	}
+}
+
+bool WaitingList::isPendingLogin(const std::string& name) const
+{
+	for (const PendingLogin& pendingLogin : pendingLogins) {
+		if (strcasecmp(pendingLogin.name.c_str(), name.c_str()) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool WaitingList::isPendingAccount(uint32_t accountId) const
+{
+	for (const PendingLogin& pendingLogin : pendingLogins) {
+		if (pendingLogin.acc == accountId) {
+			return true;
+		}
+	}
+	return false;
+}
+
 void WaitingList::cleanUpList()
 {
 	for (WaitListIterator it = waitList.begin(); it != waitList.end();) {
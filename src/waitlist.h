@@ -31,6 +31,15 @@ struct Wait {
 	int64_t timeout;
 };
 
+// what the login checks need of a player that is being loaded, copied when
+// it is admitted since the database thread writes the player meanwhile
+struct PendingLogin {
+	const Player* player;
+	std::string name;
+	uint32_t guid;
+	uint32_t acc;
+};
+
 typedef std::list<Wait*> WaitList;
 typedef WaitList::iterator WaitListIterator;
 
@@ -46,10 +55,19 @@ class WaitingList
 		int32_t getClientSlot(const Player* player);
 		static int32_t getTime(int32_t slot);
 
+		// players admitted by clientLogin whose load from the database has not
+		// finished yet, they hold a place just like online players do
+		void addPendingLogin(const Player* player);
+		void removePendingLogin(const Player* player);
+		bool isPendingLogin(const std::string& name) const;
+		bool isPendingAccount(uint32_t accountId) const;
+
 	protected:
 		WaitList priorityWaitList;
 		WaitList waitList;
 
+		std::list<PendingLogin> pendingLogins;
+
 		int32_t getTimeOut(int32_t slot);
 		WaitListIterator findClient(const Player* player, uint32_t& slot);
 		void cleanUpList();
@@ -0,0 +1,224 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "otpch.h"
+
+#include "xtea.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define XTEA_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(XTEA_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XTEA_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const uint32_t XTEA_DELTA = 0x61C88647;
+
+// The key schedule does not depend on the data, so the round keys
+// (sum + k[...]) are computed once per message and shared by all blocks.
+struct XTEARoundKeys {
+	XTEARoundKeys(const uint32_t* k) {
+		uint32_t sum = 0;
+		for (int32_t i = 0; i < 32; ++i) {
+			first[i] = sum + k[sum & 3];
+			sum -= XTEA_DELTA;
+			second[i] = sum + k[sum >> 11 & 3];
+		}
+	}
+
+	uint32_t first[32];
+	uint32_t second[32];
+};
+
+inline uint32_t loadU32(const uint8_t* buffer)
+{
+	uint32_t value;
+	memcpy(&value, buffer, sizeof(value));
+	return value;
+}
+
+inline void storeU32(uint8_t* buffer, uint32_t value)
+{
+	memcpy(buffer, &value, sizeof(value));
+}
+
+void encryptScalar(uint8_t* buffer, size_t blockCount, const XTEARoundKeys& keys)
+{
+	for (size_t n = 0; n < blockCount; ++n, buffer += 8) {
+		uint32_t v0 = loadU32(buffer), v1 = loadU32(buffer + 4);
+		for (int32_t i = 0; i < 32; ++i) {
+			v0 += ((v1 << 4 ^ v1 >> 5) + v1) ^ keys.first[i];
+			v1 += ((v0 << 4 ^ v0 >> 5) + v0) ^ keys.second[i];
+		}
+		storeU32(buffer, v0);
+		storeU32(buffer + 4, v1);
+	}
+}
+
+void decryptScalar(uint8_t* buffer, size_t blockCount, const XTEARoundKeys& keys)
+{
+	for (size_t n = 0; n < blockCount; ++n, buffer += 8) {
+		uint32_t v0 = loadU32(buffer), v1 = loadU32(buffer + 4);
+		for (int32_t i = 31; i >= 0; --i) {
+			v1 -= ((v0 << 4 ^ v0 >> 5) + v0) ^ keys.second[i];
+			v0 -= ((v1 << 4 ^ v1 >> 5) + v1) ^ keys.first[i];
+		}
+		storeU32(buffer, v0);
+		storeU32(buffer + 4, v1);
+	}
+}
+
+#ifdef XTEA_SSE2
+// 4 blocks per iteration: the words of two registers [v0 v1 v0 v1] are
+// regrouped into one register holding the v0 words and one holding the v1 words
+inline __m128i roundSSE2(__m128i v)
+{
+	return _mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(v, 4), _mm_srli_epi32(v, 5)), v);
+}
+
+size_t encryptSSE2(uint8_t* buffer, size_t blockCount, const XTEARoundKeys& keys)
+{
+	size_t n = 0;
+	for (; n + 4 <= blockCount; n += 4, buffer += 32) {
+		__m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)buffer), _MM_SHUFFLE(3, 1, 2, 0));
+		__m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(buffer + 16)), _MM_SHUFFLE(3, 1, 2, 0));
+		__m128i v0 = _mm_unpacklo_epi64(a, b);
+		__m128i v1 = _mm_unpackhi_epi64(a, b);
+		for (int32_t i = 0; i < 32; ++i) {
+			v0 = _mm_add_epi32(v0, _mm_xor_si128(roundSSE2(v1), _mm_set1_epi32(keys.first[i])));
+			v1 = _mm_add_epi32(v1, _mm_xor_si128(roundSSE2(v0), _mm_set1_epi32(keys.second[i])));
+		}
+		_mm_storeu_si128((__m128i*)buffer, _mm_shuffle_epi32(_mm_unpacklo_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+		_mm_storeu_si128((__m128i*)(buffer + 16), _mm_shuffle_epi32(_mm_unpackhi_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	return n;
+}
+
+size_t decryptSSE2(uint8_t* buffer, size_t blockCount, const XTEARoundKeys& keys)
+{
+	size_t n = 0;
+	for (; n + 4 <= blockCount; n += 4, buffer += 32) {
+		__m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)buffer), _MM_SHUFFLE(3, 1, 2, 0));
+		__m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(buffer + 16)), _MM_SHUFFLE(3, 1, 2, 0));
+		__m128i v0 = _mm_unpacklo_epi64(a, b);
+		__m128i v1 = _mm_unpackhi_epi64(a, b);
+		for (int32_t i = 31; i >= 0; --i) {
+			v1 = _mm_sub_epi32(v1, _mm_xor_si128(roundSSE2(v0), _mm_set1_epi32(keys.second[i])));
+			v0 = _mm_sub_epi32(v0, _mm_xor_si128(roundSSE2(v1), _mm_set1_epi32(keys.first[i])));
+		}
+		_mm_storeu_si128((__m128i*)buffer, _mm_shuffle_epi32(_mm_unpacklo_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+		_mm_storeu_si128((__m128i*)(buffer + 16), _mm_shuffle_epi32(_mm_unpackhi_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	return n;
+}
+#endif
+
+#ifdef XTEA_AVX2
+// same layout as the SSE2 kernel, done within each 128 bit lane for 8 blocks per iteration
+__attribute__((target("avx2"))) inline __m256i roundAVX2(__m256i v)
+{
+	return _mm256_add_epi32(_mm256_xor_si256(_mm256_slli_epi32(v, 4), _mm256_srli_epi32(v, 5)), v);
+}
+
+__attribute__((target("avx2"))) size_t encryptAVX2(uint8_t* buffer, size_t blockCount, const XTEARoundKeys& keys)
+{
+	size_t n = 0;
+	for (; n + 8 <= blockCount; n += 8, buffer += 64) {
+		__m256i a = _mm256_shuffle_epi32(_mm256_loadu_si256((const __m256i*)buffer), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i b = _mm256_shuffle_epi32(_mm256_loadu_si256((const __m256i*)(buffer + 32)), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i v0 = _mm256_unpacklo_epi64(a, b);
+		__m256i v1 = _mm256_unpackhi_epi64(a, b);
+		for (int32_t i = 0; i < 32; ++i) {
+			v0 = _mm256_add_epi32(v0, _mm256_xor_si256(roundAVX2(v1), _mm256_set1_epi32(keys.first[i])));
+			v1 = _mm256_add_epi32(v1, _mm256_xor_si256(roundAVX2(v0), _mm256_set1_epi32(keys.second[i])));
+		}
+		_mm256_storeu_si256((__m256i*)buffer, _mm256_shuffle_epi32(_mm256_unpacklo_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+		_mm256_storeu_si256((__m256i*)(buffer + 32), _mm256_shuffle_epi32(_mm256_unpackhi_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	return n;
+}
+
+__attribute__((target("avx2"))) size_t decryptAVX2(uint8_t* buffer, size_t blockCount, const XTEARoundKeys& keys)
+{
+	size_t n = 0;
+	for (; n + 8 <= blockCount; n += 8, buffer += 64) {
+		__m256i a = _mm256_shuffle_epi32(_mm256_loadu_si256((const __m256i*)buffer), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i b = _mm256_shuffle_epi32(_mm256_loadu_si256((const __m256i*)(buffer + 32)), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i v0 = _mm256_unpacklo_epi64(a, b);
+		__m256i v1 = _mm256_unpackhi_epi64(a, b);
+		for (int32_t i = 31; i >= 0; --i) {
+			v1 = _mm256_sub_epi32(v1, _mm256_xor_si256(roundAVX2(v0), _mm256_set1_epi32(keys.second[i])));
+			v0 = _mm256_sub_epi32(v0, _mm256_xor_si256(roundAVX2(v1), _mm256_set1_epi32(keys.first[i])));
+		}
+		_mm256_storeu_si256((__m256i*)buffer, _mm256_shuffle_epi32(_mm256_unpacklo_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+		_mm256_storeu_si256((__m256i*)(buffer + 32), _mm256_shuffle_epi32(_mm256_unpackhi_epi64(v0, v1), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	return n;
+}
+
+bool hasAVX2()
+{
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	return avx2;
+}
+#endif
+
+}
+
+void xteaEncrypt(uint8_t* buffer, size_t blockCount, const uint32_t* key)
+{
+	XTEARoundKeys keys(key);
+
+	size_t n = 0;
+	#ifdef XTEA_AVX2
+	if (hasAVX2()) {
+		n = encryptAVX2(buffer, blockCount, keys);
+	}
+	#endif
+
+	#ifdef XTEA_SSE2
+	n += encryptSSE2(buffer + n * 8, blockCount - n, keys);
+	#endif
+
+	encryptScalar(buffer + n * 8, blockCount - n, keys);
+}
+
+void xteaDecrypt(uint8_t* buffer, size_t blockCount, const uint32_t* key)
+{
+	XTEARoundKeys keys(key);
+
+	size_t n = 0;
+	#ifdef XTEA_AVX2
+	if (hasAVX2()) {
+		n = decryptAVX2(buffer, blockCount, keys);
+	}
+	#endif
+
+	#ifdef XTEA_SSE2
+	n += decryptSSE2(buffer + n * 8, blockCount - n, keys);
+	#endif
+
+	decryptScalar(buffer + n * 8, blockCount - n, keys);
+}
@@ -0,0 +1,29 @@
+/**
+ * The Forgotten Server - a server application for the MMORPG Tibia
+ * Copyright (C) 2013  Mark Samman <mark.samman@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef __OTSERV_XTEA_H__
+#define __OTSERV_XTEA_H__
+
+// Encrypts/decrypts blockCount consecutive 8 byte blocks in place. Independent
+// blocks are processed several at a time with SSE2/AVX2 when the CPU supports it.
+void xteaEncrypt(uint8_t* buffer, size_t blockCount, const uint32_t* key);
+void xteaDecrypt(uint8_t* buffer, size_t blockCount, const uint32_t* key);
+
+#endif